@@ -22,6 +22,17 @@
 // C-style character escapes added to immediates (e.g. #'\n') 16/8/12
 // Okay/error return value added 16/8/12
 // Explicit mnemonic alternatives for shifts added 23/3/15
+// Binary program image output (-i) added 18/10/26
+// Source files read once and replayed from memory on each pass 18/10/26
+// Open addressed symbol tables, names of any length kept in an arena 18/10/26
+// Lexer reads lines through std::string_view rather than copying them 18/10/26
+// Expressions compiled to RPN on first evaluation and replayed after 18/10/26
+// Variable length items relaxed in memory between passes 18/10/26
+// Mnemonic etc. tables built at compile time; -m file overrides 19/10/26
+// Output files built up in memory and written with writev at the end 19/10/26
+// Literal pool hashed; halfwords packed; literals dumped into ALIGN 19/10/26
+// Resident mode (--serve): reassembles on change, serves memory files 19/10/26
+// Library build (AASM_LIBRARY) assembles from memory, per thread 19/10/26
 
 // To do:	ADRL fixed, "MOVX" etc added - some more shakedown tests (?)  @@
 //              ADRL still causing problems :-(  'Length cycle' too great (4)
@@ -29,8 +40,6 @@
 //		Pass counters increased but needs some attention to find 'real'
 // answer (6/4/11)
 //
-//		Pack literal pool (halfwords) together rather than `in order'
-//		Dump literals into space in ALIGN where possible
 //		Not sure LDRSH rd, =nnnn behaviour is correct
 //			No range check but doesn't alias -1 & FFFF either
 //			I think range check; ST thinks ban it
@@ -38,31 +47,54 @@
 //		Proper shakedown testing (improving)
 //		Macros
 //		Conditional assembly
-//		"mnemonics" file not found if executed via $PATH; improve search
 //		'record'/'structure' directive for creating offsets
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include "aasm.h"
+#include <algorithm>
 #include <array>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #define MAX_PASSES 30                  // No of reiterations before giving up
 #define SHRINK_STOP (MAX_PASSES - 10)  // First pass where shrinkage forbidden
+#define RELAX_LIMIT 64                 // Most relaxation sweeps between passes
+#define RELAX_SHRINK_STOP 16           // First sweep where shrinkage forbidden
+#define RELAX_MISSES 2                 // Unsettled passes before growth only
 #define VERILOG_MAX 0x10000            // Maximum size of Verilog ROM output
 #define IF_STACK_SIZE 10               // Maximum nesting of IF clauses
+#define SERVE_MAX_RESULTS 64           // Assemblies kept when resident
+#define SERVE_MAX_CLIENTS 16           // Requests being read at once
 
-#define SYM_TAB_HASH_BITS 4
-#define SYM_TAB_LIST_COUNT (1 << SYM_TAB_HASH_BITS)
-#define SYM_TAB_LIST_MASK (SYM_TAB_LIST_COUNT - 1)
+#define SYM_TAB_MIN_SLOTS 16  // Initial size of a table; always a power of 2
+#define SYM_ARENA_BLOCK 0x4000  // Size of the blocks symbol names are kept in
 
-#define SYM_NAME_MAX 32
+#define SYM_NAME_FIELD 32  // Width of the name column in symbol listings
 #define LINE_LENGTH 256
 
 #define SYM_TAB_CASE_FLAG 1    // Bit mask for case insensitive flag
 #define SYM_TAB_EXPORT_FLAG 2  // Keep whole table
+#define SYM_TAB_BAKED_FLAG 4   // Built in at compile time; never freed
 
 #define SYM_REC_DEF_FLAG 0x0100     // Bit mask for `symbol defined' flag
 #define SYM_REC_EXPORT_FLAG 0x0200  // Bit mask for `export' flag
@@ -159,6 +191,7 @@
 #define LIT_DEFINED 0x01  // Set when a literal pool entry has a value
 #define LIT_NO_DUMP 0x02  // Set when record needn't be planted
 #define LIT_HALF 0x04     // Set when value is halfword
+#define LIT_PACKED 0x08   // Set when planted early, into a hole in the pool
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 /* Expression evaluator                                                       */
@@ -190,6 +223,22 @@
 #define LOG 22
 #define END 23
 
+// Kinds of step in a compiled (RPN) expression
+#define EVAL_OP_CONST 0   // Push value
+#define EVAL_OP_SYMBOL 1  // Push symbol's value (if defined)
+#define EVAL_OP_NAME 2    // As above, but symbol not found when compiled
+#define EVAL_OP_HERE 3    // Push assembly pointer ('.')
+#define EVAL_OP_LOCAL 4   // Push local label; arg is search directions
+#define EVAL_OP_UNARY 5   // Apply unary operator arg to top of stack
+#define EVAL_OP_BINARY 6  // Apply binary operator arg to top two
+
+// Kinds of item the relaxation stage moves between passes
+#define RELAX_ORIGIN 0   // ORG; addresses after are unaffected by those before
+#define RELAX_LABEL 1    // Label (or literal) at the address
+#define RELAX_VALUE 2    // Label (or literal) set by an expression
+#define RELAX_ALIGN 3    // Padding up to a boundary
+#define RELAX_LONG_OP 4  // Variable length data-op. (MOVX etc.)
+
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 /* List file formatting constants                                             */
 #define LIST_LINE_LENGTH 120  // Total line length
@@ -202,7 +251,6 @@
 #define HEX_BYTE_COUNT 16
 #define HEX_LINE_LENGTH (HEX_LINE_ADDRESS + 3 * HEX_BYTE_COUNT)
 
-#define ELF_TEMP_LENGTH 20
 
 #define ELF_MACHINE 40          // ARM (?)
 #define ELF_EHSIZE 52           // Defined in standard
@@ -211,6 +259,24 @@
 
 #define ELF_SHN_ABS 0xFFF1  // Defined in standard
 
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Program image file layout (all words little endian)                        */
+/*  Header:   "KMI1", entry, flags, segment count, symbol count, line count,  */
+/*            text length, reserved                                           */
+/*  Segments: address, length, file offset of the bytes                       */
+/*  Symbols:  value, name offset in text, name length, flags                  */
+/*  Lines:    address, text offset, text length (half), 0 (half),             */
+/*            4 field sizes (bytes); sorted by address                        */
+/*  Text:     symbol names and listing text, not terminated                   */
+/*  Data:     the bytes of each segment, word aligned                         */
+
+#define IMAGE_MAGIC "KMI1"
+#define IMAGE_HEADER_SIZE (4 * 8)
+#define IMAGE_SEGMENT_SIZE (4 * 3)
+#define IMAGE_SYMBOL_SIZE (4 * 4)
+#define IMAGE_LINE_SIZE (4 * 4)
+#define IMAGE_FLAG_ENTRY 0x01  // Entry point defined
+
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 
 #define v3 0xFF
@@ -256,15 +322,17 @@ typedef struct sym_record_name  // Symbol record definition
   unsigned int identifier;   // Record identifier, also definition order
   unsigned int elf_section;  // Section number - purely for ELF driver
   int value;
-  char name[SYM_NAME_MAX];  // Fixed field for name (quick)
+  char* name;  // In the name arena; terminated, for convenience
 } sym_record;
 
-typedef struct  // Symbol table header definition
+typedef struct sym_table_name  // Symbol table header definition
 {
   char* name;
   unsigned int symbol_number;
   unsigned int flags;
-  sym_record* pList[SYM_TAB_LIST_COUNT];
+  unsigned int count;     // Number of records in the table
+  unsigned int capacity;  // Number of slots; a power of 2
+  sym_record** pSlots;    // Open addressed, linear probing; NULL if empty
 } sym_table;
 
 typedef struct sym_table_item_name  // So we can make lists of symbol tables
@@ -273,6 +341,13 @@ typedef struct sym_table_item_name  // So we can make lists of symbol tables
   struct sym_table_item_name* pNext;  // Pointer to next record  (or NULL)
 } sym_table_item;
 
+typedef struct mnemonic_definer_name  // Puts mnemonics read at run time into
+{                                     // the tables
+  sym_table* mnemonics;
+  sym_table* directives;
+  void operator()(const char*, unsigned int, bool);
+} mnemonic_definer;
+
 typedef struct local_label_name  // Local label element definition
 {
   struct local_label_name* pNext;  // Pointer to next record
@@ -297,30 +372,86 @@ typedef struct literal_record_name  // Literal pool element holder definition
   unsigned int flags;
 } literal_record;
 
-typedef struct elf_temp_name {
-  struct elf_temp_name* pNext;
-  bool continuation;
-  unsigned int section;
-  unsigned int address;
-  unsigned int count;
-  char data[ELF_TEMP_LENGTH];
-} elf_temp;
-
 typedef struct elf_info_name  // Section info collecting point
 {                             // Just the bits I think need collecting
-  struct elf_info_name* pNext;
-  unsigned int name;
   unsigned int address;
-  unsigned int position;
+  unsigned int position;  // Of its first byte in elf_code
   unsigned int size;
 } elf_info;
 
+typedef struct image_segment_name  // Contiguous bytes for the program image
+{
+  unsigned int address;
+  std::vector<unsigned char> data;
+} image_segment;
+
+typedef struct image_line_name  // One listing line for the program image
+{
+  unsigned int address;
+  unsigned int text;    // Offset into image_text
+  unsigned int length;  // Length of text
+  unsigned char size[LIST_BYTE_COUNT];  // Sizes of the fields listed
+} image_line;
+
+typedef struct eval_op_name  // One step of a compiled expression
+{
+  unsigned char kind;     // EVAL_OP_*
+  unsigned char arg;      // Operator, or local label search directions
+  unsigned int position;  // On line, for errors (and name, if EVAL_OP_NAME)
+  unsigned int value;     // Constant, local label or length of name
+  struct sym_record_name* symbol;  // If EVAL_OP_SYMBOL
+} eval_op;
+
+typedef struct eval_program_name  // An expression compiled on its first
+{                                 // evaluation, replayed on later ones
+  int position;                   // Where on the line it starts ...
+  struct sym_table_name* table;   // ... and the table it was looked up in
+  int end;                        // Where on the line it finishes
+  std::vector<eval_op> ops;
+} eval_program;
+
+typedef struct source_file_name  // A source file, read once and kept in
+{                                // memory for every pass
+  std::vector<std::string> lines;  // As input_line would return them
+  std::vector<std::vector<eval_program>> expressions;  // By line
+} source_file;
+
+typedef struct serve_result_name  // The latest assembly of a source file,
+{                                  // kept by a resident assembler
+  int status;    // As returned by assemble
+  int messages;  // Memory files holding what was printed, ...
+  int listing;   // ... the KMD listing ...
+  int image;     // ... and the program image
+  std::vector<std::pair<int, std::string>> watched;  // (Directory watch, name)
+                                                     // of every file read
+  bool stale;          // Set when one of those changes
+  unsigned long used;  // When it was last asked for
+} serve_result;
+
+typedef struct serve_request_name  // A client of a resident assembler
+{                                   // whose request is still arriving
+  int client;
+  std::string text;  // What it has sent so far
+} serve_request;
+
 typedef struct size_record_name  // Size of variable length operation
 {                                // (form an ordered list)
   struct size_record_name* pNext;
   unsigned int size;
 } size_record;
 
+typedef struct relax_item_name  // Something met on a pass which may move, or
+{                               // change size, if earlier items do
+  unsigned char kind;           // RELAX_*
+  unsigned int address;         // Assembly pointer when met
+  unsigned int size;            // Words (long op.) or bytes (padding) then
+  unsigned int token;           // Long op. token, or alignment boundary
+  unsigned int* value;          // Label's or literal's value
+  size_record* record;          // Long op.'s size
+  std::vector<eval_program>* expressions;  // Expression giving value/operand
+  int expression;                          // (index, or -1 if none)
+} relax_item;
+
 /*----------------------------------------------------------------------------*/
 
 const int SYM_RECORD_SIZE = sizeof(sym_record);
@@ -328,45 +459,80 @@ const int SYM_TABLE_SIZE = sizeof(sym_table);
 const int SYM_TABLE_ITEM_SIZE = sizeof(sym_table_item);
 const int LIT_RECORD_SIZE = sizeof(literal_record);
 const int LOCAL_LABEL_SIZE = sizeof(local_label);
-const int ELF_TEMP_SIZE = sizeof(elf_temp);
-const int ELF_INFO_SIZE = sizeof(elf_info);
 const int SIZE_RECORD_SIZE = sizeof(size_record);
 
 /*----------------------------------------------------------------------------*/
 
 bool set_options(int argc, char* argv[]);
+int assemble(sym_table*,
+             sym_table*,
+             std::vector<std::string>*,
+             Aasm::ProgramImage*);
+void program_fill(Aasm::ProgramImage*, sym_table*);
+int serve(sym_table*, sym_table*);
+void serve_assemble(const std::string&,
+                    serve_result&,
+                    sym_table*,
+                    sym_table*,
+                    int);
+std::pair<int, std::string> serve_watch(int, const std::string&);
+void serve_unwatch(int, const std::vector<std::pair<int, std::string>>&);
+void serve_forget(const std::string&, int);
+void serve_changes(int, sym_table*, sym_table*);
+bool serve_receive(serve_request&);
+void serve_client(int, const std::string&, int, sym_table*, sym_table*);
+void builtin_tables();
+void builtin_tables_restore();
+void builtin_mnemonic_tables(sym_table**, sym_table**);
 
 bool input_line(FILE*, std::string&, unsigned int);
-bool parse_mnemonic_line(std::string&, sym_table*, sym_table*);
+source_file* source_load(char*);
+void source_line(source_file*, unsigned int, std::string&);
+template <class Define>
+constexpr bool parse_mnemonic_line(std::string_view, Define&);
 unsigned int parse_source_line(std::string&,
                                sym_table_item*,
                                sym_table*,
                                int,
-                               int,
+                               bool,
                                char**,
                                char*);
-void print_error(std::string&, unsigned int, unsigned int, char*, int);
-unsigned int assemble_line(std::string,
+void print_error(std::string&, unsigned int, unsigned int, char*, bool);
+unsigned int assemble_line(std::string&,
                            int,
                            unsigned int,
                            own_label*,
                            sym_table*,
                            int,
-                           int,
+                           bool,
                            char**,
                            char*);
 
 int do_literal(instr_set, type_size, unsigned int*, bool, unsigned int*);
 unsigned int find_partials(unsigned int, unsigned int*);
 unsigned int variable_item_size(int, unsigned int);
-
-int get_thing(std::string&, int*, sym_table*);
-int get_reg(std::string, int*);
-int get_thumb_reg(std::string&, int*, unsigned int);
-int get_creg(std::string&, int*);
-int get_copro(std::string&, int*);
-int get_psr(std::string&, int*);
-int get_shift(std::string&, int*);
+unsigned int long_op_fields(unsigned int,
+                            unsigned int,
+                            unsigned int*,
+                            unsigned int*);
+unsigned int align_padding(unsigned int, unsigned int);
+void relax_note(unsigned char,
+                unsigned int,
+                unsigned int,
+                unsigned int,
+                unsigned int*,
+                size_record*);
+void relax_note_label(own_label*, unsigned int);
+bool relax_evaluate(relax_item&, unsigned int, unsigned int*);
+void relax_sizes(void);
+
+int get_thing(std::string_view, int*, sym_table*);
+int get_reg(std::string_view, int*);
+int get_thumb_reg(std::string_view, int*, unsigned int);
+int get_creg(std::string_view, int*);
+int get_copro(std::string_view, int*);
+int get_psr(std::string_view, int*);
+int get_shift(std::string_view, int*);
 int data_op_imm(unsigned int);
 
 void redefine_symbol(std::string&, sym_record*, sym_table*);
@@ -376,20 +542,29 @@ void assemble_redef_label(unsigned int,
                           unsigned int*,
                           int,
                           int,
-                          int,
-                          std::string);
+                          bool,
+                          std::string&);
 
 /*----------------------------------------------------------------------------*/
 
-unsigned int evaluate(std::string, int*, unsigned int*, sym_table*);
+unsigned int evaluate(std::string_view, int*, unsigned int*, sym_table*);
+bool eval_replay(eval_program&,
+                 std::string_view,
+                 int*,
+                 unsigned int*,
+                 unsigned int*);
+unsigned int eval_unary(unsigned int, unsigned int);
+unsigned int eval_binary(unsigned int, unsigned int, unsigned int);
 
-int get_variable(std::string&,
+int get_variable(std::string_view,
                  unsigned int*,
                  unsigned int*,
                  int*,
                  bool*,
-                 sym_table*);
-int get_operator(std::string&, int*, unsigned int*, int*);
+                 sym_table*,
+                 eval_op*);
+int local_label_value(int, unsigned int, unsigned int*);
+int get_operator(std::string_view, int*, unsigned int*, int*);
 
 /*----------------------------------------------------------------------------*/
 
@@ -401,8 +576,8 @@ defn_return sym_define_label(std::string&,
                              sym_table*,
                              sym_record**);
 int sym_locate_label(std::string&, unsigned int, sym_table*, sym_record**);
-sym_record* sym_find_label_list(std::string&, sym_table_item*);
-sym_record* sym_find_label(std::string&, sym_table*);
+sym_record* sym_find_label_list(std::string_view, sym_table_item*);
+sym_record* sym_find_label(std::string_view, sym_table*);
 sym_record* sym_create_record(std::string&,
                               unsigned int,
                               unsigned int,
@@ -410,8 +585,14 @@ sym_record* sym_create_record(std::string&,
 void sym_delete_record(sym_record*);
 int sym_delete_record_list(sym_record**, int);
 int sym_add_to_table(sym_table*, sym_record*);
-sym_record* sym_find_record(sym_table*, sym_record*);
+constexpr unsigned int sym_hash(std::string_view, unsigned int, unsigned int*);
+sym_record* sym_find_hashed(sym_table*,
+                            std::string_view,
+                            unsigned int,
+                            unsigned int);
 void sym_string_copy(std::string&, sym_record*, unsigned int);
+unsigned int sym_arena_mark(void);
+void sym_arena_release(unsigned int);
 char* sym_strtab(sym_record*, unsigned int, unsigned int*);
 sym_record* sym_sort_symbols(sym_table*, label_category, label_sort);
 unsigned int sym_count_symbols(sym_table*, label_category);
@@ -421,125 +602,188 @@ void lit_print_table(literal_record*, FILE*);
 
 /*----------------------------------------------------------------------------*/
 
-void byte_dump(unsigned int, unsigned int, std::string, int);
+void byte_dump(unsigned int, unsigned int, std::string&, int);
 
-void literal_dump(int, std::string&, unsigned int);
+unsigned int literal_plant(literal_record*,
+                           unsigned int,
+                           bool,
+                           std::string&,
+                           std::string&);
+void literal_dump(bool, std::string&, unsigned int);
 
 FILE* open_output_file(int, char*);
 void close_output_file(FILE*, char*, int);
+void output_write(FILE*, const std::vector<std::string_view>&);
 void hex_dump(unsigned int, char);
 void hex_dump_flush(void);
 
 void elf_dump(unsigned int, char);
 void elf_new_section_maybe(void);
 void elf_dump_out(FILE*, sym_table*);
+void elf_dump_word(std::string&, unsigned int);
+
+void image_dump(unsigned int, char);
+void image_dump_out(FILE*, sym_table*);
+std::vector<std::string_view> image_build(sym_table*, std::string&);
+
+bool list_active(void);
 
 void list_file_out(void);
 void list_start_line(unsigned int, int);
 void list_mid_line(unsigned int, std::string&, int);
 void list_end_line(std::string&);
-void list_symbols(FILE*, sym_table*);
+void list_symbols(std::string&, sym_table*);
 void list_buffer_init(std::string&, unsigned int, int);
 void list_hex(unsigned int, unsigned int, char*);
 
 /*----------------------------------------------------------------------------*/
 
-int skip_spc(std::string, int);
+constexpr int skip_spc(std::string_view, int);
 char* file_path(char*);
 char* pathname(char*, char*);
-bool cmp_next_non_space(std::string, int*, int, char);
-bool test_eol(char);
-unsigned int get_identifier(std::string,
+bool cmp_next_non_space(std::string_view, int*, int, char);
+constexpr bool test_eol(char);
+std::string_view peek_identifier(std::string_view, unsigned int);
+unsigned int get_identifier(std::string_view,
                             unsigned int,
                             std::string&,
                             unsigned int);
-bool alpha_numeric(char);
-bool alphabetic(char);
+constexpr bool alpha_numeric(char);
+constexpr bool alphabetic(char);
 unsigned char c_char_esc(unsigned char);
-int get_num(std::string, unsigned int*, unsigned int*, unsigned int);
+constexpr int get_num(std::string_view,
+                        unsigned int*,
+                        unsigned int*,
+                        unsigned int);
 int allow_error(unsigned int, bool, bool);
+bool arm_falls_through(unsigned int);
 
 /*----------------------------------------------------------------------------*/
 /* Global variables                                                           */
-
-instr_set instruction_set;
-char* input_file_name;
-char* symbols_file_name;
-char* list_file_name;
-char* hex_file_name;
-char* elf_file_name;
-char* verilog_file_name;
-FILE *fList, *fHex, *fElf, *fVerilog;
-int symbols_stdout, list_stdout, hex_stdout, elf_stdout;  // Booleans
-int verilog_stdout;
-label_sort symbols_order;
-int list_sym, list_kmd;
-
-unsigned char Verilog_array[VERILOG_MAX];  // Assemble Verilog output in array
-unsigned int verilog_mem_size;             // Size of buffer =used=
-
-unsigned int sym_print_extras;  // <0> set for locals, <1> for literals
-
-unsigned int arm_variant;
-
-unsigned int assembly_pointer;  // Address at which to plant instruction
-unsigned int def_increment;     // Offset reached from assembly_pointer
-bool assembly_pointer_defined;
-unsigned int entry_address;
-bool entry_address_defined;
-unsigned int data_pointer;     // Used for creating record offsets etc.
-unsigned int undefined_count;  // Number of references to undefined variables
-unsigned int defined_count;    // Number of variables defined this pass
-unsigned int redefined_count;  // Number of variables redefined this pass
-unsigned int pass_count;       // Pass number, starts at 0
-unsigned int pass_errors;      // Errors occurred in this pass
-bool div_zero_this_pass;       // Indicates /0 in pass, prevents code dump
-bool dump_code;                // Allow output (false on last pass if error)
-
-own_label* evaluate_own_label;  // Yuk! @@@@@
+/* Each thread has its own, so library callers may assemble concurrently      */
+
+thread_local instr_set instruction_set;
+thread_local char* input_file_name;
+thread_local char* symbols_file_name;
+thread_local char* list_file_name;
+thread_local char* hex_file_name;
+thread_local char* elf_file_name;
+thread_local char* verilog_file_name;
+thread_local char* image_file_name;
+thread_local char* mnemonics_file_name;  // Overrides built-ins if not ""
+thread_local char* serve_socket_name;    // Stay resident, serving, if not ""
+thread_local FILE *fList, *fHex, *fElf, *fVerilog, *fImage;
+thread_local int symbols_stdout, list_stdout, hex_stdout;  // Booleans
+thread_local int elf_stdout;
+thread_local int image_stdout;
+thread_local int verilog_stdout;
+thread_local label_sort symbols_order;
+thread_local int list_sym, list_kmd;
+thread_local bool list_wanted;   // Listing lines being built (file or caller)
+thread_local bool image_wanted;  // Image being built (file or library caller)
+
+thread_local std::vector<unsigned char> Verilog_array;  // Verilog output
+thread_local unsigned int verilog_mem_size;  // Size of buffer =used=
+
+thread_local unsigned int sym_print_extras;  // <0> locals, <1> literals
+
+thread_local unsigned int arm_variant;
+
+thread_local unsigned int assembly_pointer;  // Where to plant instruction
+thread_local unsigned int def_increment;     // Offset from assembly_pointer
+thread_local bool assembly_pointer_defined;
+thread_local unsigned int entry_address;
+thread_local bool entry_address_defined;
+thread_local unsigned int data_pointer;     // For creating record offsets etc.
+thread_local unsigned int undefined_count;  // References to undefined variables
+thread_local unsigned int defined_count;    // Variables defined this pass
+thread_local unsigned int redefined_count;  // Variables redefined this pass
+thread_local unsigned int pass_count;       // Pass number, starts at 0
+thread_local unsigned int pass_errors;      // Errors occurred in this pass
+thread_local bool div_zero_this_pass;       // /0 in pass, prevents code dump
+thread_local bool dump_code;  // Allow output (false on last pass if error)
+
+thread_local own_label* evaluate_own_label;  // Yuk! @@@@@
 // Because evaluate needs to know if there is a local label on -current- line
 
-literal_record* literal_list;  // Start of the list of literals from "LDR ="
-literal_record* literal_head;  // The next literal record `expected'
-literal_record* literal_tail;  // The last literal record `dumped'
-
-local_label* loc_lab_list;      // Start of the list of local labels
-local_label* loc_lab_position;  // The current local label position
-
-size_record* size_record_list;     // Start of list of ADRL (etc.) lengths
-size_record* size_record_current;  // Current record in above list
-unsigned int size_changed_count;   // Number of `instruction' size changes
-
-bool if_stack[IF_STACK_SIZE + 1];  // Used for nesting IF clauses
-int if_SP;
-
-unsigned int list_address;
-unsigned int list_byte;
-unsigned int list_line_position;  // Pos. in the src line copied to output
-char list_buffer[LIST_LINE_LENGTH];
-
-unsigned int hex_address;
-bool hex_address_defined;
-char hex_buffer[HEX_LINE_LENGTH];
-
-int elf_section_valid;     // Flag: true if code dumped in elf_section
-unsigned int elf_section;  // Current elf section number (for labels)
-unsigned int elf_section_old;
-bool elf_new_block;
-
-elf_temp* elf_record_list;
-elf_temp* current_elf_record;
-
-sym_table* arch_table;  // Table of possible processor architectures
-sym_table* operator_table;
-sym_table* register_table;
-sym_table* cregister_table;
-sym_table* copro_table;
-sym_table* shift_table;
+thread_local literal_record* literal_list;  // The literals from "LDR ="
+thread_local literal_record* literal_head;  // The next record `expected'
+thread_local literal_record* literal_tail;  // The last record `dumped'
+thread_local bool flow_stopped;  // Code can't run on to flow_stop_address, as
+thread_local unsigned int flow_stop_address;  // a B or MOV pc, lr ended there
+thread_local std::unordered_map<unsigned int, std::vector<literal_record*>>
+    literal_index;
+// Records planted in this pass so far, by value, in order; for sharing
+
+thread_local local_label* loc_lab_list;      // Start of the local labels
+thread_local local_label* loc_lab_position;  // The current local label
+
+thread_local size_record* size_record_list;     // ADRL (etc.) lengths
+thread_local size_record* size_record_current;  // Current record in above
+thread_local unsigned int size_changed_count;   // `Instruction' size changes
+thread_local bool shrink_stopped;  // Sizes may only grow, to ensure convergence
+
+thread_local std::vector<relax_item> relax_items;  // Met this pass, in order
+thread_local bool relaxed;  // Set if sizes were settled after the last pass
+thread_local unsigned int relax_misses;  // Passes moving things after settling
+
+thread_local bool if_stack[IF_STACK_SIZE + 1];  // Used for nesting IF clauses
+thread_local int if_SP;
+
+thread_local unsigned int list_address;
+thread_local unsigned int list_byte;
+thread_local unsigned int list_line_position;  // Pos. in the src line copied
+thread_local char list_buffer[LIST_LINE_LENGTH];
+
+thread_local unsigned int hex_address;
+thread_local bool hex_address_defined;
+thread_local char hex_buffer[HEX_LINE_LENGTH];
+
+thread_local std::string hex_output;   // Output files are built up in these ...
+thread_local std::string list_output;  // ... and written out when closed
+thread_local std::string verilog_output;
+
+thread_local int elf_section_valid;     // True if code dumped in elf_section
+thread_local unsigned int elf_section;  // Current elf section (for labels)
+thread_local unsigned int elf_section_old;
+
+thread_local std::string elf_code;  // All code bytes, in dump order
+thread_local std::vector<elf_info> elf_fragments;  // Where sections' bytes are
+
+thread_local std::vector<image_segment> image_segments;  // In plant order
+thread_local std::vector<image_line> image_lines;        // In list order
+thread_local std::string image_text;      // Text referred to by the above
+thread_local image_line image_current;    // Listing line being built
+thread_local unsigned int image_next_address;  // Address after the last line
+
+thread_local std::map<std::string, source_file> source_cache;  // By path
+thread_local std::map<std::string, serve_result> serve_results;  // By path
+thread_local unsigned long serve_requests;  // Answered, to age the above
+thread_local const std::function<bool(const std::string&, std::string&)>*
+    source_reader;  // Reads sources instead of the filesystem, if not NULL
+thread_local std::vector<eval_program>* line_expressions;  // For current line
+thread_local std::vector<eval_program>* last_expressions;  // Last evaluated
+thread_local int last_expression;  // (index, or -1 if none)
+
+thread_local std::ostream* message_out = &std::cout;  // Where messages go, or
+thread_local std::ostream* message_err = &std::cerr;  // a library caller's
+
+thread_local char* sym_arena;  // Block symbol names are being copied into
+thread_local unsigned int sym_arena_free;  // Bytes left in that block
+thread_local std::vector<char*> sym_arena_blocks;  // In allocation order
+thread_local unsigned int sym_tables_live;  // Created and not yet freed
+
+thread_local sym_table* arch_table;  // Possible processor architectures
+thread_local sym_table* operator_table;
+thread_local sym_table* register_table;
+thread_local sym_table* cregister_table;
+thread_local sym_table* copro_table;
+thread_local sym_table* shift_table;
 
 /**
- * @brief
- * @param fHandle
+ * @brief Assembles every line of a source file, and of any file it includes,
+ * for one pass.
+ * @param source The file, as read by source_load.
  * @param filename
  * @param line
  * @param error_code
@@ -548,7 +792,7 @@ sym_table* shift_table;
  * @param last_pass
  * @param finished
  */
-void code_pass(FILE*& fHandle,
+void code_pass(source_file* source,
                char*& filename,
                std::string& line,
                unsigned int& error_code,
@@ -559,18 +803,20 @@ void code_pass(FILE*& fHandle,
   unsigned int line_number;
   char* include_file_path;  // Path as far as directory of "filename"
   char* include_name;
-  FILE* incl_handle;
+  source_file* include_source;
 
   include_file_path = file_path(filename);  // Path to directory in use
   line_number = 1;
 
-  while (!feof(fHandle)) {
-    include_name = NULL;                     // Don't normally return anything
-    input_line(fHandle, line, LINE_LENGTH);  // Errors ignored
+  while (line_number <= source->lines.size()) {
+    include_name = NULL;  // Don't normally return anything
+    source_line(source, line_number, line);
+    line_expressions = &source->expressions[line_number - 1];
 
     error_code =
         parse_source_line(line, arm_mnemonic_list, symbol_table, pass_count,
                           last_pass, &include_name, include_file_path);
+    line_expressions = NULL;
 
     if (error_code != EVAL_OKAY) {
       print_error(line, line_number, error_code, filename, last_pass);
@@ -585,14 +831,13 @@ void code_pass(FILE*& fHandle,
         pInclude = pathname(include_file_path, include_name);  // Add path
       }
 
-      if ((incl_handle = fopen(pInclude, "r")) == NULL) {
+      if ((include_source = source_load(pInclude)) == NULL) {
         print_error(line, line_number, SYM_NO_INCLUDE, filename, last_pass);
-        fprintf(stderr, "Can't open \"%s\"\n", include_name);
+        *message_err << "Can't open \"" << include_name << '"' << std::endl;
         finished = true;
       } else {
-        code_pass(incl_handle, pInclude, line, error_code, arm_mnemonic_list,
-                  symbol_table, last_pass, finished);
-        fclose(incl_handle);  // Doesn't leave file locked
+        code_pass(include_source, pInclude, line, error_code,
+                  arm_mnemonic_list, symbol_table, last_pass, finished);
       }
       if (pInclude != include_name) {
         free(pInclude);  // If allocated (yuk)
@@ -605,32 +850,7 @@ void code_pass(FILE*& fHandle,
   free(include_file_path);
 }
 
-/**
- * @brief Create and initialise a symbol table
- * @param table_name
- * @param flags
- * @param sym_names
- * @param values
- * @return sym_table*
- */
-sym_table* build_table(char* table_name,
-                       unsigned int flags,
-                       std::string* sym_names,
-                       int* values) {
-  sym_table* table;
-  int i;
-  sym_record* dummy;  // Don't want returned pointer
-
-  table = sym_create_table(table_name, flags);
-
-  // repeat until "" found
-  for (i = 0; sym_names[i] != ""; i++) {
-    sym_define_label(sym_names[i], values[i], 0, table, &dummy);
-  }
-
-  return table;
-}
-
+#ifndef AASM_LIBRARY /* Otherwise linked into something with its own */
 /**
  * @brief Entry point 🎉
  * @param argc
@@ -638,27 +858,27 @@ sym_table* build_table(char* table_name,
  * @return int
  */
 int main(int argc, char* argv[]) {
-  FILE *fMnemonics, *fSource;
+  FILE* fMnemonics;
   std::string line(LINE_LENGTH + 1, '\0');
-
   sym_table *arm_mnemonic_table, *directive_table;
-  sym_table* symbol_table;
-  sym_table_item* arm_mnemonic_list;  // Real lists
-  bool finished, last_pass;
-  unsigned int error_code;
+  int status;
 
-  arm_mnemonic_list = NULL;
   symbols_file_name = ""; /* Defaults */
   list_file_name = "";
   hex_file_name = "";
   elf_file_name = "";
   verilog_file_name = "";
+  image_file_name = "";
+  mnemonics_file_name = "";
+  serve_socket_name = "";
   symbols_stdout = false;
   list_stdout = false;
   hex_stdout = false;
   elf_stdout = false;
   verilog_stdout = false;
+  image_stdout = false;
   verilog_mem_size = VERILOG_MAX; /* Default to maximum size */
+  status = 0;
 
   int result = set_options(argc, argv);
 
@@ -668,361 +888,743 @@ int main(int argc, char* argv[]) {
 
   if (result) /* Parse command line and set options accordingly */
   {           /* We have a source file name, at least! */
-    char *pChar, full_name[200];  // Size? @@
-
-    /* Set up tables of operators, etc. */
+    builtin_tables(); /* Operators, registers, etc. */
+
+    if (mnemonics_file_name[0] == '\0') /* Mnemonics built in ... */
+      builtin_mnemonic_tables(&arm_mnemonic_table, &directive_table);
+    else if ((fMnemonics = fopen(mnemonics_file_name, "r")) == NULL) {
+      fprintf(stderr, "Can't open %s\n", mnemonics_file_name);
+      arm_mnemonic_table = NULL;
+    } else /* ... or overridden from a file */
+    {
+      arm_mnemonic_table = sym_create_table("ARM Mnemonics", SYM_TAB_CASE_FLAG);
+      directive_table = sym_create_table("Directives", SYM_TAB_CASE_FLAG);
+      mnemonic_definer define = {arm_mnemonic_table, directive_table};
 
-    { /* Architecture names */
-      std::string arch_name[] = {"v3",    "v3m",    "v4",   "v4xm", "v4t",
-                                 "v4txm", "v5",     "v5xm", "v5t",  "v5txm",
-                                 "v5te",  "v5texp", "all",  "any",  ""};
+      while (!feof(fMnemonics)) {
+        input_line(fMnemonics, line, LINE_LENGTH); /* Errors ignored @@@ */
+        if (!parse_mnemonic_line(line, define))
+          fprintf(stderr, "Mnemonic file error\n %s\n", &line[0]);
+      }
+      /* no error checks @@@ */
+      fclose(fMnemonics);
+    }
 
-      int arch_value[] = {v3,  v3M,   v4,   v4xM,   v4T, v4TxM, v5, v5xM,
-                          v5T, v5TxM, v5TE, v5TExP, 0,   0,     -1};
+    if (arm_mnemonic_table != NULL) {
+      if (serve_socket_name[0] != '\0') /* Stay resident ... */
+        status = serve(arm_mnemonic_table, directive_table);
+      else /* ... or just assemble the file given */
+        status = assemble(arm_mnemonic_table, directive_table, NULL, NULL);
 
-      arch_table = build_table("Architectures", SYM_TAB_CASE_FLAG, arch_name,
-                               arch_value);
+      sym_delete_table(directive_table, false);
+      sym_delete_table(arm_mnemonic_table, false);
+      sym_delete_table(arch_table, false);
+      sym_delete_table(operator_table, false);
+      sym_delete_table(register_table, false);
+      sym_delete_table(cregister_table, false);
+      sym_delete_table(copro_table, false);
+      sym_delete_table(shift_table, false);
     }
+  } else {
+    std::cout << "No input file specified" << std::endl;
+  }
 
-    { /* Diadic expression operator definitions */
-      std::string op_name[] = {"and", "or",  "xor", "eor", "shl", "lsl", "shr",
-                               "lsr", "div", "mod", "eq",  "ne",  "lo",  "ls",
-                               "hi",  "hs",  "lt",  "le",  "gt",  "ge",  ""};
-      int op_value[] = {AND,        OR,          XOR,          XOR,
-                        LEFT_SHIFT, LEFT_SHIFT,  RIGHT_SHIFT,  RIGHT_SHIFT,
-                        DIVIDE,     MODULUS,     EQUALS,       NOT_EQUAL,
-                        LOWER_THAN, LOWER_EQUAL, HIGHER_THAN,  HIGHER_EQUAL,
-                        LESS_THAN,  LESS_EQUAL,  GREATER_THAN, GREATER_EQUAL,
-                        -1};
-
-      operator_table =
-          build_table("Operators", SYM_TAB_CASE_FLAG, op_name, op_value);
-    }
+  exit(status);
+}
+#endif
 
-    { /* Register name definitions */
-      std::string reg_name[] = {"r0",  "r1",  "r2", "r3",  "r4",  "r5",  "r6",
-                                "r7",  "r8",  "r9", "r10", "r11", "r12", "r13",
-                                "r14", "r15", "sp", "lr",  "pc",  "a1",  "a2",
-                                "a3",  "a4",  "v1", "v2",  "v3",  "v4",  "v5",
-                                "sb",  "v6",  "sl", "v7",  "fp",  "ip",  ""};
-      int reg_value[] = {0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11,
-                         12, 13, 14, 15, 13, 14, 15, 0,  1,  2,  3,  4,
-                         5,  6,  7,  8,  9,  9,  10, 10, 11, 12, -1};
-
-      register_table =
-          build_table("Registers", SYM_TAB_CASE_FLAG, reg_name, reg_value);
-    }
+/**
+ * @brief Assembles the file named by input_file_name, producing whichever
+ * outputs the options asked for. Everything made on the way is freed again,
+ * so a resident assembler may call this over and over.
+ * @param arm_mnemonic_table
+ * @param directive_table
+ * @param files If not NULL, given the name of every source file read.
+ * @param program If not NULL, given everything made, for a library caller.
+ * @return int The exit status: 0 if okay, -1 after errors, 144 if the source
+ * file can't be opened.
+ */
+int assemble(sym_table* arm_mnemonic_table,
+             sym_table* directive_table,
+             std::vector<std::string>* files,
+             Aasm::ProgramImage* program) {
+  source_file* pSource;
+  std::string line(LINE_LENGTH + 1, '\0');
+  sym_table* symbol_table;
+  sym_table_item *pMnem, *pDir, *arm_mnemonic_list;  // Real lists
+  bool finished, last_pass;
+  unsigned int error_code;
+  unsigned int arena_mark;
+
+  if ((pSource = source_load(input_file_name)) == NULL) /* Read file in */
+  {
+    *message_err << "Can't open " << input_file_name << std::endl;
+    return 144;  // Return 144 for can't open input
+  }
 
-    { /* Coprocessor register name definitions */
-      std::string creg_name[] = {
-          "cr0", "cr1",  "cr2",  "cr3",  "cr4",  "cr5",  "cr6",  "cr7", "cr8",
-          "cr9", "cr10", "cr11", "cr12", "cr13", "cr14", "cr15", "c0",  "c1",
-          "c2",  "c3",   "c4",   "c5",   "c6",   "c7",   "c8",   "c9",  "c10",
-          "c11", "c12",  "c13",  "c14",  "c15",  ""};
-      int creg_value[] = {0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10,
-                          11, 12, 13, 14, 15, 0,  1,  2,  3,  4,  5,
-                          6,  7,  8,  9,  10, 11, 12, 13, 14, 15, -1};
-
-      cregister_table = build_table("Copro_Registers", SYM_TAB_CASE_FLAG,
-                                    creg_name, creg_value);
+  arena_mark = sym_arena_mark(); /* Names from here on go afterwards */
+  hex_output.clear();            /* Nothing left from any earlier run */
+  list_output.clear();
+  verilog_output.clear();
+  elf_code.clear();
+  elf_fragments.clear();
+  image_segments.clear();
+  image_lines.clear();
+  image_text.clear();
+  image_current = image_line();
+  image_next_address = 0;
+
+  pMnem = (sym_table_item*)malloc(SYM_TABLE_ITEM_SIZE); /* ARM defns. */
+  pDir = (sym_table_item*)malloc(SYM_TABLE_ITEM_SIZE);  /* (hand built) */
+  pMnem->pTable = arm_mnemonic_table;
+  pMnem->pNext = pDir;
+  pDir->pTable = directive_table;
+  pDir->pNext = NULL;
+  arm_mnemonic_list = pMnem;
+
+  symbol_table = sym_create_table("Labels", 0);  // Labels are case sensitive
+  literal_list = NULL;
+  loc_lab_list = NULL;
+  size_record_list = NULL;
+  shrink_stopped = false;
+  relaxed = false;
+  relax_misses = 0;
+
+  pass_count = 0;
+  finished = false;
+  last_pass = false;
+  dump_code = false;
+
+  fHex = open_output_file(hex_stdout, hex_file_name);    /* Open required */
+  fList = open_output_file(list_stdout, list_file_name); /*  output files */
+  fElf = open_output_file(elf_stdout, elf_file_name);
+  fVerilog = open_output_file(verilog_stdout, verilog_file_name);
+  fImage = open_output_file(image_stdout, image_file_name);
+  list_wanted = (fList != NULL) || (program != NULL);
+  image_wanted = (fImage != NULL) || (program != NULL);
+
+  if (list_wanted && list_kmd)
+    list_output = "KMD\n"; /* KMD marker */
+
+  if (fVerilog != NULL)
+    Verilog_array.assign(VERILOG_MAX, 0);
+
+  while (!finished) {
+    instruction_set = ARM; /* Default */
+    assembly_pointer = 0;  /* Default */
+    data_pointer = 0;
+    entry_address = 0;
+    assembly_pointer_defined = true; /* ??? @@@@  Okay for us! */
+    entry_address_defined = false;
+    arm_variant = 0; /* Default to any ARM architecture */
+    pass_errors = 0;
+    div_zero_this_pass = false;
+    hex_address_defined = false;
+    undefined_count = 0; /* Reads of undefined variables on this pass */
+    defined_count = 0;   /* Labels newly defined on this pass */
+    redefined_count = 0; /* Labels with values changed on this pass */
+    if_SP = 0;
+    if_stack[0] = true;
+    elf_section_valid = false; /* No bytes dumped yet */
+    elf_section = 1;
+    literal_head = NULL;
+    literal_tail = NULL;
+    literal_index.clear();
+    flow_stopped = false;
+    loc_lab_position = NULL;
+    size_record_current = size_record_list; /* Go to front of list */
+    size_changed_count = 0;
+    relax_items.clear();
+    if (pass_count >= SHRINK_STOP)
+      shrink_stopped = true;
+
+    code_pass(pSource, input_file_name, line, error_code, arm_mnemonic_list,
+              symbol_table, last_pass, finished);
+    /* no error checks @@@ */
+
+    if (literal_tail != literal_head) /* Clear the literal pool */
+    {
+      std::string literals("Remaining literals");
+
+      if (list_active()) {
+        list_start_line(assembly_pointer, false);
+      }
+      literal_dump(last_pass, literals, 0); /*  Much like an instruction */
+      if (list_active())
+        list_end_line(literals);
     }
 
-    { /* Coprocessor name definitions */
-      std::string copro_name[] = {
-          "p0",   "p1",   "p2",   "p3",   "p4",   "p5",  "p6",  "p7",  "p8",
-          "p9",   "p10",  "p11",  "p12",  "p13",  "p14", "p15", "cp0", "cp1",
-          "cp2",  "cp3",  "cp4",  "cp5",  "cp6",  "cp7", "cp8", "cp9", "cp10",
-          "cp11", "cp12", "cp13", "cp14", "cp15", ""};
-      int copro_value[] = {0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10,
-                           11, 12, 13, 14, 15, 0,  1,  2,  3,  4,  5,
-                           6,  7,  8,  9,  10, 11, 12, 13, 14, 15, -1};
-
-      copro_table = build_table("Coprocessors", SYM_TAB_CASE_FLAG, copro_name,
-                                copro_value);
+    hex_dump_flush(); /* Ensure buffer is cleared */
+
+    if (pass_errors != 0) {
+      finished = true;
+      *message_out << "Pass " << pass_count << " terminating due to "
+                   << pass_errors << " error";
+      if (pass_errors == 1) {
+        *message_out << std::endl;
+      } else {
+        *message_out << 's' << std::endl;
+      }
+    } else {
+      if (last_pass || (pass_count > MAX_PASSES))
+        finished = true;
+      else {
+        if ((defined_count == 0) && (redefined_count == 0) &&
+            (undefined_count == 0)) {
+          last_pass = true;                /* One more time ... */
+          dump_code = !div_zero_this_pass; /* If error don't plant code */
+        } else {
+          if (relaxed && (++relax_misses >= RELAX_MISSES))
+            shrink_stopped = true; /* Settling isn't; force convergence */
+          relaxed = (size_changed_count != 0);
+          if (relaxed)
+            relax_sizes(); /* Settle sizes before trying again */
+        }
+        pass_count++;
+      }
     }
 
-    { /* Shift definitions */
-      std::string shift_name[] = {"lsl", "asl", "lsr", "asr", "ror", "rrx", ""};
-      int shift_value[] = {0, 0, 1, 2, 3, 7, -1};
-      shift_table =
-          build_table("Shifts", SYM_TAB_CASE_FLAG, shift_name, shift_value);
+    if (if_SP != 0) {
+      *message_out << "Pass completed with IF clause still open; terminating"
+                   << std::endl;
+      finished = true;
     }
 
-    arm_mnemonic_table = sym_create_table("ARM Mnemonics", SYM_TAB_CASE_FLAG);
-    directive_table = sym_create_table("Directives", SYM_TAB_CASE_FLAG);
+  } /* End of WHILE */
 
-    /* Following is crude hack for test/commissioning purposes.        @@@@@ */
-    // realpath(argv[0], full_name);  // full path to binary (?) @@
+  if (list_wanted && list_sym)
+    list_symbols(list_output, symbol_table);
+  // Symbols into list file
 
-    // This if statement was added by Lawrence Warren 27/11/2020.
-    // Depends on using a Unix system which contains `proc/self/exe`
-    // To find the absolute filepath of an executable.
-    if (readlink("/proc/self/exe", full_name, sizeof(full_name)) == -1) {
-      std::cout << "Getting file path failed!";
-      exit(1);
+  if (fVerilog != NULL)  // Dump memory image to hex file
+  {
+    int i;
+    char digits[2];
+
+    verilog_output.reserve(verilog_mem_size * 9 / 4);
+    for (i = 0; i < verilog_mem_size; i++) {
+      list_hex(Verilog_array[i ^ 3], 2, digits);  // Big endian
+      verilog_output.append(digits, 2);
+      if ((i & 3) == 3)
+        verilog_output.push_back('\n');
     }
+  }
 
-    for (pChar = full_name; *pChar != '\0'; pChar++)
-      ;  // find end of string @@
-    while (*pChar != '/')
-      pChar--;                       // Cut off last element
-    pChar[1] = '\0';                 // Terminate
-    strcat(full_name, "mnemonics");  // Then append filename
+  output_write(fList, {list_output});
+  close_output_file(fList, list_file_name, pass_errors != 0);
+  output_write(fHex, {hex_output});
+  close_output_file(fHex, hex_file_name, pass_errors != 0);
+  output_write(fVerilog, {verilog_output});
+  close_output_file(fVerilog, verilog_file_name, pass_errors != 0);
 
-    if ((fMnemonics = fopen(full_name, "r")) == NULL) /* Read mnemonics */
-      fprintf(stderr, "Can't open %s\n", "mnemonics");
-    else {
-      while (!feof(fMnemonics)) {
-        input_line(fMnemonics, line, LINE_LENGTH); /* Errors ignored @@@ */
-        if (!parse_mnemonic_line(line, arm_mnemonic_table, directive_table))
-          fprintf(stderr, "Mnemonic file error\n %s\n", &line[0]);
+  if (fElf != NULL)
+    elf_dump_out(fElf, symbol_table);  // Organise & o/p ELF
+
+  if ((fImage != NULL) && (pass_errors == 0))
+    image_dump_out(fImage, symbol_table);  // Organise & o/p image
+  close_output_file(fImage, image_file_name, pass_errors != 0);
+
+  if (program != NULL)
+    program_fill(program, symbol_table);  // Everything, for a library caller
+
+  if (pass_count > MAX_PASSES) {
+    *message_out << "Couldn't do it ... fed up!" << std::endl << std::endl;
+    *message_out << "Undefined labels:" << std::endl;
+    sym_print_table(symbol_table, UNDEFINED, ALPHABETIC, true, "");
+  } else {
+    if (symbols_stdout || (symbols_file_name[0] != '\0')) {
+      sym_print_table(symbol_table, ALL, symbols_order, symbols_stdout,
+                      symbols_file_name);
+      if (!symbols_stdout) {
+        *message_out << "Symbols in file: " << symbols_file_name << std::endl;
       }
-      /* no error checks @@@ */
-      fclose(fMnemonics);
+    }
 
-      sym_table_item *pMnem, *pDir;
+    if (serve_socket_name[0] != '\0') {
+      /* A resident assembler's outputs aren't files to point to */
+    } else if (pass_errors == 0) {
+      if (list_file_name[0] != '\0') {
+        *message_out << "List file in: " << list_file_name << std::endl;
+      }
+      if (hex_file_name[0] != '\0') {
+        *message_out << "Hex dump in: " << hex_file_name << std::endl;
+      }
+      if (elf_file_name[0] != '\0') {
+        *message_out << "ELF file in: " << elf_file_name << std::endl;
+      }
+      if (image_file_name[0] != '\0') {
+        *message_out << "Image file in: " << image_file_name << std::endl;
+      }
+      if (verilog_file_name[0] != '\0') {
+        *message_out << "Verilog file in: " << verilog_file_name << std::endl;
+        *message_out << "  size: " << verilog_mem_size << " (decimal "
+                     << verilog_mem_size << ") words" << std::endl;
+      }
+    } else {
+      *message_out << "No output generated."
+                   << std::endl;  // Errors => trash output files
+    }
 
-      pMnem = (sym_table_item*)malloc(SYM_TABLE_ITEM_SIZE); /* ARM defns. */
-      pDir = (sym_table_item*)malloc(SYM_TABLE_ITEM_SIZE);  /* (hand built) */
-      pMnem->pTable = arm_mnemonic_table;
-      pMnem->pNext = pDir;
-      pDir->pTable = directive_table;
-      pDir->pNext = NULL;
-      arm_mnemonic_list = pMnem;
+    if (pass_count == 1) {
+      *message_out << std::endl << "1 pass performed." << std::endl;
+    } else {
+      *message_out << std::endl
+                   << "Complete. " << pass_count << " passes performed."
+                   << std::endl;
+    }
+  }
 
-      symbol_table =
-          sym_create_table("Labels", 0);  // Labels are case sensitive
-      literal_list = NULL;
-      loc_lab_list = NULL;
-      size_record_list = NULL;
+  { /* Free local label list */
+    local_label* pTemp;
+    while ((pTemp = loc_lab_list) != NULL) /* Syntactically grubby! */
+    {
+      loc_lab_list = loc_lab_list->pNext;
+      free(pTemp);
+    }
+  }
 
-      pass_count = 0;
-      finished = false;
-      last_pass = false;
-      dump_code = false;
+  { /* Free literal list */
+    literal_record* pTemp;
+    while ((pTemp = literal_list) != NULL) /* Syntactically grubby! */
+    {
+      literal_list = literal_list->pNext;
+      free(pTemp);
+    }
+  }
 
-      fHex = open_output_file(hex_stdout, hex_file_name);    /* Open required */
-      fList = open_output_file(list_stdout, list_file_name); /*  output files */
-      fElf = open_output_file(elf_stdout, elf_file_name);
-      fVerilog = open_output_file(verilog_stdout, verilog_file_name);
+  { /* Free size list */
+    size_record* pTemp;
+    while ((pTemp = size_record_list) != NULL) /* Syntactically grubby! */
+    {
+      size_record_list = size_record_list->pNext; /* Cut out first record */
+      free(pTemp);                                /*  and delete it */
+    }
+  }
 
-      if ((fList != NULL) && list_kmd)
-        fprintf(fList, "KMD\n"); /* KMD marker */
+  { /* Clear away lists of symbol tables */
+    sym_table_item *p1, *p2;
 
-      if ((fSource = fopen(input_file_name, "r")) == NULL) /* Read file in */
-      {
-        fprintf(stderr, "Can't open %s\n", input_file_name);
-        exit(144);  // Return 144 for can't open input
-        finished = true;
-      } else
-        finished = false;
+    p1 = arm_mnemonic_list;
+    while (p1 != NULL) {
+      p2 = p1;
+      p1 = p1->pNext;
+      free(p2);
+    }
+  }
 
-      if (fVerilog != NULL) {
-        int i;
-        for (i = 0; i < verilog_mem_size; i++)
-          Verilog_array[i] = 0;
-      }
 
-      while (!finished) {
-        instruction_set = ARM; /* Default */
-        assembly_pointer = 0;  /* Default */
-        data_pointer = 0;
-        entry_address = 0;
-        assembly_pointer_defined = true; /* ??? @@@@  Okay for us! */
-        entry_address_defined = false;
-        arm_variant = 0; /* Default to any ARM architecture */
-        pass_errors = 0;
-        div_zero_this_pass = false;
-        hex_address_defined = false;
-        elf_new_block = true;
-        undefined_count = 0; /* Reads of undefined variables on this pass */
-        defined_count = 0;   /* Labels newly defined on this pass */
-        redefined_count = 0; /* Labels with values changed on this pass */
-        if_SP = 0;
-        if_stack[0] = true;
-        elf_section_valid = false; /* No bytes dumped yet */
-        elf_section = 1;
-        literal_head = NULL;
-        literal_tail = NULL;
-        loc_lab_position = NULL;
-        size_record_current = size_record_list; /* Go to front of list */
-        size_changed_count = 0;
-
-        rewind(fSource); /* Ensure at start of file */
-
-        code_pass(fSource, input_file_name, line, error_code, arm_mnemonic_list,
-                  symbol_table, last_pass, finished);
-        /* no error checks @@@ */
-
-        if (literal_tail != literal_head) /* Clear the literal pool */
-        {
-          std::string literals("Remaining literals");
+  builtin_tables_restore(); /* Forget any RN etc. */
+  sym_delete_table(symbol_table, false);
+  sym_arena_release(arena_mark);
 
-          if (fList != NULL) {
-            list_start_line(assembly_pointer, false);
-          }
-          literal_dump(last_pass, literals, 0); /*  Much like an instruction */
-          if (fList != NULL)
-            list_end_line(literals);
-        }
+  if (files != NULL)
+    for (auto& source : source_cache)
+      files->push_back(source.first);
+  source_cache.clear(); /* Compiled expressions refer to the symbols */
 
-        hex_dump_flush(); /* Ensure buffer is cleared */
+  if (pass_errors == 0)
+    return 0;
+  else
+    return -1;
+}
 
-        if (pass_errors != 0) {
-          finished = true;
-          std::cout << "Pass " << pass_count << " terminating due to "
-                    << pass_errors << " error";
-          if (pass_errors == 1) {
-            std::cout << std::endl;
-          } else {
-            std::cout << 's' << std::endl;
-          }
-        } else {
-          if (last_pass || (pass_count > MAX_PASSES))
-            finished = true;
-          else {
-            if ((defined_count == 0) && (redefined_count == 0) &&
-                (undefined_count == 0)) {
-              last_pass = true;                /* One more time ... */
-              dump_code = !div_zero_this_pass; /* If error don't plant code */
-            }
-            pass_count++;
-          }
+/**
+ * @brief Assembles a source held in memory, for a library caller (see aasm.h).
+ * The assembler's state belongs to the thread, so calls on different threads
+ * may overlap.
+ * @param source The text of the source.
+ * @param options
+ * @return Aasm::ProgramImage What was made, and what was printed.
+ */
+Aasm::ProgramImage Aasm::assemble(std::string_view source,
+                                  const Options& options) {
+  ProgramImage program = {};
+  std::ostringstream messages;
+  std::string name = options.name;
+  sym_table *arm_mnemonic_table, *directive_table;
+  const std::function<bool(const std::string&, std::string&)> reader =
+      [&](const std::string& path, std::string& text) {
+        if (path == name) {
+          text = source;
+          return true;
         }
+        return options.include && options.include(path, text);
+      };
+
+  symbols_file_name = list_file_name = hex_file_name = ""; /* No files */
+  elf_file_name = verilog_file_name = image_file_name = "";
+  serve_socket_name = "";
+  symbols_stdout = list_stdout = hex_stdout = elf_stdout = false;
+  verilog_stdout = image_stdout = false;
+  list_sym = list_kmd = true; /* As "-lk" */
+  verilog_mem_size = VERILOG_MAX;
+  input_file_name = &name[0];
+  source_reader = &reader;
+  message_out = message_err = &messages;
+
+  builtin_tables();
+  builtin_mnemonic_tables(&arm_mnemonic_table, &directive_table);
+  program.status =
+      ::assemble(arm_mnemonic_table, directive_table, NULL, &program);
+
+  source_reader = NULL;
+  message_out = &std::cout;
+  message_err = &std::cerr;
+  program.diagnostics = messages.str();
+  return program;
+}
 
-        if (if_SP != 0) {
-          std::cout << "Pass completed with IF clause still open; terminating"
-                    << std::endl;
-          finished = true;
-        }
+/*----------------------------------------------------------------------------*/
+/* Resident assembler ("--serve <socket>").  A client connects to the Unix    */
+/* socket and sends the absolute path of a source file, ending in a newline.  */
+/* The reply is the int exit status assemble gave, with three descriptors     */
+/* attached (SCM_RIGHTS): memory files holding what was printed, the KMD      */
+/* listing and the program image.  They are sealed, and shared by every       */
+/* client, so should be read with pread or mmap, or opened afresh through     */
+/* /proc/self/fd.  Nothing is written to disk.  Each source file is assembled */
+/* once, then again whenever it or anything it INCLUDEs is written to.  Only  */
+/* the SERVE_MAX_RESULTS most recently asked for are kept, and one is dropped */
+/* when its source file goes away.                                            */
 
-      } /* End of WHILE */
+/**
+ * @brief Serves assemblies on serve_socket_name until killed.
+ * @param arm_mnemonic_table
+ * @param directive_table
+ * @return int -1 if the socket couldn't be set up.
+ */
+int serve(sym_table* arm_mnemonic_table, sym_table* directive_table) {
+  struct sockaddr_un addr;
+  struct stat old;
+  std::vector<struct pollfd> polls;
+  std::vector<serve_request> clients;
+  int listener, watcher, client;
+
+  signal(SIGPIPE, SIG_IGN); /* A vanishing client mustn't kill the server */
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, serve_socket_name, sizeof(addr.sun_path) - 1);
+  if ((lstat(serve_socket_name, &old) == 0) && S_ISSOCK(old.st_mode))
+    unlink(serve_socket_name); /* Remove a socket left by an earlier server */
+
+  listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if ((listener < 0) ||
+      (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0) ||
+      (listen(listener, SOMAXCONN) < 0)) {
+    perror("aasm: socket");
+    return -1;
+  }
 
-      if (fSource != NULL)
-        fclose(fSource);
+  if ((watcher = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+    perror("aasm: inotify");
+    return -1;
+  }
 
-      if ((fList != NULL) && list_sym)
-        list_symbols(fList, symbol_table);
-      // Symbols into list file
+  std::cout << "Serving on " << serve_socket_name << std::endl;
 
-      if (fVerilog != NULL)  // Dump memory image to hex file
-      {
-        int i;
-        for (i = 0; i < verilog_mem_size; i++) {
-          fprintf(fVerilog, "%02X", Verilog_array[i ^ 3]);  // Big endian
-          if ((i & 3) == 3)
-            fprintf(fVerilog, "\n");
-        }
+  while (true) {
+    polls.clear();
+    polls.push_back({listener, POLLIN, 0});
+    polls.push_back({watcher, POLLIN, 0});
+    for (serve_request& request : clients)
+      polls.push_back({request.client, POLLIN, 0});
+
+    if (poll(polls.data(), polls.size(), -1) < 0)
+      continue; /* Interrupted */
+
+    if ((polls[1].revents & POLLIN) != 0) /* Changes first, so that ... */
+      serve_changes(watcher, arm_mnemonic_table, directive_table);
+
+    /* ... no client gets old results; backwards, as answered ones go */
+    for (size_t i = clients.size(); i-- > 0;)
+      if ((polls[2 + i].revents != 0) && serve_receive(clients[i])) {
+        serve_client(clients[i].client, clients[i].text, watcher,
+                     arm_mnemonic_table, directive_table);
+        close(clients[i].client);
+        clients.erase(clients.begin() + i);
       }
 
-      close_output_file(fList, list_file_name, pass_errors != 0);
-      close_output_file(fHex, hex_file_name, pass_errors != 0);
-      close_output_file(fVerilog, verilog_file_name, pass_errors != 0);
+    if (((polls[0].revents & POLLIN) != 0) &&
+        ((client = accept4(listener, NULL, NULL,
+                           SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0)) {
+      if (clients.size() == SERVE_MAX_CLIENTS) {
+        close(clients.front().client); /* Silent clients mustn't lock out */
+        clients.erase(clients.begin()); /* the rest */
+      }
+      clients.push_back({client, ""});
+    }
+  }
+}
 
-      if (fElf != NULL)
-        elf_dump_out(fElf, symbol_table);  // Organise & o/p ELF
+/**
+ * @brief Assembles a source file into fresh memory files, replacing those of
+ * its last assembly, and watches every file it read.
+ * @param path An absolute path to the source file.
+ * @param result Where the assembly is kept.
+ * @param arm_mnemonic_table
+ * @param directive_table
+ * @param watcher The inotify descriptor.
+ */
+void serve_assemble(const std::string& path,
+                    serve_result& result,
+                    sym_table* arm_mnemonic_table,
+                    sym_table* directive_table,
+                    int watcher) {
+  char list_name[32], image_name[32];
+  int saved_out, saved_err;
+  std::vector<std::string> files;
+
+  for (int fd : {result.messages, result.listing, result.image})
+    if (fd >= 0)
+      close(fd); /* Clients may still have them */
+
+  result.messages = memfd_create("messages", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  result.listing = memfd_create("listing", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  result.image = memfd_create("image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+  /* Written through names of their own, like any other output files */
+  snprintf(list_name, sizeof(list_name), "/proc/self/fd/%d", result.listing);
+  snprintf(image_name, sizeof(image_name), "/proc/self/fd/%d", result.image);
+  input_file_name = (char*)path.c_str();
+  list_file_name = list_name;
+  image_file_name = image_name;
+  symbols_file_name = hex_file_name = elf_file_name = verilog_file_name = "";
+  list_stdout = image_stdout = symbols_stdout = hex_stdout = false;
+  elf_stdout = verilog_stdout = false;
+  list_sym = list_kmd = true; /* As "-lk" */
+
+  std::cout.flush(); /* Anything printed goes to the messages file */
+  fflush(stdout);
+  saved_out = dup(1);
+  saved_err = dup(2);
+  dup2(result.messages, 1);
+  dup2(result.messages, 2);
+
+  std::cout << "Input file: " << path << std::endl;
+  result.status =
+      assemble(arm_mnemonic_table, directive_table, &files, NULL);
+
+  std::cout.flush();
+  fflush(stdout);
+  fflush(stderr);
+  dup2(saved_out, 1);
+  dup2(saved_err, 2);
+  close(saved_out);
+  close(saved_err);
+
+  for (int fd : {result.messages, result.listing, result.image})
+    fcntl(fd, F_ADD_SEALS,
+          F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE);
+
+  if (files.empty())
+    files.push_back(path); /* Watch for it to appear */
+  std::vector<std::pair<int, std::string>> watched;
+  for (std::string& file : files)
+    watched.push_back(serve_watch(watcher, file));
+  result.watched.swap(watched);
+  serve_unwatch(watcher, watched); /* Directories no longer INCLUDEd from */
+  result.stale = false;
+
+  std::cout << "Assembled " << path << " (" << result.status << ")"
+            << std::endl;
+}
 
-      if (pass_count > MAX_PASSES) {
-        std::cout << "Couldn't do it ... fed up!" << std::endl << std::endl;
-        std::cout << "Undefined labels:" << std::endl;
-        sym_print_table(symbol_table, UNDEFINED, ALPHABETIC, true, "");
-      } else {
-        if (symbols_stdout || (symbols_file_name[0] != '\0')) {
-          sym_print_table(symbol_table, ALL, symbols_order, symbols_stdout,
-                          symbols_file_name);
-          if (!symbols_stdout) {
-            std::cout << "Symbols in file: " << symbols_file_name << std::endl;
-          }
-        }
+/**
+ * @brief Watches the directory a file is in - rather than the file, which an
+ * editor may replace - for files in it being written.
+ * @param watcher The inotify descriptor.
+ * @param file An absolute path.
+ * @return std::pair<int, std::string> The directory's watch and the file's
+ * name within it, as events give them.
+ */
+std::pair<int, std::string> serve_watch(int watcher, const std::string& file) {
+  size_t slash;
+  std::string directory;
+
+  slash = file.rfind('/');
+  directory = (slash == 0) ? "/" : file.substr(0, slash);
+
+  /* Watching a directory again gives the same watch, not another */
+  return {inotify_add_watch(watcher, directory.c_str(),
+                            IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE |
+                                IN_DELETE | IN_MOVED_FROM),
+          file.substr(slash + 1)};
+}
 
-        if (pass_errors == 0) {
-          if (list_file_name[0] != '\0') {
-            std::cout << "List file in: " << list_file_name << std::endl;
-          }
-          if (hex_file_name[0] != '\0') {
-            std::cout << "Hex dump in: " << hex_file_name << std::endl;
-          }
-          if (elf_file_name[0] != '\0') {
-            std::cout << "ELF file in: " << elf_file_name << std::endl;
-          }
-          if (verilog_file_name[0] != '\0') {
-            std::cout << "Verilog file in: " << verilog_file_name << std::endl;
-            std::cout << "  size: " << verilog_mem_size << " (decimal "
-                      << verilog_mem_size << ") words" << std::endl;
-          }
-        } else {
-          std::cout << "No output generated."
-                    << std::endl;  // Errors => trash output files
-        }
+/**
+ * @brief Reads every pending inotify event, then reassembles each source file
+ * that read one of the files named.
+ * @param watcher The inotify descriptor.
+ * @param arm_mnemonic_table
+ * @param directive_table
+ */
+void serve_changes(int watcher,
+                   sym_table* arm_mnemonic_table,
+                   sym_table* directive_table) {
+  alignas(struct inotify_event) char buffer[4096];
+  struct inotify_event* event;
+  ssize_t length;
+
+  while ((length = read(watcher, buffer, sizeof(buffer))) > 0)
+    for (char* p = buffer; p < buffer + length;
+         p += sizeof(struct inotify_event) + event->len) {
+      event = (struct inotify_event*)p;
+      if (event->len != 0)
+        for (auto& result : serve_results)
+          for (auto& file : result.second.watched)
+            if ((file.first == event->wd) && (file.second == event->name))
+              result.second.stale = true;
+    }
 
-        if (pass_count == 1) {
-          std::cout << std::endl << "1 pass performed." << std::endl;
-        } else {
-          std::cout << std::endl
-                    << "Complete. " << pass_count << " passes performed."
-                    << std::endl;
-        }
-      }
+  std::vector<std::string> gone;
+  for (auto& result : serve_results)
+    if (!result.second.stale)
+      continue;
+    else if (access(result.first.c_str(), F_OK) != 0)
+      gone.push_back(result.first); /* Assembled again if asked for */
+    else
+      serve_assemble(result.first, result.second, arm_mnemonic_table,
+                     directive_table, watcher);
 
-      { /* Free local label list */
-        local_label* pTemp;
-        while ((pTemp = loc_lab_list) != NULL) /* Syntactically grubby! */
-        {
-          loc_lab_list = loc_lab_list->pNext;
-          free(pTemp);
-        }
-      }
+  for (std::string& path : gone)
+    serve_forget(path, watcher);
+}
 
-      { /* Free literal list */
-        literal_record* pTemp;
-        while ((pTemp = literal_list) != NULL) /* Syntactically grubby! */
-        {
-          literal_list = literal_list->pNext;
-          free(pTemp);
-        }
-      }
+/**
+ * @brief Reads what a client has sent, without waiting for more.
+ * @param request The client and its request so far.
+ * @return true When the request is complete - ended by a newline, or by the
+ * client - or too long to be a path, when it is emptied.
+ */
+bool serve_receive(serve_request& request) {
+  char buffer[PATH_MAX];
+  ssize_t count;
+  size_t end;
+
+  count = read(request.client, buffer, sizeof(buffer));
+  if ((count < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+    return false; /* Nothing after all */
+  if (count > 0)
+    request.text.append(buffer, count);
+
+  if ((end = request.text.find('\n')) != std::string::npos)
+    request.text.resize(end);
+  else if (request.text.size() >= PATH_MAX)
+    request.text.clear();
+  else if (count > 0)
+    return false; /* More to come */
+
+  return true;
+}
 
-      { /* Free size list */
-        size_record* pTemp;
-        while ((pTemp = size_record_list) != NULL) /* Syntactically grubby! */
-        {
-          size_record_list = size_record_list->pNext; /* Cut out first record */
-          free(pTemp);                                /*  and delete it */
-        }
-      }
+/**
+ * @brief Answers a client with the latest assembly of the file it asked for,
+ * assembling it first if there isn't one.
+ * @param client The client's socket.
+ * @param request The absolute path the client sent.
+ * @param watcher The inotify descriptor.
+ * @param arm_mnemonic_table
+ * @param directive_table
+ */
+void serve_client(int client,
+                  const std::string& request,
+                  int watcher,
+                  sym_table* arm_mnemonic_table,
+                  sym_table* directive_table) {
+  int status = 144; /* As if the file couldn't be opened */
+  int fds[3];
+  struct iovec iov = {&status, sizeof(status)};
+  struct msghdr message;
+  union {
+    struct cmsghdr header; /* (For alignment) */
+    char space[CMSG_SPACE(sizeof(fds))];
+  } control;
+
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+
+  if (request[0] == '/') {
+    auto found = serve_results.find(request);
+
+    if (found == serve_results.end()) /* New to us */
+      found = serve_results.insert({request, {0, -1, -1, -1, {}, true, 0}})
+                  .first;
+    if (found->second.stale)
+      serve_assemble(found->first, found->second, arm_mnemonic_table,
+                     directive_table, watcher);
+    found->second.used = ++serve_requests;
+
+    status = found->second.status;
+    fds[0] = found->second.messages;
+    fds[1] = found->second.listing;
+    fds[2] = found->second.image;
+
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+    CMSG_FIRSTHDR(&message)->cmsg_level = SOL_SOCKET;
+    CMSG_FIRSTHDR(&message)->cmsg_type = SCM_RIGHTS;
+    CMSG_FIRSTHDR(&message)->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(CMSG_FIRSTHDR(&message)), fds, sizeof(fds));
+  }
 
-      { /* Clear away lists of symbol tables */
-        sym_table_item *p1, *p2;
+  sendmsg(client, &message, 0); /* Ignores errors */
 
-        p1 = arm_mnemonic_list;
-        while (p1 != NULL) {
-          p2 = p1;
-          p1 = p1->pNext;
-          free(p2);
-        }
-      }
+  if ((request[0] == '/') && (access(request.c_str(), F_OK) != 0))
+    serve_forget(request, watcher); /* Don't keep watching for it */
 
-      sym_delete_table(symbol_table, false);
-      sym_delete_table(directive_table, false);
-      sym_delete_table(arm_mnemonic_table, false);
-      sym_delete_table(arch_table, false);
-      sym_delete_table(operator_table, false);
-      sym_delete_table(register_table, false);
-      sym_delete_table(cregister_table, false);
-      sym_delete_table(copro_table, false);
-      sym_delete_table(shift_table, false);
-    }
-  } else {
-    std::cout << "No input file specified" << std::endl;
+  if (serve_results.size() > SERVE_MAX_RESULTS) {
+    auto oldest = serve_results.begin();
+    for (auto result = serve_results.begin(); result != serve_results.end();
+         result++)
+      if (result->second.used < oldest->second.used)
+        oldest = result;
+    serve_forget(oldest->first, watcher);
   }
+}
 
-  if (pass_errors == 0) {
-    exit(0);
-  } else {
-    exit(-1);
+/**
+ * @brief Stops watching the directories in a list that no kept assembly reads
+ * files from any more.
+ * @param watcher The inotify descriptor.
+ * @param watched (Directory watch, name) pairs, as in serve_result.
+ */
+void serve_unwatch(int watcher,
+                   const std::vector<std::pair<int, std::string>>& watched) {
+  for (auto& file : watched) {
+    bool shared = false;
+
+    for (auto& result : serve_results)
+      for (auto& other : result.second.watched)
+        shared = shared || (other.first == file.first);
+
+    if (!shared && (file.first >= 0))
+      inotify_rm_watch(watcher, file.first); /* Fails harmlessly if repeated */
   }
 }
 
+/**
+ * @brief Drops the kept assembly of a source file, closing its memory files
+ * (clients keep their own descriptors) and any watches only it needed.
+ * @param path The source file.
+ * @param watcher The inotify descriptor.
+ */
+void serve_forget(const std::string& path, int watcher) {
+  auto found = serve_results.find(path);
+  std::vector<std::pair<int, std::string>> watched;
+
+  if (found == serve_results.end())
+    return;
+
+  for (int fd : {found->second.messages, found->second.listing,
+                 found->second.image})
+    if (fd >= 0)
+      close(fd);
+  watched.swap(found->second.watched);
+  serve_results.erase(found);
+  serve_unwatch(watcher, watched);
+}
+
 /**
  * @brief
  * @param std_out
@@ -1067,7 +1669,13 @@ bool set_options(int argc, char* argv[]) {
               << "Options:    -e <filename>  specify ELF output file"
               << std::endl
               << "            -h <filename>  specify hex dump file" << std::endl
+              << "            -i <filename>  specify program image file"
+              << std::endl
               << "            -l <filename>  specify list file" << std::endl
+              << "            -m <filename>  read mnemonics from file"
+              << std::endl
+              << "                (instead of using the built-in tables)"
+              << std::endl
               << "                -ls appends symbol table" << std::endl
               << "                -lk produces a KMD file" << std::endl
               << "            -s <filename>  specify symbol table file"
@@ -1087,6 +1695,10 @@ bool set_options(int argc, char* argv[]) {
               << std::endl
               << "                    (output aliases modulo this size)"
               << std::endl
+              << "            --serve <socket>  stay resident, assembling for"
+              << std::endl
+              << "                clients of the Unix socket instead"
+              << std::endl
               << "Omitting a filename (or using '-') directs to stdout"
               << std::endl;
   } else {
@@ -1108,6 +1720,11 @@ bool set_options(int argc, char* argv[]) {
           file_option(&hex_stdout, &hex_file_name, "Hex dump", argc, argv);
           break;
 
+        case 'I':
+        case 'i':
+          file_option(&image_stdout, &image_file_name, "Image", argc, argv);
+          break;
+
         case 'L':
         case 'l':
           list_sym =
@@ -1117,6 +1734,29 @@ bool set_options(int argc, char* argv[]) {
           file_option(&list_stdout, &list_file_name, "List", argc, argv);
           break;
 
+        case '-':
+          if (strcmp(*argv, "--serve") != 0)
+            std::cout << "Unknown option " << *argv << std::endl;
+          else if (argc > 2) {
+            serve_socket_name = argv[1];
+            argc--;
+            argv++;
+          } else {
+            std::cout << "Socket name omitted" << std::endl;
+          }
+          break;
+
+        case 'M':
+        case 'm':
+          if (argc > 2) {
+            mnemonics_file_name = argv[1];
+            argc--;
+            argv++;
+          } else {
+            std::cout << "Mnemonics filename omitted" << std::endl;
+          }
+          break;
+
         case 'S':
         case 's': {
           int pos;
@@ -1194,7 +1834,8 @@ bool set_options(int argc, char* argv[]) {
 
       std::cout << "Input file: " << input_file_name << std::endl;
       okay = true;
-    }
+    } else if (serve_socket_name[0] != '\0')
+      okay = true; /* Clients name the source files */
   }
   return okay;
 }
@@ -1219,7 +1860,7 @@ void print_error(std::string& line,
     if (!last_pass) {
       return;
     } else {
-      std::cout << "Warning: ";
+      *message_out << "Warning: ";
     }
   } else {
     pass_errors++;  // Don't tally warnings
@@ -1230,190 +1871,191 @@ void print_error(std::string& line,
 
   switch (error_code & 0xFFFFFF00) {
     case SYM_ERR_SYNTAX:
-      std::cout << "Syntax error";
+      *message_out << "Syntax error";
       break;
     case SYM_ERR_NO_MNEM:
-      std::cout << "Mnemonic not found";
+      *message_out << "Mnemonic not found";
       break;
     case SYM_ERR_NO_EQU:
-      std::cout << "Label missing";
+      *message_out << "Label missing";
       break;
     case SYM_BAD_REG:
-      std::cout << "Bad register";
+      *message_out << "Bad register";
       break;
     case SYM_BAD_REG_COMB:
-      std::cout << "Illegal register combination";
+      *message_out << "Illegal register combination";
       break;
     case SYM_NO_REGLIST:
-      std::cout << "Register list required";
+      *message_out << "Register list required";
       break;
     case SYM_NO_RSQUIGGLE:
-      std::cout << "Missing '}'";
+      *message_out << "Missing '}'";
       break;
     case SYM_OORANGE:
-      std::cout << "Value out of range";
+      *message_out << "Value out of range";
       break;
     case SYM_ENDLESS_STRING:
-      std::cout << "String unterminated";
+      *message_out << "String unterminated";
       break;
     case SYM_DEF_TWICE:
-      std::cout << "Label redefined";
+      *message_out << "Label redefined";
       break;
     case SYM_NO_COMMA:
-      std::cout << "',' expected";
+      *message_out << "',' expected";
       break;
     case SYM_GARBAGE:
-      std::cout << "Garbage";
+      *message_out << "Garbage";
       break;
     case SYM_ERR_NO_EXPORT:
-      std::cout << "Exported label not defined";
+      *message_out << "Exported label not defined";
       break;
     case SYM_INCONSISTENT:
-      std::cout << "Label redefined inconsistently";
+      *message_out << "Label redefined inconsistently";
       break;
     case SYM_ERR_NO_FILENAME:
-      std::cout << "Filename missing";
+      *message_out << "Filename missing";
       break;
     case SYM_NO_LBR:
-      std::cout << "'[' expected";
+      *message_out << "'[' expected";
       break;
     case SYM_NO_RBR:
-      std::cout << "']' expected";
+      *message_out << "']' expected";
       break;
     case SYM_ADDR_MODE_ERR:
-      std::cout << "Error in addressing mode";
+      *message_out << "Error in addressing mode";
       break;
     case SYM_ADDR_MODE_BAD:
-      std::cout << "Illegal addressing mode";
+      *message_out << "Illegal addressing mode";
       break;
     case SYM_NO_LSQUIGGLE:
-      std::cout << "'{' expected";
+      *message_out << "'{' expected";
       break;
     case SYM_OFFSET_TOO_BIG:
-      std::cout << "Offset out of range";
+      *message_out << "Offset out of range";
       break;
     case SYM_BAD_COPRO:
-      std::cout << "Coprocessor specifier expected";
+      *message_out << "Coprocessor specifier expected";
       break;
     case SYM_BAD_VARIANT:
-      std::cout << "Instruction not available";
+      *message_out << "Instruction not available";
       break;
     case SYM_NO_COND:
-      std::cout << "Conditional execution forbidden";
+      *message_out << "Conditional execution forbidden";
       break;
     case SYM_BAD_CP_OP:
-      std::cout << "Bad coprocessor operation";
+      *message_out << "Bad coprocessor operation";
       break;
     case SYM_NO_LABELS:
-      std::cout << "No labels! Position uncertain";
+      *message_out << "No labels! Position uncertain";
       break;
     case SYM_DOUBLE_ENTRY:
-      std::cout << "Entry already defined";
+      *message_out << "Entry already defined";
       break;
     case SYM_NO_INCLUDE:
-      std::cout << "Include file missing";
+      *message_out << "Include file missing";
       break;
     case SYM_NO_BANG:
-      std::cout << "'!' expected";
+      *message_out << "'!' expected";
       break;
     case SYM_MISALIGNED:
-      std::cout << "Offset misaligned";
+      *message_out << "Offset misaligned";
       break;
     case SYM_OORANGE_BRANCH:
-      std::cout << "Branch out of range";
+      *message_out << "Branch out of range";
       break;
     case SYM_UNALIGNED_BRANCH:
-      std::cout << "Branch to misaligned target";
+      *message_out << "Branch to misaligned target";
       break;
     case SYM_VAR_INCONSISTENT:
-      std::cout << "Variable redefined inconsistently";
+      *message_out << "Variable redefined inconsistently";
       break;
     case SYM_NO_IDENTIFIER:
-      std::cout << "Identifier expected";
+      *message_out << "Identifier expected";
       break;
     case SYM_MANY_IFS:
-      std::cout << "Too many nested IFs";
+      *message_out << "Too many nested IFs";
       break;
     case SYM_MANY_FIS:
-      std::cout << "ENDIF without an IF";
+      *message_out << "ENDIF without an IF";
       break;
     case SYM_LOST_ELSE:
-      std::cout << "Floating ELSE";
+      *message_out << "Floating ELSE";
       break;
     case SYM_NO_HASH:
-      std::cout << "'#' expected";
+      *message_out << "'#' expected";
       break;
     case SYM_NO_IMPORT:
-      std::cout << "Import file missing";
+      *message_out << "Import file missing";
       break;
     case SYM_ADRL_PC:
-      std::cout << "Only ADR allowed with destination PC";
+      *message_out << "Only ADR allowed with destination PC";
       break;
     case SYM_ERR_NO_SHFT:
-      std::cout << "Shift operator expected";
+      *message_out << "Shift operator expected";
       break;
     case SYM_NO_REG_HASH:
-      std::cout << "'#' or register expected";
+      *message_out << "'#' or register expected";
       break;
     case EVAL_NO_OPERAND:
-      std::cout << "Operand expected";
+      *message_out << "Operand expected";
       break;
     case EVAL_NO_OPERATOR:
-      std::cout << "Operator expected";
+      *message_out << "Operator expected";
       break;
     case EVAL_NO_CLOSEBR:
-      std::cout << "Missing ')'";
+      *message_out << "Missing ')'";
       break;
     case EVAL_NO_OPENBR:
-      std::cout << "Extra ')'";
+      *message_out << "Extra ')'";
       break;
     case EVAL_MATHSTACK_LIMIT:
-      std::cout << "Math stack overflow";
+      *message_out << "Math stack overflow";
       break;
     case EVAL_NO_LIMIT:
-      std::cout << "Label not found";
+      *message_out << "Label not found";
       break;
     case EVAL_LABEL_UNDEF:
-      std::cout << "Label undefined";
+      *message_out << "Label undefined";
       break;
     case EVAL_OUT_OF_RADIX:
-      std::cout << "Number out of radix";
+      *message_out << "Number out of radix";
       break;
     case EVAL_DIV_BY_ZERO:
-      std::cout << "Division by zero";
+      *message_out << "Division by zero";
       break;
     case EVAL_OPERAND_ERROR:
-      std::cout << "Operand error";
+      *message_out << "Operand error";
       break;
     case EVAL_BAD_LOC_LAB:
-      std::cout << "Bad local label";
+      *message_out << "Bad local label";
       break;
     case EVAL_NO_LABEL_YET:
-      std::cout << "Label not defined before this point";
+      *message_out << "Label not defined before this point";
       break;
 
     default:
-      std::cout << "Strange error";
+      *message_out << "Strange error";
       break;
   }
-  std::cout << " on line " << line_no << "of file: " << filename << std::endl;
+  *message_out << " on line " << line_no << "of file: " << filename
+               << std::endl;
 
   for (i = 0; line[i] != '\0'; i++) {
-    std::cout << line[i];
+    *message_out << line[i];
   }
-  std::cout << std::endl;
+  *message_out << std::endl;
 
   // else position not well defined
   if (position > 0) {
     // 1 space less than the posn.
     for (i = 0; i <= position - 1; i++) {
       if (line[i] == '\t') {
-        std::cout << '\t';
+        *message_out << '\t';
       } else {
-        std::cout << " ";
+        *message_out << " ";
       }
     }
-    std::cout
+    *message_out
         << "^"
         << std::endl;  // Mirrors TAB expansion (non-printing chars too? @@)
   }
@@ -1457,59 +2099,141 @@ bool input_line(FILE* file, std::string& buffer, unsigned int max) {
   }
 }
 
+/**
+ * @brief Reads a source file into the cache, split into lines exactly as
+ * input_line would split them, so that later passes (and later INCLUDEs of
+ * the same file) need not go back to the file.
+ * @param filename
+ * @return source_file* The cached file, or NULL if it can't be opened.
+ */
+source_file* source_load(char* filename) {
+  auto cached = source_cache.find(filename);
+  if (cached != source_cache.end()) {
+    return &cached->second;
+  }
+
+  std::string text;
+  if (source_reader != NULL) {  // A library caller's sources
+    if (!(*source_reader)(filename, text)) {
+      return NULL;
+    }
+  } else {
+    FILE* handle = fopen(filename, "r");
+    if (handle == NULL) {
+      return NULL;  // Not cached, in case it appears later
+    }
+
+    char block[4096];
+    size_t count;
+    while ((count = fread(block, 1, sizeof(block), handle)) > 0) {
+      text.append(block, count);
+    }
+    fclose(handle);
+  }
+
+  source_file& source = source_cache[filename];
+  size_t pos = 0;
+  bool end = false;
+
+  // Like reading with input_line until feof, a file ending in a newline
+  // yields one last empty line
+  while (!end) {
+    std::string buffer;
+    int c;
+
+    do {
+      end = pos >= text.size();
+      c = end ? EOF : text[pos++];
+      if (!end && (buffer.size() < LINE_LENGTH)) {
+        buffer += c;
+      }
+    } while ((c != '\n') && (c != '\r') && !end);
+
+    if (!buffer.empty() &&
+        ((buffer.back() == '\n') || (buffer.back() == '\r'))) {
+      buffer.pop_back();  // Strip LF
+    }
+
+    if (c == '\r') {  // Strip off any silly DOS-iness
+      if (pos >= text.size()) {
+        end = true;  // Looking for it found the end of the file
+      } else if (text[pos] == '\n') {
+        pos++;
+      }
+    }
+
+    source.lines.push_back(buffer);
+  }
+  source.expressions.resize(source.lines.size());
+
+  return &source;
+}
+
+/**
+ * @brief Copies a cached source line into the line buffer, terminated as
+ * input_line would leave it.
+ * @param source
+ * @param line_number Counting from 1.
+ * @param buffer
+ */
+void source_line(source_file* source,
+                 unsigned int line_number,
+                 std::string& buffer) {
+  const std::string& text = source->lines[line_number - 1];
+
+  text.copy(&buffer[0], text.size());
+  buffer[text.size()] = '\0';
+}
+
 /**
  * @brief
  * @param letter
  * @param mask
  */
-void extra_letter(const char letter,
-                  unsigned int mask,
-                  const unsigned int eos,
-                  std::string& name2,
-                  unsigned int& token2,
-                  sym_table*& a_table,
-                  sym_record*& dummy,
-                  std::string& buffer) {
+template <class Define>
+constexpr void extra_letter(const char letter,
+                            unsigned int mask,
+                            const unsigned int eos,
+                            unsigned int token2,
+                            char* buffer,
+                            Define& define) {
   buffer[eos] = letter;
   buffer[eos + 1] = '\0';
-  sym_define_label(name2, token2 | mask, 0, a_table, &dummy);
+  define(buffer, token2 | mask, false);
 }
 
 /**
  * @brief Wrapper to allow more suffixes (e.g. "S") on mnemonics
- * @param name2
+ * @param buffer Holds the mnemonic, terminated at `eos'
  * @param eos
  * @param token2
  * @param variation
+ * @param define Called with each mnemonic produced
  */
-void parse_mnem_variant(std::string& name2,
-                        unsigned int eos,
-                        unsigned int token2,
-                        unsigned int variation,
-                        sym_table*& a_table,
-                        sym_record*& dummy,
-                        std::string& buffer) {
+template <class Define>
+constexpr void parse_mnem_variant(char* buffer,
+                                  unsigned int eos,
+                                  unsigned int token2,
+                                  unsigned int variation,
+                                  Define& define) {
   switch (variation) {
     case 0x1:  // Arithmetic 'S'
     case 0xD:
-      sym_define_label(name2, token2, 0, a_table, &dummy);
-      extra_letter('s', 0x00100000, eos, name2, token2, a_table, dummy, buffer);
+      define(buffer, token2, false);
+      extra_letter('s', 0x00100000, eos, token2, buffer, define);
       break;
 
     case 0x2:  // Multiplies 'S' + others with just register lists
-      sym_define_label(name2, token2, 0, a_table, &dummy);
+      define(buffer, token2, false);
       switch (token2 & 0x0000F000) {
         case 0x00001000:
-          extra_letter('s', 0x00100000, eos, name2, token2, a_table, dummy,
-                       buffer);
+          extra_letter('s', 0x00100000, eos, token2, buffer, define);
           break;  // MUL etc.
         case 0x00002000:
-          extra_letter('b', 0x00400000, eos, name2, token2, a_table, dummy,
-                       buffer);
+          extra_letter('b', 0x00400000, eos, token2, buffer, define);
           break;  // SWP
         case 0x00004000:
-          extra_letter('s', 0x00100000, eos, name2, token2, a_table, dummy,
-                       buffer);
+          extra_letter('s', 0x00100000, eos, token2, buffer, define);
           break;  // Shifts
         default:
           break;  // 0 - CLZ, 3 - QADD, 8-B - SMUL
@@ -1517,22 +2241,22 @@ void parse_mnem_variant(std::string& name2,
       break;
 
     case 0x3:  // LDR/STR - not LDRH etc.
-      sym_define_label(name2, token2, 0, a_table, &dummy);
-      extra_letter('t', 0x00001000, eos, name2, token2, a_table, dummy,
-                   buffer); /* suffix 'T' */
-      extra_letter('b', 0x00400000, eos, name2, token2, a_table, dummy,
-                   buffer); /* suffix 'B' */
+      define(buffer, token2, false);
+      extra_letter('t', 0x00001000, eos, token2, buffer,
+                   define); /* suffix 'T' */
+      extra_letter('b', 0x00400000, eos, token2, buffer,
+                   define); /* suffix 'B' */
       eos++;                /* Grubbily leaves previous 'B' in place */
-      extra_letter('t', 0x00401000, eos, name2, token2, a_table, dummy,
-                   buffer); /* suffix 'BT' */
+      extra_letter('t', 0x00401000, eos, token2, buffer,
+                   define); /* suffix 'BT' */
       break;
 
     case 0x6:  // LDM/STM
     {
-      char* ldm_mode[] = {"da fa", "ia fd", "db ea", "ib ed"};
-      char* stm_mode[] = {"da ed", "ia ea", "db fd", "ib fa"};
-      char* pMode;
-      int mode, k;
+      const char* ldm_mode[] = {"da fa", "ia fd", "db ea", "ib ed"};
+      const char* stm_mode[] = {"da ed", "ia ea", "db fd", "ib fa"};
+      const char* pMode = NULL;
+      int mode = 0, k = 0;
 
       for (mode = 0; mode < 4; mode++) /* Loop over possible addressing modes */
       {
@@ -1547,7 +2271,7 @@ void parse_mnem_variant(std::string& name2,
           while ((*pMode != '\0') && (*pMode != ' '))
             buffer[k++] = *(pMode++);
           buffer[k] = '\0'; /* Copy suffix and terminate it */
-          sym_define_label(name2, token2 | (mode << 23), 0, a_table, &dummy);
+          define(buffer, token2 | (mode << 23), false);
 
           while (*pMode == ' ')
             pMode++; /* Skip spaces - next suffix (if any) */
@@ -1556,26 +2280,26 @@ void parse_mnem_variant(std::string& name2,
     } break;
 
     case 0x9:  // LDRH etc.
-      extra_letter('h', 0x00000000, eos, name2, token2, a_table, dummy,
-                   buffer);            // suffix 'H'
+      extra_letter('h', 0x00000000, eos, token2, buffer,
+                   define);            // suffix 'H'
       if ((token2 & 0x00100000) != 0)  // Loads, only
       {
         buffer[eos++] = 's';
-        extra_letter('b', 0x00001000, eos, name2, token2, a_table, dummy,
-                     buffer); /* suffix "SB" */
-        extra_letter('h', 0x00002000, eos, name2, token2, a_table, dummy,
-                     buffer); /* suffix "SH" */
+        extra_letter('b', 0x00001000, eos, token2, buffer,
+                     define); /* suffix "SB" */
+        extra_letter('h', 0x00002000, eos, token2, buffer,
+                     define); /* suffix "SH" */
       }
       break;
 
     case 0xB:  // LDC/STC
-      sym_define_label(name2, token2, 0, a_table, &dummy);
-      extra_letter('l', 0x00400000, eos, name2, token2, a_table, dummy, buffer);
+      define(buffer, token2, false);
+      extra_letter('l', 0x00400000, eos, token2, buffer, define);
       break;
 
     case 0xC:  // LDRD/STRD
-      extra_letter('d', 0x00000000, eos, name2, token2, a_table, dummy,
-                   buffer);  // suffix 'D'
+      extra_letter('d', 0x00000000, eos, token2, buffer,
+                   define);  // suffix 'D'
       break;
 
     case 0x4:  // Branch
@@ -1584,37 +2308,37 @@ void parse_mnem_variant(std::string& name2,
     case 0x8:  // ADR
     case 0xA:  // CDP + MCR/MRC
     default:
-      sym_define_label(name2, token2, 0, a_table, &dummy);
+      define(buffer, token2, false);
       break;
   }
 }
 
 /**
- * @brief
- * @param line
- * @param a_table
- * @param d_table
+ * @brief Expands a line of the mnemonics file into every mnemonic (with its
+ * conditions and suffixes) or directive it stands for. `define' is called
+ * with each name, its value and whether it is a directive; this happens at
+ * compile time for the built-in tables and at run time for a -m file.
+ * @param line Terminated
+ * @param define
  * @return true
  * @return false
  */
-bool parse_mnemonic_line(std::string& line,
-                         sym_table* a_table,
-                         sym_table* d_table) {
-  int j, k, okay;
-  unsigned int i, value, token;
-  sym_record* dummy;
-  std::string buffer(SYM_NAME_MAX + 5,
-                     0);  // Largest suffix is 5 bytes, inc. terminator
-  char* conditions[] = {"eq", "ne", "cs hs", "cc lo", "mi", "pl", "vs", "vc",
-                        "hi", "ls", "ge",    "lt",    "gt", "le", "al"};
-  char* pCC;
+template <class Define>
+constexpr bool parse_mnemonic_line(std::string_view line, Define& define) {
+  int j = 0, k = 0, okay = 0;
+  unsigned int i = 0, value = 0, token = 0;
+  char buffer[LINE_LENGTH + 5] = {};  // Largest suffix is 5 bytes, inc. term.
+  const char* conditions[] = {"eq", "ne", "cs hs", "cc lo", "mi",
+                              "pl", "vs", "vc",    "hi",    "ls",
+                              "ge", "lt", "gt",    "le",    "al"};
+  const char* pCC = NULL;
 
   i = skip_spc(line, 0);
   j = 0; /* Indicates end of `root' mnemonic */
 
   if (!test_eol(line[i])) /* Something on line - not comment */
   {
-    while (alpha_numeric(line[i]) && (j < SYM_NAME_MAX))
+    while (alpha_numeric(line[i]) && (j < LINE_LENGTH))
       buffer[j++] = line[i++]; /* Mnemonics may start with numeric */
     buffer[j] = '\0';          /* Add terminator */
 
@@ -1624,11 +2348,13 @@ bool parse_mnemonic_line(std::string& line,
 
     if (okay) {
       if ((value & 0xF0000000) == 0xF0000000) /* Straight directive */
-        sym_define_label(buffer, value, 0, d_table, &dummy);
+        define(buffer, value, true);
+      else if ((value & 0x00000100) != 0) /* Thumb - not supported */
+        ;
       else {
         token = value & 0x0FFFFFFF;
         parse_mnem_variant(buffer, j, 0xE0000000 | token, (value >> 16) & 0xF,
-                           a_table, dummy, buffer);
+                           define);
         /* Straightforward "always" */
 
         if ((value & 0x40000000) != 0) /* Conditions too? */
@@ -1641,7 +2367,7 @@ bool parse_mnemonic_line(std::string& line,
                 buffer[k++] = *(pCC++);
               buffer[k] = '\0'; /* Copy and terminate */
               parse_mnem_variant(buffer, k, (i << 28) | token,
-                                 (value >> 16) & 0xF, a_table, dummy, buffer);
+                                 (value >> 16) & 0xF, define);
 
               while (*pCC == ' ')
                 pCC++; /* Skip spaces */
@@ -1656,6 +2382,51 @@ bool parse_mnemonic_line(std::string& line,
   return okay;
 }
 
+/**
+ * @brief Runs parse_mnemonic_line over each line of a whole mnemonics file.
+ * @param text
+ * @param define
+ * @return bool true if every line parsed
+ */
+template <class Define>
+constexpr bool parse_mnemonic_text(std::string_view text, Define& define) {
+  char line[LINE_LENGTH + 1] = {};
+  unsigned int i = 0, length = 0;
+  bool okay = true;
+
+  while (i < text.size()) {
+    length = 0;
+    while ((i < text.size()) && (text[i] != '\n') && (text[i] != '\r')) {
+      if (length < LINE_LENGTH)
+        line[length++] = text[i];  // Truncated, as input_line would
+      i++;
+    }
+    line[length] = '\0';
+
+    if (!parse_mnemonic_line(std::string_view(line, length + 1), define))
+      okay = false;
+    i++;  // Past the line end
+  }
+
+  return okay;
+}
+
+/**
+ * @brief Defines a mnemonic or directive read from a -m file in its table
+ * @param name
+ * @param value
+ * @param directive
+ */
+void mnemonic_definer::operator()(const char* name,
+                                  unsigned int value,
+                                  bool directive) {
+  std::string buffer(name);
+  sym_record* dummy;
+
+  sym_define_label(buffer, value, 0, directive ? directives : mnemonics,
+                   &dummy);
+}
+
 /**
  * @brief
  * @param line
@@ -1685,7 +2456,7 @@ unsigned int parse_source_line(std::string& line,
   label_this_line.sort = NO_LABEL;
   pos = skip_spc(line, 0);
 
-  if (last_pass && (fList != NULL))
+  if (last_pass && list_active())
     list_start_line(assembly_pointer, false);
 
   if (!test_eol(line[pos])) /* Something on line - not comment */
@@ -1764,6 +2535,7 @@ unsigned int parse_source_line(std::string& line,
           assemble_redef_label(assembly_pointer, assembly_pointer_defined,
                                &label_this_line, &error_code, 0, pass_count,
                                last_pass, line);
+          relax_note_label(&label_this_line, assembly_pointer);
         }
       }
     }
@@ -1780,7 +2552,7 @@ unsigned int parse_source_line(std::string& line,
   }
 
   if (last_pass) {
-    if (fList != NULL) {
+    if (list_active()) {
       list_end_line(line);
     }
 
@@ -1851,6 +2623,8 @@ int do_literal(instr_set instr_type,
       literal_head = literal_list;
     else
       literal_head = literal_head->pNext;
+    relax_note(RELAX_VALUE, assembly_pointer, 0, 0, &literal_head->value, NULL);
+    literal_head->flags &= ~LIT_PACKED; /* Not planted yet in this pass */
 
     if (*pError == EVAL_OKAY) {
       if ((literal_head->flags & LIT_DEFINED) == 0) /* undef? */
@@ -1867,72 +2641,62 @@ int do_literal(instr_set instr_type,
           || ((instr_type == ARM) && (data_op_imm(value) >= 0))) {
         what = 0;                     /* Can do a MOV */
         *ext_value = value;           /* Return value */
-        if (pass_count < SHRINK_STOP) /* If object code can still shrink ... */
+        if (!shrink_stopped) /* If object code can still shrink ... */
           literal_head->flags |= LIT_NO_DUMP; /*  ... save word in lit. pool */
       } else {
         if ((instr_type == ARM) && (data_op_imm(~value) >= 0)) {
           what = 1;           /* Can do a MVN */
           *ext_value = value; /* Return value */
-          if (pass_count <
-              SHRINK_STOP) /* If object code can still shrink ... */
+          if (!shrink_stopped) /* If object code can still shrink ... */
             literal_head->flags |=
                 LIT_NO_DUMP; /*  ... save word in lit. pool */
         } else {
-          bool found;
-
           what = 2;                            /* Needs a load */
           literal_head->flags &= ~LIT_NO_DUMP; /* Long form */
-          /* -Needed- here to guarantee termination of loop below */
-          pTemp = literal_list; /* Guaranteed not NULL */
-          found = false;
-
-          /* This searches whole assembly, no just currently pending pool */
-          while (!found) /* Search for earlier, duplicate value */
-          {              /* Always finds itself, if nothing else */
-            while ((pTemp->value != literal_head->value) /* Search ...*/
-                   || ((pTemp->flags & LIT_NO_DUMP) != 0))
-              pTemp = pTemp->pNext; /* Find own value in list */
-
-            if (!(found = (pTemp == literal_head))) /* Flag if self */
-            { /*  else see if alternative `nearby' */
-              if (((pTemp->flags & LIT_HALF) == 0) /* Alias is 32-bit */
-                  || (size == TYPE_HALF))          /*  or I'm only 16-bit */
-              {                                    /* Range check to alias */
-                int range;
-
-                range = pTemp->address - (assembly_pointer + PC_inc);
-
-                if (range < 0) {
-                  range = -range;
-                }
+          pTemp = literal_head;                /* Unique, unless ... */
 
-                switch (size) {
-                  case TYPE_WORD:
-                    found = range < 4096;
-                    break;
-                  case TYPE_HALF:
-                    found = range < 256;
-                    break;
-                  case TYPE_CPRO:
-                    found = range < 1024;
-                    break;
-                }
+          /* Earlier copies anywhere in assembly, not just the pending pool */
+          for (literal_record* pAlias : literal_index[value]) {
+            if (((pAlias->flags & LIT_HALF) == 0) /* Alias is 32-bit */
+                || (size == TYPE_HALF))           /*  or I'm only 16-bit */
+            {                                     /* Range check to alias */
+              int range;
+              bool found = false;
 
-              } /*  else not found (word can't alias to halfword) */
-            }
-            if (!found)
-              pTemp = pTemp->pNext; /* Unlucky - try again */
-          }                         /* End of outer `while' */
+              range = pAlias->address - (assembly_pointer + PC_inc);
+
+              if (range < 0) {
+                range = -range;
+              }
+
+              switch (size) {
+                case TYPE_WORD:
+                  found = range < 4096;
+                  break;
+                case TYPE_HALF:
+                  found = range < 256;
+                  break;
+                case TYPE_CPRO:
+                  found = range < 1024;
+                  break;
+              }
+              if (found) {
+                pTemp = pAlias; /* ... an earlier copy is `nearby' */
+                break;
+              }
+            } /*  else not found (word can't alias to halfword) */
+          }
 
           if (pTemp != literal_head)
             literal_head->flags |= LIT_NO_DUMP; /* Shares literal */
-          else
-            literal_head->flags &= ~LIT_NO_DUMP; /* Unique */
 
           *ext_value = pTemp->address; /* Return value */
         }
       }
     }
+
+    if ((literal_head->flags & LIT_NO_DUMP) == 0) /* Will be planted */
+      literal_index[literal_head->value].push_back(literal_head);
   }
 
   if (*pError == EVAL_OKAY)
@@ -1971,6 +2735,100 @@ unsigned int find_partials(unsigned int imm, unsigned int* buffer) {
   return count;
 }
 
+/**
+ * @brief Choose the shortest sequence of data-ops. for a long data-op. (MOVX
+ * etc.) with immediate "imm"
+ * @param token
+ * @param imm
+ * @param fields Set to the immediate fields of the sequence
+ * @param op_base Set to the op. code of the first in the sequence
+ * @return unsigned int number of words required
+ */
+unsigned int long_op_fields(unsigned int token,
+                            unsigned int imm,
+                            unsigned int* fields,
+                            unsigned int* op_base) {
+  unsigned int alternate[4]; /* Buffer for alternative imm. fields */
+  unsigned int count, alt_count, i;
+
+  if ((token & 0x0FE00000) == TOKEN_ANDX  /* AND must be single op. */
+      && find_partials(imm, fields) != 1) /*  else ANDX => BICX */
+  {
+    token = token & 0xF01FFFFF | TOKEN_BICX;
+    imm = ~imm;
+  }
+
+  *op_base = token & 0xFFF00000;
+  count = find_partials(imm, fields); /* Break up imm */
+  alt_count = count;
+
+  switch (token & 0x0FE00000) /* Check for shorter alternatives */
+  {
+    case TOKEN_ANDX: /* ANDX */
+    case TOKEN_EORX: /* EORX */
+    case TOKEN_ORRX: /* ORRX */
+    case TOKEN_BICX: /* BICX */
+    case TOKEN_RSBX: /* RSBX */
+    case TOKEN_RSCX: /* RSCX */
+      break;
+
+    case TOKEN_SUBX:                              /* SUBX */
+    case TOKEN_ADDX:                              /* ADDX */
+    case TOKEN_ADCX:                              /* ADCX */
+    case TOKEN_SBCX:                              /* SBCX */
+      alt_count = find_partials(-imm, alternate); /* Negate */
+      if (alt_count < count) /* Use alternative op. */
+      {
+        switch (token & 0x0FE00000) /* Change op. code */
+        {
+          case TOKEN_SUBX:
+            *op_base = *op_base & 0xFE100000 | TOKEN_ADDX;
+            break;
+          case TOKEN_ADDX:
+            *op_base = *op_base & 0xFE100000 | TOKEN_SUBX;
+            break;
+          case TOKEN_ADCX:
+            *op_base = *op_base & 0xFE100000 | TOKEN_SBCX;
+            break;
+          case TOKEN_SBCX:
+            *op_base = *op_base & 0xFE100000 | TOKEN_ADCX;
+            break;
+        }
+      }
+      break;
+
+      /* Note: doesn't try 16-bit MOVs from v6T2 */
+    case TOKEN_MOVX:                              /* MOVX */
+      alt_count = find_partials(~imm, alternate); /* One's comp. */
+      if (alt_count < count) /* Use alternative op. */
+        *op_base = *op_base | 0x00400000; /* MVN */
+      break;
+
+    default:
+      *message_out << "Unknown `long' operation" << std::endl;
+      break;
+  }
+
+  if (alt_count < count) {
+    count = alt_count;
+    for (i = 0; i < count; i++)
+      fields[i] = alternate[i];
+  }
+  return count;
+}
+
+/**
+ * @brief Padding needed to bring "address" up to a multiple of "boundary"
+ * @param address
+ * @param boundary
+ * @return unsigned int number of bytes to skip (none if boundary is zero)
+ */
+unsigned int align_padding(unsigned int address, unsigned int boundary) {
+  if (boundary == 0) /* (ALIGN 0 has no effect) */
+    return 0;
+  return boundary - ((address - 1) % boundary + 1);
+}
+
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 /* Make/maintain list of variable size items.                                 */
 /* Inputs: first_pass - build or use flag                                     */
@@ -1993,7 +2851,7 @@ unsigned int variable_item_size(int first_pass, unsigned int size) {
     size_record_current = pTemp;          /* Pointer to last in list */
   } else { /* Check for changes in object code size */
     if (size_record_current->size != size) {
-      if ((pass_count < SHRINK_STOP)             /* Can still shrink */
+      if (!shrink_stopped                        /* Can still shrink */
           || (size_record_current->size < size)) /*  or grow */
       {
         size_record_current->size = size;
@@ -2007,6 +2865,143 @@ unsigned int variable_item_size(int first_pass, unsigned int size) {
   return size;
 }
 
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Note something which may move if earlier items change size, so that the    */
+/* sizes can be settled before the next pass.                                 */
+/* Inputs: kind - RELAX_*                                                     */
+/*         address - where it is on this pass                                 */
+/*         size - its size this pass (words for long op., else bytes)         */
+/*         token - long op. token or alignment boundary                       */
+/*         value - label or literal value to be moved                         */
+/*         record - size record of a long op.                                 */
+/* Globals: relax_items, last_expressions, last_expression                    */
+
+void relax_note(unsigned char kind,
+                unsigned int address,
+                unsigned int size,
+                unsigned int token,
+                unsigned int* value,
+                size_record* record) {
+  relax_item item = {kind, address, size, token, value, record, NULL, -1};
+
+  if ((kind == RELAX_VALUE) || (kind == RELAX_LONG_OP)) {
+    item.expressions = last_expressions; /* Operand just evaluated */
+    item.expression = last_expression;
+  }
+  relax_items.push_back(item);
+}
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Note a label planted at the given address on the current line.             */
+
+void relax_note_label(own_label* my_label, unsigned int address) {
+  if (!assembly_pointer_defined)
+    return;
+
+  if ((my_label->sort == SYMBOL) || (my_label->sort == MAYBE_SYMBOL))
+    relax_note(RELAX_LABEL, address, 0, 0,
+               (unsigned int*)&my_label->symbol->value, NULL);
+  else if (my_label->sort == LOCAL_LABEL)
+    relax_note(RELAX_LABEL, address, 0, 0, &my_label->local->value, NULL);
+}
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Re-evaluate the expression an item was given, as though at `address'.      */
+/* Expressions with names still unresolved or local labels are left alone.    */
+/* Returns: true if `value' is set                                            */
+
+bool relax_evaluate(relax_item& item,
+                    unsigned int address,
+                    unsigned int* value) {
+  unsigned int error;
+  int pos;
+
+  if (item.expression < 0)
+    return false;
+
+  eval_program& program = (*item.expressions)[item.expression];
+  for (eval_op& step : program.ops)
+    if ((step.kind == EVAL_OP_NAME) || (step.kind == EVAL_OP_LOCAL))
+      return false;
+
+  assembly_pointer = address; /* For `.' */
+  def_increment = 0;
+  return eval_replay(program, "", &pos, value, &error) && (error == EVAL_OKAY);
+}
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Settle the sizes of the variable length items met on the pass just done.   */
+/* Sweeps the items noted, in order, moving each label and literal by the     */
+/* growth of everything before it and re-sizing items from the moved values,  */
+/* until nothing changes; the next pass then finds everything where it was    */
+/* put unless something outside the model (e.g. a literal pool) moved too.    */
+/* Like the passes themselves, shrinkage stops after a while so that the      */
+/* sweeps must converge.                                                      */
+/* Globals: relax_items, shrink_stopped                                       */
+
+void relax_sizes(void) {
+  unsigned int saved_pointer, saved_increment, saved_undefined;
+  bool saved_div_zero;
+  unsigned int partial[4], op_base;
+  int sweep;
+
+  saved_pointer = assembly_pointer; /* Replaying expressions affects these */
+  saved_increment = def_increment;
+  saved_undefined = undefined_count;
+  saved_div_zero = div_zero_this_pass;
+
+  for (sweep = 0; sweep < RELAX_LIMIT; sweep++) {
+    unsigned int delta, changed, value, size;
+
+    if (sweep == RELAX_SHRINK_STOP)
+      shrink_stopped = true;
+
+    delta = 0; /* Growth of everything so far */
+    changed = 0;
+    for (relax_item& item : relax_items) {
+      switch (item.kind) {
+        case RELAX_ORIGIN:
+          delta = 0;
+          break;
+
+        case RELAX_LABEL:
+          *item.value = item.address + delta;
+          break;
+
+        case RELAX_VALUE:
+          if (relax_evaluate(item, item.address + delta, &value))
+            *item.value = value;
+          break;
+
+        case RELAX_ALIGN:
+          delta = delta + align_padding(item.address + delta, item.token) -
+                  item.size;
+          break;
+
+        case RELAX_LONG_OP:
+          if (relax_evaluate(item, item.address + delta, &value)) {
+            size = long_op_fields(item.token, value, partial, &op_base);
+            if ((size != item.record->size) &&
+                (!shrink_stopped || (item.record->size < size))) {
+              item.record->size = size;
+              changed++;
+            }
+          }
+          delta = delta + 4 * (item.record->size - item.size);
+          break;
+      }
+    }
+
+    if (changed == 0)
+      break;
+  }
+
+  assembly_pointer = saved_pointer;
+  def_increment = saved_increment;
+  undefined_count = saved_undefined;
+  div_zero_this_pass = saved_div_zero;
+}
+
 /**
  * @brief
  * @param size
@@ -2675,12 +3670,16 @@ void arm_mnemonic(bool& last_pass,
   unsigned int op_code, value, extras;
   int reg;
   bool rrx;  // Flag (of convenience) identifying short RRX
+  bool decode;
 
   extras = 0;  // Instruction length - 4
 
   /* Only do difficult stuff on first pass (syntax) and last pass (code dump)
-    unless instruction may cause file length to vary (e.g. LDR Rd, =###) */
-  if (first_pass || last_pass || ((token & 0x00008000) != 0)) {
+    unless instruction may cause file length to vary (e.g. LDR Rd, =###), or
+    a following ALIGN may need to know if its gap can take pending literals */
+  decode = first_pass || last_pass || ((token & 0x00008000) != 0) ||
+           (literal_tail != literal_head);
+  if (decode) {
     op_code = token & 0xFFF00000;
 
     rrx = ((token & 0x000FFF00) == 0x00024E00);  // Nasty irregular case
@@ -2726,9 +3725,9 @@ void arm_mnemonic(bool& last_pass,
               if (!cmp_next_non_space(line, &position, 0, ',')) {
                 error_code = SYM_NO_COMMA | position;
               }
+            } else {
+              error_code = SYM_BAD_REG | position;
             }
-          } else {
-            error_code = SYM_BAD_REG | position;
           }
 
           // Rm always present, so check omitted
@@ -3190,13 +4189,10 @@ void arm_mnemonic(bool& last_pass,
 
       case 0x000A0000: /* CDP + MCR/MRC */
       {
-        int cdp_parameters[] = {0xFFFFFFF0, 20, 1, 1, 2};
-        int mcr_parameters[] = {0xFFFFFFF8, 21, 0, 1, 1};
-        int mcrr_parameters[] = {0xFFFFFFF0, 4, 0, 0, 0};
+        int cdp_parameters[] = {(int)0xFFFFFFF0, 20, 1, 1, 2};
+        int mcr_parameters[] = {(int)0xFFFFFFF8, 21, 0, 1, 1};
+        int mcrr_parameters[] = {(int)0xFFFFFFF0, 4, 0, 0, 0};
         int* parameters;
-        int CDP;
-
-        CDP = ((token & 0x0000F000) == 0x00000000); /* Differ. from MCR/MRC */
 
         switch (token & 0x0000F000) {
           case 0x00000000:
@@ -3301,8 +4297,9 @@ void arm_mnemonic(bool& last_pass,
       case 0x000D0000: /* Long data-op. variants */
       {
         unsigned int Rd, Rn, imm;
-        unsigned int partial[4], alternate[4]; /* Buffers for imm. fields */
-        unsigned int count, alt_count, true_count, *ptr;
+        unsigned int partial[4]; /* Buffer for imm. fields */
+        unsigned int count, true_count, *ptr;
+        size_record* record;
         unsigned int op_base;
 
         if ((Rd = get_reg(line, &position)) >= 0) /* Syntax parsing */
@@ -3333,75 +4330,21 @@ void arm_mnemonic(bool& last_pass,
 
         ptr = partial;               /* Default setting */
         if (error_code == EVAL_OKAY) /* Got the (possible) immediate value */
-        {
-          if ((token & 0x0FE00000) == TOKEN_ANDX   /* AND must be single op. */
-              && find_partials(imm, partial) != 1) /*  else ANDX => BICX */
-          {
-            token = token & 0xF01FFFFF | TOKEN_BICX;
-            imm = ~imm;
-          }
-
-          op_base = token & 0xFFF00000;
-          count = find_partials(imm, partial); /* Break up imm */
-
-          switch (token & 0x0FE00000) /* Check for shorter alternatives */
-          {
-            case TOKEN_ANDX: /* ANDX */
-            case TOKEN_EORX: /* EORX */
-            case TOKEN_ORRX: /* ORRX */
-            case TOKEN_BICX: /* BICX */
-            case TOKEN_RSBX: /* RSBX */
-            case TOKEN_RSCX: /* RSCX */
-              break;
-
-            case TOKEN_SUBX:                              /* SUBX */
-            case TOKEN_ADDX:                              /* ADDX */
-            case TOKEN_ADCX:                              /* ADCX */
-            case TOKEN_SBCX:                              /* SBCX */
-              alt_count = find_partials(-imm, alternate); /* Negate */
-              if (alt_count < count) /* Use alternative op. */
-              {
-                count = alt_count;
-                ptr = alternate;
-                switch (token & 0x0FE00000) /* Change op. code */
-                {
-                  case TOKEN_SUBX:
-                    op_base = op_base & 0xFE100000 | TOKEN_ADDX;
-                    break;
-                  case TOKEN_ADDX:
-                    op_base = op_base & 0xFE100000 | TOKEN_SUBX;
-                    break;
-                  case TOKEN_ADCX:
-                    op_base = op_base & 0xFE100000 | TOKEN_SBCX;
-                    break;
-                  case TOKEN_SBCX:
-                    op_base = op_base & 0xFE100000 | TOKEN_ADCX;
-                    break;
-                }
-              }
-              break;
-
-              /* Note: doesn't try 16-bit MOVs from v6T2 */
-            case TOKEN_MOVX:                              /* MOVX */
-              alt_count = find_partials(~imm, alternate); /* One's comp. */
-              if (alt_count < count) /* Use alternative op. */
-              {
-                count = alt_count;
-                ptr = alternate;
-                op_base = op_base | 0x00400000; /* MVN */
-              }
-              break;
-
-            default:
-              std::cout << "Unknown `long' operation" << std::endl;
-              break;
-          }
-        } else
+          count = long_op_fields(token, imm, partial, &op_base);
+        else
           count = 4;
 
+        record = size_record_current;
         true_count = variable_item_size(first_pass, count);
         /* Account for variable length sequence */
 
+        if (!first_pass && if_stack[if_SP]) {
+          if (error_code != EVAL_OKAY)
+            last_expression = -1; /* No value to re-size it from */
+          relax_note(RELAX_LONG_OP, assembly_pointer, true_count, token, NULL,
+                     record);
+        }
+
         if (!last_pass)
           extras = extras + 4 * (true_count - 1);
         else /* Only derive op. code(s) on last pass */
@@ -3446,7 +4389,7 @@ void arm_mnemonic(bool& last_pass,
       } break;
 
       default:
-        std::cout << "Unprocessable opcode!" << std::endl;
+        *message_out << "Unprocessable opcode!" << std::endl;
         break;
     }
 
@@ -3464,8 +4407,12 @@ void arm_mnemonic(bool& last_pass,
     /* Dump 0x00000000 place holder */
   }
   //##
-  if (if_stack[if_SP])
+  if (if_stack[if_SP]) {
     assembly_pointer = assembly_pointer + 4 + extras;
+    flow_stopped =
+        decode && (error_code == EVAL_OKAY) && !arm_falls_through(op_code);
+    flow_stop_address = assembly_pointer;
+  }
 }
 
 /**
@@ -3490,23 +4437,25 @@ void do_align(unsigned int& error_code,
   }
 
   if (error_code == EVAL_OKAY) {
-    if (operand != 0) {  // (ALIGN 0 has no effect)
-      temp = (assembly_pointer - 1) % operand;
-      operand = operand - (temp + 1);  // No. of elements to skip(/fill)
-    }
+    temp = operand;
+    operand = align_padding(assembly_pointer, operand);  // Elements to skip
 
     if (fill = (line[position] == ','))  // Note where any label should go
       fill_space(operand, position, error_code, last_pass, line, symbol_table,
                  operand, first_pass);  // Fill with value (?)
     else                                // Start new section if leaving gap
     {
-      // dumping literals inside ALIGN @@@
-      // literal_dump(last_pass, line, assembly_pointer + operand);
-      // printf("Hello?\n");
-      if (fList != NULL) {
+      if ((operand != 0) && ((temp % 4) == 0) && if_stack[if_SP] &&
+          (literal_tail != literal_head) && flow_stopped &&
+          (flow_stop_address == assembly_pointer)) {
+        // Fill gap with pending literals, if no code can run into it
+        literal_dump(last_pass, line, assembly_pointer + operand);
+        operand = align_padding(assembly_pointer, temp);  // What's left
+      }
+      if (list_active() && (list_byte == 0)) {
         list_start_line(assembly_pointer + operand, false);
       }
-      // Revise list file address
+      // Revise list file address, unless literals were listed
 
       if (operand != 0) {
         elf_new_section_maybe();  // Only reorigin in needed
@@ -3516,13 +4465,19 @@ void do_align(unsigned int& error_code,
 
   if (error_code == EVAL_OKAY) /* Still OK? */
   {
-    if (fill) /* Any label is at source point */
+    if (fill) { /* Any label is at source point */
       assemble_redef_label(assembly_pointer, assembly_pointer_defined, my_label,
                            &error_code, 0, pass_count, last_pass, line);
-    else /* Any label is after alignment */
+      relax_note_label(my_label, assembly_pointer);
+    }
+    if (if_stack[if_SP])
+      relax_note(RELAX_ALIGN, assembly_pointer, operand, temp, NULL, NULL);
+    if (!fill) { /* Any label is after alignment */
       assemble_redef_label(assembly_pointer + operand, assembly_pointer_defined,
                            my_label, &error_code, 0, pass_count, last_pass,
                            line);
+      relax_note_label(my_label, assembly_pointer + operand);
+    }
     //##
     if (if_stack[if_SP]) {
       assembly_pointer = assembly_pointer + operand;
@@ -3544,7 +4499,7 @@ void do_align(unsigned int& error_code,
  * @param include_file_path
  * @return unsigned int
  */
-unsigned int assemble_line(std::string line,
+unsigned int assemble_line(std::string& line,
                            int position,
                            unsigned int token,
                            own_label* my_label,
@@ -3568,9 +4523,11 @@ unsigned int assemble_line(std::string line,
     sym_add_to_table(symbol_table, my_label->symbol); /* Must be a label */
 
   if (((token & 0xF8000000) != 0xF8000000) && (my_label->sort != NO_LABEL))
-    /* Redefine label if present/required unless directive such as EQU */
+  { /* Redefine label if present/required unless directive such as EQU */
     assemble_redef_label(assembly_pointer, assembly_pointer_defined, my_label,
                          &error_code, 0, pass_count, last_pass, line);
+    relax_note_label(my_label, assembly_pointer);
+  }
 
   def_increment = 0; /* Default to first position/item on line */
 
@@ -3800,6 +4757,9 @@ unsigned int assemble_line(std::string line,
         case 0xF8030000: /* DEF */
           error_code = evaluate(line, &position, &temp, symbol_table);
           if (my_label->symbol != NULL) {
+            if ((my_label->sort == SYMBOL) || (my_label->sort == MAYBE_SYMBOL))
+              relax_note(RELAX_VALUE, assembly_pointer, 0, 0,
+                         (unsigned int*)&my_label->symbol->value, NULL);
             if (token == 0xF8000000)
               assemble_redef_label(temp, true, my_label, &error_code,
                                    SYM_REC_EQU_FLAG, pass_count, last_pass,
@@ -3821,12 +4781,14 @@ unsigned int assemble_line(std::string line,
           if (allow_error(error_code, first_pass, last_pass))
             error_code =
                 SYM_NO_ERROR; /* ORG undefined -itself- is not an error */
-          if (fList != NULL)
+          if (list_active())
             list_start_line(assembly_pointer, false);
           /* Revise list file address */
           assemble_redef_label(assembly_pointer, assembly_pointer_defined,
                                my_label, &error_code, 0, pass_count, last_pass,
                                line);
+          relax_note(RELAX_ORIGIN, assembly_pointer, 0, 0, NULL, NULL);
+          relax_note_label(my_label, assembly_pointer);
 
           elf_new_section_maybe(); /* else reuse previous (unused) number */
           break;
@@ -3963,21 +4925,19 @@ unsigned int assemble_line(std::string line,
 /* Look up a value in a symbol table.                                         */
 /* Intended to recover positive values only; returns -1 if not found.         */
 
-#define THING_BUFFER_LENGTH 16
-
-int get_thing(std::string& line, int* pos, sym_table* table) {
-  int i, result;
-  std::string buffer(THING_BUFFER_LENGTH, 0);
+int get_thing(std::string_view line, int* pos, sym_table* table) {
+  int result;
+  std::string_view name;
   sym_record* ptr;
 
   *pos = skip_spc(line, *pos);
   result = -1; /* Not found code */
 
-  if ((i = get_identifier(line, *pos, buffer, THING_BUFFER_LENGTH)) >
-      0) {                                               /* Something taken */
-    if ((ptr = sym_find_label(buffer, table)) != NULL) { /* Symbol recognised */
+  name = peek_identifier(line, *pos);
+  if (!name.empty()) {                                 /* Something taken */
+    if ((ptr = sym_find_label(name, table)) != NULL) { /* Symbol recognised */
       result = ptr->value;
-      *pos += i;
+      *pos += name.size();
     }
   }
 
@@ -3986,7 +4946,7 @@ int get_thing(std::string& line, int* pos, sym_table* table) {
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 
-int get_reg(std::string line, int* pos) /* Expand into code? @@@@ */
+int get_reg(std::string_view line, int* pos) /* Expand into code? @@@@ */
 {
   return get_thing(line, pos, register_table);
 }
@@ -3995,7 +4955,7 @@ int get_reg(std::string line, int* pos) /* Expand into code? @@@@ */
 /* Like get_reg but accepts a mask of which subset of registers are allowed.  */
 /* If mask doesn't match then leaves *pos at start of symbol.                 */
 
-int get_thumb_reg(std::string& line, int* pos, unsigned int reg_mask) {
+int get_thumb_reg(std::string_view line, int* pos, unsigned int reg_mask) {
   int reg;
   unsigned int start_pos;
 
@@ -4012,19 +4972,19 @@ int get_thumb_reg(std::string& line, int* pos, unsigned int reg_mask) {
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 
-int get_creg(std::string& line, int* pos) {
+int get_creg(std::string_view line, int* pos) {
   return get_thing(line, pos, cregister_table);
 }
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 
-int get_copro(std::string& line, int* pos) {
+int get_copro(std::string_view line, int* pos) {
   return get_thing(line, pos, copro_table);
 }
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 
-int get_psr(std::string& line, int* pPos) {
+int get_psr(std::string_view line, int* pPos) {
   int reg;
 
   if ((line[*pPos] & 0xDF) == 'C')
@@ -4083,7 +5043,7 @@ int get_psr(std::string& line, int* pPos) {
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 
-int get_shift(std::string& line, int* pos) {
+int get_shift(std::string_view line, int* pos) {
   int result, flag;
 
   *pos = skip_spc(line, *pos);
@@ -4104,7 +5064,7 @@ int get_shift(std::string& line, int* pos) {
 }
 
 unsigned int rol32(unsigned int x, unsigned int j) {
-  return (((x & 0xFFFFFFFF) >> (32 - j)) | (x << j)) & 0xFFFFFFFF;
+  return (((x & 0xFFFFFFFF) >> ((32 - j) & 31)) | (x << j)) & 0xFFFFFFFF;
 }
 
 /**
@@ -4157,7 +5117,7 @@ void assemble_redef_label(unsigned int value,
                           int type_change,
                           int pass_count,
                           bool last_pass,
-                          std::string line) {
+                          std::string& line) {
   int value_defined; /* Genuine value supplied */
   unsigned int old_value;
   int flags;
@@ -4233,7 +5193,7 @@ void assemble_redef_label(unsigned int value,
 
 void byte_dump(unsigned int address,
                unsigned int value,
-               std::string line,
+               std::string& line,
                int size) {
   int i;
 
@@ -4241,7 +5201,7 @@ void byte_dump(unsigned int address,
   // size);
 
   if (dump_code && if_stack[if_SP]) {
-    if (fList != NULL)
+    if (list_active())
       list_mid_line(value, line, size);
 
     for (i = 0; i < size; i++) {
@@ -4249,6 +5209,8 @@ void byte_dump(unsigned int address,
         hex_dump(address + i, (value >> (8 * i)) & 0xFF);
       if (fElf != NULL)
         elf_dump(address + i, (value >> (8 * i)) & 0xFF);
+      if (image_wanted)
+        image_dump(address + i, (value >> (8 * i)) & 0xFF);
       if (fVerilog != NULL)
         Verilog_array[(address + i) % VERILOG_MAX] = (value >> (8 * i)) & 0xFF;
     }
@@ -4256,81 +5218,123 @@ void byte_dump(unsigned int address,
   return;
 }
 
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Plant a single literal record, aligning first as required                  */
+/* `my_message' is listed against any padding; it becomes `line' thereafter   */
+/* Returns the address following the literal                                  */
+
+unsigned int literal_plant(literal_record* pLiteral,
+                           unsigned int address,
+                           bool last_pass,
+                           std::string& line,
+                           std::string& my_message) {
+  unsigned int size; /* Each plant aligns to the appropriate boundary */
+  int i;
+
+  if ((pLiteral->flags & LIT_HALF) == 0)
+    size = 4;
+  else
+    size = 2;
+
+  relax_note(RELAX_ALIGN, address, align_padding(address, size), size, NULL,
+             NULL);
+  for (i = 0; ((address + i) & (size - 1)) != 0; i++) /* Align */
+    if (last_pass)
+      byte_dump(address + i, 0, my_message, 1); /* Padded */
+  /* Padding avoids need to mess about with sections in elf output */
+  address = address + i; /* Step, even if not planting */
+
+  if (list_active() && ((i != 0) /* Needed to align first */
+                        || ((size == 4) &&
+                            ((list_byte % 4) != 0)))) /*  or unaligned */
+  { /* Start new list line if alignment was needed */
+    list_end_line(my_message);
+    list_start_line(address, (my_message == line)); /* May *continue' */
+  }
+
+  pLiteral->address = address; /* Note dump address in record */
+  relax_note(RELAX_LABEL, address, 0, 0, &pLiteral->address, NULL);
+
+  my_message = line; /* Real output line (if any) now */
+  if (last_pass)
+    byte_dump(address, pLiteral->value, line, size); /*Plant*/
+  return address + size;                             /* Step on */
+}
+
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 /* Dump any pending literal records into code                                 */
 /* `last_pass' is a bool which enables code dumping                        */
 /* `line' is the input source line                                            */
 /* `limit' is a dump address not to exceed, unless 0 which indicates no limit */
+/* A halfword further down the pool is brought forward into any hole which    */
+/*  would otherwise be left in front of a word.                               */
 
 void literal_dump(bool last_pass, std::string& line, unsigned int limit) {
   unsigned int address; /* Needed because assembly pointer is static */
                         /*  for each `instruction' in the list file */
-  unsigned int size;    /* Each plant aligns to the appropriate boundary */
+  unsigned int size;
   int i;
   char* align_message = "(padding)";
   std::string my_message;
+  literal_record* pNext;
+  literal_record* pHalf; /* Where the last search for a halfword stopped */
 
   address = assembly_pointer;
   my_message = align_message; /* In case we need to align first */
+  pHalf = NULL;
 
-  // For dumping inside ALIGN etc.	@@@
-  // while ((literal_tail != literal_head)  /* Strip any unwanted entries at
-  // start */
-  //   && (literal_tail != NULL)
-  //   && ((literal_tail->flags & LIT_NO_DUMP) != 0))
-  //  if (literal_tail == NULL) literal_tail = literal_list;
-  //  else                      literal_tail = literal_tail->pNext;
-
-  while ((literal_tail != literal_head) &&
-         ((limit == 0) ||
-          ((address + (((literal_tail->flags & LIT_HALF) != 0) ? 2 : 4)) <=
-           limit))) { /* Something to dump and space to dump it in */
+  while (literal_tail != literal_head) /* Something to dump */
+  {
     if (literal_tail == NULL)
-      literal_tail = literal_list;
-    else
-      literal_tail = literal_tail->pNext;
-
-    if ((literal_tail->flags & LIT_HALF) == 0)
-      size = 4;
+      pNext = literal_list;
     else
-      size = 2;
+      pNext = literal_tail->pNext;
 
-    if ((literal_tail->flags & LIT_NO_DUMP) ==
-        0) /* If -not- converted to MOV */
+    if ((pNext->flags & LIT_PACKED) != 0) /* Already planted in a hole */
     {
-      for (i = 0; ((address + i) & (size - 1)) != 0; i++) /* Align */
-        if (last_pass)
-          byte_dump(address + i, 0, my_message, 1); /* Padded */
-      /* Padding avoids need to mess about with sections in elf output */
-      address = address + i; /* Step, even if not planting */
-
-      if ((fList != NULL) &&
-          ((i != 0) /* Needed to align first */
-           || ((size == 4) &&
-               ((list_byte % 4) != 0)))) /*  or unaligned for word */
-      { /* Start new list line if alignment was needed */
-        list_end_line(my_message);
-        list_start_line(address, (my_message == line)); /* May *continue' */
+      pNext->flags &= ~LIT_PACKED;
+      if (pNext == pHalf)
+        pHalf = NULL; /* Search on from here next time */
+    } else if ((pNext->flags & LIT_NO_DUMP) == 0) /* If -not- a MOV */
+    {
+      if ((pNext->flags & LIT_HALF) == 0)
+        size = 4;
+      else
+        size = 2;
+
+      if ((limit != 0) &&
+          ((address + align_padding(address, size) + size) > limit))
+        break; /* No space to dump it in */
+
+      if ((size == 4) && (align_padding(address, 4) >= (2 + (address & 1)))) {
+        if (pHalf == NULL) /* Look for a halfword to fill the hole */
+          pHalf = pNext;
+        while ((pHalf != literal_head) &&
+               (((pHalf = pHalf->pNext)->flags &
+                 (LIT_HALF | LIT_NO_DUMP | LIT_PACKED)) != LIT_HALF))
+          ;
+
+        if ((pHalf->flags & (LIT_HALF | LIT_NO_DUMP | LIT_PACKED)) ==
+            LIT_HALF) {
+          address = literal_plant(pHalf, address, last_pass, line, my_message);
+          pHalf->flags |= LIT_PACKED; /* Skip it when reached */
+        }
       }
-    } else if ((literal_tail->flags & LIT_DEFINED) == 0)
-      undefined_count++;  // Is this a "label"?? @@@
-    else {
-      if (address != literal_tail->address)
+
+      address = literal_plant(pNext, address, last_pass, line, my_message);
+    } else {
+      if ((pNext->flags & LIT_DEFINED) == 0)
+        undefined_count++;  // Is this a "label"?? @@@
+      else if (address != pNext->address)
         redefined_count++;  // Is this a "label"?? @@@
       /* Addr. change => offset may change => other literals (/labels) may move
        */
-    }
-
-    literal_tail->address = address; /* Note dump address in record anyway */
 
-    if ((literal_tail->flags & LIT_NO_DUMP) ==
-        0) /* If -not- converted to MOV */
-    {
-      my_message = (char*)line.c_str(); /* Real output line (if any) now */
-      if (last_pass)
-        byte_dump(address, literal_tail->value, line, size); /*Plant*/
-      address = address + size;                              /* Step on */
+      pNext->address = address; /* Note dump address in record anyway */
+      relax_note(RELAX_LABEL, address, 0, 0, &pNext->address, NULL);
     }
+
+    literal_tail = pNext;
   }
 
   for (i = 0; ((address + i) & 3) != 0; i++) /* Realign to word boundary */
@@ -4366,6 +5370,45 @@ void close_output_file(FILE* handle, char* filename, int errors) {
   return;
 }
 
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Write the pieces of an output file, in order, in as few system calls as    */
+/* possible.  Outputs are built up in memory and written once, at the end, so */
+/* the cost is linear in their size.                                          */
+
+void output_write(FILE* handle, const std::vector<std::string_view>& pieces) {
+  std::vector<struct iovec> iov;
+  unsigned int first;
+  ssize_t written;
+
+  if (handle == NULL)
+    return;
+
+  for (const std::string_view& piece : pieces)
+    if (!piece.empty())
+      iov.push_back({(void*)piece.data(), piece.size()});
+
+  fflush(handle); /* Anything already written through stdio goes first */
+
+  first = 0;
+  while (first < iov.size()) {
+    written = writev(fileno(handle), &iov[first],
+                     std::min<size_t>(iov.size() - first, IOV_MAX));
+    if (written <= 0)
+      break;  // Ignores errors if any  @@@
+
+    while ((first < iov.size()) && ((size_t)written >= iov[first].iov_len)) {
+      written -= iov[first].iov_len; /* Step past pieces written in full */
+      first++;
+    }
+    if (written > 0) /* Part of a piece written */
+    {
+      iov[first].iov_base = (char*)iov[first].iov_base + written;
+      iov[first].iov_len -= written;
+    }
+  }
+  return;
+}
+
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 
 void hex_dump(unsigned int address, char value) {
@@ -4377,7 +5420,7 @@ void hex_dump(unsigned int address, char value) {
     hex_address++;
   } else { /* New or unexpected address */
     if (hex_address_defined)
-      fprintf(fHex, "%s\n", hex_buffer);
+      hex_output.append(hex_buffer).push_back('\n');
 
     for (i = 0; i < HEX_LINE_LENGTH - 1; i++)
       hex_buffer[i] = ' ';
@@ -4394,7 +5437,7 @@ void hex_dump(unsigned int address, char value) {
 
   if ((hex_address % HEX_BYTE_COUNT) == 0) /* If end of line, dump */
   {
-    fprintf(fHex, "%s\n", hex_buffer);
+    hex_output.append(hex_buffer).push_back('\n');
     hex_address_defined = false;
   }
 
@@ -4405,7 +5448,7 @@ void hex_dump(unsigned int address, char value) {
 
 void hex_dump_flush(void) {
   if (hex_address_defined)
-    fprintf(fHex, "%s\n", hex_buffer);
+    hex_output.append(hex_buffer).push_back('\n');
   hex_address_defined = false;
   return;
 }
@@ -4413,34 +5456,21 @@ void hex_dump_flush(void) {
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 
 void elf_dump(unsigned int address, char value) {
-  elf_temp* pTemp;
-
   elf_section_valid = true; /* Note that we've dumped -something- in section */
 
-  if (elf_new_block ||
-      (elf_section != elf_section_old)) {     /* New or unexpected address */
-    pTemp = (elf_temp*)malloc(ELF_TEMP_SIZE); /* Allocate block */
-    pTemp->pNext = NULL;                      /* Initialise new record */
-    pTemp->continuation = (elf_section == elf_section_old);
-    pTemp->section = elf_section;
-    pTemp->address = address;
-    pTemp->count = 0;
-
-    if (current_elf_record == NULL) { /* First record */
-      elf_record_list = pTemp;
-      pTemp->continuation = false;
-    } else
-      current_elf_record->pNext = pTemp;
-
-    current_elf_record = pTemp; /* Move on */
+  if (elf_fragments.empty() ||
+      (elf_section != elf_section_old)) { /* New or unexpected address */
+    elf_fragments.push_back(elf_info());
+    elf_fragments.back().address = address;
+    elf_fragments.back().position = elf_code.size();
+    elf_fragments.back().size = 0;
   }
 
-  current_elf_record->data[(current_elf_record->count)++] = value;
+  elf_code.push_back(value);
+  elf_fragments.back().size++;
 
   elf_section_old = elf_section;
 
-  elf_new_block = (current_elf_record->count >= ELF_TEMP_LENGTH);
-
   return;
 }
 
@@ -4457,12 +5487,14 @@ void elf_new_section_maybe(void) {
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 
-void elf_dump_word(FILE* fElf, unsigned int word) {
-  fprintf(fElf, "%c%c%c%c", word & 0xFF, (word >> 8) & 0xFF,
-          (word >> 16) & 0xFF, (word >> 24) & 0xFF);
+void elf_dump_word(std::string& out, unsigned int word) {
+  char bytes[4] = {(char)(word & 0xFF), (char)((word >> 8) & 0xFF),
+                   (char)((word >> 16) & 0xFF), (char)((word >> 24) & 0xFF)};
+
+  out.append(bytes, 4);
 }
 
-void elf_dump_SH(FILE* fElf,
+void elf_dump_SH(std::string& out,
                  unsigned int name,
                  unsigned int type,
                  unsigned int flags,
@@ -4473,21 +5505,20 @@ void elf_dump_SH(FILE* fElf,
                  unsigned int info,
                  unsigned int align,
                  unsigned int size2) {
-  elf_dump_word(fElf, name);
-  elf_dump_word(fElf, type);
-  elf_dump_word(fElf, flags);
-  elf_dump_word(fElf, addr);
-  elf_dump_word(fElf, pos);
-  elf_dump_word(fElf, size);
-  elf_dump_word(fElf, link);
-  elf_dump_word(fElf, info);
-  elf_dump_word(fElf, align);
-  elf_dump_word(fElf, size2);
+  elf_dump_word(out, name);
+  elf_dump_word(out, type);
+  elf_dump_word(out, flags);
+  elf_dump_word(out, addr);
+  elf_dump_word(out, pos);
+  elf_dump_word(out, size);
+  elf_dump_word(out, link);
+  elf_dump_word(out, info);
+  elf_dump_word(out, align);
+  elf_dump_word(out, size2);
 }
 
 void elf_dump_out(FILE* fElf, sym_table* table) {
-  elf_temp *pTemp, *pTemp_old;
-  elf_info *pInfo_head, *pInfo, *pInfo_new;
+  std::string header, symtab, tables; /* Built up around the code bytes */
   unsigned int fragments, total, pad_to_align, i, j, temp;
   unsigned int symtab_count, symtab_length, strtab_length, shstrtab_length;
   unsigned int symtab_local_count;
@@ -4501,32 +5532,8 @@ void elf_dump_out(FILE* fElf, sym_table* table) {
   char* str_sectionname = "strtab";
   char* shs_sectionname = "shstrtab";
 
-  pInfo = NULL;
-  pInfo_head = NULL; /* Needed in case there's nothing to write (e.g. error) */
-  pTemp = elf_record_list;
-  fragments = 0; /* Number of ORGs */
-  total = 0;     /* Length of all code bytes */
-
-  while (pTemp != NULL) /* Make an code output section list */
-  {
-    if (!pTemp->continuation) {
-      pInfo_new = (elf_info*)malloc(ELF_INFO_SIZE); /* Allocate block */
-      pInfo_new->pNext = NULL;
-      pInfo_new->address = pTemp->address;
-      pInfo_new->position = total;
-      if (pInfo == NULL)
-        pInfo_head = pInfo_new; /* Start ...          */
-      else
-        pInfo->pNext = pInfo_new; /* ... or add to list */
-
-      pInfo = pInfo_new;
-      pInfo->size = 0;
-      fragments++;
-    }
-    pInfo->size = pInfo->size + pTemp->count;
-    total = total + pTemp->count;
-    pTemp = pTemp->pNext;
-  }
+  fragments = elf_fragments.size(); /* Number of ORGs */
+  total = elf_code.size();          /* Length of all code bytes */
 
   head = sym_sort_symbols(table, ALL, FOR_ELF); /* Make temp. symbol list */
 
@@ -4587,46 +5594,36 @@ void elf_dump_out(FILE* fElf, sym_table* table) {
   symtab_length = 16 * symtab_count;                /* True length */
 
   elf_dump_word(
-      fElf, 0x7F | ('E' << 8) | ('L' << 16) | ('F' << 24)); /* File header */
-  elf_dump_word(fElf, 0x00010101);
-  elf_dump_word(fElf, 0);
-  elf_dump_word(fElf, 0);
-  elf_dump_word(fElf, 2 + (ELF_MACHINE << 16));
-  elf_dump_word(fElf, 1);
-  elf_dump_word(fElf, entry_address);
-  elf_dump_word(fElf, prog_start + total + symtab_length + strtab_length +
-                          shstrtab_length);
-  elf_dump_word(fElf, prog_start + total + symtab_length + strtab_length +
-                          shstrtab_length + (ELF_PHENTSIZE * fragments));
-  elf_dump_word(fElf, 0);  // Flags @@@
-  elf_dump_word(fElf, ELF_EHSIZE + (ELF_PHENTSIZE << 16));
-  elf_dump_word(fElf, fragments + (ELF_SHENTSIZE << 16));
-  elf_dump_word(fElf, (fragments + 4) + ((fragments + 3) << 16));  // @@@
-
-  pTemp = elf_record_list;
-
-  while (pTemp != NULL) /* Dump the code sections */
-  {
-    for (i = 0; i < pTemp->count; i++) {
-      fprintf(fElf, "%c", pTemp->data[i]);
-    }
-    pTemp = pTemp->pNext;
-  }
-  for (i = 0; i < pad_to_align; i++)
-    fprintf(fElf, "%c", 0); /* Align */
+      header, 0x7F | ('E' << 8) | ('L' << 16) | ('F' << 24)); /* File header */
+  elf_dump_word(header, 0x00010101);
+  elf_dump_word(header, 0);
+  elf_dump_word(header, 0);
+  elf_dump_word(header, 2 + (ELF_MACHINE << 16));
+  elf_dump_word(header, 1);
+  elf_dump_word(header, entry_address);
+  elf_dump_word(header, prog_start + total + symtab_length + strtab_length +
+                            shstrtab_length);
+  elf_dump_word(header, prog_start + total + symtab_length + strtab_length +
+                            shstrtab_length + (ELF_PHENTSIZE * fragments));
+  elf_dump_word(header, 0);  // Flags @@@
+  elf_dump_word(header, ELF_EHSIZE + (ELF_PHENTSIZE << 16));
+  elf_dump_word(header, fragments + (ELF_SHENTSIZE << 16));
+  elf_dump_word(header, (fragments + 4) + ((fragments + 3) << 16));  // @@@
+
+  /* Code sections follow the header straight from elf_code, then align */
 
   /* Symbol table - values et alia */
   for (i = 0; i < 4; i++)
-    elf_dump_word(fElf, 0); /* Dummy first symbol */
+    elf_dump_word(symtab, 0); /* Dummy first symbol */
 
   ptr = head;
   j = 0;
   for (i = 1; i < symtab_count; i++) {
     while (strings[j++] != '\0')
       ; /* Point beyond next '\0' */
-    elf_dump_word(fElf, j);
-    elf_dump_word(fElf, ptr->value);
-    elf_dump_word(fElf, 0x00000000);
+    elf_dump_word(symtab, j);
+    elf_dump_word(symtab, ptr->value);
+    elf_dump_word(symtab, 0x00000000);
 
     if ((ptr->flags & SYM_REC_EXPORT_FLAG) == 0)
       temp = 0x00;
@@ -4634,9 +5631,9 @@ void elf_dump_out(FILE* fElf, sym_table* table) {
       temp = 0x10;
     /* Binding */
     if ((ptr->flags & SYM_REC_EQUATED) == 0)
-      elf_dump_word(fElf, (ptr->elf_section << 16) | temp);
+      elf_dump_word(symtab, (ptr->elf_section << 16) | temp);
     else /* EQU, so regard as absolute */
-      elf_dump_word(fElf, (ELF_SHN_ABS << 16) | temp);
+      elf_dump_word(symtab, (ELF_SHN_ABS << 16) | temp);
     ptr = ptr->pNext;
   }
 
@@ -4645,62 +5642,48 @@ void elf_dump_out(FILE* fElf, sym_table* table) {
   // printf("SHStrtab start:  %08X\n",
   // ELF_EHSIZE+total+symtab_length+strtab_length);
 
-  for (i = 0; i < strtab_length; i++)
-    fprintf(fElf, "%c", strings[i]);
-  for (i = 0; i < shstrtab_length; i++)
-    fprintf(fElf, "%c", SHstrings[i]);
-
-  pInfo = pInfo_head;
+  /* String tables go out as they are */
 
   for (j = 0; j < fragments; j++)  // PHeader	@@@@@
   {  // Should one -segment- magically cover all these -sections- ?@@@
-    elf_dump_word(fElf, 1);
-    elf_dump_word(fElf, ELF_EHSIZE + pInfo->position);
-    elf_dump_word(fElf, pInfo->address);
-    elf_dump_word(fElf, pInfo->address);
-    elf_dump_word(fElf, pInfo->size);
-    elf_dump_word(fElf, pInfo->size);
-    elf_dump_word(fElf, 0x00000000);
-    elf_dump_word(fElf, 1);
-    pInfo = pInfo->pNext;
+    elf_info* pInfo = &elf_fragments[j];
+    elf_dump_word(tables, 1);
+    elf_dump_word(tables, ELF_EHSIZE + pInfo->position);
+    elf_dump_word(tables, pInfo->address);
+    elf_dump_word(tables, pInfo->address);
+    elf_dump_word(tables, pInfo->size);
+    elf_dump_word(tables, pInfo->size);
+    elf_dump_word(tables, 0x00000000);
+    elf_dump_word(tables, 1);
   }
 
-  elf_dump_SH(fElf, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0); /* Dump section table */
+  elf_dump_SH(tables, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0); /* Dump section table */
 
-  pInfo = pInfo_head;
   for (i = 0; i < fragments; i++) {
-    elf_dump_SH(fElf, code_SHstr_offset, 1, 0x07, pInfo->address,
+    elf_info* pInfo = &elf_fragments[i];
+    elf_dump_SH(tables, code_SHstr_offset, 1, 0x07, pInfo->address,
                 ELF_EHSIZE + pInfo->position, pInfo->size, 0, 0, 0, 0);
-    pInfo = pInfo->pNext;
   }
 
-  elf_dump_SH(fElf, sym_SHstr_offset, 2, 0, 0, ELF_EHSIZE + total,
+  elf_dump_SH(tables, sym_SHstr_offset, 2, 0, 0, ELF_EHSIZE + total,
               symtab_length, fragments + 2, symtab_local_count, 0, 16);  // @@@
 
-  elf_dump_SH(fElf, str_SHstr_offset, 3, 0, 0,
+  elf_dump_SH(tables, str_SHstr_offset, 3, 0, 0,
               ELF_EHSIZE + total + symtab_length, strtab_length, 0, 0, 0, 0);
 
-  elf_dump_SH(fElf, SHstr_SHstr_offset, 3, 0, 0,
+  elf_dump_SH(tables, SHstr_SHstr_offset, 3, 0, 0,
               ELF_EHSIZE + total + symtab_length + strtab_length,
               shstrtab_length, 0, 0, 0, 0);
 
+  output_write(fElf, {header, elf_code,
+                      std::string_view("\0\0\0", pad_to_align), symtab,
+                      std::string_view(strings, strtab_length),
+                      std::string_view(SHstrings, shstrtab_length), tables});
   close_output_file(fElf, elf_file_name, pass_errors != 0);
 
   /* Trash temporary data structures */
-  pInfo = pInfo_head;
-
-  while (pInfo != NULL) {
-    pInfo_new = pInfo->pNext;
-    free(pInfo);
-    pInfo = pInfo_new;
-  }
-
-  pTemp = elf_record_list;
-  while (pTemp != NULL) {
-    pTemp_old = pTemp;
-    pTemp = pTemp->pNext;
-    free(pTemp_old);
-  }
+  elf_code.clear();
+  elf_fragments.clear();
 
   free(strings);
   free(SHstrings);
@@ -4709,22 +5692,169 @@ void elf_dump_out(FILE* fElf, sym_table* table) {
 }
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
-/* Prepare the list output buffer at the start of a line.                     */
+/* Plant a byte in the program image, extending the current segment if the    */
+/* byte follows on from it.                                                   */
+
+void image_dump(unsigned int address, char value) {
+  if (image_segments.empty() ||
+      (image_segments.back().address + image_segments.back().data.size() !=
+       address)) { /* New or unexpected address */
+    image_segments.push_back(image_segment());
+    image_segments.back().address = address;
+  }
 
-void list_start_line(unsigned int address, int cont) {
-  list_byte = 0;
-  if (!cont)
-    list_line_position = 0;
-  list_address = address;
+  image_segments.back().data.push_back(value);
   return;
 }
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
-// Parameterisation a bit dubious; due for re-analysis & revision @@@@
+/* Write the program image, in the layout described at the top of the file.   */
 
-void list_mid_line(unsigned int value, std::string& line, int size) {
-  if (list_byte == 0)                         /* At start of first line */
-    list_buffer_init(line, list_byte, true);  /* Zero output buffer */
+void image_dump_out(FILE* fImage, sym_table* table) {
+  std::string header;
+
+  output_write(fImage, image_build(table, header));
+  return;
+}
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Lay out the program image as pieces to be written in order; "header" holds */
+/* everything before the text.  Only to be done once per assembly.            */
+
+std::vector<std::string_view> image_build(sym_table* table,
+                                          std::string& header) {
+  sym_record *sorted_list, *pSym;
+  unsigned int symbol_count, offset, i;
+  std::vector<unsigned int> names;
+  std::vector<std::string_view> pieces;
+
+  /* Symbol names go into the text after the listing */
+  symbol_count = 0;
+  sorted_list = sym_sort_symbols(table, ALL, DEFINITION);
+  for (pSym = sorted_list; pSym != NULL; pSym = pSym->pNext)
+    if ((pSym->flags & SYM_REC_DEF_FLAG) != 0) {
+      names.push_back(image_text.size());
+      image_text.append(pSym->name, pSym->count);
+      symbol_count++;
+    }
+
+  /* Stable, so lines at the same address keep listing order */
+  std::stable_sort(image_lines.begin(), image_lines.end(),
+                   [](const image_line& a, const image_line& b) {
+                     return a.address < b.address;
+                   });
+
+  header.append(IMAGE_MAGIC, 4); /* Header */
+  elf_dump_word(header, entry_address);
+  elf_dump_word(header, entry_address_defined ? IMAGE_FLAG_ENTRY : 0);
+  elf_dump_word(header, image_segments.size());
+  elf_dump_word(header, symbol_count);
+  elf_dump_word(header, image_lines.size());
+  elf_dump_word(header, image_text.size());
+  elf_dump_word(header, 0);
+
+  offset = IMAGE_HEADER_SIZE + IMAGE_SEGMENT_SIZE * image_segments.size() +
+           IMAGE_SYMBOL_SIZE * symbol_count +
+           IMAGE_LINE_SIZE * image_lines.size() + image_text.size();
+  offset = (offset + 3) & ~3; /* Data starts word aligned */
+
+  for (i = 0; i < image_segments.size(); i++) /* Segments */
+  {
+    elf_dump_word(header, image_segments[i].address);
+    elf_dump_word(header, image_segments[i].data.size());
+    elf_dump_word(header, offset);
+    offset = (offset + image_segments[i].data.size() + 3) & ~3;
+  }
+
+  i = 0;
+  for (pSym = sorted_list; pSym != NULL; pSym = pSym->pNext) /* Symbols */
+    if ((pSym->flags & SYM_REC_DEF_FLAG) != 0) {
+      elf_dump_word(header, pSym->value);
+      elf_dump_word(header, names[i++]);
+      elf_dump_word(header, pSym->count);
+      elf_dump_word(header, pSym->flags);
+    }
+  sym_delete_record_list(&sorted_list, false); /* Destroy temporary list */
+
+  for (i = 0; i < image_lines.size(); i++) /* Lines */
+  {
+    image_line* pLine = &image_lines[i];
+    elf_dump_word(header, pLine->address);
+    elf_dump_word(header, pLine->text);
+    elf_dump_word(header, pLine->length & 0xFFFF);
+    header.append((char*)pLine->size, LIST_BYTE_COUNT);
+  }
+
+  pieces.push_back(header);
+  pieces.push_back(image_text); /* Text */
+  pieces.push_back(std::string_view("\0\0\0", -image_text.size() & 3));
+
+  for (i = 0; i < image_segments.size(); i++) /* Data, straight from memory */
+  {
+    pieces.push_back(std::string_view((char*)image_segments[i].data.data(),
+                                      image_segments[i].data.size()));
+    pieces.push_back(
+        std::string_view("\0\0\0", -image_segments[i].data.size() & 3));
+  }
+
+  return pieces;
+}
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Hand everything an assembly made to a library caller.  After errors, only  */
+/* where it would have started.                                               */
+
+void program_fill(Aasm::ProgramImage* program, sym_table* table) {
+  sym_record *sorted_list, *pSym;
+  std::string header;
+
+  program->entry = entry_address;
+  program->entryDefined = entry_address_defined;
+  if (pass_errors != 0)
+    return;
+
+  for (std::string_view piece : image_build(table, header))
+    program->image.append(piece); /* Also puts the lines in address order */
+  program->listing = list_output;
+
+  for (image_segment& segment : image_segments)
+    program->segments.push_back({segment.address, segment.data});
+
+  sorted_list = sym_sort_symbols(table, ALL, DEFINITION);
+  for (pSym = sorted_list; pSym != NULL; pSym = pSym->pNext)
+    if ((pSym->flags & SYM_REC_DEF_FLAG) != 0)
+      program->symbols.push_back({std::string(pSym->name, pSym->count),
+                                  (uint32_t)pSym->value,
+                                  (pSym->flags & SYM_REC_EXPORT_FLAG) != 0});
+  sym_delete_record_list(&sorted_list, false); /* Destroy temporary list */
+
+  for (image_line& line : image_lines) {
+    Aasm::Line out = {line.address, {},
+                      image_text.substr(line.text, line.length)};
+
+    std::copy(line.size, line.size + LIST_BYTE_COUNT, out.sizes.begin());
+    program->lines.push_back(out);
+  }
+  return;
+}
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Prepare the list output buffer at the start of a line.                     */
+
+void list_start_line(unsigned int address, int cont) {
+  list_byte = 0;
+  if (!cont)
+    list_line_position = 0;
+  list_address = address;
+  return;
+}
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+// Parameterisation a bit dubious; due for re-analysis & revision @@@@
+
+void list_mid_line(unsigned int value, std::string& line, int size) {
+  if (list_byte == 0)                         /* At start of first line */
+    list_buffer_init(line, list_byte, true);  /* Zero output buffer */
   else if (((list_byte % 4) == 0)             /* Start of another line */
            || (((list_byte % 4) + size) > 4)) /*  or about to overflow */
   {
@@ -4734,6 +5864,12 @@ void list_mid_line(unsigned int value, std::string& line, int size) {
   }
 
   list_hex(value, 2 * size, &list_buffer[10 + 3 * (list_byte % 4)]);
+  for (int i = 0; i < LIST_BYTE_COUNT; i++)
+    if (image_current.size[i] == 0) /* Note field for image */
+    {
+      image_current.size[i] = size;
+      break;
+    }
   list_byte = list_byte + size;
   return;
 }
@@ -4761,56 +5897,76 @@ void list_end_line(std::string& line) {
 /* Excessive use of globals (?? @@)                                           */
 
 void list_file_out(void) {
-  if (dump_code && (fList != NULL))
-    fprintf(fList, "%s\n", list_buffer);
+  if (dump_code && list_wanted)
+    list_output.append(list_buffer).push_back('\n');
+
+  if (dump_code && image_wanted) /* Same line for the image */
+  {
+    const char* text = &list_buffer[LIST_BYTE_FIELD];
+    int i;
+
+    image_current.text = image_text.size();
+    image_current.length = strlen(text);
+    image_text.append(text, image_current.length);
+    image_lines.push_back(image_current);
+
+    image_next_address = image_current.address;
+    for (i = 0; i < LIST_BYTE_COUNT; i++)
+      image_next_address += image_current.size[i];
+  }
   return; /* Shouldn't reach here unless there -is- an output file */
 }
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
-/* Add the symbol table to the list file                                      */
+/* True if listing lines are wanted, for the list file or the image file      */
+
+bool list_active(void) {
+  return list_wanted || image_wanted;
+}
 
-void list_symbols(FILE* fList, sym_table* table) {
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Add the symbol table to the list file                                     */
+
+void list_symbols(std::string& out, sym_table* table) {
   unsigned int sym_count;
   sym_record *sorted_list, *pSym;
-  int i;
+  char value[8];
 
   sym_count = sym_count_symbols(table, ALL);
   if (sym_count > 0)
-    fprintf(fList, "\nSymbol Table: %s\n", table->name);
+    out.append("\nSymbol Table: ").append(table->name).push_back('\n');
   {
     sorted_list = sym_sort_symbols(table, ALL, DEFINITION);
     /* Generate record list */
     pSym = sorted_list;
     while (pSym != NULL) {
-      fprintf(fList, ": ");
-      for (i = 0; i < SYM_NAME_MAX; i++) {
-        if (i < pSym->count)
-          fprintf(fList, "%c", pSym->name[i]);
-        else
-          fprintf(fList, " ");
-      }
+      out.append(": ").append(pSym->name, pSym->count);
+      if (pSym->count < SYM_NAME_FIELD)
+        out.append(SYM_NAME_FIELD - pSym->count, ' ');
+
       if ((pSym->flags & SYM_REC_DEF_FLAG) != 0)
-        fprintf(fList, "  %08X", pSym->value);
+        list_hex(pSym->value, 8, value);
       else
-        fprintf(fList, "  00000000");
+        list_hex(0, 8, value);
+      out.append("  ").append(value, 8);
 
       if ((pSym->flags & SYM_REC_EQU_FLAG) != 0)
-        fprintf(fList, "  Value");
+        out.append("  Value");
       else if ((pSym->flags & SYM_REC_USR_FLAG) != 0)
-        fprintf(fList, "  Constant");
+        out.append("  Constant");
       else if ((pSym->flags & SYM_REC_DATA_FLAG) != 0)
-        fprintf(fList, "  Offset");
+        out.append("  Offset");
       else if ((pSym->flags & SYM_REC_DEF_FLAG) == 0)
-        fprintf(fList, "  Undefined");
+        out.append("  Undefined");
       else {
         if ((pSym->flags & SYM_REC_EXPORT_FLAG) != 0)
-          fprintf(fList, "  Global -");
+          out.append("  Global -");
         else {
-          fprintf(fList, "  Local --");
+          out.append("  Local --");
         }
-        fprintf(fList, " ARM");
+        out.append(" ARM");
       }
-      fprintf(fList, "\n");
+      out.push_back('\n');
       pSym = pSym->pNext;
     }
 
@@ -4830,6 +5986,12 @@ void list_buffer_init(std::string& line, unsigned int offset, int do_address) {
     list_hex(list_address + offset, 8, &list_buffer[0]);
     list_buffer[8] = ':';
   }
+
+  /* Image line starts; continuations follow on like a KMD reader expects */
+  image_current.address = do_address ? list_address + offset
+                                     : image_next_address;
+  for (i = 0; i < LIST_BYTE_COUNT; i++)
+    image_current.size[i] = 0;
   list_buffer[LIST_BYTE_FIELD - 2] = ';';
 
   for (i = 0; (i < LIST_LINE_LIST) && (line[list_line_position] != '\0');
@@ -4855,14 +6017,10 @@ void list_buffer_init(std::string& line, unsigned int offset, int do_address) {
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 
 void list_hex(unsigned int number, unsigned int length, char* destination) {
-  int i, digit;
-
-  for (i = 0; i < length; i++) {
-    digit = (number >> (4 * (length - i - 1))) & 0xF;
-    if (digit < 10)
-      destination[i] = '0' + digit;
-    else
-      destination[i] = 'A' + digit - 10;
+  while (length > 0) /* Last digit first */
+  {
+    destination[--length] = "0123456789ABCDEF"[number & 0xF];
+    number = number >> 4;
   }
   return;
 }
@@ -4884,7 +6042,11 @@ sym_table* sym_create_table(char* name, unsigned int flags) {
   new_table = (sym_table*)malloc(SYM_TABLE_SIZE); /* Allocate header */
   if (new_table != NULL) {
     new_table->name = (char*)malloc(i + 1); /* Allocate name string */
-    if (new_table->name == NULL) {          /* Problem - tidy up and leave */
+    new_table->pSlots = (sym_record**)calloc(SYM_TAB_MIN_SLOTS,
+                                             sizeof(sym_record*));
+    if ((new_table->name == NULL) || (new_table->pSlots == NULL)) {
+      free(new_table->name); /* Problem - tidy up and leave */
+      free(new_table->pSlots);
       free(new_table);
       new_table = NULL;
     } else {
@@ -4894,41 +6056,66 @@ sym_table* sym_create_table(char* name, unsigned int flags) {
         i--;
       } /* Includes terminator */
       new_table->flags = flags;
-      for (i = 0; i < SYM_TAB_LIST_COUNT; i++) /* Initialise linked lists */
-        new_table->pList[i] = NULL;
+      new_table->count = 0;
+      new_table->capacity = SYM_TAB_MIN_SLOTS;
+      sym_tables_live++;
     }
   }
   return new_table;
 }
-
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 /* Delete a symbol table, including all its contents, unless records are both */
-/* wanted and marked for export.                                              */
+/* wanted and marked for export.  Kept records keep their identifiers.  Once  */
+/* the last table is freed, no name can be referred to, so the whole name     */
+/* arena is freed too.                                                        */
 /* On input: old_table is the symbol table for destruction                    */
 /*           export is a Boolean - true allows records marked for export to   */
 /*             retained                                                       */
 /* Returns:  Boolean - true if some of the table remains                      */
 
 int sym_delete_table(sym_table* old_table, bool exprt) {
-  int i;
+  unsigned int i, identifier;
   bool some_kept;
+  sym_record *kept, *ptr;
+
+  if ((old_table->flags & SYM_TAB_BAKED_FLAG) != 0)
+    return true; /* Built-in tables stay for the whole run */
 
   some_kept = exprt && ((old_table->flags & SYM_TAB_EXPORT_FLAG) != 0);
 
   if (!some_kept) /* Not exporting whole table */
-    for (i = 0; i < SYM_TAB_LIST_COUNT;
-         i++) /* Chain down lists, deleting records */
-      if (sym_delete_record_list(&(old_table->pList[i]), exprt))
-        some_kept = true;
+  {
+    kept = NULL; /* Chain records into a list, deleting that */
+    for (i = 0; i < old_table->capacity; i++)
+      if ((ptr = old_table->pSlots[i]) != NULL) {
+        ptr->pNext = kept;
+        kept = ptr;
+        old_table->pSlots[i] = NULL;
+      }
+    old_table->count = 0;
+
+    some_kept = sym_delete_record_list(&kept, exprt);
+
+    while (kept != NULL) /* Put back any that are kept */
+    {
+      ptr = kept->pNext;
+      identifier = kept->identifier;
+      sym_add_to_table(old_table, kept);
+      kept->identifier = identifier; /* Not renumbered */
+      kept = ptr;
+    }
+  }
 
   if (!some_kept) {
+    free(old_table->pSlots);
     free(old_table->name);
     free(old_table);
+    if (--sym_tables_live == 0)
+      sym_arena_release(0);
   } /* Free, if poss. */
 
   return some_kept;
 }
-
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 /* Define a label with the given name, value and attributes in the specified  */
 /* symbol table.  Allocates memory as appropriate (linked into symbol table). */
@@ -4945,42 +6132,46 @@ defn_return sym_define_label(std::string& name,
                              unsigned int flags,
                              sym_table* table,
                              sym_record** record) {
-  sym_record *ptr1, *ptr2;
+  sym_record* ptr;
   defn_return result;
+  unsigned int hash, count;
 
-  ptr1 = sym_create_record(name, value, flags | SYM_REC_DEF_FLAG, table->flags);
-
-  if ((table == NULL) || (ptr1 == NULL))
+  if (table == NULL)
     result = SYM_REC_ERROR; /* Oooer! */
   else {
-    if ((ptr2 = sym_find_record(table, ptr1)) ==
+    hash = sym_hash(name, table->flags, &count);
+
+    if ((ptr = sym_find_hashed(table, name, count, hash)) ==
         NULL) /* Label already exists? */
     {
-      sym_add_to_table(table, ptr1); /*  No - add the new record */
-      *record = ptr1;                /* Point at new record */
-      result = SYM_REC_ADDED;
+      ptr = sym_create_record(name, value, flags | SYM_REC_DEF_FLAG,
+                              table->flags);
+      if (ptr == NULL)
+        result = SYM_REC_ERROR;
+      else {
+        sym_add_to_table(table, ptr); /*  No - add the new record */
+        *record = ptr;                /* Point at new record */
+        result = SYM_REC_ADDED;
+      }
     } else {
-      if ((ptr2->flags & SYM_REC_DEF_FLAG) == 0) /* Undefined? */
+      if ((ptr->flags & SYM_REC_DEF_FLAG) == 0) /* Undefined? */
       {
-        ptr2->flags |=
-            SYM_REC_DEF_FLAG;      /* First definition of existing label */
-        ptr2->value = ptr1->value; /* Update value */
+        ptr->flags |= SYM_REC_DEF_FLAG; /* First definition of existing label */
+        ptr->value = value;             /* Update value */
         result = SYM_REC_DEFINED;
-      } else if (ptr2->value != ptr1->value) /* Value different? */
+      } else if (ptr->value != (int)value) /* Value different? */
       {
-        ptr2->value = ptr1->value; /* Update value */
+        ptr->value = value; /* Update value */
         result = SYM_REC_REDEFINED;
       } else
         result = SYM_REC_UNCHANGED;
 
-      *record = ptr2;          /* Point at discovered record */
-      sym_delete_record(ptr1); /* Trash temporary record */
+      *record = ptr; /* Point at discovered record */
     }
   }
 
   return result;
 }
-
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 /* Locate a label with the given name and attributes in the specified symbol  */
 /* table.  Creates the entry if it wasn't there.  The value is undefined.     */
@@ -4996,23 +6187,16 @@ int sym_locate_label(std::string& name,
                      unsigned int flags,
                      sym_table* table,
                      sym_record** record) {
-  sym_record *ptr1, *ptr2;
-  bool result;
-  // defn_return result;
+  unsigned int hash, count;
 
-  ptr1 = sym_create_record(name, 0, flags & ~SYM_REC_DEF_FLAG, table->flags);
+  hash = sym_hash(name, table->flags, &count);
 
-  if ((ptr2 = sym_find_record(table, ptr1)) == NULL) /* Label already exists? */
-  {
-    *record = ptr1; /* Point at new record */
-    result = false;
-  } else {
-    sym_delete_record(ptr1); /* Trash temporary record */
-    *record = ptr2;          /* Point at discovered record */
-    result = true;
-  }
+  if ((*record = sym_find_hashed(table, name, count, hash)) != NULL)
+    return true; /* Point at discovered record */
 
-  return result;
+  /* Point at new record */
+  *record = sym_create_record(name, 0, flags & ~SYM_REC_DEF_FLAG, table->flags);
+  return false;
 }  // Errors?  (If allocation fails?)  @@@@@@
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
@@ -5021,38 +6205,46 @@ int sym_locate_label(std::string& name,
 /*           table points to an existing list of symbol tables                */
 /* Returns:  pointer to record (NULL if not found)                            */
 
-sym_record* sym_find_label_list(std::string& name, sym_table_item* item) {
+sym_record* sym_find_label_list(std::string_view name, sym_table_item* item) {
   sym_table* table;
   sym_record* result;
+  unsigned int hash, count, flags;
+  bool hashed;
 
   result = NULL; /* In case nothing in list */
+  hashed = false;
 
   while ((item != NULL) && (result == NULL)) /* Terminate if EOList or found */
   {
     table = item->pTable;
-    if (table != NULL)
-      result = sym_find_label(name, table);
+    if (table != NULL) {
+      if (!hashed || (((table->flags ^ flags) & SYM_TAB_CASE_FLAG) != 0)) {
+        flags = table->flags; /* Only hash again if the case rules differ */
+        hash = sym_hash(name, flags, &count);
+        hashed = true;
+      }
+      result = sym_find_hashed(table, name, count, hash);
+    }
     item = item->pNext;
   }
 
   return result;
 }
-
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 /* Find a label (by name) in the designated table.                            */
 /* On input: name points to a string which is the label name                  */
 /*           table points to an existing symbol table                         */
 /* Returns:  pointer to record (NULL if not found)                            */
 
-sym_record* sym_find_label(std::string& name, sym_table* table) {
-  sym_record *temp, *result;
+sym_record* sym_find_label(std::string_view name, sym_table* table) {
+  unsigned int hash, count;
 
-  temp = sym_create_record(name, 0, 0, table->flags); /* Hash name */
-  result = sym_find_record(table, temp);              /* Search */
-  sym_delete_record(temp); /* Lose temporary record */
-  return result;
-}
+  if (table == NULL)
+    return NULL;
 
+  hash = sym_hash(name, table->flags, &count);
+  return sym_find_hashed(table, name, count, hash);
+}
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 /* Create a new symbol record, complete with hashing etc.                     */
 /* On input: name is the label name (ASCII string)                            */
@@ -5122,86 +6314,175 @@ void sym_delete_record(
 }
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
-/* Add record to appropriate part of table (front of list)                    */
+/* The slot a hash starts probing from, in a table with `capacity' slots.     */
+/* The name hash is crude, so its bits are spread before masking.             */
+
+constexpr unsigned int sym_slot(unsigned int hash, unsigned int capacity) {
+  hash = hash * 0x9E3779B1;
+  return (hash ^ (hash >> 16)) & (capacity - 1);
+}
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Add record to table, doubling the table first if it is getting full.       */
 
 int sym_add_to_table(sym_table* table, sym_record* record) {
-  unsigned int list; /* Which data substructure is used */
+  unsigned int i, slot, old_capacity;
+  sym_record** old_slots;
 
   if (table != NULL) {
-    list = record->hash & SYM_TAB_LIST_MASK;
+    if (4 * (table->count + 1) > 3 * table->capacity) /* Keep under 3/4 full */
+    {
+      old_slots = table->pSlots;
+      old_capacity = table->capacity;
+      table->capacity = 2 * old_capacity;
+      table->pSlots =
+          (sym_record**)calloc(table->capacity, sizeof(sym_record*));
+
+      for (i = 0; i < old_capacity; i++) /* Rehash into the larger table */
+        if (old_slots[i] != NULL) {
+          slot = sym_slot(old_slots[i]->hash, table->capacity);
+          while (table->pSlots[slot] != NULL)
+            slot = (slot + 1) & (table->capacity - 1);
+          table->pSlots[slot] = old_slots[i];
+        }
+      if ((table->flags & SYM_TAB_BAKED_FLAG) == 0)
+        free(old_slots); /* (Built-in slots weren't allocated) */
+    }
+
+    slot = sym_slot(record->hash, table->capacity);
+    while (table->pSlots[slot] != NULL)
+      slot = (slot + 1) & (table->capacity - 1);
 
     record->identifier = table->symbol_number++; /* Allocate unique record No */
-    record->pNext = table->pList[list];
-    table->pList[list] = record;
+    record->pNext = NULL;
+    table->pSlots[slot] = record;
+    table->count++;
 
     return SYM_NO_ERROR;
   } else
     return SYM_NO_TABLE;
 }
-
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
-/* Search for record's twin in specified table and return a pointer.          */
+/* Search a table for a name already hashed by sym_hash, without allocating.  */
 /* Returns NULL if not found.                                                 */
 
-sym_record* sym_find_record(sym_table* table, sym_record* record) {
+sym_record* sym_find_hashed(sym_table* table,
+                            std::string_view name,
+                            unsigned int count,
+                            unsigned int hash) {
   sym_record* ptr;
-  bool found;
-  int i;
+  unsigned int slot, i;
+  int case_insensitive;
+  char c;
 
-  if (table != NULL) {
-    ptr =
-        table->pList[record->hash & SYM_TAB_LIST_MASK]; /* Correct list start */
-    found = false;
+  if (table == NULL)
+    return NULL; /* If table pointer not valid, not found */
 
-    while ((ptr != NULL) && !found) {
-      if ((ptr->hash == record->hash) && (ptr->count == record->count)) {
-        i = 0;
-        found = true;                     /* Speculation, at present */
-        while ((i < ptr->count) && found) /* Scan string */
-        {
-          found = (ptr->name[i] == record->name[i]); /* Not found after all? */
-          i++;
-        }
+  case_insensitive = ((table->flags & SYM_TAB_CASE_FLAG) != 0);
+  slot = sym_slot(hash, table->capacity);
+
+  while ((ptr = table->pSlots[slot]) != NULL) /* Empty slot ends the search */
+  {
+    if ((ptr->hash == hash) && (ptr->count == count)) {
+      for (i = 0; i < count; i++) /* Scan string */
+      {
+        c = name[i];
+        if (case_insensitive && (c >= 'a') && (c <= 'z'))
+          c = c & 0xDF;
+        if (ptr->name[i] != c)
+          break; /* Not found after all */
       }
-      if (!found)
-        ptr = ptr->pNext; /* If not found, try again */
+      if (i == count)
+        return ptr;
     }
-    return ptr;
-  } else
-    return NULL; /* If table pointer not valid, not found */
+    slot = (slot + 1) & (table->capacity - 1); /* Try the next slot */
+  }
+
+  return NULL;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Hash a name (up to its terminator) as a table with the given flags would,  */
+/* also returning its length.                                                 */
+
+constexpr unsigned int sym_hash(std::string_view string,
+                                unsigned int table_flags,
+                                unsigned int* count) {
+  unsigned int hash = 0, i = 0;
+  int case_insensitive = 0;
+  char c = '\0';
+
+  case_insensitive = ((table_flags & SYM_TAB_CASE_FLAG) != 0);
+
+  i = 0;
+  hash = 0;
+  while ((i < string.size()) && ((c = string[i]) != '\0')) {
+    if (case_insensitive && (c >= 'a') && (c <= 'z'))
+      c = c & 0xDF;                            /* Case conv? */
+    hash = (((hash << 5) ^ (hash >> 11)) + c); /* Crude but spreads LSBs */
+    i++;
+  }
+
+  *count = i;
+  return hash;
 }
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
-/*  Copy a string into a specified record, including case conversion,         */
-/* generating hash functions, etc.                                            */
+/* Copy a string into the name arena for a specified record, including case   */
+/* conversion, generating hash functions, etc.  Names are only freed with     */
+/* their arena block, so copies of records (e.g. sorted lists) may share them.*/
 
 void sym_string_copy(std::string& string,
                      sym_record* record,
                      unsigned int table_flags) {
-  unsigned int hash, count;
-  int case_insensitive;
+  unsigned int count, i, size;
   char c;
 
-  case_insensitive = ((table_flags & SYM_TAB_CASE_FLAG) != 0);
+  record->hash = sym_hash(string, table_flags, &count);
+  record->count = count;
 
-  count = 0;
-  hash = 0;
-  while ((c = string[count]) != '\0') {
-    if (case_insensitive && (c >= 'a') && (c <= 'z'))
-      c = c & 0xDF; /* Case conv? */
-    if (count < SYM_NAME_MAX)
-      record->name[count] = c;
-    /* Keep characters whilst there is space */
+  if (count + 1 > sym_arena_free) /* Start a new block */
+  {
+    size = (count + 1 > SYM_ARENA_BLOCK) ? count + 1 : SYM_ARENA_BLOCK;
+    sym_arena = (char*)malloc(size);  // No error checking @@@
+    sym_arena_free = size;
+    sym_arena_blocks.push_back(sym_arena);
+  }
 
-    hash = (((hash << 5) ^ (hash >> 11)) + c); /* Crude but spreads LSBs */
-    count++;
-  } /* Doesn't copy the terminator */
+  record->name = sym_arena;
+  for (i = 0; i < count; i++) {
+    c = string[i];
+    if (((table_flags & SYM_TAB_CASE_FLAG) != 0) && (c >= 'a') && (c <= 'z'))
+      c = c & 0xDF;
+    record->name[i] = c;
+  }
+  record->name[count] = '\0';
 
-  record->count = count;
-  record->hash = hash;
+  sym_arena += count + 1;
+  sym_arena_free -= count + 1;
 
   return;
 }
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Mark the name arena, so that names copied from here on can be freed        */
+/* together by sym_arena_release.  Starts a new block.                        */
+
+unsigned int sym_arena_mark(void) {
+  sym_arena_free = 0; /* Don't share a block with what went before */
+  return sym_arena_blocks.size();
+}
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Free the name arena back to a mark; no record may still refer to names     */
+/* copied since.                                                              */
+
+void sym_arena_release(unsigned int mark) {
+  while (sym_arena_blocks.size() > mark) {
+    free(sym_arena_blocks.back());
+    sym_arena_blocks.pop_back();
+  }
+  sym_arena_free = 0;
+  return;
+}
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 /* Make up an array of all the strings in the symbol table                    */
@@ -5250,35 +6531,25 @@ unsigned int sym_count_symbols(sym_table* table, label_category what) {
 
   count = 0;
 
-  for (i = 0; i < SYM_TAB_LIST_COUNT; i++) /* For all structures */
+  for (i = 0; i < table->capacity; i++) /* For all slots */
   {
-    ptr = table->pList[i]; /* Start of list */
-    while (ptr != NULL) {
-      if ((what != EXPORTED) || ((ptr->flags & SYM_REC_EXPORT_FLAG) != 0))
-        count++;
-      ptr = ptr->pNext;
-    }
+    ptr = table->pSlots[i];
+    if ((ptr != NULL) &&
+        ((what != EXPORTED) || ((ptr->flags & SYM_REC_EXPORT_FLAG) != 0)))
+      count++;
   }
 
   return count;
 }
-
 void sym_dup_record(sym_record* old_record, sym_record* new_record) {
-  unsigned int i, j;
-
   new_record->count = old_record->count;
   new_record->hash = old_record->hash;
   new_record->flags = old_record->flags;
   new_record->identifier = old_record->identifier;
   new_record->value = old_record->value;
   new_record->elf_section = old_record->elf_section;
-  j = old_record->count;
-  if (j > SYM_NAME_MAX)
-    j = SYM_NAME_MAX;
-  for (i = 0; i < j; i++)
-    new_record->name[i] = old_record->name[i];
+  new_record->name = old_record->name; /* Shared; the arena outlives both */
 }
-
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
 /* Returns a newly created (allocated) linked list of symbol records copied   */
 /* from the designated table and sorted as specified.                         */
@@ -5286,10 +6557,9 @@ void sym_dup_record(sym_record* old_record, sym_record* new_record) {
 sym_record* sym_sort_symbols(sym_table* table,
                              label_category what,
                              label_sort how) {
-  sym_record *temp_record, *sorted_list, *ptr1, *ptr2, **pptr;
-  int i, j, min, after;
-  bool found;
-  unsigned int flag_mask, flag_match;
+  sym_record *temp_record, *sorted_list, *ptr;
+  std::vector<sym_record*> records;
+  unsigned int i, flag_mask, flag_match;
 
   switch (what) /* Class of records to include */
   {
@@ -5315,72 +6585,54 @@ sym_record* sym_sort_symbols(sym_table* table,
       break;
   }
 
-  sorted_list = NULL;
-  for (i = 0; i < SYM_TAB_LIST_COUNT; i++) {
-    ptr1 = table->pList[i];
-    while (ptr1 != NULL) {
-      if ((ptr1->flags & flag_mask) == flag_match) /* Criteria for output */
-      {
-        temp_record = (sym_record*)malloc(SYM_RECORD_SIZE);
-        sym_dup_record(ptr1, temp_record);
-
-        if ((table->flags & SYM_TAB_EXPORT_FLAG) != 0)
-          temp_record->flags |= SYM_REC_EXPORT_FLAG; /* Global => local flag */
-
-        pptr = &sorted_list; /* Linked list insertion sort */
-        ptr2 = sorted_list;
-        found = false;
-        while ((ptr2 != NULL) && !found) {
-          switch (how) /* Field used for sorting */
-          {
-            case ALPHABETIC: /* Sort alphabetically */
-              if (temp_record->count < ptr2->count)
-                min = temp_record->count;
-              else
-                min = ptr2->count;
-              if (min > SYM_NAME_MAX)
-                min = SYM_NAME_MAX;
-              /* Clip to field length */
-              j = 0;
-              while ((temp_record->name[j] == ptr2->name[j]) && (j < min))
-                j++;
-              after =
-                  (temp_record->name[j] > ptr2->name[j]) /* After candidate? */
-                  ||
-                  ((j >= min) && (temp_record->count > j)); /* New string > ? */
-              break;
+  for (i = 0; i < table->capacity; i++) {
+    ptr = table->pSlots[i];
+    if ((ptr != NULL) &&
+        ((ptr->flags & flag_mask) == flag_match)) /* Criteria for output */
+    {
+      temp_record = (sym_record*)malloc(SYM_RECORD_SIZE);
+      sym_dup_record(ptr, temp_record);
 
-            case VALUE: /* Sort numerically */
-              after = (temp_record->value > ptr2->value) &&
-                      ((temp_record->flags & SYM_REC_DEF_FLAG) != 0);
-              break;
+      if ((table->flags & SYM_TAB_EXPORT_FLAG) != 0)
+        temp_record->flags |= SYM_REC_EXPORT_FLAG; /* Global => local flag */
 
-            case DEFINITION: /* In order of definition */
-              after = (temp_record->identifier > ptr2->identifier);
-              break;
+      records.push_back(temp_record);
+    }
+  }
 
-            case FOR_ELF: /* In order of definition, locals first */
-              after = ((((temp_record->flags & SYM_REC_EXPORT_FLAG) != 0) &&
-                        ((ptr2->flags & SYM_REC_EXPORT_FLAG) == 0)) ||
-                       (temp_record->identifier > ptr2->identifier));
-              break;
-          }
+  /* Slot order is arbitrary, so ties fall back to definition order */
+  std::sort(records.begin(), records.end(),
+            [how](const sym_record* a, const sym_record* b) {
+              switch (how) /* Field used for sorting */
+              {
+                case ALPHABETIC: /* Sort alphabetically; names are unique */
+                  return strcmp(a->name, b->name) < 0;
+
+                case VALUE: /* Sort numerically, undefined first */
+                  if (((a->flags ^ b->flags) & SYM_REC_DEF_FLAG) != 0)
+                    return (a->flags & SYM_REC_DEF_FLAG) == 0;
+                  if (((a->flags & SYM_REC_DEF_FLAG) != 0) &&
+                      (a->value != b->value))
+                    return a->value < b->value;
+                  break;
 
-          if (after) {
-            pptr = &(ptr2->pNext);
-            ptr2 = ptr2->pNext; /* Lower, keep going */
-          } else
-            found = true;
+                case DEFINITION: /* In order of definition */
+                  break;
 
-          //        DUPLICATES  ???
-        }
-        temp_record->pNext = ptr2; /* Insert created record */
-        *pptr = temp_record;
-      }
+                case FOR_ELF: /* In order of definition, locals first */
+                  if (((a->flags ^ b->flags) & SYM_REC_EXPORT_FLAG) != 0)
+                    return (a->flags & SYM_REC_EXPORT_FLAG) == 0;
+                  break;
+              }
+              return a->identifier < b->identifier;
+            });
 
-      ptr1 = ptr1->pNext; /* Next source record */
-    }
+  sorted_list = NULL; /* Link up, back to front */
+  for (i = records.size(); i > 0; i--) {
+    records[i - 1]->pNext = sorted_list;
+    sorted_list = records[i - 1];
   }
+
   return sorted_list;
 }
 
@@ -5408,14 +6660,14 @@ void sym_print_table(sym_table* table,
 
     fprintf(handle, "\nSymbol table: %s\n", table->name);
     fprintf(handle, "Label");
-    for (i = 0; i < SYM_NAME_MAX - 2; i++)
+    for (i = 0; i < SYM_NAME_FIELD - 2; i++)
       fprintf(handle, " ");
     //  fprintf(handle, "  ID      Length     Hash     Value    Type\n");
     fprintf(handle, "  ID      Value    Type\n");
 
     ptr = sorted_list;
     while (ptr != NULL) {
-      for (i = 0; i < SYM_NAME_MAX; i++) {
+      for (i = 0; (i < SYM_NAME_FIELD) || (i < (int)ptr->count); i++) {
         if (i < ptr->count)
           fprintf(handle, "%c", ptr->name[i]);
         else if (i > ptr->count + 1)
@@ -5511,18 +6763,22 @@ void lit_print_table(literal_record* pTemp, FILE* handle) {
  * @param string
  * @param pos
  * @param symbol_table
+ * @param first_error
+ * @param program If not NULL, the steps taken are appended to it as RPN
  */
 void Eval_inner(int priority,
                 unsigned int* value,
                 std::array<unsigned int, MATHSTACK_SIZE>& math_stack,
                 unsigned int& math_SP,
                 unsigned int& error,
-                std::string& string,
+                std::string_view string,
                 int*& pos,
                 sym_table*& symbol_table,
-                unsigned int& first_error) {
+                unsigned int& first_error,
+                std::vector<eval_op>* program) {
   bool done, bracket;
   unsigned int n_operator, operand, unary;
+  eval_op step;
 
   done = false;  // Termination indicator
 
@@ -5531,7 +6787,7 @@ void Eval_inner(int priority,
 
   while (!done) {
     error = get_variable(string, (unsigned int*&)pos, &operand, (int*)&unary,
-                         &bracket, symbol_table);
+                         &bracket, symbol_table, &step);
 
     // Error not instantly fatal
     if ((error & ALL_EXCEPT_LAST_PASS) != 0) {
@@ -5545,29 +6801,15 @@ void Eval_inner(int priority,
     if (error == EVAL_OKAY) {
       if (bracket) {
         Eval_inner(1, &operand, math_stack, math_SP, error, string, pos,
-                   symbol_table, first_error);  // May return error
+                   symbol_table, first_error, program);  // May return error
+      } else if (program != NULL) {
+        program->push_back(step);
       }
       // Can now apply unary to returned value
       if (error == EVAL_OKAY) {
-        switch (unary) {
-          case PLUS:
-            break;
-          case MINUS:
-            operand = -operand;
-            break;
-          case NOT:
-            operand = ~operand;
-            break;
-          // Truncated log2 of operand
-          case LOG: {
-            unsigned int i;
-            i = operand;
-            operand = -1;
-            while (i > 0) {
-              operand++;
-              i = i >> 1;
-            }
-          } break;
+        operand = eval_unary(unary, operand);
+        if ((program != NULL) && (unary != PLUS)) {
+          program->push_back({EVAL_OP_UNARY, (unsigned char)unary, 0, 0, NULL});
         }
 
         if ((error = get_operator(string, pos, &n_operator, &priority)) ==
@@ -5575,120 +6817,18 @@ void Eval_inner(int priority,
           // If priority decreasing and previous a real operator, OPERATE
           while ((priority <= math_stack[math_SP - 1]) &&
                  (math_stack[math_SP - 1] > 1)) {
-            switch (math_stack[math_SP - 2]) {
-              case PLUS:
-                operand = math_stack[math_SP - 3] + operand;
-                break;
-              case MINUS:
-                operand = math_stack[math_SP - 3] - operand;
-                break;
-              case MULTIPLY:
-                operand = math_stack[math_SP - 3] * operand;
-                break;
-              case DIVIDE:
-                if (operand != 0) {
-                  operand = math_stack[math_SP - 3] / operand;
-                } else {
-                  operand = -1;
-                  if ((error == EVAL_OKAY) && (first_error == EVAL_OKAY)) {
-                    error = EVAL_DIV_BY_ZERO;
-                  }
-                  div_zero_this_pass = true;
-                }
-                break;
-              case MODULUS:
-                // else leave it alone
-                if (operand != 0) {
-                  operand = math_stack[math_SP - 3] % operand;
-                }
-                break;
-              case LEFT_SHIFT:
-                operand = math_stack[math_SP - 3] << operand;
-                break;
-              case RIGHT_SHIFT:
-                operand = math_stack[math_SP - 3] >> operand;
-                break;
-              case AND:
-                operand = math_stack[math_SP - 3] & operand;
-                break;
-              case OR:
-                operand = math_stack[math_SP - 3] | operand;
-                break;
-              case XOR:
-                operand = math_stack[math_SP - 3] ^ operand;
-                break;
-              case EQUALS:
-                if (math_stack[math_SP - 3] == operand) {
-                  operand = -1;
-                } else {
-                  operand = 0;
-                }
-                break;
-              case NOT_EQUAL:
-                if (math_stack[math_SP - 3] != operand) {
-                  operand = -1;
-                } else {
-                  operand = 0;
-                }
-                break;
-              case LOWER_THAN:
-                if (math_stack[math_SP - 3] < operand) {
-                  operand = -1;
-                } else {
-                  operand = 0;
-                }
-                break;
-              case LOWER_EQUAL:
-                if (math_stack[math_SP - 3] <= operand) {
-                  operand = -1;
-                } else {
-                  operand = 0;
-                }
-                break;
-              case HIGHER_THAN:
-                if (math_stack[math_SP - 3] > operand) {
-                  operand = -1;
-                } else {
-                  operand = 0;
-                }
-                break;
-              case HIGHER_EQUAL:
-                if (math_stack[math_SP - 3] >= operand) {
-                  operand = -1;
-                } else {
-                  operand = 0;
-                }
-                break;
-              case LESS_THAN:
-                if ((int)math_stack[math_SP - 3] < (int)operand) {
-                  operand = -1;
-                } else {
-                  operand = 0;
-                }
-                break;
-              case LESS_EQUAL:
-                if ((int)math_stack[math_SP - 3] <= (int)operand) {
-                  operand = -1;
-                } else {
-                  operand = 0;
-                }
-                break;
-              case GREATER_THAN:
-                if ((int)math_stack[math_SP - 3] > (int)operand) {
-                  operand = -1;
-                } else {
-                  operand = 0;
-                }
-                break;
-              case GREATER_EQUAL:
-                if ((int)math_stack[math_SP - 3] >= (int)operand) {
-                  operand = -1;
-                } else {
-                  operand = 0;
-                }
-                break;
-              default:
-                break;
+            if ((math_stack[math_SP - 2] == DIVIDE) && (operand == 0)) {
+              if ((error == EVAL_OKAY) && (first_error == EVAL_OKAY)) {
+                error = EVAL_DIV_BY_ZERO;
+              }
+              div_zero_this_pass = true;
+            }
+            operand = eval_binary(math_stack[math_SP - 2],
+                                  math_stack[math_SP - 3], operand);
+            if (program != NULL) {
+              program->push_back({EVAL_OP_BINARY,
+                                  (unsigned char)math_stack[math_SP - 2], 0, 0,
+                                  NULL});
             }
             math_SP = math_SP - 3;
           }
@@ -5736,6 +6876,204 @@ void Eval_inner(int priority,
   *value = operand;
 }
 
+/**
+ * @brief Applies a unary operator
+ * @param unary
+ * @param operand
+ * @return unsigned int
+ */
+unsigned int eval_unary(unsigned int unary, unsigned int operand) {
+  switch (unary) {
+    case MINUS:
+      return -operand;
+    case NOT:
+      return ~operand;
+    // Truncated log2 of operand
+    case LOG: {
+      unsigned int i, result;
+      i = operand;
+      result = -1;
+      while (i > 0) {
+        result++;
+        i = i >> 1;
+      }
+      return result;
+    }
+    default:
+      return operand;
+  }
+}
+
+/**
+ * @brief Applies a binary operator. Division by zero gives -1; the caller
+ * deals with reporting it.
+ * @param n_operator
+ * @param left
+ * @param right
+ * @return unsigned int
+ */
+unsigned int eval_binary(unsigned int n_operator,
+                         unsigned int left,
+                         unsigned int right) {
+  switch (n_operator) {
+    case PLUS:
+      return left + right;
+    case MINUS:
+      return left - right;
+    case MULTIPLY:
+      return left * right;
+    case DIVIDE:
+      return (right != 0) ? left / right : -1;
+    case MODULUS:
+      return (right != 0) ? left % right : right;  // else leave it alone
+    case LEFT_SHIFT:
+      return left << right;
+    case RIGHT_SHIFT:
+      return left >> right;
+    case AND:
+      return left & right;
+    case OR:
+      return left | right;
+    case XOR:
+      return left ^ right;
+    case EQUALS:
+      return (left == right) ? -1 : 0;
+    case NOT_EQUAL:
+      return (left != right) ? -1 : 0;
+    case LOWER_THAN:
+      return (left < right) ? -1 : 0;
+    case LOWER_EQUAL:
+      return (left <= right) ? -1 : 0;
+    case HIGHER_THAN:
+      return (left > right) ? -1 : 0;
+    case HIGHER_EQUAL:
+      return (left >= right) ? -1 : 0;
+    case LESS_THAN:  // Signed comparisons
+      return ((int)left < (int)right) ? -1 : 0;
+    case LESS_EQUAL:
+      return ((int)left <= (int)right) ? -1 : 0;
+    case GREATER_THAN:
+      return ((int)left > (int)right) ? -1 : 0;
+    case GREATER_EQUAL:
+      return ((int)left >= (int)right) ? -1 : 0;
+    default:
+      return right;
+  }
+}
+
+/**
+ * @brief Re-evaluates a compiled expression against the current symbol
+ * values, reporting errors as Eval_inner would have. Gives up, having changed
+ * nothing, if Eval_inner would have stopped part way (on a division by zero);
+ * the expression must then be evaluated from the source.
+ * @param program
+ * @param string The line, for names not yet found when compiled
+ * @param pos Set to the end of the expression
+ * @param value
+ * @param error
+ * @return bool false if the expression must be evaluated from the source
+ */
+bool eval_replay(eval_program& program,
+                 std::string_view string,
+                 int* pos,
+                 unsigned int* value,
+                 unsigned int* error) {
+  std::array<unsigned int, MATHSTACK_SIZE> stack;
+  unsigned int SP, first_error, undefined, operand, status;
+
+  SP = 0;
+  first_error = EVAL_OKAY;
+  undefined = 0;
+
+  for (eval_op& step : program.ops) {
+    operand = 0;  // Value of anything not (yet) defined
+    status = EVAL_OKAY;
+
+    switch (step.kind) {
+      case EVAL_OP_CONST:
+        operand = step.value;
+        break;
+
+      case EVAL_OP_NAME:  // Bind it, if it's there now
+        step.symbol = sym_find_label(string.substr(step.position, step.value),
+                                     program.table);
+        if (step.symbol == NULL) {
+          status = EVAL_NO_LIMIT | step.position;
+          break;
+        }
+        step.kind = EVAL_OP_SYMBOL;
+        // fall through
+
+      case EVAL_OP_SYMBOL:
+        if ((step.symbol->flags & SYM_REC_DEF_FLAG) != 0) {
+          operand = step.symbol->value;
+        } else {
+          status = EVAL_LABEL_UNDEF | step.position;
+          undefined++;
+        }
+        break;
+
+      case EVAL_OP_HERE:
+        if (assembly_pointer_defined) {
+          operand = assembly_pointer + def_increment;
+        } else {
+          status = EVAL_LABEL_UNDEF | step.position;
+        }
+        break;
+
+      case EVAL_OP_LOCAL:
+        status = local_label_value(step.arg, step.value, &operand);
+        break;
+
+      case EVAL_OP_UNARY:
+        stack[SP - 1] = eval_unary(step.arg, stack[SP - 1]);
+        continue;
+
+      case EVAL_OP_BINARY:
+        if ((step.arg == DIVIDE) && (stack[SP - 1] == 0)) {
+          if (first_error == EVAL_OKAY) {
+            return false;  // Evaluation would stop here
+          }
+          div_zero_this_pass = true;
+        }
+        stack[SP - 2] = eval_binary(step.arg, stack[SP - 2], stack[SP - 1]);
+        SP--;
+        continue;
+    }
+
+    if ((status != EVAL_OKAY) && (first_error == EVAL_OKAY)) {
+      first_error = status;  // Keep note of first error
+    }
+    stack[SP++] = operand;
+  }
+
+  undefined_count += undefined;
+  *pos = program.end;
+  *value = stack[0];
+  *error = first_error;
+  return true;
+}
+
+/**
+ * @brief True if an expression starting at `position' on the current source
+ * line should be compiled, because it hasn't been already
+ * @param position
+ * @param symbol_table
+ * @return bool
+ */
+bool program_wanted(int position, sym_table* symbol_table) {
+  if (line_expressions == NULL) {
+    return false;
+  }
+
+  for (eval_program& compiled : *line_expressions) {
+    if ((compiled.position == position) && (compiled.table == symbol_table)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 /**
  * @brief Evaluate - modulo current word length
  * On entry: *string points to a pointer to the input string
@@ -5751,18 +7089,45 @@ void Eval_inner(int priority,
  * @param symbol_table
  * @return unsigned int
  */
-unsigned int evaluate(std::string string,
+unsigned int evaluate(std::string_view string,
                       int* pos,
                       unsigned int* value,
                       sym_table* symbol_table) {
   std::array<unsigned int, MATHSTACK_SIZE> math_stack;
   unsigned int math_SP, error, first_error;
+  std::vector<eval_op> program;
+  int start;
+  bool compile;
+
+  // Expressions on source lines are compiled the first time they are met,
+  // and after that only need re-running against the symbols' current values
+  last_expressions = line_expressions;
+  last_expression = -1;
+  if (line_expressions != NULL) {
+    for (eval_program& compiled : *line_expressions) {
+      if ((compiled.position == *pos) && (compiled.table == symbol_table)) {
+        last_expression = &compiled - line_expressions->data();
+        if (eval_replay(compiled, string, pos, value, &error)) {
+          return error;
+        }
+        break;  // Evaluate this one from the source
+      }
+    }
+  }
 
   error = EVAL_OKAY;        // "Evaluate" initialised and called from here
   first_error = EVAL_OKAY;  // Used to note if labels undefined, etc.
   math_SP = 0;
+  start = *pos;
+  compile = program_wanted(start, symbol_table);
   Eval_inner(0, value, math_stack, math_SP, error, string, pos, symbol_table,
-             first_error);  // Potentially recursive evaluation code
+             first_error, compile ? &program : NULL);
+  // Potentially recursive evaluation code
+
+  if ((error == EVAL_OKAY) && compile) {
+    last_expression = line_expressions->size();
+    line_expressions->push_back({start, symbol_table, *pos, program});
+  }
 
   if (error == EVAL_OKAY) {
     return first_error;  // Signal any problems held over
@@ -5793,12 +7158,13 @@ unsigned int evaluate(std::string string,
  * @param symbol_table
  * @return int
  */
-int get_variable(std::string& input,
+int get_variable(std::string_view input,
                  unsigned int* pos,
                  unsigned int* value,
                  int* unary,
                  bool* bracket,
-                 sym_table* symbol_table) {
+                 sym_table* symbol_table,
+                 eval_op* step) {
   int status, radix;
   unsigned int ii;
 
@@ -5831,12 +7197,15 @@ int get_variable(std::string& input,
     status = EVAL_OKAY;
   } else {
     int i;
-    std::string ident(LINE_LENGTH, 0);
+    std::string_view ident = peek_identifier(input, ii);
     sym_record* symbol;
 
-    if ((i = get_identifier(input, ii, ident, LINE_LENGTH)) > 0) {
+    if ((i = ident.size()) > 0) {
       // Something taken
+      *step = {EVAL_OP_NAME, 0, ii, (unsigned int)i, NULL};
       if ((symbol = sym_find_label(ident, symbol_table)) != NULL) {
+        step->kind = EVAL_OP_SYMBOL;
+        step->symbol = symbol;
         // Label present and with a valid value
         if ((symbol->flags & SYM_REC_DEF_FLAG) != 0) {
           *value = symbol->value;
@@ -5854,74 +7223,29 @@ int get_variable(std::string& input,
       ii = ii + i;  // Step pointer on End of label gathering
     } else {
       if (input[ii] == '\%') {
-        local_label *pStart, *pTemp;
-        char c;
         int directions;  // Bit flags for search directions
         unsigned int label;
 
-        c = input[ii + 1] & 0xDF;
-
-        if (c == 'B') {
-          directions = 1;
-          ii = ii + 2;
-        }
-        // Backwards
-        else if (c == 'F') {
-          directions = 2;
-          ii = ii + 2;
-        }
-        // Forwards
-        else {
-          directions = 3;
-          ii = ii + 1;
-        }  // Both ways
-
-        // If searching forwards only and no local label on this line
-        if ((evaluate_own_label->sort != LOCAL_LABEL) &&
-            ((directions & 1) == 0)) {
-          if (loc_lab_position == NULL) {
-            pStart = loc_lab_list;  // Start of list
-          } else {
-            pStart = loc_lab_position->pNext;
-          }
-        }
-        // If searching backwards, own label will be present already
-        else {
-          pStart = loc_lab_position;
+        switch (input[ii + 1] & 0xDF) {
+          case 'B':  // Backwards
+            directions = 1;
+            ii = ii + 2;
+            break;
+          case 'F':  // Forwards
+            directions = 2;
+            ii = ii + 2;
+            break;
+          default:  // Both ways
+            directions = 3;
+            ii = ii + 1;
+            break;
         }
+
         if (!get_num(input, &ii, &label, 10)) {
           status = EVAL_BAD_LOC_LAB;
         } else {
-          bool found;
-
-          found = false;
-
-          // Seach backwards
-          if ((directions & 1) != 0) {
-            pTemp = pStart;
-            while ((pTemp != NULL) && !found) {
-              if (!(found = (label == pTemp->label))) {
-                pTemp = pTemp->pPrev;
-              }
-            }
-          }
-
-          // Seach forwards
-          if (!found && ((directions & 2) != 0)) {
-            pTemp = pStart;
-            while ((pTemp != NULL) && !found) {
-              if (!(found = (label == pTemp->label))) {
-                pTemp = pTemp->pNext;
-              }
-            }
-          }
-
-          if (found) {
-            status = EVAL_OKAY;
-            *value = pTemp->value;
-          } else {
-            status = EVAL_NO_LIMIT;
-          }
+          *step = {EVAL_OP_LOCAL, (unsigned char)directions, ii, label, NULL};
+          status = local_label_value(directions, label, value);
         }
       } else {
         // Character constant
@@ -5936,6 +7260,7 @@ int get_variable(std::string& input,
             if ((input[ii] != '\0') && (input[ii] != '\n') &&
                 (input[ii + 1] == '\'')) {
               *value = input[ii];
+              *step = {EVAL_OP_CONST, 0, ii, *value, NULL};
               ii += 2;
               status = EVAL_OKAY;
             } else {
@@ -5948,6 +7273,7 @@ int get_variable(std::string& input,
             if ((input[ii] != '\0') && (input[ii] != '\n') &&
                 (input[ii + 1] == '\'')) {
               *value = c_char_esc(input[ii]);
+              *step = {EVAL_OP_CONST, 0, ii, *value, NULL};
               ii += 2;
               status = EVAL_OKAY;
             } else {
@@ -5956,6 +7282,7 @@ int get_variable(std::string& input,
           }
         } else {
           if (input[ii] == '.') {
+            *step = {EVAL_OP_HERE, 0, ii, 0, NULL};
             if (assembly_pointer_defined) {
               *value = assembly_pointer + def_increment;
               status = EVAL_OKAY;
@@ -5996,6 +7323,7 @@ int get_variable(std::string& input,
             }
             if (radix > 0) {
               if (get_num(input, &ii, value, radix)) {
+                *step = {EVAL_OP_CONST, 0, ii, *value, NULL};
                 status = EVAL_OKAY;
               } else {
                 status = EVAL_OUT_OF_RADIX;
@@ -6014,6 +7342,61 @@ int get_variable(std::string& input,
   return status;  // Return error code
 }
 
+/**
+ * @brief Finds the value of the local label nearest the current line in the
+ * given directions
+ * @param directions Bit 0 to search backwards, bit 1 forwards
+ * @param label The label number
+ * @param value Set if the label is found
+ * @return int The evaluation status
+ */
+int local_label_value(int directions, unsigned int label, unsigned int* value) {
+  local_label *pStart, *pTemp;
+  bool found;
+
+  // If searching forwards only and no local label on this line
+  if ((evaluate_own_label->sort != LOCAL_LABEL) && ((directions & 1) == 0)) {
+    if (loc_lab_position == NULL) {
+      pStart = loc_lab_list;  // Start of list
+    } else {
+      pStart = loc_lab_position->pNext;
+    }
+  }
+  // If searching backwards, own label will be present already
+  else {
+    pStart = loc_lab_position;
+  }
+
+  found = false;
+
+  // Seach backwards
+  if ((directions & 1) != 0) {
+    pTemp = pStart;
+    while ((pTemp != NULL) && !found) {
+      if (!(found = (label == pTemp->label))) {
+        pTemp = pTemp->pPrev;
+      }
+    }
+  }
+
+  // Seach forwards
+  if (!found && ((directions & 2) != 0)) {
+    pTemp = pStart;
+    while ((pTemp != NULL) && !found) {
+      if (!(found = (label == pTemp->label))) {
+        pTemp = pTemp->pNext;
+      }
+    }
+  }
+
+  if (found) {
+    *value = pTemp->value;
+    return EVAL_OKAY;
+  } else {
+    return EVAL_NO_LIMIT;
+  }
+}
+
 /**
  * @brief Get an operator from the front of the passed ASCII input string,
  * stripping it in the process.  Returns the token and the priority.
@@ -6032,7 +7415,7 @@ int get_variable(std::string& input,
  * @param priority
  * @return int
  */
-int get_operator(std::string& input,
+int get_operator(std::string_view input,
                  int* pos,
                  unsigned int* n_operator,
                  int* priority) {
@@ -6150,13 +7533,13 @@ int get_operator(std::string& input,
     // Have a go at symbolically defined operators
     default: {
       int i;
-      std::string buffer(SYM_NAME_MAX, 0);
+      std::string_view name = peek_identifier(input, ii);
       sym_record* ptr;
 
       // Something taken
-      if ((i = get_identifier(input, ii, buffer, SYM_NAME_MAX)) > 0) {
+      if ((i = name.size()) > 0) {
         // Symbol recognised
-        if ((ptr = sym_find_label(buffer, operator_table)) != NULL) {
+        if ((ptr = sym_find_label(name, operator_table)) != NULL) {
           *n_operator = ptr->value;
           ii += i;
           status = EVAL_OKAY;
@@ -6248,7 +7631,7 @@ int get_operator(std::string& input,
  * @param position
  * @return int
  */
-int skip_spc(std::string line, int position) {
+constexpr int skip_spc(std::string_view line, int position) {
   while ((line[position] == ' ') || (line[position] == '\t')) {
     position++;
   }
@@ -6308,7 +7691,7 @@ char* pathname(char* name1, char* name2) {
  * @param character
  * @return bool true if `character' is found
  */
-bool cmp_next_non_space(std::string line,
+bool cmp_next_non_space(std::string_view line,
                         int* pPos,
                         int offset,
                         char character) {
@@ -6327,10 +7710,29 @@ bool cmp_next_non_space(std::string line,
  * @param character
  * @return bool true if `character' is valid end of statement
  */
-bool test_eol(char character) {
+constexpr bool test_eol(char character) {
   return (character == '\0') || (character == ';') || (character == '\n');
 }
 
+/**
+ * @brief Finds the identifier starting at `position', without copying it
+ * @param line
+ * @param position
+ * @return std::string_view The identifier; empty if there isn't one
+ */
+std::string_view peek_identifier(std::string_view line, unsigned int position) {
+  unsigned int end;
+
+  end = position;
+  if (alphabetic(line[position])) {
+    while (alpha_numeric(line[end])) {
+      end++;
+    }
+  }
+
+  return line.substr(position, end - position);
+}
+
 /**
  * @brief Get the identifier object
  * @param line
@@ -6339,18 +7741,16 @@ bool test_eol(char character) {
  * @param max_length
  * @return unsigned int
  */
-unsigned int get_identifier(std::string line,
+unsigned int get_identifier(std::string_view line,
                             unsigned int position,
                             std::string& buffer,
                             unsigned int max_length) {
+  std::string_view name;
   unsigned int i;
 
-  i = 0;
-  if (alphabetic(line[position])) {
-    while ((alpha_numeric(line[position])) && (i < max_length - 1)) {
-      buffer[i++] = line[position++];  // Truncates if too long for buffer
-    }
-  }
+  name = peek_identifier(line, position);
+  i = name.size() < max_length - 1 ? name.size() : max_length - 1;
+  name.copy(&buffer[0], i);  // Truncates if too long for buffer
 
   buffer[i] = '\0';
   return i;  // Length of symbol (sans terminator)
@@ -6361,7 +7761,7 @@ unsigned int get_identifier(std::string line,
  * @param c
  * @return bool
  */
-bool alpha_numeric(char c) {
+constexpr bool alpha_numeric(char c) {
   return (((c >= '0') && (c <= '9')) || alphabetic(c));
 }
 
@@ -6370,7 +7770,7 @@ bool alpha_numeric(char c) {
  * @param c
  * @return bool
  */
-bool alphabetic(char c) {
+constexpr bool alphabetic(char c) {
   return ((c == '_') || ((c >= 'A') && (c <= 'Z')) ||
           ((c >= 'a') && (c <= 'z')));
 }
@@ -6433,8 +7833,8 @@ unsigned char c_char_esc(unsigned char c) {
  * @param radix
  * @return int
  */
-int num_char(std::string& line, int* pos, unsigned int radix) {
-  char c;
+constexpr int num_char(std::string_view line, int* pos, unsigned int radix) {
+  char c = '\0';
 
   while ((c = line[*pos]) == '_') {
     (*pos)++;  // Allow & ignore  '_'
@@ -6471,12 +7871,12 @@ int num_char(std::string& line, int* pos, unsigned int radix) {
  * @param radix
  * @return int flag to say number read (value at pointer).
  */
-int get_num(std::string line,
-            unsigned int* position,
-            unsigned int* value,
-            unsigned int radix) {
-  int i, new_digit;
-  bool found;
+constexpr int get_num(std::string_view line,
+                      unsigned int* position,
+                      unsigned int* value,
+                      unsigned int radix) {
+  int i = 0, new_digit = 0;
+  bool found = false;
 
   i = skip_spc(line, *position);
   *value = 0;
@@ -6505,3 +7905,425 @@ int allow_error(unsigned int error_code, bool first_pass, bool last_pass) {
   return (!last_pass && ((error_code & ALLOW_ON_INTER_PASS) != 0)) ||
          (first_pass && ((error_code & ALLOW_ON_FIRST_PASS) != 0));
 }
+
+/**
+ * @brief Whether execution may go on from an ARM instruction to the next one.
+ * Only unconditional B, BX, and writes to the PC by data processing, LDR or
+ * LDM are known not to.
+ * @param op_code
+ * @return bool
+ */
+bool arm_falls_through(unsigned int op_code) {
+  if ((op_code & 0xF0000000) != 0xE0000000) /* Conditional (or BLX) */
+    return true;
+  if ((op_code & 0x0F000000) == 0x0A000000) /* B (not BL) */
+    return false;
+  if ((op_code & 0x0FFFFFF0) == 0x012FFF10) /* BX */
+    return false;
+  if ((op_code & 0x0E108000) == 0x08108000) /* LDM including PC */
+    return false;
+  if ((op_code & 0x0C10F000) == 0x0410F000) /* LDR PC */
+    return false;
+  if (((op_code & 0x0C00F000) == 0x0000F000) && /* Data processing to PC */
+      ((op_code & 0x01800000) != 0x01000000) && /*  not a test or MRS/MSR */
+      ((op_code & 0x02000090) != 0x00000090))   /*  nor multiply etc. */
+    return false;
+  return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Built-in tables                                                            */
+/* The mnemonic, directive, register etc. tables are laid out at compile time */
+/* just as sym_add_to_table would leave them (all are case insensitive), so   */
+/* none need building at startup.  The mnemonics come from bin/mnemonics,     */
+/* which the makefile wraps up as mnemonics.inc.                              */
+
+/**
+ * @brief A case insensitive symbol table, built up at compile time
+ * @tparam ENTRIES Most records it may hold
+ * @tparam CHARS Most name characters (inc. terminators) it may hold
+ * @tparam SLOTS Its capacity; a power of 2
+ */
+template <unsigned int ENTRIES, unsigned int CHARS, unsigned int SLOTS>
+struct baked_builder {
+  static constexpr unsigned int capacity = SLOTS;
+
+  const char* table_name;
+  unsigned int count;                      // Records so far
+  unsigned int chars;                      // Name characters so far
+  std::array<unsigned int, ENTRIES> name;  // Offset of each name in `names'
+  std::array<unsigned int, ENTRIES> length;
+  std::array<unsigned int, ENTRIES> hash;
+  std::array<int, ENTRIES> value;
+  std::array<unsigned int, SLOTS> slot;  // Record number + 1; 0 if empty
+  std::array<char, CHARS> names;         // Case converted and terminated
+
+  constexpr baked_builder(const char* table_name)
+      : table_name(table_name),
+        count(0),
+        chars(0),
+        name(),
+        length(),
+        hash(),
+        value(),
+        slot(),
+        names() {}
+
+  /**
+   * @brief Adds a record, or changes the value of an existing one, as
+   * sym_define_label would
+   * @param string
+   * @param new_value
+   */
+  constexpr void define(std::string_view string, int new_value) {
+    unsigned int n = 0, h = 0, s = 0, r = 0, i = 0;
+    char c = '\0';
+
+    h = sym_hash(string, SYM_TAB_CASE_FLAG, &n);
+
+    for (s = sym_slot(h, SLOTS); (r = slot[s]) != 0; s = (s + 1) & (SLOTS - 1))
+      if ((hash[r - 1] == h) && (length[r - 1] == n)) {
+        for (i = 0; i < n; i++) {
+          c = string[i];
+          if ((c >= 'a') && (c <= 'z'))
+            c = c & 0xDF;
+          if (names[name[r - 1] + i] != c)
+            break;
+        }
+        if (i == n) {
+          value[r - 1] = new_value;  // Redefined
+          return;
+        }
+      }
+
+    name[count] = chars;
+    length[count] = n;
+    hash[count] = h;
+    value[count] = new_value;
+    for (i = 0; i < n; i++) {
+      c = string[i];
+      if ((c >= 'a') && (c <= 'z'))
+        c = c & 0xDF;
+      names[chars++] = c;
+    }
+    names[chars++] = '\0';
+    slot[s] = ++count;
+  }
+};
+
+/**
+ * @brief The smallest capacity that keeps a table no more than half full
+ * @param entries
+ * @return unsigned int
+ */
+constexpr unsigned int baked_capacity(unsigned int entries) {
+  unsigned int capacity = SYM_TAB_MIN_SLOTS;
+
+  while (capacity < 2 * entries)
+    capacity *= 2;
+
+  return capacity;
+}
+
+/**
+ * @brief Sizes the tables a mnemonics file expands into (as an upper bound;
+ * names defined twice are counted twice)
+ */
+struct mnemonic_sizes {
+  unsigned int entries[2] = {};  // Mnemonics, directives
+  unsigned int chars[2] = {};
+  bool okay = false;
+
+  constexpr void operator()(const char* name, unsigned int, bool directive) {
+    entries[directive]++;
+    chars[directive] += std::string_view(name).size() + 1;
+  }
+};
+
+/**
+ * @brief The mnemonic and directive tables a mnemonics file expands into
+ */
+template <class Mnemonics, class Directives>
+struct baked_mnemonics {
+  Mnemonics mnemonics;
+  Directives directives;
+
+  constexpr void operator()(const char* name,
+                            unsigned int value,
+                            bool directive) {
+    if (directive)
+      directives.define(name, value);
+    else
+      mnemonics.define(name, value);
+  }
+};
+
+constexpr std::string_view mnemonics_text =
+#include "mnemonics.inc"
+    ;
+
+/**
+ * @brief
+ * @return mnemonic_sizes
+ */
+constexpr mnemonic_sizes size_mnemonics() {
+  mnemonic_sizes sizes;
+
+  sizes.okay = parse_mnemonic_text(mnemonics_text, sizes);
+  return sizes;
+}
+
+constexpr mnemonic_sizes mnemonics_size = size_mnemonics();
+static_assert(mnemonics_size.okay, "Mnemonic file error");
+
+typedef baked_builder<mnemonics_size.entries[0],
+                      mnemonics_size.chars[0],
+                      baked_capacity(mnemonics_size.entries[0])>
+    baked_mnemonic_table;
+typedef baked_builder<mnemonics_size.entries[1],
+                      mnemonics_size.chars[1],
+                      baked_capacity(mnemonics_size.entries[1])>
+    baked_directive_table;
+
+/**
+ * @brief
+ * @return baked_mnemonics<baked_mnemonic_table, baked_directive_table>
+ */
+constexpr baked_mnemonics<baked_mnemonic_table, baked_directive_table>
+bake_mnemonics() {
+  baked_mnemonics<baked_mnemonic_table, baked_directive_table> tables = {
+      baked_mnemonic_table("ARM Mnemonics"),
+      baked_directive_table("Directives")};
+
+  parse_mnemonic_text(mnemonics_text, tables);
+  return tables;
+}
+
+constexpr auto mnemonics_baked = bake_mnemonics();
+constexpr baked_mnemonic_table mnemonic_baked = mnemonics_baked.mnemonics;
+constexpr baked_directive_table directive_baked = mnemonics_baked.directives;
+
+typedef struct baked_name_name  // Entry in a hand written built-in table
+{
+  const char* name;
+  int value;
+} baked_name;
+
+/**
+ * @brief Name characters (inc. terminators) in a hand written table
+ * @param list
+ * @return unsigned int
+ */
+template <unsigned int N>
+constexpr unsigned int baked_chars(const baked_name (&list)[N]) {
+  unsigned int i = 0, chars = 0;
+
+  for (i = 0; i < N; i++)
+    chars += std::string_view(list[i].name).size() + 1;
+
+  return chars;
+}
+
+/**
+ * @brief
+ * @param table_name
+ * @param list
+ * @return baked_builder<N, CHARS, baked_capacity(N)>
+ */
+template <unsigned int CHARS, unsigned int N>
+constexpr baked_builder<N, CHARS, baked_capacity(N)> bake_list(
+    const char* table_name,
+    const baked_name (&list)[N]) {
+  baked_builder<N, CHARS, baked_capacity(N)> table(table_name);
+  unsigned int i = 0;
+
+  for (i = 0; i < N; i++)
+    table.define(list[i].name, list[i].value);
+
+  return table;
+}
+
+/* Architecture names */
+constexpr baked_name arch_names[] = {
+    {"v3", v3},   {"v3m", v3M},     {"v4", v4},     {"v4xm", v4xM},
+    {"v4t", v4T}, {"v4txm", v4TxM}, {"v5", v5},     {"v5xm", v5xM},
+    {"v5t", v5T}, {"v5txm", v5TxM}, {"v5te", v5TE}, {"v5texp", v5TExP},
+    {"all", 0},   {"any", 0}};
+
+/* Diadic expression operator definitions */
+constexpr baked_name op_names[] = {
+    {"and", AND},          {"or", OR},
+    {"xor", XOR},          {"eor", XOR},
+    {"shl", LEFT_SHIFT},   {"lsl", LEFT_SHIFT},
+    {"shr", RIGHT_SHIFT},  {"lsr", RIGHT_SHIFT},
+    {"div", DIVIDE},       {"mod", MODULUS},
+    {"eq", EQUALS},        {"ne", NOT_EQUAL},
+    {"lo", LOWER_THAN},    {"ls", LOWER_EQUAL},
+    {"hi", HIGHER_THAN},   {"hs", HIGHER_EQUAL},
+    {"lt", LESS_THAN},     {"le", LESS_EQUAL},
+    {"gt", GREATER_THAN},  {"ge", GREATER_EQUAL}};
+
+/* Register name definitions */
+constexpr baked_name reg_names[] = {
+    {"r0", 0},   {"r1", 1},   {"r2", 2},   {"r3", 3},   {"r4", 4},
+    {"r5", 5},   {"r6", 6},   {"r7", 7},   {"r8", 8},   {"r9", 9},
+    {"r10", 10}, {"r11", 11}, {"r12", 12}, {"r13", 13}, {"r14", 14},
+    {"r15", 15}, {"sp", 13},  {"lr", 14},  {"pc", 15},  {"a1", 0},
+    {"a2", 1},   {"a3", 2},   {"a4", 3},   {"v1", 4},   {"v2", 5},
+    {"v3", 6},   {"v4", 7},   {"v5", 8},   {"sb", 9},   {"v6", 9},
+    {"sl", 10},  {"v7", 10},  {"fp", 11},  {"ip", 12}};
+
+/* Coprocessor register name definitions */
+constexpr baked_name creg_names[] = {
+    {"cr0", 0},   {"cr1", 1},   {"cr2", 2},   {"cr3", 3},   {"cr4", 4},
+    {"cr5", 5},   {"cr6", 6},   {"cr7", 7},   {"cr8", 8},   {"cr9", 9},
+    {"cr10", 10}, {"cr11", 11}, {"cr12", 12}, {"cr13", 13}, {"cr14", 14},
+    {"cr15", 15}, {"c0", 0},    {"c1", 1},    {"c2", 2},    {"c3", 3},
+    {"c4", 4},    {"c5", 5},    {"c6", 6},    {"c7", 7},    {"c8", 8},
+    {"c9", 9},    {"c10", 10},  {"c11", 11},  {"c12", 12},  {"c13", 13},
+    {"c14", 14},  {"c15", 15}};
+
+/* Coprocessor name definitions */
+constexpr baked_name copro_names[] = {
+    {"p0", 0},    {"p1", 1},    {"p2", 2},    {"p3", 3},    {"p4", 4},
+    {"p5", 5},    {"p6", 6},    {"p7", 7},    {"p8", 8},    {"p9", 9},
+    {"p10", 10},  {"p11", 11},  {"p12", 12},  {"p13", 13},  {"p14", 14},
+    {"p15", 15},  {"cp0", 0},   {"cp1", 1},   {"cp2", 2},   {"cp3", 3},
+    {"cp4", 4},   {"cp5", 5},   {"cp6", 6},   {"cp7", 7},   {"cp8", 8},
+    {"cp9", 9},   {"cp10", 10}, {"cp11", 11}, {"cp12", 12}, {"cp13", 13},
+    {"cp14", 14}, {"cp15", 15}};
+
+/* Shift definitions */
+constexpr baked_name shift_names[] = {{"lsl", 0}, {"asl", 0}, {"lsr", 1},
+                                      {"asr", 2}, {"ror", 3}, {"rrx", 7}};
+
+constexpr auto arch_baked =
+    bake_list<baked_chars(arch_names)>("Architectures", arch_names);
+constexpr auto op_baked =
+    bake_list<baked_chars(op_names)>("Operators", op_names);
+constexpr auto reg_baked =
+    bake_list<baked_chars(reg_names)>("Registers", reg_names);
+constexpr auto creg_baked =
+    bake_list<baked_chars(creg_names)>("Copro_Registers", creg_names);
+constexpr auto copro_baked =
+    bake_list<baked_chars(copro_names)>("Coprocessors", copro_names);
+constexpr auto shift_baked =
+    bake_list<baked_chars(shift_names)>("Shifts", shift_names);
+
+/**
+ * @brief The records of a baked table, numbered in order of definition
+ * @param built
+ * @param names Where the table's names have been put
+ * @return std::array<sym_record, COUNT>
+ */
+template <unsigned int COUNT, class Builder>
+constexpr std::array<sym_record, COUNT> baked_records(const Builder& built,
+                                                      char* names) {
+  std::array<sym_record, COUNT> records = {};
+  unsigned int i = 0;
+
+  for (i = 0; i < COUNT; i++)
+    records[i] = sym_record{NULL,
+                            built.length[i],
+                            built.hash[i],
+                            SYM_REC_DEF_FLAG,
+                            i,
+                            0,
+                            built.value[i],
+                            names + built.name[i]};
+
+  return records;
+}
+
+/**
+ * @brief The slots of a baked table
+ * @param built
+ * @param records Where the table's records have been put
+ * @return std::array<sym_record*, Builder::capacity>
+ */
+template <class Builder>
+constexpr std::array<sym_record*, Builder::capacity> baked_slots(
+    const Builder& built,
+    sym_record* records) {
+  std::array<sym_record*, Builder::capacity> slots = {};
+  unsigned int i = 0;
+
+  for (i = 0; i < Builder::capacity; i++)
+    slots[i] = (built.slot[i] == 0) ? NULL : &records[built.slot[i] - 1];
+
+  return slots;
+}
+
+/**
+ * @brief Gives a baked table a home in each thread, copied from the constant
+ * built version the first time it is asked for.
+ * @return sym_table*
+ */
+template <const auto& built>
+sym_table* baked_table(bool restore = false) {
+  static thread_local auto names = built.names;
+  static thread_local auto records =
+      baked_records<built.count>(built, names.data());
+  static thread_local auto slots = baked_slots(built, records.data());
+  static thread_local sym_table table = {(char*)built.table_name,
+                                         built.count,
+                                         SYM_TAB_CASE_FLAG | SYM_TAB_BAKED_FLAG,
+                                         built.count,
+                                         built.capacity,
+                                         slots.data()};
+
+  if (restore && (table.count != built.count)) { /* Records added (RN etc.) */
+    for (unsigned int i = 0; i < table.capacity; i++)
+      if ((table.pSlots[i] != NULL) &&
+          ((uintptr_t)table.pSlots[i] - (uintptr_t)records.data() >=
+           sizeof(records)))
+        sym_delete_record(table.pSlots[i]); /* Not one of the built-in ones */
+    if (table.pSlots != slots.data())
+      free(table.pSlots); /* Grown */
+
+    slots = baked_slots(built, records.data());
+    table = {(char*)built.table_name,
+             built.count,
+             SYM_TAB_CASE_FLAG | SYM_TAB_BAKED_FLAG,
+             built.count,
+             built.capacity,
+             slots.data()};
+  }
+
+  return &table;
+}
+
+/**
+ * @brief Points the operator, register etc. tables at their built-in versions
+ */
+void builtin_tables() {
+  arch_table = baked_table<arch_baked>();
+  operator_table = baked_table<op_baked>();
+  register_table = baked_table<reg_baked>();
+  cregister_table = baked_table<creg_baked>();
+  copro_table = baked_table<copro_baked>();
+  shift_table = baked_table<shift_baked>();
+}
+
+/**
+ * @brief Puts the operator, register etc. tables back as they were built,
+ * ready for another assembly
+ */
+void builtin_tables_restore() {
+  baked_table<arch_baked>(true);
+  baked_table<op_baked>(true);
+  baked_table<reg_baked>(true);
+  baked_table<creg_baked>(true);
+  baked_table<copro_baked>(true);
+  baked_table<shift_baked>(true);
+}
+
+/**
+ * @brief Gives the built-in mnemonic and directive tables
+ * @param mnemonics
+ * @param directives
+ */
+void builtin_mnemonic_tables(sym_table** mnemonics, sym_table** directives) {
+  *mnemonics = baked_table<mnemonic_baked>();
+  *directives = baked_table<directive_baked>();
+}
@@ -0,0 +1,75 @@
+/**
+ * @file aasm.h
+ * @author Lawrence Warren (lawrencewarren2@gmail.com)
+ * @brief The header file for using aasm as a library - `aasm.cpp` compiled
+ * with `AASM_LIBRARY` defined, which leaves out its `main`. Sources are
+ * assembled from memory, and the results handed back in memory; nothing is
+ * read or written through the filesystem unless the caller does it.
+ * @version 1.0.0
+ * @date 19-10-2026
+ */
+
+#include <stdint.h>
+#include <array>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Aasm {
+/**
+ * @brief How a source is to be assembled.
+ */
+struct Options {
+  // The source's name, for messages; relative INCLUDEs are beside it
+  std::string name = "source.s";
+  // Gives the text of an INCLUDEd file by its path; if empty, none can be
+  std::function<bool(const std::string& path, std::string& text)> include;
+};
+
+/**
+ * @brief Bytes planted at consecutive addresses.
+ */
+struct Segment {
+  uint32_t address;
+  std::vector<unsigned char> bytes;
+};
+
+/**
+ * @brief A label, as defined at the end of assembly.
+ */
+struct Symbol {
+  std::string name;
+  uint32_t value;
+  bool exported;
+};
+
+/**
+ * @brief A line of the listing: the address it starts at, the size of each
+ * value listed on it (0 if none), and the source text.
+ */
+struct Line {
+  uint32_t address;
+  std::array<unsigned char, 4> sizes;
+  std::string text;
+};
+
+/**
+ * @brief Everything an assembly made. After errors, `diagnostics` says what
+ * they were and the rest is empty.
+ */
+struct ProgramImage {
+  int status;  // 0 if okay, -1 after errors
+  uint32_t entry;
+  bool entryDefined;
+  std::vector<Segment> segments;  // In the order planted
+  std::vector<Symbol> symbols;    // Defined ones, in order of definition
+  std::vector<Line> lines;        // By address
+  std::string diagnostics;        // Whatever aasm would have printed
+  std::string listing;            // As "-lk" writes it
+  std::string image;              // As "-i" writes it
+};
+
+ProgramImage assemble(std::string_view source,
+                      const Options& options = Options());
+}  // namespace Aasm
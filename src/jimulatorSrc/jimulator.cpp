@@ -10,12 +10,22 @@
  * @todo interrupt enable behaviour on exceptions (etc.)
  */
 
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 #include <iostream>
+#include <string>
 
 #define uchar unsigned char
 #define uint unsigned int
@@ -50,6 +60,8 @@ typedef enum {
   BR_RESET = 0x04,
   BR_FR_WRITE = 0x12,
   BR_FR_READ = 0x13,
+  BR_SUBSCRIBE = 0x14,
+  BR_LOAD_IMAGE = 0x15,
   BR_WOT_U_DO = 0x20,
   BR_STOP = 0x21,
   BR_PAUSE = 0x22,
@@ -68,7 +80,7 @@ typedef enum {
 
 #define NO_OF_BREAKPOINTS 32  // Max 32
 #define NO_OF_WATCHPOINTS 4   // Max 32
-#define RING_BUF_SIZE 64
+#define RING_BUF_SIZE 1024  // Holds several full-length BR_FR_WRITE frames
 
 typedef struct {
   uint iHead;
@@ -76,12 +88,86 @@ typedef struct {
   uchar buffer[RING_BUF_SIZE];
 } ringBuffer;
 
-struct pollfd pollfd;
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* Hosts are served as sessions. By default the only session is the parent    */
+/*   process on stdin/stdout; with "--socket <path>" or "--port <n>" every    */
+/*   accepted connection is a session, and the emulator outlives them all.    */
+/* Whatever a session sends is buffered until it makes a whole command, and   */
+/*   replies are queued and sent as the host takes them, so no one session    */
+/*   can hold up the others by stopping part way through.                     */
+
+#define MAX_SESSIONS 8
+#define MAX_COMMAND_LENGTH (16 << 20)  // Longer, and the host is dropped
+
+/* Unsolicited event frames, sent to subscribed socket sessions and to the    */
+/*   descriptor given with "--events <fd>", as                                */
+/*   {type, payload length, payload...}                                       */
+#define EV_STATUS 0x01   // Payload is as the reply to BR_WOT_U_DO
+#define EV_CONSOLE 0x02  // Payload is the number of characters waiting
+
+typedef struct {
+  int in;              // Descriptor commands are read from (-1 if slot free)
+  int out;             // Descriptor replies are written to
+  uchar events;        // Mask of EV_* types this session subscribed to
+  uchar owed;          // EV_* types held back while output was queued
+  std::string input;   // Received, but not yet a whole command
+  std::string output;  // Replies and event frames not yet sent
+} Session;
+
+Session sessions[MAX_SESSIONS];
+int listenFd = -1;     // Listening socket, or -1 when serving stdin/stdout
+int hostSession;       // The session whose command is being handled ...
+size_t hostInputUsed;  // ... and how much of the command has been read
+bool hostLost;         // The session being served broke off mid-command
+
+/* A single GDB remote serial protocol connection can be served alongside    */
+/*   the sessions, with "--gdb <port>".                                       */
+#define GDB_PACKET_SIZE 4096
+#define GDB_MAX_READ ((GDB_PACKET_SIZE - 4) / 2)  // Bytes an 'm' reply holds
+#define GDB_ARM_FP_REGS 8  // Legacy FPA registers gdb expects, 12 bytes each
+
+int gdbListenFd = -1;
+int gdbFd = -1;
+bool gdbWaiting;  // gdb has resumed the target and awaits a stop reply
+bool gdbNoAck;    // QStartNoAckMode agreed: no acks or checksums
+std::string gdbInput;
+
+struct pollfd hostPoll[MAX_SESSIONS + 3];
+int hostPollCount;
+bool hostPollStale = false;  // A descriptor in hostPoll was closed elsewhere
+uchar lastEventStatus;
+int eventFd = -1;              // Descriptor every event frame is written to
+uchar eventFdOwed;             // EV_* types it had no room for
+bool consoleAnnounced = false;  // EV_CONSOLE sent since the host last read
 
 // Local prototypes
 
 void step();
-void comm(struct pollfd*);
+void comm();
+int openListener(const char*, int);
+void acceptSession();
+void closeSession(int);
+size_t commandLength(const std::string&);
+void serveSession(int);
+bool flushOutput(int);
+void buildHostPoll();
+int eventPayload(uchar, uchar*);
+void broadcastEvent(uchar);
+void flushEventFd();
+void checkStatusEvent();
+void checkConsoleEvent();
+
+void gdbAccept();
+void gdbClose();
+void gdbService();
+void gdbPacket(std::string&);
+void gdbSend(const std::string&);
+void gdbStopReply();
+void gdbCheckStop();
+void gdbResume(int);
+bool gdbPoint(bool, int, uint, uint);
+void gdbHex(std::string&, uint, int);
+uint gdbUnhex(const char*, int);
 
 void emulSetup();
 void saveState(uchar);
@@ -311,6 +397,7 @@ BreakElement watchpoints[NO_OF_WATCHPOINTS];
 
 uint emulBPFlag[2];
 uint emulWPFlag[2];
+uint bpGeneration;  // Bumped whenever the breakpoint table changes
 
 uchar memory[RAMSIZE];
 
@@ -360,8 +447,6 @@ int PC;
 int BLPrefix, BLAddress;
 int ARMFlag;
 
-struct pollfd* SWIPoll;  // Pointer to allow SWI to scan input - YUK!
-
 ringBuffer terminal0Tx, terminal0Rx;
 ringBuffer terminal1Tx, terminal1Rx;
 ringBuffer* terminalTable[16][2];
@@ -385,9 +470,47 @@ int main(int argc, char** argv) {
   terminalTable[1][0] = &terminal1Tx;
   terminalTable[1][1] = &terminal1Rx;
 
-  pollfd.fd = 0;
-  pollfd.events = POLLIN;
-  SWIPoll = &pollfd;  // Grubby pass to "mySystem"
+  for (int i = 0; i < MAX_SESSIONS; i++) {
+    sessions[i].in = -1;
+    sessions[i].events = 0;
+    sessions[i].owed = 0;
+  }
+
+  const char* socketPath = NULL;
+  int port = 0;
+  int gdbPort = 0;
+
+  for (int i = 1; i < argc - 1; i++) {
+    if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--socket")) {
+      socketPath = argv[++i];
+    } else if (!strcmp(argv[i], "-p") || !strcmp(argv[i], "--port")) {
+      port = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-g") || !strcmp(argv[i], "--gdb")) {
+      gdbPort = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-e") || !strcmp(argv[i], "--events")) {
+      eventFd = atoi(argv[++i]);
+    }
+  }
+
+  // Events are held back rather than stalling the emulator on a slow host
+  if (eventFd >= 0) {
+    signal(SIGPIPE, SIG_IGN);
+    fcntl(eventFd, F_SETFL, fcntl(eventFd, F_GETFL) | O_NONBLOCK);
+  }
+
+  if (gdbPort != 0) {
+    gdbListenFd = openListener(NULL, gdbPort);
+  }
+
+  if ((socketPath != NULL) || (port != 0)) {
+    listenFd = openListener(socketPath, port);
+  } else {
+    sessions[0].in = 0;  // Parent process on the inherited pipes
+    sessions[0].out = 1;
+    sessions[0].events = 0;
+    sessions[0].owed = 0;
+  }
+  buildHostPoll();
 
   emulSetup();
 
@@ -405,13 +528,22 @@ int main(int argc, char** argv) {
     emulWPFlag[1] = (1 << NO_OF_WATCHPOINTS) - 1;
   }
 
+  lastEventStatus = status;
+
   while (true) {
-    comm(&pollfd);  // Check for monitor command
+    comm();  // Check for monitor command
     if ((status & CLIENT_STATE_CLASS_MASK) == CLIENT_STATE_CLASS_RUNNING) {
       step();  // Step emulator as required
     } else {
-      poll(&pollfd, 1, -1);  // If not running, deschedule until command arrives
+      // If not running, deschedule until command arrives
+      if (hostPollStale) {
+        buildHostPoll();
+      }
+      poll(hostPoll, hostPollCount, -1);
     }
+    checkStatusEvent();
+    checkConsoleEvent();
+    gdbCheckStop();
   }
 
   return 0;
@@ -466,9 +598,7 @@ void monitorOptionsMisc(uchar command) {
     case BR_NOP:
       break;
     case BR_PING:
-      if (write(1, "OK00", 4) < 0) {
-        std::cout << "Some error occurred!" << std::endl;
-      }
+      sendCharArray(4, (uchar*)"OK00");
       break;
     case BR_WOT_R_U:
       sendCharArray(whatAreYou[0], &whatAreYou[1]);
@@ -490,6 +620,7 @@ void monitorOptionsMisc(uchar command) {
       sendChar(status);
       sendNBytes(stepsToGo, 4);
       sendNBytes(stepsReset, 4);
+      sendNBytes(bpGeneration, 4);
       break;
 
     case BR_PAUSE:
@@ -520,6 +651,7 @@ void monitorOptionsMisc(uchar command) {
       emulBPFlag[1] = (~emulBPFlag[0] & emulBPFlag[1]) |
                       (emulBPFlag[0] & ((emulBPFlag[1] & ~data[0]) | data[1]));
       emulBPFlag[0] = emulBPFlag[0] & (data[0] | ~data[1]);
+      bpGeneration++;
     } break;
 
     case BR_BP_READ:
@@ -550,6 +682,7 @@ void monitorOptionsMisc(uchar command) {
       temp = (1 << temp) & ~emulBPFlag[0];
       emulBPFlag[0] |= temp;
       emulBPFlag[1] |= temp;
+      bpGeneration++;
       break;
 
     case BR_WP_GET:
@@ -597,8 +730,10 @@ void monitorOptionsMisc(uchar command) {
       emulWPFlag[1] |= temp;
       break;
 
+    // Replies with how many characters fitted in the buffer; the host sends
+    // the rest again once the program has read some
     case BR_FR_WRITE: {
-      uchar device, length;
+      uchar device, length, accepted = 0;
       ringBuffer* pBuff;
 
       getChar(&device);
@@ -607,12 +742,46 @@ void monitorOptionsMisc(uchar command) {
       temp = tempchar;
       while (length-- > 0) {
         getChar(&tempchar); /* Read character */
-        if (pBuff != NULL)
-          putBuffer(pBuff, tempchar); /*  and put in buffer */
+        if ((pBuff != NULL) && putBuffer(pBuff, tempchar)) /* and buffer it */
+          accepted++;
       }
-      sendChar(0);
+      sendChar(accepted);
     } break;
 
+    // A whole program image in one frame: a range count, then for each range
+    // its address, length and bytes. Acknowledged once everything is stored
+    case BR_LOAD_IMAGE: {
+      int ranges, addr, length;
+
+      hostLost = (getNBytes(&ranges, 4) != 4);
+      while ((ranges-- > 0) && !hostLost) {
+        hostLost = (getNBytes(&addr, 4) != 4) || (getNBytes(&length, 4) != 4);
+
+        while ((length > 0) && !hostLost) {  // Split wherever it wraps round
+          int offset = addr & (RAMSIZE - 1);
+          int chunk = (int)(RAMSIZE - offset) < length ? RAMSIZE - offset
+                                                       : length;
+          hostLost = (getCharArray(chunk, memory + offset) != chunk);
+          addr += chunk;
+          length -= chunk;
+        }
+      }
+
+      if (!hostLost) {  // Otherwise the session is dropped, unacknowledged
+        sendChar(0);
+      }
+    } break;
+
+    // Select which event frames this session is sent; only socket sessions
+    // may subscribe, as they are the ones that can afford a dedicated stream
+    case BR_SUBSCRIBE:
+      getChar(&tempchar);
+      if (listenFd >= 0) {
+        sessions[hostSession].events = tempchar;
+      }
+      sendChar(0);
+      break;
+
     case BR_FR_READ: {
       uchar device, max_length;
       uint i, length, available;
@@ -634,6 +803,7 @@ void monitorOptionsMisc(uchar command) {
         getBuffer(pBuff, &c);
         sendChar(c);
       }
+      consoleAnnounced = false;  // Announce again if any are left
     } break;
 
     default:
@@ -723,16 +893,174 @@ void monitorBreakpoints(uchar c) {
 }
 
 /**
- * @brief
- * @param pPollfd
+ * @brief Services every session with input waiting or output queued, accepts
+ * any new connections, and sends event frames the event descriptor had no
+ * room for. Nothing here waits on any one host.
+ */
+void comm() {
+  if (hostPollStale) {
+    buildHostPoll();
+  }
+
+  if (poll(hostPoll, hostPollCount, 0) <= 0) {
+    return;
+  }
+
+  for (int p = 0; p < hostPollCount; p++) {
+    if (hostPoll[p].revents == 0) {
+      continue;
+    }
+
+    if (hostPoll[p].fd == listenFd) {
+      acceptSession();
+      continue;
+    } else if (hostPoll[p].fd == gdbListenFd) {
+      gdbAccept();
+      hostPollStale = true;
+      continue;
+    } else if (hostPoll[p].fd == gdbFd) {
+      gdbService();  // May close the connection, marking hostPoll stale
+      continue;
+    } else if (hostPoll[p].fd == eventFd) {
+      flushEventFd();
+      continue;
+    }
+
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+      Session* session = &sessions[i];
+
+      if ((session->in != hostPoll[p].fd) && (session->out != hostPoll[p].fd)) {
+        continue;
+      }
+
+      if ((hostPoll[p].revents & POLLOUT) && !flushOutput(i)) {
+        closeSession(i);  // Host went away
+        break;
+      }
+
+      if (hostPoll[p].revents & (POLLIN | POLLHUP | POLLERR)) {
+        char buffer[4096];
+        int length = read(session->in, buffer, sizeof(buffer));
+
+        if (length <= 0) {
+          closeSession(i);  // Host went away
+          break;
+        }
+        session->input.append(buffer, length);
+      }
+
+      serveSession(i);
+      break;
+    }
+  }
+
+  if (hostPollStale) {
+    buildHostPoll();
+  }
+}
+
+/**
+ * @brief Works out how long the command at the front of a session's input is,
+ * from its command byte and whatever length fields it carries.
+ * @param input The session's input.
+ * @return size_t The length of the command, or 0 if it has not all arrived.
  */
-void comm(struct pollfd* pPollfd) {
-  uchar c;
+size_t commandLength(const std::string& input) {
+  const uchar* in = (const uchar*)input.data();
+  const size_t have = input.size();
+  size_t need = 1;
+
+  auto word = [in](size_t at, int bytes) {
+    uint value = 0;
+    for (int i = 0; i < bytes; i++) {
+      value |= in[at + i] << (8 * i);
+    }
+    return value;
+  };
+
+  if (have == 0) {
+    return 0;
+  }
+
+  switch (in[0] & 0xC0) {
+    case 0x00:
+      switch (in[0] & 0x3F) {
+        case BR_RTF_SET:
+        case BR_BP_READ:
+        case BR_WP_READ:
+        case BR_SUBSCRIBE:
+          need = 2;
+          break;
+        case BR_FR_READ:
+          need = 3;
+          break;
+        case BR_BP_SET:
+        case BR_WP_SET:
+          need = 9;
+          break;
+        case BR_BP_WRITE:
+        case BR_WP_WRITE:
+          need = 28;
+          break;
+        case BR_FR_WRITE:
+          need = (have < 3) ? 3 : 3 + in[2];
+          break;
+        case BR_LOAD_IMAGE: {  // Ranges are walked as they arrive
+          int ranges = (have < 5) ? 0 : (int)word(1, 4);
+
+          need = 5;
+          while ((ranges-- > 0) && (have >= need + 8)) {
+            int length = (int)word(need + 4, 4);
+            need += 8 + ((length > 0) ? length : 0);
+          }
+          if (ranges >= 0) {
+            return 0;  // Range header still to come
+          }
+        } break;
+        default:
+          break;
+      }
+      break;
+
+    case 0x40:  // As monitorMemory reads it
+      need = 7;
+      if (have >= need) {
+        size_t size = word(5, 2);
+
+        if ((in[0] & 8) != 0) {
+          break;  // A read: nothing more follows
+        } else if ((in[0] & 0x30) == 0x10) {
+          need += 4 * size;
+        } else {
+          need += size << (in[0] & 7);
+        }
+      }
+      break;
+
+    case 0x80:
+      need = 5;
+      break;
+  }
+
+  return (have >= need) ? need : 0;
+}
+
+/**
+ * @brief Handles every whole command a session has sent, as long as it is
+ * taking its replies, and sends what they produce.
+ * @param i The session slot.
+ */
+void serveSession(int i) {
+  Session* session = &sessions[i];
+  size_t length;
+
+  while (session->output.empty() &&
+         ((length = commandLength(session->input)) != 0)) {
+    uchar c = session->input[0];
+
+    hostSession = i;
+    hostInputUsed = 1;
 
-  if (poll(pPollfd, 1, 0) > 0) {
-    if (read(0, &c, 1) < 0) {
-      std::cout << "Some error occurred!" << std::endl;
-    }  // Look at error return - find EOF & exit
     switch (c & 0xC0) {
       case 0x00:
         monitorOptionsMisc(c);
@@ -746,7 +1074,765 @@ void comm(struct pollfd* pPollfd) {
       case 0xC0:
         break;
     }
+    session->input.erase(0, length);
+
+    if (hostLost || !flushOutput(i)) {
+      hostLost = false;
+      closeSession(i);
+      return;
+    }
   }
+
+  if (session->input.size() > MAX_COMMAND_LENGTH) {
+    closeSession(i);  // Not a command this emulator would send
+  }
+}
+
+/**
+ * @brief Sends as much of a session's queued output as the host will take
+ * without waiting; the parent process on a pipe is waited for, as before.
+ * Once the queue empties, any event frames held back are sent with the
+ * latest state.
+ * @param i The session slot.
+ * @return bool false if the host has gone away.
+ */
+bool flushOutput(int i) {
+  Session* session = &sessions[i];
+  bool queued = !session->output.empty();
+
+  while (!session->output.empty()) {
+    int sent = (listenFd >= 0)
+                   ? send(session->out, session->output.data(),
+                          session->output.size(), MSG_DONTWAIT | MSG_NOSIGNAL)
+                   : write(session->out, session->output.data(),
+                           session->output.size());
+
+    if ((sent < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+                       (errno == EINTR))) {
+      break;  // No room yet; polled for
+    } else if (sent <= 0) {
+      return false;
+    }
+    session->output.erase(0, sent);
+
+    if (session->output.empty() && (session->owed != 0)) {
+      uchar frame[2 + 255];
+
+      for (uchar type = EV_STATUS; type <= EV_CONSOLE; type <<= 1) {
+        int length = ((session->owed & type) == 0)
+                         ? -1
+                         : eventPayload(type, &frame[2]);
+        if (length >= 0) {
+          frame[0] = type;
+          frame[1] = length;
+          session->output.append((char*)frame, 2 + length);
+        }
+      }
+      session->owed = 0;
+    }
+  }
+
+  if (queued || !session->output.empty()) {
+    hostPollStale = true;  // Poll for room, or stop polling for it
+  }
+
+  return true;
+}
+
+/**
+ * @brief Opens a listening socket. A Unix-domain socket is used if a path is
+ * given, otherwise a TCP socket bound to loopback.
+ * @param path The filesystem path of the Unix-domain socket, or NULL.
+ * @param port The loopback TCP port, used if path is NULL.
+ * @return int The listening descriptor.
+ */
+int openListener(const char* path, int port) {
+  int listenFd;
+  int one = 1;
+
+  signal(SIGPIPE, SIG_IGN);  // A vanishing host must not kill the emulator
+
+  if (path != NULL) {
+    struct sockaddr_un addr;
+    struct stat old;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    // Remove any socket left over by a previous emulator - but nothing else
+    if ((lstat(path, &old) == 0) && S_ISSOCK(old.st_mode)) {
+      unlink(path);
+    }
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((listenFd < 0) ||
+        (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0)) {
+      perror("jimulator: socket");
+      exit(1);
+    }
+  } else {
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd >= 0) {
+      setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if ((listenFd < 0) ||
+        (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0)) {
+      perror("jimulator: socket");
+      exit(1);
+    }
+  }
+
+  if (listen(listenFd, MAX_SESSIONS) < 0) {
+    perror("jimulator: listen");
+    exit(1);
+  }
+
+  // A connection may be gone again by the time it is accepted
+  fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+
+  return listenFd;
+}
+
+/**
+ * @brief Accepts a pending connection as a new session. If every session slot
+ * is in use, the connection is closed straight away.
+ */
+void acceptSession() {
+  int fd = accept(listenFd, NULL, NULL);
+
+  if (fd < 0) {
+    return;
+  }
+
+  for (int i = 0; i < MAX_SESSIONS; i++) {
+    if (sessions[i].in < 0) {
+      sessions[i].in = fd;
+      sessions[i].out = fd;
+      sessions[i].events = 0;
+      sessions[i].owed = 0;
+      sessions[i].input.clear();
+      sessions[i].output.clear();
+      hostPollStale = true;
+      return;
+    }
+  }
+
+  close(fd);
+}
+
+/**
+ * @brief Ends a session. The parent process going away ends the emulator;
+ * socket sessions just free their slot so that a host may reconnect.
+ * @param i The session slot.
+ */
+void closeSession(int i) {
+  if (listenFd < 0) {
+    exit(0);
+  }
+
+  close(sessions[i].in);
+  sessions[i].in = -1;
+  sessions[i].out = -1;
+  sessions[i].events = 0;
+  sessions[i].owed = 0;
+  sessions[i].input.clear();
+  sessions[i].output.clear();
+  hostPollStale = true;
+}
+
+/**
+ * @brief Rebuilds the set of descriptors polled: the listening socket (if
+ * any), every open session - for room while it has output queued, and for
+ * commands otherwise - the event descriptor while it owes frames, and gdb.
+ */
+void buildHostPoll() {
+  hostPollCount = 0;
+  hostPollStale = false;
+
+  if (listenFd >= 0) {
+    hostPoll[hostPollCount].fd = listenFd;
+    hostPoll[hostPollCount++].events = POLLIN;
+  }
+
+  for (int i = 0; i < MAX_SESSIONS; i++) {
+    if (sessions[i].in < 0) {
+      continue;
+    }
+
+    if (sessions[i].output.empty()) {
+      hostPoll[hostPollCount].fd = sessions[i].in;
+      hostPoll[hostPollCount++].events = POLLIN;
+    } else {
+      hostPoll[hostPollCount].fd = sessions[i].out;
+      hostPoll[hostPollCount++].events = POLLOUT;
+    }
+  }
+
+  if ((eventFd >= 0) && (eventFdOwed != 0)) {
+    hostPoll[hostPollCount].fd = eventFd;
+    hostPoll[hostPollCount++].events = POLLOUT;
+  }
+
+  if (gdbListenFd >= 0) {
+    hostPoll[hostPollCount].fd = (gdbFd >= 0) ? gdbFd : gdbListenFd;
+    hostPoll[hostPollCount++].events = POLLIN;
+  }
+}
+
+/**
+ * @brief Fills in the payload of an event frame from the current state.
+ * @param type The EV_* type of the frame.
+ * @param payload Where the payload goes.
+ * @return int The length of the payload, or -1 if there is nothing to say.
+ */
+int eventPayload(uchar type, uchar* payload) {
+  if (type == EV_STATUS) {
+    payload[0] = status;
+    for (int i = 0; i < 4; i++) {
+      payload[1 + i] = (stepsToGo >> (8 * i)) & 0xFF;
+      payload[5 + i] = (stepsReset >> (8 * i)) & 0xFF;
+      payload[9 + i] = (bpGeneration >> (8 * i)) & 0xFF;
+    }
+    return 13;
+  }
+
+  int available = countBuffer(&terminal0Tx);
+  if (available == 0) {
+    return -1;  // Read since it was announced
+  }
+  payload[0] = available < 255 ? available : 255;
+  return 1;
+}
+
+/**
+ * @brief Sends an event frame, with the current state, to every session
+ * subscribed to its type and to the event descriptor. Nothing waits for a slow
+ * host: a session with output still queued, or a full event descriptor, is
+ * marked as owed a frame of that type, and sent one with the state as it is
+ * then once there is room.
+ * @param type The EV_* type of the frame.
+ */
+void broadcastEvent(uchar type) {
+  uchar frame[2 + 255];
+  int length = eventPayload(type, &frame[2]);
+
+  if (length < 0) {
+    return;
+  }
+  frame[0] = type;
+  frame[1] = length;
+
+  for (int i = 0; i < MAX_SESSIONS; i++) {
+    Session* session = &sessions[i];
+
+    if ((session->in < 0) || ((session->events & type) == 0)) {
+      continue;
+    } else if (!session->output.empty()) {
+      session->owed |= type;  // Frames are queued whole, so framing holds
+    } else {
+      session->output.append((char*)frame, 2 + length);
+      if (!flushOutput(i)) {
+        closeSession(i);  // Host went away
+      }
+    }
+  }
+
+  if (eventFd >= 0) {
+    eventFdOwed |= type;
+    flushEventFd();
+  }
+}
+
+/**
+ * @brief Writes the frames owed to the event descriptor, with the current
+ * state. Frames are shorter than PIPE_BUF, so are written whole or not at all;
+ * any it has no room for stay owed, and it is polled for room.
+ */
+void flushEventFd() {
+  uchar frame[2 + 255];
+
+  for (uchar type = EV_STATUS; type <= EV_CONSOLE; type <<= 1) {
+    int length = ((eventFdOwed & type) == 0) ? -1 : eventPayload(type,
+                                                                  &frame[2]);
+    if (length < 0) {
+      eventFdOwed &= ~type;
+      continue;
+    }
+
+    frame[0] = type;
+    frame[1] = length;
+    if (write(eventFd, frame, 2 + length) >= 0) {
+      eventFdOwed &= ~type;
+    } else if (errno == EPIPE) {
+      close(eventFd);  // Host went away
+      eventFd = -1;
+      eventFdOwed = 0;
+      break;
+    }
+  }
+
+  hostPollStale = true;  // Poll it for room only while frames are owed
+}
+
+/**
+ * @brief Fans a status transition out to subscribed sessions.
+ */
+void checkStatusEvent() {
+  if (status == lastEventStatus) {
+    return;
+  }
+
+  lastEventStatus = status;
+
+  if ((listenFd >= 0) || (eventFd >= 0)) {
+    broadcastEvent(EV_STATUS);
+  }
+}
+
+/**
+ * @brief Tells subscribed sessions when console output becomes available, so
+ * they need not poll for it. Announced once until the host next reads.
+ */
+void checkConsoleEvent() {
+  int available = countBuffer(&terminal0Tx);
+
+  if (available == 0) {
+    consoleAnnounced = false;
+  } else if (!consoleAnnounced && ((listenFd >= 0) || (eventFd >= 0))) {
+    consoleAnnounced = true;
+    broadcastEvent(EV_CONSOLE);
+  }
+}
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -*/
+/* GDB remote serial protocol stub. Registers are presented in gdb's legacy   */
+/*   ARM layout (r0-r15, f0-f7, fps, cpsr); breakpoints and watchpoints are   */
+/*   entries in the same tables the monitor protocol uses.                    */
+
+/**
+ * @brief Appends a value to a string as hex, in target (little endian) order.
+ * @param out The string appended to.
+ * @param value The value.
+ * @param bytes The number of bytes of the value to append.
+ */
+void gdbHex(std::string& out, uint value, int bytes) {
+  const char* digits = "0123456789abcdef";
+
+  for (int i = 0; i < bytes; i++) {
+    out += digits[(value >> 4) & 0xF];
+    out += digits[value & 0xF];
+    value = value >> 8;
+  }
+}
+
+/**
+ * @brief Reads a little endian hex value from a packet.
+ * @param text The hex digits.
+ * @param bytes The number of bytes to read.
+ * @return uint The value.
+ */
+uint gdbUnhex(const char* text, int bytes) {
+  uint value = 0;
+  char pair[3] = {0, 0, 0};
+
+  for (int i = 0; i < bytes; i++) {
+    pair[0] = text[2 * i];
+    pair[1] = text[2 * i + 1];
+    value |= strtoul(pair, NULL, 16) << (8 * i);
+  }
+
+  return value;
+}
+
+/**
+ * @brief Accepts a debugger connection; only one is served at a time.
+ */
+void gdbAccept() {
+  int fd = accept(gdbListenFd, NULL, NULL);
+
+  if (fd < 0) {
+    return;
+  }
+
+  if (gdbFd >= 0) {
+    close(fd);
+    return;
+  }
+
+  gdbFd = fd;
+  gdbWaiting = false;
+  gdbNoAck = false;
+  gdbInput.clear();
+}
+
+/**
+ * @brief Drops the debugger connection. The target is left as it is.
+ */
+void gdbClose() {
+  close(gdbFd);
+  gdbFd = -1;
+  hostPollStale = true;  // May be reached from the main loop, not just comm
+  gdbWaiting = false;
+  gdbNoAck = false;
+  gdbInput.clear();
+}
+
+/**
+ * @brief Reads whatever the debugger has sent, and handles every complete
+ * packet in it.
+ */
+void gdbService() {
+  char buffer[GDB_PACKET_SIZE];
+  int length = read(gdbFd, buffer, sizeof(buffer));
+
+  if (length <= 0) {
+    gdbClose();
+    return;
+  }
+
+  gdbInput.append(buffer, length);
+
+  while (!gdbInput.empty() && (gdbFd >= 0)) {
+    if (gdbInput[0] == 0x03) {  // Interrupt, as BR_STOP
+      if ((status & CLIENT_STATE_CLASS_MASK) == CLIENT_STATE_CLASS_RUNNING) {
+        oldStatus = status;
+        status = CLIENT_STATE_STOPPED;
+      }
+      gdbInput.erase(0, 1);
+    } else if (gdbInput[0] == '$') {
+      size_t end = gdbInput.find('#');
+
+      if ((end == std::string::npos) || (end + 2 >= gdbInput.size())) {
+        break;  // Incomplete, wait for the rest
+      }
+
+      std::string packet = gdbInput.substr(1, end - 1);
+      uchar checksum = gdbUnhex(&gdbInput[end + 1], 1);
+      gdbInput.erase(0, end + 3);
+
+      if (gdbNoAck) {
+        gdbPacket(packet);
+        continue;
+      }
+
+      for (char c : packet) {
+        checksum -= c;
+      }
+
+      // A corrupt packet is NAKed and dropped; gdb will send it again
+      if (write(gdbFd, (checksum == 0) ? "+" : "-", 1) < 0) {
+        gdbClose();
+        break;
+      }
+
+      if (checksum == 0) {
+        gdbPacket(packet);
+      }
+    } else {
+      gdbInput.erase(0, 1);  // Acknowledgements and line noise
+    }
+  }
+}
+
+/**
+ * @brief Sends a reply packet to the debugger.
+ * @param data The packet contents.
+ */
+void gdbSend(const std::string& data) {
+  std::string packet = "$" + data + "#";
+  uchar checksum = 0;
+
+  for (char c : data) {
+    checksum += c;
+  }
+  gdbHex(packet, checksum, 1);
+
+  if (write(gdbFd, packet.data(), packet.size()) < 0) {
+    gdbClose();
+  }
+}
+
+/**
+ * @brief Tells the debugger the target has stopped.
+ */
+void gdbStopReply() {
+  gdbSend("S05");  // SIGTRAP
+}
+
+/**
+ * @brief Sends the stop reply owed to the debugger once a resumed target is no
+ * longer running.
+ */
+void gdbCheckStop() {
+  if (gdbWaiting &&
+      ((status & CLIENT_STATE_CLASS_MASK) != CLIENT_STATE_CLASS_RUNNING)) {
+    gdbWaiting = false;
+    gdbStopReply();
+  }
+}
+
+/**
+ * @brief Resumes the target, as the monitor's run command does, with
+ * breakpoints and watchpoints enabled.
+ * @param steps The number of steps to run for (0 for indefinite).
+ */
+void gdbResume(int steps) {
+  runFlags = 0x30;
+  breakpointEnable = true;
+  breakpointEnabled = false;  // Don't break on the instruction stopped at
+  runThroughBL = false;
+  runThroughSWI = false;
+  stepsToGo = steps;
+  status = (steps == 0) ? CLIENT_STATE_RUNNING : CLIENT_STATE_STEPPING;
+  gdbWaiting = true;
+}
+
+/**
+ * @brief Adds or removes a breakpoint or watchpoint for a Z or z packet.
+ * @param insert true to add the point, false to remove it.
+ * @param type The gdb point type: 0/1 breakpoint, 2 write, 3 read, 4 access.
+ * @param addr The address.
+ * @param length The length (or, for breakpoints, kind) of the point.
+ * @return bool true if the request was handled.
+ */
+bool gdbPoint(bool insert, int type, uint addr, uint length) {
+  BreakElement* table;
+  uint* flags;
+  int count;
+  uchar cond;
+  BreakElement point;
+
+  if (type <= 1) {
+    table = breakpoints;
+    flags = emulBPFlag;
+    count = NO_OF_BREAKPOINTS;
+    cond = 0xFF;  // As KoMo2 sets them: address and data masked
+    point.addrA = addr;
+    point.addrB = 0xFFFFFFFF;
+  } else if (type <= 4) {
+    table = watchpoints;
+    flags = emulWPFlag;
+    count = NO_OF_WATCHPOINTS;
+    cond = 0x08 | 0x03;  // Address range, any data
+    cond |= (type == 2) ? 0x10 : (type == 3) ? 0x20 : 0x30;
+    point.addrA = addr;
+    point.addrB = addr + length - 1;
+  } else {
+    return false;
+  }
+
+  point.state = 0;
+  point.cond = cond;
+  point.size = 0xFF;
+  point.dataA[0] = point.dataA[1] = 0;
+  point.dataB[0] = point.dataB[1] = 0;
+
+  for (int i = 0; i < count; i++) {
+    if (((flags[0] & (1 << i)) != 0) && (table[i].cond == cond) &&
+        (table[i].addrA == point.addrA) && (table[i].addrB == point.addrB)) {
+      if (!insert) {
+        flags[0] &= ~(1 << i);
+        flags[1] &= ~(1 << i);
+        bpGeneration += (table == breakpoints);
+      }
+      return true;  // Already present, or now removed
+    }
+  }
+
+  if (!insert) {
+    return true;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if ((flags[0] & (1 << i)) == 0) {
+      table[i] = point;
+      flags[0] |= 1 << i;
+      flags[1] |= 1 << i;
+      bpGeneration += (table == breakpoints);
+      return true;
+    }
+  }
+
+  return false;  // Table full
+}
+
+/**
+ * @brief Handles one packet from the debugger.
+ * @param packet The packet contents, without framing.
+ */
+void gdbPacket(std::string& packet) {
+  std::string reply;
+  const char* args = packet.c_str() + 1;
+  char* end;
+
+  switch (packet[0]) {
+    case '?':
+      gdbStopReply();
+      return;
+
+    case 'g':
+      for (int i = 0; i < 16; i++) {
+        gdbHex(reply, getRegisterMonitor(i, regCurrent), 4);
+      }
+      reply.append(GDB_ARM_FP_REGS * 12 * 2 + 8, '0');  // f0-f7, fps
+      gdbHex(reply, cpsr, 4);
+      break;
+
+    case 'G':
+      if (packet.size() < 1 + (16 * 4 + GDB_ARM_FP_REGS * 12 + 8) * 2) {
+        reply = "E01";
+        break;
+      }
+      for (int i = 0; i < 16; i++) {
+        putRegister(i, gdbUnhex(args + 8 * i, 4), regCurrent);
+      }
+      putRegister(16, gdbUnhex(args + 8 * 16 + GDB_ARM_FP_REGS * 24 + 8, 4),
+                  regCurrent);
+      reply = "OK";
+      break;
+
+    case 'p': {
+      uint n = strtoul(args, NULL, 16);
+
+      if (n < 16) {
+        gdbHex(reply, getRegisterMonitor(n, regCurrent), 4);
+      } else if (n < 16 + GDB_ARM_FP_REGS) {
+        reply.append(24, '0');
+      } else if (n == 16 + GDB_ARM_FP_REGS) {
+        reply.append(8, '0');
+      } else if (n == 17 + GDB_ARM_FP_REGS) {
+        gdbHex(reply, cpsr, 4);
+      } else {
+        reply = "E01";
+      }
+    } break;
+
+    case 'P': {
+      uint n = strtoul(args, &end, 16);
+
+      if (*end == '=') {
+        if (n < 16) {
+          putRegister(n, gdbUnhex(end + 1, 4), regCurrent);
+        } else if (n == 17 + GDB_ARM_FP_REGS) {
+          putRegister(16, gdbUnhex(end + 1, 4), regCurrent);
+        }
+        reply = "OK";  // FPA registers are accepted and ignored
+      } else {
+        reply = "E01";
+      }
+    } break;
+
+    case 'm': {
+      uint addr = strtoul(args, &end, 16);
+      uint length = strtoul(end + 1, NULL, 16);
+
+      // gdb accepts a short read, and asks again for the rest
+      if (length > GDB_MAX_READ) {
+        length = GDB_MAX_READ;
+      }
+
+      for (uint i = 0; i < length; i++) {
+        gdbHex(reply, memory[(addr + i) & (RAMSIZE - 1)], 1);
+      }
+    } break;
+
+    case 'M':
+    case 'X': {
+      uint addr = strtoul(args, &end, 16);
+      uint length = strtoul(end + 1, &end, 16);
+      const char* data = end + 1;
+      const char* last = packet.c_str() + packet.size();
+
+      if (*end != ':') {
+        reply = "E01";
+        break;
+      }
+
+      for (uint i = 0; (i < length) && (data < last); i++) {
+        uchar byte;
+
+        if (packet[0] == 'M') {
+          byte = gdbUnhex(data, 1);
+          data += 2;
+        } else if (*data == '}') {  // Escaped binary byte
+          byte = data[1] ^ 0x20;
+          data += 2;
+        } else {
+          byte = *data++;
+        }
+        memory[(addr + i) & (RAMSIZE - 1)] = byte;
+      }
+      reply = "OK";
+    } break;
+
+    case 'c':
+    case 's':
+      if (*args != '\0') {
+        putRegister(15, strtoul(args, NULL, 16), regCurrent);
+      }
+      gdbResume(packet[0] == 's' ? 1 : 0);
+      return;  // Reply is sent when the target stops
+
+    case 'Z':
+    case 'z': {
+      int type = strtoul(args, &end, 16);
+      uint addr = strtoul(end + 1, &end, 16);
+      uint length = strtoul(end + 1, NULL, 16);
+
+      if (gdbPoint(packet[0] == 'Z', type, addr, length)) {
+        reply = "OK";
+      } else if (type > 4) {
+        reply = "";  // Unsupported type
+      } else {
+        reply = "E01";
+      }
+    } break;
+
+    case 'q':
+      if (packet.compare(0, 10, "qSupported") == 0) {
+        reply = "PacketSize=";
+        reply += std::to_string(GDB_PACKET_SIZE);
+        reply += ";QStartNoAckMode+";
+      } else if (packet == "qAttached") {
+        reply = "1";
+      }
+      break;
+
+    case 'Q':
+      if (packet == "QStartNoAckMode") {
+        gdbSend("OK");  // Acknowledged as usual; no-ack starts after it
+        gdbNoAck = true;
+        return;
+      }
+      break;
+
+    case 'H':
+    case 'T':
+      reply = "OK";
+      break;
+
+    case 'D':
+      gdbSend("OK");
+      gdbClose();
+      return;
+
+    case 'k':
+      gdbClose();
+      return;
+
+    default:
+      break;  // Empty reply: not supported
+  }
+
+  gdbSend(reply);
 }
 
 /**
@@ -814,47 +1900,36 @@ int getNBytes(int* valPtr, int N) {
 }
 
 /**
- * @brief Reads a character array from buffer. Sends charNumber number of
- * characters given by dataPtr.
+ * @brief Reads a character array from the command being handled. The whole
+ * command has arrived before it is handled, so this never waits on the host.
  * @param charNumber
  * @param dataPtr
  * @return int Number of bytes received.
  */
 int getCharArray(int charNumber, uchar* dataPtr) {
-  int ret = charNumber;
-  int replycount = 0;
-  struct pollfd pollfd;
-
-  pollfd.fd = 0;
-  pollfd.events = POLLIN;
+  const std::string& input = sessions[hostSession].input;
+  int available = input.size() - hostInputUsed;
 
-  while (charNumber) {
-    if (!poll(&pollfd, 1, -1)) {
-      return ret - charNumber;
-    }
-
-    replycount = read(0, dataPtr, charNumber);
-    if (replycount < 0) {
-      replycount = 0;
-    }
-
-    charNumber -= replycount;
-    dataPtr += replycount;
+  if (charNumber > available) {
+    charNumber = available;  // Not a command this emulator would send
+    hostLost = true;
   }
 
-  return ret;
+  memcpy(dataPtr, input.data() + hostInputUsed, charNumber);
+  hostInputUsed += charNumber;
+
+  return charNumber;
 }
 
 /**
- * @brief writes an array of bytes in the buffer.
+ * @brief Queues an array of bytes to be sent to the host the command came
+ * from.
  * @param charNumber number of bytes given by dataPtr
  * @param dataPtr points to the beginning of the sequence to be sent
  * @return int
  */
 int sendCharArray(int charNumber, uchar* dataPtr) {
-  if (write(1, dataPtr, charNumber) < 0) {
-    std::cout << "Some error occurred!" << std::endl;
-  }
+  sessions[hostSession].output.append((char*)dataPtr, charNumber);
 
   return charNumber;  // send char array to the board
 }
@@ -1928,7 +3003,8 @@ bool swiCharacterPrint(char c) {
     if (status == CLIENT_STATE_RESET) {
       return false;
     } else {
-      comm(SWIPoll);  // If stalled, retain monitor communications
+      checkConsoleEvent();  // The host may be waiting to be told
+      comm();               // If stalled, retain monitor communications
     }
   }
 
@@ -1991,7 +3067,7 @@ void mySystem(uint opCode) {
         // Bodge PC so that stall looks `correct'
         while ((!getBuffer(&terminal0Rx, &c)) &&
                (status != CLIENT_STATE_RESET)) {
-          comm(SWIPoll);
+          comm();
         }
 
         if (status != CLIENT_STATE_RESET) {
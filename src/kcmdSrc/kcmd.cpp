@@ -9,7 +9,9 @@
  */
 
 #include "kcmd.h"
+#include "../aasmSrc/aasm.h"
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <math.h>
 #include <signal.h>
@@ -18,21 +20,26 @@
 #include <string.h>
 #include <sys/poll.h>
 #include <sys/signal.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <termios.h>
 #include <unistd.h>
 #include <algorithm>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <regex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 #include <sstream>
-#include <thread>
-#include <mutex>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #ifdef __APPLE__
 #include <mach-o/dyld.h>
 #endif
@@ -52,6 +59,75 @@ constexpr int SOURCE_FIELD_COUNT = 4;
  */
 constexpr int SOURCE_TEXT_LENGTH = 100;
 
+/**
+ * @brief Builds a table mapping every character to its value as a hex digit.
+ * @return The table, holding -1 for characters that are not hex digits.
+ */
+constexpr std::array<signed char, 256> makeHexDigitTable() {
+  std::array<signed char, 256> table = {};
+  for (int i = 0; i < 256; i++) {
+    table[i] = -1;
+  }
+  for (int i = 0; i < 10; i++) {
+    table['0' + i] = i;
+  }
+  for (int i = 0; i < 6; i++) {
+    table['A' + i] = 10 + i;
+    table['a' + i] = 10 + i;
+  }
+  return table;
+}
+
+/**
+ * @brief The value of every character as a hex digit, or -1 if it is not one.
+ */
+constexpr std::array<signed char, 256> HEX_DIGIT_TABLE = makeHexDigitTable();
+
+/**
+ * @brief The magic number at the start of a program image written by aasm.
+ */
+constexpr char IMAGE_MAGIC[] = "KMI1";
+
+/**
+ * @brief The sizes, in bytes, of the header and of each table entry in a
+ * program image.
+ */
+constexpr int IMAGE_HEADER_SIZE = 32;
+constexpr int IMAGE_SEGMENT_SIZE = 12;
+constexpr int IMAGE_SYMBOL_SIZE = 16;
+constexpr int IMAGE_LINE_SIZE = 16;
+
+/**
+ * @brief The flag set in a program image header when it has an entry point.
+ */
+constexpr int IMAGE_FLAG_ENTRY = 0x01;
+
+/**
+ * @brief The identifying bytes at the start of an ELF file.
+ */
+constexpr unsigned char ELF_MAGIC[] = {0x7F, 'E', 'L', 'F'};
+
+/**
+ * @brief Sizes of the ELF32 structures the loader reads; entry sizes given in
+ * the file header may be larger, but never smaller.
+ */
+constexpr int ELF_HEADER_SIZE = 52;
+constexpr int ELF_PROGRAM_HEADER_SIZE = 32;
+constexpr int ELF_SECTION_HEADER_SIZE = 40;
+constexpr int ELF_SYMBOL_SIZE = 16;
+
+/**
+ * @brief ELF constants: 32-bit little-endian ARM, loadable segments, symbol
+ * table sections, and the symbol types that do not name an address.
+ */
+constexpr int ELF_CLASS_32 = 1;
+constexpr int ELF_DATA_LSB = 1;
+constexpr int ELF_MACHINE_ARM = 40;
+constexpr int ELF_PT_LOAD = 1;
+constexpr int ELF_SHT_SYMTAB = 2;
+constexpr int ELF_STT_SECTION = 3;
+constexpr int ELF_STT_FILE = 4;
+
 /**
  * @brief The maximum amount of time to wait after sending input to the pipes.
  */
@@ -78,10 +154,23 @@ int communicationToJimulator[2];
 int compilerCommunication[2];
 int writeToJimulator;
 int readFromJimulator;
-int emulator_PID;
+int jimulatorEvents = -1;
+int emulator_PID = -1;
 
-std::thread *t1, *t2;
-std::mutex mtx;
+// Terminal settings to put back on exit, if stdin is a terminal
+termios savedTerminal;
+bool terminalSaved = false;
+
+/**
+ * @brief How many milliseconds the I/O loop waits between polls of Jimulator,
+ * when it cannot wait for Jimulator to say that something happened.
+ */
+constexpr int POLL_INTERVAL = 10;
+
+// Exit statuses, beyond usage errors
+constexpr int EXIT_HALTED = 0;   // The program halted itself
+constexpr int EXIT_STOPPED = 2;  // Stopped any other way, or ran out of steps
+constexpr int EXIT_LOST = 3;     // Jimulator went away
 
 /**
  * @brief Contains the information read from Jimulator about a given breakpoint.
@@ -137,6 +226,9 @@ enum class BoardInstruction : unsigned char {
   FR_WRITE = 0x12,
   FR_READ = 0x13,
 
+  // Event frames
+  SUBSCRIBE = 0x14,
+
   // Breakpoint read/write
   BP_WRITE = 0x30,
   BP_READ = 0x31,
@@ -145,11 +237,12 @@ enum class BoardInstruction : unsigned char {
 
   // Register read/write
   GET_REG = 0x5A,
-  SET_REG = 0x52,  // Unused
+  SET_REG = 0x52,
 
   // Memory read/write
   GET_MEM = 0x4A,
   SET_MEM = 0x40,
+  LOAD_IMAGE = 0x15,
 };
 
 /**
@@ -167,16 +260,6 @@ inline unsigned char operator|(BoardInstruction l, unsigned char r) {
  */
 class SourceFileLine {
  public:
-  /**
-   * @brief The previous line of the overall source file.
-   */
-  SourceFileLine* prev;
-
-  /**
-   * @brief The next line of the overall source file.
-   */
-  SourceFileLine* next;
-
   /**
    * @brief A flag that indicates that the line stores internal data or not.
    */
@@ -198,25 +281,86 @@ class SourceFileLine {
   int dataValue[4];
 
   /**
-   * @brief Text, as read from the source file.
+   * @brief The offset of the line's text within the mapped source file.
    */
-  char* text;
+  unsigned int textOffset;
+
+  /**
+   * @brief The length of the line's text.
+   */
+  unsigned int textLength;
 };
 
 /**
  * @brief Describes an entire file of a .kmd sourceFile.
+ * Lines are held in a single array sorted by address (lines with equal
+ * addresses keep their file order), so that the line for any address can be
+ * found with a binary search. A private copy of the file is held in memory
+ * while it is loaded, and the text of every line is a view into that copy.
  */
 class sourceFile {
  public:
   /**
-   * @brief The first line in a source file.
+   * @brief Every line of the source file, sorted by address once loaded.
+   */
+  std::vector<SourceFileLine> lines;
+
+  /**
+   * @brief A copy of the source file's contents, mapped read only.
+   */
+  const char* mapping = NULL;
+
+  /**
+   * @brief The length of the mapping in bytes.
+   */
+  size_t mappingLength = 0;
+
+  /**
+   * @brief Gets the first line of the source file.
+   * @return SourceFileLine* The first line, or NULL if the file is empty.
+   */
+  SourceFileLine* first() { return lines.empty() ? NULL : lines.data(); }
+
+  /**
+   * @brief Gets the line following a line of the source file.
+   * @param line The current line.
+   * @return SourceFileLine* The next line, or NULL at the end of the file.
    */
-  SourceFileLine* pStart;
+  SourceFileLine* next(SourceFileLine* const line) {
+    return (line + 1 < lines.data() + lines.size()) ? line + 1 : NULL;
+  }
+
+  /**
+   * @brief Finds the first line at or beyond an address.
+   * @param address The address to search for.
+   * @return SourceFileLine* The line, or NULL if every line is before address.
+   */
+  SourceFileLine* lowerBound(const unsigned int address) {
+    auto iter = std::lower_bound(lines.begin(), lines.end(), address,
+                                 [](const SourceFileLine& l, unsigned int a) {
+                                   return l.address < a;
+                                 });
+    return (iter == lines.end()) ? NULL : &*iter;
+  }
+
+  /**
+   * @brief Gets the text of a line.
+   * @param line The line.
+   * @return std::string_view The text of the line.
+   */
+  std::string_view textOf(const SourceFileLine* const line) const {
+    return std::string_view(mapping + line->textOffset, line->textLength);
+  }
 
   /**
-   * @brief The last line in a source file.
+   * @brief Sorts the lines by address, once every line has been read.
    */
-  SourceFileLine* pEnd;
+  void sort() {
+    std::stable_sort(lines.begin(), lines.end(),
+                     [](const SourceFileLine& a, const SourceFileLine& b) {
+                       return a.address < b.address;
+                     });
+  }
 };
 
 /**
@@ -224,16 +368,115 @@ class sourceFile {
  */
 sourceFile source;
 
+/**
+ * @brief The client's copy of Jimulator's breakpoint table. It is only read
+ * back from Jimulator when the breakpoint generation Jimulator reports with
+ * its status has moved on from the one the copy was taken at; changes this
+ * client makes itself are applied to the copy as they are sent.
+ */
+class BreakpointMirror {
+ public:
+  /**
+   * @brief Whether the copy has been read from Jimulator at all.
+   */
+  bool valid = false;
+
+  /**
+   * @brief The breakpoint generation the copy is up to date with.
+   */
+  unsigned int generation = 0;
+
+  /**
+   * @brief Jimulator's breakpoint flags: which are active, and which may be
+   * defined.
+   */
+  unsigned int wordA = 0, wordB = 0;
+
+  /**
+   * @brief The index of the active breakpoint at each address.
+   */
+  std::unordered_map<u_int32_t, int> indices;
+};
+
+/**
+ * @brief The breakpoints currently set in Jimulator.
+ */
+BreakpointMirror breakpoints;
+
+/**
+ * @brief The breakpoint generation Jimulator last reported with its status.
+ */
+unsigned int boardBreakpointGeneration = 0;
+
+/**
+ * @brief Terminal input waiting to be sent to Jimulator, oldest first.
+ */
+std::string terminalInput;
+
+/**
+ * @brief A run of contiguous bytes of a program image, as sent to Jimulator.
+ */
+class MemoryRange {
+ public:
+  /**
+   * @brief The address of the first byte in the range.
+   */
+  unsigned int address;
+
+  /**
+   * @brief The bytes of the range, in address order.
+   */
+  std::vector<unsigned char> bytes;
+};
+
+/**
+ * @brief A range of memory whose contents lie in a mapped file; any of the
+ * range beyond the file's bytes is filled with zeroes.
+ */
+class MappedRange {
+ public:
+  /**
+   * @brief The address of the first byte in the range.
+   */
+  unsigned int address;
+
+  /**
+   * @brief The first of the range's bytes in the mapping.
+   */
+  const unsigned char* bytes;
+
+  /**
+   * @brief How many bytes are taken from the mapping.
+   */
+  unsigned int fileLength;
+
+  /**
+   * @brief The length of the range in memory, at least `fileLength`.
+   */
+  unsigned int memoryLength;
+};
+
 // ! Forward declaring auxiliary load functions
 
 // Workers
 
 inline void flushSourceFile();
 inline const bool readSourceFile(const char* const);
+inline const bool readProgramImage(const char* const, const char* const);
+inline const bool loadProgramImage(void* const, const size_t);
+inline const bool readElfFile(const char* const);
+inline const std::string imagePathFor(const char* const);
+inline void appendToImage(std::vector<MemoryRange>&,
+                          const unsigned int,
+                          const unsigned int,
+                          const int);
+inline void boardLoadImage(const std::vector<MemoryRange>&);
+inline void boardLoadMapped(const std::vector<MappedRange>&);
+inline void boardSetProgramCounter(const unsigned int);
 inline const ClientState getBoardStatus();
 inline const std::array<unsigned char, 64> readRegistersIntoArray();
-constexpr const int disassembleSourceFile(SourceFileLine*, unsigned int);
-constexpr const bool moveSrc(bool firstFlag, SourceFileLine** src);
+inline const int disassembleSourceFile(SourceFileLine*, unsigned int);
+inline const bool moveSrc(bool firstFlag, SourceFileLine** src);
 inline const std::string generateMemoryHex(SourceFileLine** src,
                                            const uint32_t s_address,
                                            int* const increment,
@@ -260,6 +503,8 @@ inline const bool getBreakpointDefinition(unsigned int, BreakpointInfo*);
 inline void setBreakpointStatus(unsigned int, unsigned int);
 inline void setBreakpointDefinition(unsigned int, BreakpointInfo*);
 inline const std::unordered_map<u_int32_t, bool> getAllBreakpoints();
+inline const bool syncBreakpoints();
+inline void trackBreakpointChange();
 
 // Helpers
 
@@ -272,58 +517,189 @@ inline const std::string integerArrayToHexString(int,
                                                  unsigned char* const,
                                                  const bool = false);
 constexpr const char getLeastSignificantByte(const int);
+constexpr const bool isTerminalCharacter(const unsigned int);
 
 /**
- * @brief Runs `pathToS` through the associated compiler binary, and outputs a
- * .kmd file at `pathToKMD`.
- * @param pathToBin An absolute path to the `aasm` binary.
+ * @brief Assembles `pathToS` within this process, with aasm linked in as a
+ * library, and loads the result. Files it INCLUDEs are read from beside it;
+ * no listing or image is written to disk.
+ * @param pathToS A path to the `.s` file to be compiled.
+ * @param messages Set to whatever the assembler printed.
+ * @return true if the file assembled and was loaded.
+ */
+const bool Jimulator::assembleJimulator(const char* const pathToS,
+                                        std::string& messages) {
+  auto readFile = [](const std::string& path, std::string& text) {
+    std::ifstream file(path, std::ios::binary);
+    if (not file) {
+      return false;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    text = contents.str();
+    return true;
+  };
+
+  Aasm::Options options;
+  std::string text;
+  options.name = pathToS;
+  options.include = readFile;
+  if (not readFile(pathToS, text)) {
+    messages = "Can't open " + options.name + "\n";
+    return false;
+  }
+
+  const Aasm::ProgramImage program = Aasm::assemble(text, options);
+  messages = program.diagnostics;
+  if (program.status != 0 || program.image.empty()) {
+    return false;
+  }
+
+  // Loaded as if mapped from an image file, so the source lines can keep it
+  void* mapping = mmap(NULL, program.image.size(), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  memcpy(mapping, program.image.data(), program.image.size());
+
+  flushSourceFile();
+  return loadProgramImage(mapping, program.image.size());
+}
+
+/**
+ * @brief Asks a resident assembler (`aasm --serve`), listening on the socket
+ * named by the `AASM_SOCKET` environment variable, for `pathToS`, and loads
+ * the result. The listing and program image come back as memory files rather
+ * than through the disk, and are read through `/proc/self/fd`.
  * @param pathToS An absolute path to the `.s` file to be compiled.
- * @param pathToKMD an absolute path to the `.kmd` file that will be output.
- */
-void Jimulator::compileJimulator(std::string pathToBin,
-                                 const char* const pathToS,
-				 const char* const pathToKMD) {
-  char *file_name, *fnoext, *tmp;
-  size_t len;
-  int pid = -1;
-
-  close(1);
-  dup2(compilerCommunication[1], 1);
-  close(2);
-  dup2(compilerCommunication[1], 2);
-  
-  file_name = strdup(pathToS);
-  tmp = strrchr(file_name, '/');
-  fnoext = strchr(file_name, '.');
-
-  *tmp = 0;
-  *fnoext = 0;
-  pid = fork();
-
-  if(!pid) {
-	  int dfd = open("/dev/null", O_RDWR);
-	  close(1);
-	  dup2(dfd, 1);
-#ifdef __APPLE__
-	  execlp(pathToBin.append("/aasm.sh").c_str(), "aasm.sh", file_name, tmp+1, (char*)0);
-#else
-	  const char *p = pathToBin.append("/aasm").c_str();
-	  char *cmd = (char*)malloc(0x500);
-	  sprintf(cmd, "%s -lk %s %s", p, pathToKMD, pathToS);
-	  system(cmd);
-	  exit(0);
-#endif
+ * @param messages Set to whatever the assembler printed.
+ * @return const ResidentCompile Whether the file was loaded, or failed to
+ * assemble or load, or whether there is no resident assembler to ask.
+ */
+const ResidentCompile Jimulator::compileResidentJimulator(
+    const char* const pathToS,
+    std::string& messages) {
+  const char* const socketName = getenv("AASM_SOCKET");
+  struct sockaddr_un address = {};
+  if (socketName == NULL ||
+      strlen(socketName) >= sizeof(address.sun_path)) {
+    return ResidentCompile::UNAVAILABLE;
+  }
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socketName);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return ResidentCompile::UNAVAILABLE;
+  }
+  if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+    close(fd);
+    return ResidentCompile::UNAVAILABLE;
+  }
+
+  // The reply is the exit status, carrying the messages, listing and image
+  const std::string request = std::string(pathToS) + '\n';
+  int status = -1;
+  int files[3] = {-1, -1, -1};
+  union {
+    struct cmsghdr header;
+    char space[CMSG_SPACE(sizeof(files))];
+  } control;
+  struct iovec part = {&status, sizeof(status)};
+  struct msghdr reply = {};
+  reply.msg_iov = &part;
+  reply.msg_iovlen = 1;
+  reply.msg_control = control.space;
+  reply.msg_controllen = sizeof(control.space);
+
+  const bool answered =
+      write(fd, request.data(), request.size()) == (ssize_t)request.size() &&
+      recvmsg(fd, &reply, MSG_CMSG_CLOEXEC) == sizeof(status);
+  close(fd);
+  if (not answered) {
+    return ResidentCompile::UNAVAILABLE;
+  }
+
+  struct cmsghdr* header = CMSG_FIRSTHDR(&reply);
+  if (header != NULL && header->cmsg_level == SOL_SOCKET &&
+      header->cmsg_type == SCM_RIGHTS &&
+      header->cmsg_len == CMSG_LEN(sizeof(files))) {
+    memcpy(files, CMSG_DATA(header), sizeof(files));
   }
-  wait(NULL);
+
+  messages.clear();
+  char buffer[4096];
+  ssize_t count;
+  for (off_t offset = 0;
+       files[0] >= 0 &&
+       (count = pread(files[0], buffer, sizeof(buffer), offset)) > 0;
+       offset += count) {
+    messages.append(buffer, count);
+  }
+
+  bool loaded = false;
+  if (status == 0 && files[1] >= 0 && files[2] >= 0) {
+    const std::string pathToKMD = "/proc/self/fd/" + std::to_string(files[1]);
+    const std::string pathToImage =
+        "/proc/self/fd/" + std::to_string(files[2]);
+
+    resetJimulator();
+    flushSourceFile();
+    loaded = readProgramImage(pathToImage.c_str(), pathToKMD.c_str());
+    if (not loaded) {
+      flushSourceFile();
+      loaded = readSourceFile(pathToKMD.c_str());
+    }
+  }
+
+  for (const int file : files) {
+    if (file >= 0) {
+      close(file);
+    }
+  }
+
+  return loaded ? ResidentCompile::LOADED : ResidentCompile::FAILED;
+}
+
+/**
+ * @brief Checks whether the file at `path` is an ELF file, which is loaded as
+ * it is rather than being assembled.
+ * @param path A path to the file to check.
+ * @return true if the file starts with the ELF magic number.
+ */
+const bool Jimulator::isElfFile(const char* const path) {
+  unsigned char magic[sizeof(ELF_MAGIC)];
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  const bool elf = read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+                   memcmp(magic, ELF_MAGIC, sizeof(magic)) == 0;
+  close(fd);
+  return elf;
 }
 
 /**
  * @brief Clears the existing `source` object and loads the file at `pathToKMD`
  * into Jimulator.
- * @param pathToKMD an absolute path to the `.kmd` file that will be loaded.
+ * @param pathToKMD an absolute path to the `.kmd` file, or ELF executable, that
+ * will be loaded.
  * @returns
  */
 const bool Jimulator::loadJimulator(const char* const pathToKMD) {
+  flushSourceFile();
+
+  if (isElfFile(pathToKMD)) {
+    return readElfFile(pathToKMD);
+  }
+
+  // Prefer the program image aasm wrote beside the listing, if it is current
+  if (readProgramImage(imagePathFor(pathToKMD).c_str(), pathToKMD)) {
+    return true;
+  }
+
   flushSourceFile();
   return readSourceFile(pathToKMD);
 }
@@ -370,7 +746,6 @@ void Jimulator::resetJimulator() {
  * @return const bool If setting the breakpoint succeeded.
  */
 const bool Jimulator::setBreakpoint(const uint32_t addr) {
-  unsigned int wordA = 0, wordB = 0;
   unsigned char address[ADDRESS_BUS_WIDTH] = {0};
 
   // Unpack address to byte array
@@ -378,29 +753,28 @@ const bool Jimulator::setBreakpoint(const uint32_t addr) {
     address[i] = getLeastSignificantByte(addr >> (8 * i));
   }
 
-  // Reads the breakpoints
-  if (not getBreakpointStatus(&wordA, &wordB)) {
+  // Brings the copy of the breakpoints up to date, if it is not already
+  if (not syncBreakpoints()) {
     return false;
   }
 
   // Checks to see if a breakpoint exists at this address and turns it off if so
-  for (int i = 0; i < MAX_NUMBER_OF_BREAKPOINTS; i++) {
-    if (((wordA >> i) & 1) != 0) {
-      BreakpointInfo bp;
-
-      // Gets breakpoint i from the list;
-      // checks if that breakpoint is set for current address;
-      // turns it off if so
-      if (getBreakpointDefinition(i, &bp) &&
-          (numericStringSubtraction(address, bp.addressA) == 0)) {
-        setBreakpointStatus(0, 1 << i);
-        return false;
-      }
-    }
+  auto existing = breakpoints.indices.find(addr);
+  if (existing != breakpoints.indices.end()) {
+    const unsigned int bit = 1 << existing->second;
+    setBreakpointStatus(0, bit);
+
+    // As Jimulator applies it
+    breakpoints.wordB = (~breakpoints.wordA & breakpoints.wordB) |
+                        (breakpoints.wordA & (breakpoints.wordB | bit));
+    breakpoints.wordA &= ~bit;
+    breakpoints.indices.erase(existing);
+    trackBreakpointChange();
+    return false;
   }
 
   // See if there are any more breakpoints to be set, return if not
-  int temp = (~wordA) & wordB;
+  int temp = (~breakpoints.wordA) & breakpoints.wordB;
   if (temp == 0) {
     return false;
   }
@@ -411,6 +785,11 @@ const bool Jimulator::setBreakpoint(const uint32_t addr) {
 
   int i = getNextFreeBreakpoint(temp);
   setBreakpointDefinition(i, &bp);
+
+  breakpoints.wordA |= 1 << i;
+  breakpoints.wordB |= 1 << i;
+  breakpoints.indices[addr] = i;
+  trackBreakpointChange();
   return true;
 }
 
@@ -476,7 +855,7 @@ const std::string Jimulator::getJimulatorTerminalMessages() {
   while (length > 0) {
     sendChar(static_cast<unsigned char>(BoardInstruction::FR_READ));
     sendChar(0);  // send the terminal number
-    sendChar(32);
+    sendChar(255);
     getChar(&length);  // get length of message
 
     // non-zero received from board - not an empty packet
@@ -491,31 +870,77 @@ const std::string Jimulator::getJimulatorTerminalMessages() {
 }
 
 /**
- * @brief Sends terminal information to Jimulator.
+ * @brief Sends terminal information to Jimulator. The key is queued behind any
+ * input that is still waiting to be sent.
  * @param val A key code.
  * @return true If the key was sent to Jimulator successfully.
  * @return false If the key was not sent to Jimulator successfully.
  */
 const bool Jimulator::sendTerminalInputToJimulator(const unsigned int val) {
   unsigned int key_pressed = val;
-  unsigned char res = 0;
 
   // Sending keys to Jimulator
-  if (((key_pressed >= ' ') && (key_pressed <= 0x7F)) ||
-      (key_pressed == '\n') || (key_pressed == '\b') || (key_pressed == '\t') ||
-      (key_pressed == '\a')) {
-    sendChar(static_cast<unsigned char>(
-        BoardInstruction::FR_WRITE));  // begins a write
-    sendChar(0);                       // tells where to send it
-    sendChar(1);                       // send length 1
-    sendChar(key_pressed);             // send the message - 1 char currently
-    getChar(&res);                     // Read the result
+  if (isTerminalCharacter(key_pressed)) {
+    terminalInput += static_cast<char>(key_pressed);
+    flushTerminalInput();
     return true;
   }
 
   return false;
 }
 
+/**
+ * @brief Sends a run of text to Jimulator as terminal input - for example,
+ * pasted text or redirected input. Characters that could not be typed at the
+ * terminal are dropped.
+ * @param text The text to send.
+ * @return const bool true if some of the text is still waiting to be sent, in
+ * which case `flushTerminalInput` should be called again later.
+ */
+const bool Jimulator::sendTerminalTextToJimulator(const std::string& text) {
+  for (const unsigned char c : text) {
+    if (isTerminalCharacter(c)) {
+      terminalInput += c;
+    }
+  }
+
+  return flushTerminalInput();
+}
+
+/**
+ * @brief Sends the queued terminal input to Jimulator, in frames of up to 255
+ * characters, until Jimulator has no room for more.
+ * @return const bool true if some of the input is still waiting to be sent,
+ * because the program has not yet read what was sent before it.
+ */
+const bool Jimulator::flushTerminalInput() {
+  while (not terminalInput.empty()) {
+    const unsigned char length = std::min(terminalInput.size(), 255ul);
+    unsigned char accepted = 0;
+
+    sendChar(static_cast<unsigned char>(BoardInstruction::FR_WRITE));
+    sendChar(0);  // tells where to send it
+    sendChar(length);
+    sendCharArray(length, (unsigned char*)terminalInput.data());
+    getChar(&accepted);  // how many characters fitted
+
+    terminalInput.erase(0, accepted);
+    if (accepted < length) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @brief Gets whether any terminal input is still waiting to be sent.
+ * @return const bool true if there is input waiting.
+ */
+const bool Jimulator::isTerminalInputWaiting() {
+  return not terminalInput.empty();
+}
+
 /**
  * @brief Get the memory values from Jimulator, starting to s_address.
  * @param s_address The address to start at, as an integer.
@@ -544,20 +969,20 @@ std::array<Jimulator::MemoryValues, 13> Jimulator::getJimulatorMemoryValues(
   bool firstFlag = false;
 
   // Moves our src line to the relevant line of the src file
-  if (source.pStart != NULL) {
-    src = source.pStart;  // Known to be valid
-    while ((src != NULL) && ((src->address < s_address) || not src->hasData)) {
-      src = src->next;
+  if (source.first() != NULL) {
+    src = source.lowerBound(s_address);
+    while ((src != NULL) && not src->hasData) {
+      src = source.next(src);
     }
 
     // We fell off the end; wrap to start
     if (src == NULL) {
-      src = source.pStart;
+      src = source.first();
       firstFlag = true;
 
       // Find a record with some data
       while ((src != NULL) && not src->hasData) {
-        src = src->next;
+        src = source.next(src);
       }
     }
   }
@@ -578,8 +1003,8 @@ std::array<Jimulator::MemoryValues, 13> Jimulator::getJimulatorMemoryValues(
 
     // Generate the hex
     if (src != NULL && currentAddressI == src->address) {
-      readValues[i].disassembly =
-          std::regex_replace(std::string(src->text), std::regex(";.*$"), "");
+      readValues[i].disassembly = std::regex_replace(
+          std::string(source.textOf(src)), std::regex(";.*$"), "");
       readValues[i].hex = generateMemoryHex(&src, s_address, &increment,
                                             currentAddressI, &memdata);
 
@@ -602,6 +1027,62 @@ std::array<Jimulator::MemoryValues, 13> Jimulator::getJimulatorMemoryValues(
   return readValues;
 }
 
+/**
+ * @brief Asks Jimulator to send status and console event frames down a
+ * connection of their own, so that they are never interleaved with replies.
+ * @param fd A second connection to a Jimulator running in socket mode.
+ * @return const bool true if Jimulator accepted the subscription.
+ */
+const bool Jimulator::subscribeToJimulatorEvents(const int fd) {
+  const unsigned char request[2] = {
+      static_cast<unsigned char>(BoardInstruction::SUBSCRIBE),
+      static_cast<unsigned char>(JimulatorEvent::STATUS) |
+          static_cast<unsigned char>(JimulatorEvent::CONSOLE)};
+  unsigned char ack;
+
+  if (write(fd, request, sizeof(request)) != sizeof(request) ||
+      read(fd, &ack, 1) != 1) {
+    return false;
+  }
+
+  // Events are read as they arrive, without waiting for more
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return true;
+}
+
+/**
+ * @brief Reads every event frame Jimulator has sent since this was last
+ * called. A frame is {type, payload length, payload...}; a frame that has only
+ * partly arrived is kept until the rest of it does.
+ * @return const int A mask of the types of event read, or -1 if Jimulator has
+ * stopped sending them.
+ */
+const int Jimulator::readJimulatorEvents() {
+  static std::vector<unsigned char> pending;
+  unsigned char data[256];
+  int events = 0;
+  int count;
+
+  while ((count = read(jimulatorEvents, data, sizeof(data))) > 0) {
+    pending.insert(pending.end(), data, data + count);
+  }
+
+  // End of file, or an error other than there being nothing left to read
+  if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+    return -1;
+  }
+
+  long unsigned int i = 0;
+  while (pending.size() - i >= 2 &&
+         pending.size() - i >= 2u + pending[i + 1]) {
+    events |= pending[i];
+    i += 2 + pending[i + 1];
+  }
+
+  pending.erase(pending.begin(), pending.begin() + i);
+  return events;
+}
+
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! //
 // !!!!!!!!!! Functions below are not included in the header file !!!!!!!!!! //
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! //
@@ -630,6 +1111,17 @@ constexpr const char getLeastSignificantByte(const int val) {
   return val & 0xFF;
 }
 
+/**
+ * @brief Whether a character can be typed at the terminal, and so be sent to
+ * Jimulator as input.
+ * @param c The character.
+ * @return const bool true if the character can be sent.
+ */
+constexpr const bool isTerminalCharacter(const unsigned int c) {
+  return ((c >= ' ') && (c <= 0x7F)) || (c == '\n') || (c == '\b') ||
+         (c == '\t') || (c == '\a');
+}
+
 /**
  * @brief Rotates an integers bits to the right by 1 byte.
  * @param val The integer to rotate.
@@ -696,13 +1188,13 @@ inline const bool getBreakpointStatus(unsigned int* wordA,
  * @param src A pointer to the source line pointer.
  * @return bool true if the firstFlag is set.
  */
-constexpr const bool moveSrc(bool firstFlag, SourceFileLine** src) {
+inline const bool moveSrc(bool firstFlag, SourceFileLine** src) {
   do {
-    if ((*src)->next != NULL) {
-      (*src) = (*src)->next;
+    if (source.next(*src) != NULL) {
+      (*src) = source.next(*src);
     } else {
       if (not firstFlag) {
-        (*src) = source.pStart;
+        (*src) = source.first();
         firstFlag = true;
       } else {
         (*src) = NULL;
@@ -987,17 +1479,21 @@ inline const ClientState getBoardStatus() {
   unsigned char clientStatus = 0;
   int stepsSinceReset;
   int leftOfWalk;
+  int breakpointGeneration;
 
   // If the board sends back the wrong the amount of data
   sendChar(static_cast<unsigned char>(BoardInstruction::WOT_U_DO));
 
   if (getChar(&clientStatus) != 1 ||
-      getNBytes(&leftOfWalk, 4) != 4 ||       // Steps remaining
-      getNBytes(&stepsSinceReset, 4) != 4) {  // Steps since reset
+      getNBytes(&leftOfWalk, 4) != 4 ||            // Steps remaining
+      getNBytes(&stepsSinceReset, 4) != 4 ||       // Steps since reset
+      getNBytes(&breakpointGeneration, 4) != 4) {  // Breakpoint changes
     std::cout << "board not responding\n";
     return ClientState::BROKEN;
   }
 
+  boardBreakpointGeneration = breakpointGeneration;
+
   // TODO: clientStatus represents what the board is doing and why - can be
   //       reflected in the view? and the same with stepsSinceReset
 
@@ -1101,8 +1597,8 @@ constexpr void numericStringAndIntAddition(unsigned char* const s, int n) {
  * @return const int The difference between the current address to display and
  * the next address that needs to be displayed.
  */
-constexpr const int disassembleSourceFile(SourceFileLine* src,
-                                          unsigned int addr) {
+inline const int disassembleSourceFile(SourceFileLine* src,
+                                       unsigned int addr) {
   if (src == NULL || src == nullptr) {
     return 4;
   }
@@ -1111,7 +1607,7 @@ constexpr const int disassembleSourceFile(SourceFileLine* src,
 
   // Do have a source line, but shan't use it
   if (diff == 0) {
-    src = src->next;  // Use the one after
+    src = source.next(src);  // Use the one after
     if (src != NULL) {
       diff = src->address - addr;  // if present
     } else {
@@ -1127,8 +1623,9 @@ constexpr const int disassembleSourceFile(SourceFileLine* src,
 }
 
 /**
- * @brief Reads all of the breakpoints from Jimulator into a map that can be
- * indexed by address.
+ * @brief Gets all of the breakpoints set in Jimulator as a map that can be
+ * indexed by address. The breakpoints come from the client's copy, which is
+ * only read back from Jimulator when it is out of date.
  * The address is the key, with a boolean as the value to form a pair. However
  * the boolean is redundant - since the address is the key, if you lookup an
  * address in the map and it is present, you know that a breakpoint was found
@@ -1137,27 +1634,61 @@ constexpr const int disassembleSourceFile(SourceFileLine* src,
  */
 inline const std::unordered_map<u_int32_t, bool> getAllBreakpoints() {
   std::unordered_map<u_int32_t, bool> breakpointAddresses;
-  unsigned int wordA, wordB;
-  bool error = false;
-
-  // If reading the breakpoints was a success, loops through all of the possible
-  // breakpoints - if they are active, add them to the map.
-  if (getBreakpointStatus(&wordA, &wordB)) {
-    for (int i = 0; (i < MAX_NUMBER_OF_BREAKPOINTS) && not error; i++) {
-      if (((wordA >> i) & 1) != 0) {
-        BreakpointInfo bp;
-
-        if (getBreakpointDefinition(i, &bp)) {
-          u_int32_t addr = numericStringToInt(4, bp.addressA);
-          breakpointAddresses.insert({addr, true});
-        } else {
-          error = true;  // Read failure causes loop termination
-        }
+
+  syncBreakpoints();
+  for (const auto& bp : breakpoints.indices) {
+    breakpointAddresses.insert({bp.first, true});
+  }
+
+  return breakpointAddresses;
+}
+
+/**
+ * @brief Re-reads the breakpoints from Jimulator into `breakpoints`, unless
+ * the copy is already up to date with the generation Jimulator last reported.
+ * @return true if the copy is up to date, false if reading it failed.
+ */
+inline const bool syncBreakpoints() {
+  if (breakpoints.valid &&
+      breakpoints.generation == boardBreakpointGeneration) {
+    return true;  // Nothing has changed
+  }
+
+  breakpoints.valid = false;
+  breakpoints.indices.clear();
+  if (not getBreakpointStatus(&breakpoints.wordA, &breakpoints.wordB)) {
+    return false;
+  }
+
+  // Loops through all of the possible breakpoints - if they are active, add
+  // them to the map
+  for (int i = 0; i < MAX_NUMBER_OF_BREAKPOINTS; i++) {
+    if (((breakpoints.wordA >> i) & 1) != 0) {
+      BreakpointInfo bp;
+
+      if (not getBreakpointDefinition(i, &bp)) {
+        breakpoints.indices.clear();
+        return false;  // Read failure - try again next time
       }
+      breakpoints.indices[numericStringToInt(4, bp.addressA)] = i;
     }
   }
 
-  return breakpointAddresses;
+  breakpoints.valid = true;
+  breakpoints.generation = boardBreakpointGeneration;
+  return true;
+}
+
+/**
+ * @brief Accounts for a change this client has made to the breakpoints, which
+ * Jimulator counts as one generation. If the copy was up to date before the
+ * change it still is, so the change is not read back.
+ */
+inline void trackBreakpointChange() {
+  if (breakpoints.generation == boardBreakpointGeneration) {
+    boardBreakpointGeneration++;
+  }
+  breakpoints.generation++;
 }
 
 // ! COMPILING STUFF BELOW! !
@@ -1168,19 +1699,43 @@ inline const std::unordered_map<u_int32_t, bool> getAllBreakpoints() {
  * @brief removes all of the old references to the previous file.
  */
 inline void flushSourceFile() {
-  SourceFileLine* old = source.pStart;
-  source.pStart = NULL;
-  source.pEnd = NULL;
+  source.lines.clear();
 
-  while (old != NULL) {
-    if (old->text != NULL) {
-      free(old->text);
-    }
+  if (source.mapping != NULL) {
+    munmap((void*)source.mapping, source.mappingLength);
+    source.mapping = NULL;
+    source.mappingLength = 0;
+  }
+}
+
+/**
+ * @brief Reads a whole file into an anonymous mapping of its own. The file
+ * itself is never mapped: aasm truncates its outputs before writing them
+ * again, and a page of a truncated file mapping faults with SIGBUS.
+ * @param fd The file, open for reading.
+ * @param length The length of the file in bytes.
+ * @return void* The read only copy, to be released with `munmap`, or
+ * MAP_FAILED if it could not be read in full.
+ */
+inline void* copyFile(const int fd, const size_t length) {
+  void* copy = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (copy == MAP_FAILED) {
+    return MAP_FAILED;
+  }
 
-    SourceFileLine* trash = old;
-    old = old->next;
-    free(trash);
+  for (size_t done = 0; done < length;) {
+    ssize_t count =
+        pread(fd, static_cast<char*>(copy) + done, length - done, done);
+    if (count <= 0) {  // Shrunk since it was measured
+      munmap(copy, length);
+      return MAP_FAILED;
+    }
+    done += count;
   }
+
+  mprotect(copy, length, PROT_READ);
+  return copy;
 }
 
 /**
@@ -1189,37 +1744,33 @@ inline void flushSourceFile() {
  * @return int the hex value or -1 if not a legal hex digit
  */
 constexpr const int checkHexCharacter(const char character) {
-  if ((character >= '0') && (character <= '9')) {
-    return character - '0';
-  } else if ((character >= 'A') && (character <= 'F')) {
-    return character - 'A' + 10;
-  } else if ((character >= 'a') && (character <= 'f')) {
-    return character - 'a' + 10;
-  } else {
-    return -1;
-  }
+  return HEX_DIGIT_TABLE[static_cast<unsigned char>(character)];
 }
 
 /**
- * @brief Reads a n from a string of text in the .kmd file.
- * @param f A file handle.
- * @param c A pointer to the current character being read in the file.
- * @param n A pointer for where to read the found n into.
- * @return int The read n.
+ * @brief Reads a number from a line of text in the .kmd file.
+ * @param p A pointer to the current character, moved to the first character
+ * after the number.
+ * @param end The end of the line.
+ * @param n A pointer for where to read the found number into.
+ * @return int The size of the number in bytes, or 0 if none was found.
  */
-constexpr const int readNumberFromFile(FILE* const f,
-                                       char* const c,
+constexpr const int readNumberFromText(const char** const p,
+                                       const char* const end,
                                        unsigned int* const n) {
-  while ((*c == ' ') || (*c == '\t')) {
-    *c = getc(f);  // Skip spaces
+  while ((*p < end) && ((**p == ' ') || (**p == '\t'))) {
+    (*p)++;  // Skip spaces
   }
 
-  int j = 0, value = 0;
-  for (int digit = checkHexCharacter(*c); digit >= 0;
-       digit = checkHexCharacter(*c), j++) {
+  int j = 0;
+  unsigned int value = 0;
+  for (; *p < end; (*p)++, j++) {
+    int digit = checkHexCharacter(**p);
+    if (digit < 0) {
+      break;  // Exits at first non-hex character
+    }
     value = (value << 4) | digit;  // Accumulate digit
-    *c = getc(f);                  // Get next character
-  }  // Exits at first non-hex character (which is discarded)
+  }
 
   j = (j + 1) / 2;  // Round digit count to bytes
 
@@ -1242,41 +1793,382 @@ constexpr const int readNumberFromFile(FILE* const f,
 }
 
 /**
- * @brief Converts a provided memory size into a Jimulator legal memory size.
- * @param size The size to convert.
- * @return unsigned int The Jimulator legal size.
+ * @brief Adds a little endian value to a program image, extending the last
+ * range if the value follows straight on from it.
+ * @param image The program image being built.
+ * @param address The address of the value.
+ * @param value The value.
+ * @param size The size of the value in bytes.
  */
-constexpr const unsigned int boardTranslateMemsize(const int size) {
-  switch (size) {
-    case 1:
-      return 0;
-    case 2:
-      return 1;
-    case 4:
-      return 2;
-    case 8:
-      return 3;
-    default:
-      return 0;
+inline void appendToImage(std::vector<MemoryRange>& image,
+                          const unsigned int address,
+                          const unsigned int value,
+                          const int size) {
+  if (image.empty() ||
+      image.back().address + image.back().bytes.size() != address) {
+    image.push_back({address, {}});
+  }
+
+  for (int i = 0; i < size; i++) {
+    image.back().bytes.push_back(getLeastSignificantByte(value >> (8 * i)));
+  }
+}
+
+/**
+ * @brief Sends a whole program image to Jimulator as a single frame, and waits
+ * for it to be stored. Ranges are stored in order, so where they overlap the
+ * later one wins - as with lines later in a .kmd file.
+ * @param image The program image.
+ */
+inline void boardLoadImage(const std::vector<MemoryRange>& image) {
+  std::vector<unsigned char> frame;
+
+  auto appendWord = [&frame](unsigned int word) {
+    for (int i = 0; i < 4; i++) {
+      frame.push_back(getLeastSignificantByte(word >> (8 * i)));
+    }
+  };
+
+  frame.push_back(static_cast<unsigned char>(BoardInstruction::LOAD_IMAGE));
+  appendWord(image.size());
+  for (const auto& range : image) {
+    appendWord(range.address);
+    appendWord(range.bytes.size());
+    frame.insert(frame.end(), range.bytes.begin(), range.bytes.end());
+  }
+
+  sendCharArray(frame.size(), frame.data());
+
+  unsigned char ack;
+  getChar(&ack);
+}
+
+/**
+ * @brief Sends ranges held in a mapped file to Jimulator in a single
+ * LOAD_IMAGE frame, and waits for it to be acknowledged. The frame and range
+ * headers are small copies; the range bytes go straight from the mapping.
+ * @param ranges The ranges to be loaded.
+ */
+inline void boardLoadMapped(const std::vector<MappedRange>& ranges) {
+  static const std::array<unsigned char, 256> zeroes{};
+  std::vector<unsigned char> header;
+  auto appendWord = [&header](unsigned int value) {
+    for (int i = 0; i < 4; i++) {
+      header.push_back(getLeastSignificantByte(value >> (8 * i)));
+    }
+  };
+
+  header.push_back(static_cast<unsigned char>(BoardInstruction::LOAD_IMAGE));
+  appendWord(ranges.size());
+  for (const auto& range : ranges) {
+    appendWord(range.address);
+    appendWord(range.memoryLength);
+    sendCharArray(header.size(), header.data());
+    header.clear();
+
+    if (range.fileLength > 0) {
+      sendCharArray(range.fileLength, const_cast<unsigned char*>(range.bytes));
+    }
+    for (unsigned int left = range.memoryLength - range.fileLength; left > 0;) {
+      const unsigned int chunk =
+          std::min<unsigned int>(left, zeroes.size());
+      sendCharArray(chunk, const_cast<unsigned char*>(zeroes.data()));
+      left -= chunk;
+    }
+  }
+  if (not header.empty()) {
+    sendCharArray(header.size(), header.data());  // No ranges at all
+  }
+
+  unsigned char ack;
+  getChar(&ack);
+}
+
+/**
+ * @brief Sets the program counter, so the program starts from `address`.
+ * @param address The address to start from.
+ */
+inline void boardSetProgramCounter(const unsigned int address) {
+  sendChar(static_cast<unsigned char>(BoardInstruction::SET_REG));
+  sendNBytes(15, 4);  // PC
+  sendNBytes(1, 2);   // One register
+  sendNBytes(address, 4);
+}
+
+/**
+ * @brief Gets the path of the program image that aasm writes beside a `.kmd`
+ * file.
+ * @param pathToKMD A path to a `.kmd` file.
+ * @return const std::string The path with its `.kmd` extension swapped for
+ * `.kmi`.
+ */
+inline const std::string imagePathFor(const char* const pathToKMD) {
+  std::string path(pathToKMD);
+  auto dot = path.rfind('.');
+
+  if (dot != std::string::npos && path.compare(dot, 4, ".kmd") == 0) {
+    path.erase(dot);
+  }
+
+  return path + ".kmi";
+}
+
+/**
+ * @brief Loads a program image written by aasm. The image is copied in, its
+ * segments are sent to Jimulator straight from the copy in a single
+ * LOAD_IMAGE frame, and its line table - already sorted by address - becomes
+ * the source lines, with text viewed in place.
+ * @param pathToImage A path to the `.kmi` file to be loaded.
+ * @param pathToKMD A path to the `.kmd` listing written alongside it. The
+ * image is only used if it is at least as new as the listing.
+ * @return true if the image was loaded, false if it is missing, stale or
+ * malformed (in which case nothing has been sent to Jimulator).
+ */
+inline const bool readProgramImage(const char* const pathToImage,
+                                   const char* const pathToKMD) {
+  struct stat imageStatus, kmdStatus;
+  if (stat(pathToImage, &imageStatus) != 0 ||
+      imageStatus.st_size < IMAGE_HEADER_SIZE) {
+    return false;
+  }
+  if (stat(pathToKMD, &kmdStatus) == 0 &&
+      kmdStatus.st_mtime > imageStatus.st_mtime) {
+    return false;  // Left over from an older assembly
   }
+
+  int fd = open(pathToImage, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  void* mapping = copyFile(fd, imageStatus.st_size);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+
+  return loadProgramImage(mapping, imageStatus.st_size);
 }
 
 /**
- * @brief Sets a memory value of a given address to a new value.
- * This code is LEGACY. It used to run with a check on `board_version`:
- * however `board_version` always passed the check due to the certainty of the
- * "hardware" run under the emulator; therefore the check has been removed.
- * @param address pointer to the address (in bytes)
- * @param value pointer to the new value to be stored
- * @param size width of current memory (in bytes)
+ * @brief Loads a program image already in memory. Its segments are sent to
+ * Jimulator straight from the mapping, and its line table becomes the source
+ * lines, with text viewed in place.
+ * @param mapping The image, mapped with `mmap`; kept by the source lines if it
+ * is loaded, and unmapped otherwise.
+ * @param length The length of the image.
+ * @return true if the image was loaded, false if it is malformed (in which
+ * case nothing has been sent to Jimulator).
  */
-inline void boardSetMemory(unsigned char* const address,
-                           unsigned char* const value,
-                           const int size) {
-  sendChar(BoardInstruction::SET_MEM | boardTranslateMemsize(size));
-  sendCharArray(ADDRESS_BUS_WIDTH, address);  // send address
-  sendNBytes(1, 2);                           // send width
-  sendCharArray(size, value);
+inline const bool loadProgramImage(void* const mapping, const size_t length) {
+  const unsigned char* const base = static_cast<const unsigned char*>(mapping);
+  auto word = [base](size_t offset) {
+    return static_cast<unsigned int>(numericStringToInt(4, base + offset));
+  };
+
+  const unsigned int entry = word(4), flags = word(8);
+  const size_t segmentCount = word(12), symbolCount = word(16),
+               lineCount = word(20), textLength = word(24);
+  const size_t segments = IMAGE_HEADER_SIZE;
+  const size_t lines = segments + segmentCount * IMAGE_SEGMENT_SIZE +
+                       symbolCount * IMAGE_SYMBOL_SIZE;
+  const size_t text = lines + lineCount * IMAGE_LINE_SIZE;
+
+  // Check the tables, and every segment, lie within the file
+  bool valid = memcmp(base, IMAGE_MAGIC, 4) == 0 && text + textLength <= length;
+  for (size_t i = 0; valid && i < segmentCount; i++) {
+    size_t entryOffset = segments + i * IMAGE_SEGMENT_SIZE;
+    valid = word(entryOffset + 8) + (size_t)word(entryOffset + 4) <= length;
+  }
+  for (size_t i = 0; valid && i < lineCount; i++) {
+    size_t entryOffset = lines + i * IMAGE_LINE_SIZE;
+    valid = word(entryOffset + 4) + (size_t)(word(entryOffset + 8) & 0xFFFF) <=
+            textLength;
+  }
+
+  if (not valid) {
+    munmap(mapping, length);
+    return false;
+  }
+
+  source.mapping = reinterpret_cast<const char*>(base);
+  source.mappingLength = length;
+  source.lines.resize(lineCount);
+
+  for (size_t i = 0; i < lineCount; i++) {
+    const size_t entryOffset = lines + i * IMAGE_LINE_SIZE;
+    SourceFileLine& line = source.lines[i];
+    int byteTotal = 0;
+
+    line.address = word(entryOffset);
+    line.textOffset = text + word(entryOffset + 4);
+    line.textLength = std::min<unsigned int>(word(entryOffset + 8) & 0xFFFF,
+                                             SOURCE_TEXT_LENGTH);  // Clip
+    for (int j = 0; j < SOURCE_FIELD_COUNT; j++) {
+      line.dataSize[j] = base[entryOffset + 12 + j];
+      line.dataValue[j] = 0;  // Memory is read back from Jimulator
+      byteTotal += line.dataSize[j];
+    }
+    line.hasData = byteTotal != 0;
+  }
+
+  std::vector<MappedRange> ranges(segmentCount);
+  for (size_t i = 0; i < segmentCount; i++) {
+    const size_t entryOffset = segments + i * IMAGE_SEGMENT_SIZE;
+    ranges[i].address = word(entryOffset);
+    ranges[i].bytes = base + word(entryOffset + 8);
+    ranges[i].fileLength = ranges[i].memoryLength = word(entryOffset + 4);
+  }
+  boardLoadMapped(ranges);
+
+  // Start from the entry point, if the program declared one
+  if ((flags & IMAGE_FLAG_ENTRY) != 0) {
+    boardSetProgramCounter(entry);
+  }
+
+  return true;
+}
+
+/**
+ * @brief Loads an ELF32 ARM executable. The file is copied in, every `PT_LOAD`
+ * segment is sent to Jimulator straight from the copy in a single
+ * LOAD_IMAGE frame, and the PC is set to `e_entry`. There is no listing, so
+ * each word of a segment becomes a source line, named after the symbol from
+ * `.symtab` at its address (if any) with the text viewed in place.
+ * @param pathToELF A path to the ELF executable to be loaded.
+ * @return true if the executable was loaded, false if it could not be read or
+ * is not a 32-bit little-endian ARM ELF file (in which case nothing has been
+ * sent to Jimulator).
+ */
+inline const bool readElfFile(const char* const pathToELF) {
+  int fd = open(pathToELF, O_RDONLY);
+  struct stat status;
+  if (fd < 0 || fstat(fd, &status) != 0 || status.st_size < ELF_HEADER_SIZE) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    std::cout << "Executable could not be opened!\n";
+    return false;
+  }
+
+  void* mapping = copyFile(fd, status.st_size);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    std::cout << "Executable could not be opened!\n";
+    return false;
+  }
+
+  const unsigned char* const base = static_cast<const unsigned char*>(mapping);
+  const size_t length = status.st_size;
+  auto word = [base](size_t offset) {
+    return static_cast<unsigned int>(numericStringToInt(4, base + offset));
+  };
+  auto half = [base](size_t offset) {
+    return static_cast<unsigned int>(numericStringToInt(2, base + offset));
+  };
+
+  const unsigned int entry = word(24);
+  const size_t programHeaders = word(28), sectionHeaders = word(32);
+  const size_t programHeaderSize = half(42), programHeaderCount = half(44);
+  const size_t sectionHeaderSize = half(46), sectionHeaderCount = half(48);
+
+  // Check this is an executable Jimulator can run, with its program headers
+  // and every loadable segment lying within the file
+  bool valid = memcmp(base, ELF_MAGIC, 4) == 0 && base[4] == ELF_CLASS_32 &&
+               base[5] == ELF_DATA_LSB && half(18) == ELF_MACHINE_ARM &&
+               programHeaderSize >= ELF_PROGRAM_HEADER_SIZE &&
+               programHeaders + programHeaderCount * programHeaderSize <=
+                   length;
+
+  std::vector<MappedRange> ranges;
+  for (size_t i = 0; valid && i < programHeaderCount; i++) {
+    const size_t header = programHeaders + i * programHeaderSize;
+    if (word(header) != ELF_PT_LOAD) {
+      continue;
+    }
+
+    MappedRange range;
+    range.address = word(header + 8);
+    range.bytes = base + word(header + 4);
+    range.fileLength = word(header + 16);
+    range.memoryLength = word(header + 20);
+    valid = word(header + 4) + (size_t)range.fileLength <= length &&
+            range.fileLength <= range.memoryLength;
+    ranges.push_back(range);
+  }
+
+  if (not valid) {
+    munmap(mapping, length);
+    std::cout << "Not an ARM executable!\n";
+    return false;
+  }
+
+  source.mapping = reinterpret_cast<const char*>(base);
+  source.mappingLength = length;
+
+  // Symbol names, by address, as views into the string table. The symbol
+  // table is found by type rather than name, so `symtab` and `.symtab` both do
+  std::unordered_map<unsigned int, std::pair<unsigned int, unsigned int>> names;
+  if (sectionHeaderSize >= ELF_SECTION_HEADER_SIZE &&
+      sectionHeaders + sectionHeaderCount * sectionHeaderSize <= length) {
+    for (size_t i = 0; i < sectionHeaderCount; i++) {
+      const size_t header = sectionHeaders + i * sectionHeaderSize;
+      const size_t link = word(header + 24);
+      if (word(header + 4) != ELF_SHT_SYMTAB || link >= sectionHeaderCount) {
+        continue;
+      }
+
+      const size_t strings = sectionHeaders + link * sectionHeaderSize;
+      const size_t symbols = word(header + 16), symbolsLength = word(header + 20);
+      const size_t text = word(strings + 16), textLength = word(strings + 20);
+      if (symbols + symbolsLength > length || text + textLength > length) {
+        continue;
+      }
+
+      // Symbol 0 is always the null symbol
+      for (size_t s = ELF_SYMBOL_SIZE; s + ELF_SYMBOL_SIZE <= symbolsLength;
+           s += ELF_SYMBOL_SIZE) {
+        const size_t symbol = symbols + s;
+        const unsigned int name = word(symbol), type = base[symbol + 12] & 0xF;
+        if (name == 0 || name >= textLength || half(symbol + 14) == 0 ||
+            type == ELF_STT_SECTION || type == ELF_STT_FILE) {
+          continue;
+        }
+
+        const char* start = reinterpret_cast<const char*>(base + text + name);
+        names.emplace(word(symbol + 4),
+                      std::make_pair(text + name,
+                                     std::min<unsigned int>(
+                                         strnlen(start, textLength - name),
+                                         SOURCE_TEXT_LENGTH)));
+      }
+    }
+  }
+
+  // One line per word of each segment (partial words at the ends)
+  for (const auto& range : ranges) {
+    for (unsigned int offset = 0; offset < range.memoryLength;) {
+      const unsigned int address = range.address + offset;
+      const unsigned int size = std::min<unsigned int>(
+          4 - (address & 3), range.memoryLength - offset);
+      SourceFileLine line{};
+      auto name = names.find(address);
+
+      line.hasData = true;
+      line.address = address;
+      line.dataSize[0] = size;
+      if (name != names.end()) {
+        line.textOffset = name->second.first;
+        line.textLength = name->second.second;
+      }
+      source.lines.push_back(line);
+      offset += size;
+    }
+  }
+  source.sort();
+
+  boardLoadMapped(ranges);
+  boardSetProgramCounter(entry);
+  return true;
 }
 
 /**
@@ -1288,9 +2180,9 @@ inline const bool readSourceFile(const char* const pathToKMD) {
   // TODO: this function is a jumbled mess, refactor and remove sections
   unsigned int oldAddress, dSize[SOURCE_FIELD_COUNT],
       dValue[SOURCE_FIELD_COUNT];
-  int byteTotal, textLength;
-  char buffer[SOURCE_TEXT_LENGTH + 1];  // + 1 for terminator
-  SourceFileLine* currentLine;
+  int byteTotal;
+  SourceFileLine* currentLine;  // Valid until the next line is added
+  std::vector<MemoryRange> image;  // Sent to Jimulator in one go at the end
 
   // `system` runs the paramter string as a shell command (i.e. it launches a
   // new process) `pidof` checks to see if a process by the name `jimulator` is
@@ -1301,22 +2193,46 @@ inline const bool readSourceFile(const char* const pathToKMD) {
   }*/
 
   // If file cannot be read, return false
-  FILE* komodoSource = fopen(pathToKMD, "r");
-  if (komodoSource == NULL) {
+  int fd = open(pathToKMD, O_RDONLY);
+  struct stat status;
+  if (fd < 0 || fstat(fd, &status) != 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
     std::cout << "Source could not be opened!\n";
     return false;
   }
 
+  // Copy the whole file; line text is kept as views into the copy
+  if (status.st_size > 0) {
+    void* mapping = copyFile(fd, status.st_size);
+    if (mapping == MAP_FAILED) {
+      close(fd);
+      std::cout << "Source could not be opened!\n";
+      return false;
+    }
+    source.mapping = static_cast<const char*>(mapping);
+    source.mappingLength = status.st_size;
+  }
+  close(fd);
+
+  const char* p = source.mapping;
+  const char* const fileEnd = source.mapping + source.mappingLength;
   bool hasOldAddress = false;  // Don't know where we start
 
-  // Repeat until end of file
-  while (not feof(komodoSource)) {
-    unsigned int address = 0;     // Really needed?
-    bool flag = false;            // Haven't found an address yet
-    char c = getc(komodoSource);  // The current character being parsed
+  // Repeat until end of file, a line at a time
+  while (p < fileEnd) {
+    const char* lineEnd =
+        static_cast<const char*>(memchr(p, '\n', fileEnd - p));
+    if (lineEnd == NULL) {
+      lineEnd = fileEnd;
+    }
+
+    unsigned int address = 0;  // Really needed?
+    bool flag = false;         // Haven't found an address yet
 
     // If the first character is a colon, read a symbol record
-    if (c == ':') {
+    if (*p == ':') {
       hasOldAddress = false;  // Don't retain position
     }
 
@@ -1328,18 +2244,18 @@ inline const bool readSourceFile(const char* const pathToKMD) {
       }
 
       byteTotal = 0;
-      flag = readNumberFromFile(komodoSource, &c, &address) != 0;
+      flag = readNumberFromText(&p, lineEnd, &address) != 0;
 
       // Read a new address - and if we got an address, try for data fields
       if (flag) {
-        if (c == ':') {
-          c = getc(komodoSource);  // Skip colon
+        if ((p < lineEnd) && (*p == ':')) {
+          p++;  // Skip colon
         }
 
         // Loop on data fields
         // repeat several times or until `illegal' character met
         for (int j = 0; j < SOURCE_FIELD_COUNT; j++) {
-          dSize[j] = readNumberFromFile(komodoSource, &c, &dValue[j]);
+          dSize[j] = readNumberFromText(&p, lineEnd, &dValue[j]);
 
           if (dSize[j] == 0) {
             break;  // Quit if nothing found
@@ -1357,133 +2273,69 @@ inline const bool readSourceFile(const char* const pathToKMD) {
         flag = true;           // Note we do have an address
       }
 
-      // We have a record with an address
-      if (flag) {
-        while ((c != ';') && (c != '\n') && not feof(komodoSource)) {
-          c = getc(komodoSource);
+      // We have a record with an address; check for field separator
+      const char* text =
+          flag ? static_cast<const char*>(memchr(p, ';', lineEnd - p)) : NULL;
+
+      if (text != NULL) {
+        text++;
+        if ((text < lineEnd) && (*text == ' ')) {
+          text++;  // Skip formatting space
         }
 
-        // Check for field separator
-        if (c == ';') {
-          c = getc(komodoSource);
-          if (c == ' ') {
-            c = getc(komodoSource);  // Skip formatting space
-          }
+        source.lines.emplace_back();  // Create new record
+        currentLine = &source.lines.back();
+        currentLine->address = address;
+        currentLine->textOffset = text - source.mapping;
+        currentLine->textLength =
+            std::min<long>(lineEnd - text, SOURCE_TEXT_LENGTH);  // Clip
 
-          textLength = 0;  // Measure (& buffer) source line
+        byteTotal = 0;  // Inefficient
+        for (int j = 0; j < SOURCE_FIELD_COUNT; j++) {
+          currentLine->dataSize[j] = dSize[j];  // Bytes, not digits
+          currentLine->dataValue[j] = dValue[j];
 
-          // Everything to end of line (or clip)
-          while ((c != '\n') && not feof(komodoSource) &&
-                 (textLength < SOURCE_TEXT_LENGTH)) {
-            buffer[textLength++] = c;
-            c = getc(komodoSource);
+          if ((currentLine->dataSize[j] > 0) &&
+              ((currentLine->dataSize[j] + byteTotal) <= SOURCE_BYTE_COUNT)) {
+            appendToImage(image, address + byteTotal, currentLine->dataValue[j],
+                          currentLine->dataSize[j]);
           }
 
-          buffer[textLength++] = '\0';  // textLength now length incl. '\0'
-          currentLine = (SourceFileLine *)malloc(sizeof(SourceFileLine));  // Create new record
-          currentLine->address = address;
-
-          byteTotal = 0;  // Inefficient
-          for (int j = 0; j < SOURCE_FIELD_COUNT; j++) {
-            currentLine->dataSize[j] = dSize[j];  // Bytes, not digits
-            currentLine->dataValue[j] = dValue[j];
-
-            if ((currentLine->dataSize[j] > 0) &&
-                ((currentLine->dataSize[j] + byteTotal) <= SOURCE_BYTE_COUNT)) {
-              unsigned char addr[4], data[4];
-
-              for (int i = 0; i < 4; i++) {
-                addr[i] =
-                    getLeastSignificantByte((address + byteTotal) >> (8 * i));
-              }
-              for (int i = 0; i < currentLine->dataSize[j]; i++) {
-                data[i] = getLeastSignificantByte(currentLine->dataValue[j] >>
-                                                  (8 * i));
-              }
-
-              // Ignore Boolean error return value for now
-              boardSetMemory(addr, data, currentLine->dataSize[j]);
-            }
+          byteTotal = byteTotal + currentLine->dataSize[j];
+          currentLine->hasData = (byteTotal != 0);  // If blank line
+        }
 
-            byteTotal = byteTotal + currentLine->dataSize[j];
-            currentLine->hasData = (byteTotal != 0);  // If blank line
-          }
+        // clips source record - essential
+        if (byteTotal > SOURCE_BYTE_COUNT) {
+          int m = 0;
 
-          // clips source record - essential
-          if (byteTotal > SOURCE_BYTE_COUNT) {
-            int m = 0;
-
-            for (int j = 0; j < SOURCE_FIELD_COUNT; j++) {
-              m = m + currentLine->dataSize[j];
-              if (m <= SOURCE_BYTE_COUNT) {
-                dSize[j] = 0;
-                byteTotal = byteTotal - currentLine->dataSize[j];
-              } else {
-                dSize[j] = currentLine->dataSize[j];  // Bytes, not digits
-                currentLine->dataSize[j] = 0;
-              }
+          for (int j = 0; j < SOURCE_FIELD_COUNT; j++) {
+            m = m + currentLine->dataSize[j];
+            if (m <= SOURCE_BYTE_COUNT) {
+              dSize[j] = 0;
+              byteTotal = byteTotal - currentLine->dataSize[j];
+            } else {
+              dSize[j] = currentLine->dataSize[j];  // Bytes, not digits
+              currentLine->dataSize[j] = 0;
             }
-
-            // error here?
-            std::cout << "OVERFLOW " << dSize[0] << " " << dSize[1] << " "
-                      << dSize[2] << " " << dSize[3] << " " << byteTotal
-                      << std::endl;
-          }
-
-          // Copy text to buffer
-	  currentLine->text = (char *)malloc(textLength);
-	  for (int j = 0; j < textLength; j++) {
-            currentLine->text[j] = buffer[j];
-          }
-
-          SourceFileLine* temp1 = source.pStart;
-          SourceFileLine* temp2 = NULL;
-
-          while ((temp1 != NULL) && (address >= temp1->address)) {
-            temp2 = temp1;
-            temp1 = temp1->next;
           }
 
-          currentLine->next = temp1;
-          currentLine->prev = temp2;
-
-          if (temp1 != NULL) {
-            temp1->prev = currentLine;
-          } else {
-            source.pEnd = currentLine;
-          }
-
-          if (temp2 != NULL) {
-            temp2->next = currentLine;
-          } else {
-            source.pStart = currentLine;
-          }
+          // error here?
+          std::cout << "OVERFLOW " << dSize[0] << " " << dSize[1] << " "
+                    << dSize[2] << " " << dSize[3] << " " << byteTotal
+                    << std::endl;
         }
       }  // Source line
     }
 
-    // Get the next relevant character
-    while ((c != '\n') && not feof(komodoSource)) {
-      c = getc(komodoSource);
-    }
+    p = lineEnd + 1;  // Move on to the next line
   }
 
-  fclose(komodoSource);
+  source.sort();  // Lines are read in file order
+  boardLoadImage(image);
   return true;
 }
 
-char * stokmd(char *file_name) {
-	char *s = strdup(file_name);
-	size_t len;
-	*strrchr(s, '.') = 0;
-
-	len = strlen(file_name);
-	s = (char *)realloc(s, len + 5);
-	strcat(s, ".kmd");
-
-	return s;
-}
-
 char * getKcmdPath() {
 	char *dbuf;
 	uint32_t size = 0x100;
@@ -1514,6 +2366,12 @@ void initJimulator(std::string argv0) {
   readFromJimulator = communicationFromJimulator[0];
   writeToJimulator = communicationToJimulator[1];
 
+  // A third pipe carries event frames; without it, Jimulator is polled
+  int events[2];
+  if (pipe(events)) {
+    events[0] = events[1] = -1;
+  }
+
   // Stores the emulator_PID for later.
   emulator_PID = fork();
 
@@ -1528,65 +2386,240 @@ void initJimulator(std::string argv0) {
     dup2(communicationToJimulator[0], 0);
 
     auto jimulatorPath = argv0.append("/jimulator").c_str();
-    execlp(jimulatorPath, "jimulator", (char*)0);
+    if (events[1] >= 0) {
+      dup2(events[1], 3);
+      execlp(jimulatorPath, "jimulator", "--events", "3", (char*)0);
+    } else {
+      execlp(jimulatorPath, "jimulator", (char*)0);
+    }
     // should never get here
     _exit(1);
   }
+
+  if (events[1] >= 0) {
+    close(events[1]);
+    jimulatorEvents = events[0];
+    fcntl(events[0], F_SETFL, fcntl(events[0], F_GETFL) | O_NONBLOCK);
+  }
+}
+
+/**
+ * @brief Attaches to a Jimulator already running in socket mode, rather than
+ * forking a private one.
+ * @param address Either a loopback TCP port number, or the path of a
+ * Unix-domain socket.
+ * @return bool true if the connection was made.
+ */
+static int openJimulatorSocket(const char *address) {
+	int fd;
+
+	if(strspn(address, "0123456789") == strlen(address)) {
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(atoi(address));
+
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if(fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	} else {
+		struct sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, address, sizeof(addr.sun_path) - 1);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	return fd;
+}
+
+static bool connectJimulator(const char *address) {
+	int fd = openJimulatorSocket(address);
+
+	if(fd < 0) {
+		std::cerr << "Can't attach to jimulator at " << address << ".\n";
+		return false;
+	}
+
+	readFromJimulator = fd;
+	writeToJimulator = fd;
+
+	// A second connection carries event frames; without it, jimulator is polled
+	int events = openJimulatorSocket(address);
+	if(events >= 0 && Jimulator::subscribeToJimulatorEvents(events)) {
+		jimulatorEvents = events;
+	} else if(events >= 0) {
+		close(events);
+	}
+
+	return true;
+}
+
+static void restoreTerm() {
+	if(terminalSaved) {
+		tcsetattr(0, TCSANOW, &savedTerminal);
+	}
+}
+
+static void onSignal(int sig) {
+	restoreTerm();
+	if(emulator_PID > 0) {
+		kill(emulator_PID, SIGTERM);
+		waitpid(emulator_PID, NULL, 0);
+	}
+	signal(sig, SIG_DFL);
+	raise(sig);
 }
 
+// Keys go straight to the program, unechoed, if stdin is a terminal; input
+// from a file or pipe is passed on as it is
 static void initTerm() {
-	termios oldt;
-	tcgetattr(0, &oldt);
-	termios newt = oldt;
-	newt.c_lflag &= ~(ECHO|ICANON);
-	tcsetattr(0, TCSANOW, &newt);
-	std::cout.setf(std::ios::unitbuf);
-	std::cin.setf(std::ios::unitbuf);
-}
-
-static void handle_io() {
-	char c;
-
-	t1 = new std::thread([&]() -> void {
-		while(true) {
-			usleep(10000);
-			mtx.lock();
-			std::cout << Jimulator::getJimulatorTerminalMessages();
-			mtx.unlock();
+	if(isatty(0) && tcgetattr(0, &savedTerminal) == 0) {
+		termios newt = savedTerminal;
+		newt.c_lflag &= ~(ECHO|ICANON);
+		tcsetattr(0, TCSANOW, &newt);
+		terminalSaved = true;
+	}
+
+	// Being killed still puts the terminal back and takes jimulator with it
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	signal(SIGHUP, onSignal);
+}
+
+static void printOutput() {
+	std::cout << Jimulator::getJimulatorTerminalMessages() << std::flush;
+}
+
+// Forwards stdin to the program and its output to stdout until it stops, and
+// returns the exit status that describes how it stopped. Jimulator says when
+// either happens if it can, and is polled if it cannot
+static int handle_io() {
+	const int everything = static_cast<int>(JimulatorEvent::STATUS) |
+			static_cast<int>(JimulatorEvent::CONSOLE);
+	bool inputOpen = true;
+	char input[255];
+
+	while(true) {
+		struct pollfd fds[2];
+		int count = 0;
+		int stdinIndex = -1;
+		int eventIndex = -1;
+
+		// Input the program has no room for is held back, along with stdin
+		const bool waiting = Jimulator::isTerminalInputWaiting();
+		if(inputOpen && !waiting) {
+			fds[count] = {0, POLLIN, 0};
+			stdinIndex = count++;
+		}
+		if(jimulatorEvents >= 0) {
+			fds[count] = {jimulatorEvents, POLLIN, 0};
+			eventIndex = count++;
 		}
-	});
-
-	t2 = new std::thread([&]() -> void {
-		while(true) {
-			c = getchar();
-			mtx.lock();
-			Jimulator::sendTerminalInputToJimulator(c);
-			mtx.unlock();
+
+		const int timeout = (jimulatorEvents < 0 || waiting) ? POLL_INTERVAL : -1;
+		if(poll(fds, count, timeout) < 0 && errno != EINTR) {
+			return EXIT_LOST;
+		}
+
+		if(stdinIndex >= 0 && fds[stdinIndex].revents != 0) {
+			int length = read(0, input, sizeof(input));
+			if(length > 0) {
+				Jimulator::sendTerminalTextToJimulator(std::string(input, length));
+			} else {
+				inputOpen = false;  // What was sent is all the program gets
+			}
+		} else if(waiting) {
+			Jimulator::flushTerminalInput();
 		}
-	});
+
+		int events = everything;
+		if(eventIndex >= 0) {
+			events = fds[eventIndex].revents != 0 ? Jimulator::readJimulatorEvents() : 0;
+			if(events < 0) {
+				return EXIT_LOST;
+			}
+		}
+
+		if(events != 0) {
+			printOutput();
+		}
+
+		if(events & JimulatorEvent::STATUS) {
+			switch(Jimulator::checkBoardState()) {
+				case ClientState::RUNNING:
+				case ClientState::RUNNING_SWI:
+				case ClientState::STEPPING:
+				case ClientState::BUSY:
+					break;
+				case ClientState::FINISHED:
+					printOutput();
+					return EXIT_HALTED;
+				default:
+					printOutput();
+					return EXIT_STOPPED;
+			}
+		}
+	}
 }
 
 int main(int argc, char** argv) {
 	if(argc != 2) {
-		std::cout << "usage: " << argv[0] << " <asm file>\n";
+		std::cout << "usage: " << argv[0] << " <asm file | ELF executable>\n";
 		return 1;
 	}
 
 	char *kcmd_path = getKcmdPath();
-	char *kmd_path = stokmd(argv[1]);
 
 	*strrchr(kcmd_path, '/') = 0;
-	initJimulator(kcmd_path);
+
+	// Attach to an already running jimulator if asked to, else fork our own
+	char *address = getenv("JIMULATOR_SOCKET");
+	if(address == NULL || !connectJimulator(address)) {
+		initJimulator(kcmd_path);
+	} else {
+		Jimulator::resetJimulator();  // A program that halted won't start again
+	}
 	initTerm();
-	Jimulator::compileJimulator(kcmd_path, argv[1], kmd_path);
-	
-	Jimulator::loadJimulator(kmd_path);
+	// An ELF executable is loaded as it is; anything else is assembled first
+	if(Jimulator::isElfFile(argv[1])) {
+		Jimulator::loadJimulator(argv[1]);
+	} else {
+		// A resident assembler, if one is running, has likely done it already
+		char *source_path = realpath(argv[1], NULL);
+		std::string messages;
+		switch(Jimulator::compileResidentJimulator(
+		    source_path ? source_path : argv[1], messages)) {
+		case ResidentCompile::LOADED:
+			break;
+		case ResidentCompile::FAILED:
+			std::cerr << messages;
+			break;
+		case ResidentCompile::UNAVAILABLE:
+			// Otherwise assemble it here, with aasm linked in
+			if(!Jimulator::assembleJimulator(argv[1], messages)) {
+				std::cerr << messages;
+			}
+			break;
+		}
+		free(source_path);
+	}
 	Jimulator::startJimulator(1000000);
-	handle_io();
+	int status = handle_io();
+	restoreTerm();
 
-	free(kmd_path);
 	free(kcmd_path);
-	wait(NULL);
-	kill(emulator_PID, SIGTERM);
+	if(emulator_PID > 0) {
+		kill(emulator_PID, SIGTERM);
+		waitpid(emulator_PID, NULL, 0);
+	}
+
+	return status;
 }
 
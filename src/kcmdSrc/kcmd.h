@@ -37,6 +37,37 @@ inline unsigned char operator|(ClientState l, unsigned char r) {
   return static_cast<unsigned char>(l) | r;
 }
 
+/**
+ * @brief What became of asking a resident assembler (`aasm --serve`) to
+ * compile and load a file.
+ */
+enum class ResidentCompile : unsigned char {
+  UNAVAILABLE = 0,  // There is none to ask; run aasm instead
+  FAILED = 1,       // It did not assemble, or did not load
+  LOADED = 2,
+};
+
+/**
+ * @brief The types of unsolicited event frame Jimulator sends when something
+ * happens, rather than waiting to be asked. Each is a single bit, so that
+ * several can be combined into a mask.
+ */
+enum class JimulatorEvent : unsigned char {
+  STATUS = 0x01,
+  CONSOLE = 0x02,
+};
+
+/**
+ * @brief Performing an and between a mask of JimulatorEvents and a
+ * JimulatorEvent.
+ * @param l The left hand mask.
+ * @param r The right hand JimulatorEvent value.
+ * @return bool Whether the event is in the mask.
+ */
+inline bool operator&(int l, JimulatorEvent r) {
+  return (l & static_cast<unsigned char>(r)) != 0;
+}
+
 /**
  * @brief Groups together functions that make up the Jimulator API layer - these
  * functions and classes are used for sending and receiving information from
@@ -77,9 +108,10 @@ const std::string getJimulatorTerminalMessages();
 
 // ! Loading data
 
-void compileJimulator(std::string pathToBin,
-                      const char* const pathToS,
-		      const char* const pathToKMD);
+const bool assembleJimulator(const char* const pathToS, std::string& messages);
+const ResidentCompile compileResidentJimulator(const char* const pathToS,
+                                               std::string& messages);
+const bool isElfFile(const char* const path);
 const bool loadJimulator(const char* const pathToKMD);
 
 // ! Sending commands
@@ -89,5 +121,13 @@ void continueJimulator();
 void pauseJimulator();
 void resetJimulator();
 const bool sendTerminalInputToJimulator(const unsigned int val);
+const bool sendTerminalTextToJimulator(const std::string& text);
+const bool flushTerminalInput();
+const bool isTerminalInputWaiting();
 const bool setBreakpoint(const uint32_t address);
+
+// ! Events
+
+const bool subscribeToJimulatorEvents(const int fd);
+const int readJimulatorEvents();
 }  // namespace Jimulator
@@ -0,0 +1,773 @@
+/**
+ * @file disassembler.cpp
+ * @author Lawrence Warren (lawrencewarren2@gmail.com)
+ * @brief A table-driven ARM and Thumb disassembler. Each instruction set has a
+ * decode table of mask/value pairs with a format string; the first row an
+ * instruction matches says how it is written. Decoding allocates nothing -
+ * text is written straight into a fixed size cache, indexed by address and
+ * word, so redrawing memory that has not changed costs a lookup.
+ * @version 1.0.0
+ * @date 18-10-2026
+ */
+
+#include "disassembler.h"
+#include <stdio.h>
+#include <array>
+
+namespace {
+/**
+ * @brief The longest text an instruction (or, for Thumb, a pair of them) can
+ * disassemble to, including the terminating null.
+ */
+constexpr int TEXT_LENGTH = 72;
+
+/**
+ * @brief How many disassembled words are remembered. Must be a power of 2.
+ */
+constexpr int CACHE_SIZE = 1024;
+
+/**
+ * @brief A row of a decode table. An instruction matches the row if its bits
+ * under `mask` equal `value`; the first matching row of a table is used.
+ */
+class Decoding {
+ public:
+  /**
+   * @brief The bits of the instruction that identify it.
+   */
+  uint32_t mask;
+
+  /**
+   * @brief What those bits must be.
+   */
+  uint32_t value;
+
+  /**
+   * @brief How the instruction is written. A `%` followed by a letter is an
+   * operand, decoded by the formatter for the table's instruction set.
+   */
+  const char* format;
+};
+
+/**
+ * @brief The ARM decode table. Multiplies, swaps, halfword transfers and
+ * status register transfers share encoding space with data processing, so
+ * they come first.
+ */
+constexpr Decoding ARM_TABLE[] = {
+    {0xFE000000, 0xFA000000, "blx %Y"},
+    {0x0F000000, 0x0F000000, "swi%c %x"},
+    {0x0FFFFFF0, 0x012FFF10, "bx%c %m"},
+    {0x0FFFFFF0, 0x012FFF30, "blx%c %m"},
+    {0x0FE000F0, 0x00000090, "mul%c%s %n, %m, %S"},
+    {0x0FE000F0, 0x00200090, "mla%c%s %n, %m, %S, %d"},
+    {0x0FE000F0, 0x00800090, "umull%c%s %d, %n, %m, %S"},
+    {0x0FE000F0, 0x00A00090, "umlal%c%s %d, %n, %m, %S"},
+    {0x0FE000F0, 0x00C00090, "smull%c%s %d, %n, %m, %S"},
+    {0x0FE000F0, 0x00E00090, "smlal%c%s %d, %n, %m, %S"},
+    {0x0FB00FF0, 0x01000090, "swp%c%B %d, %m, [%n]"},
+    {0x0E1000F0, 0x001000B0, "ldr%ch %d, %A"},
+    {0x0E1000F0, 0x000000B0, "str%ch %d, %A"},
+    {0x0E1000F0, 0x001000D0, "ldr%csb %d, %A"},
+    {0x0E1000F0, 0x001000F0, "ldr%csh %d, %A"},
+    {0x0E000090, 0x00000090, "undefined"},
+    {0x0FBF0FFF, 0x010F0000, "mrs%c %d, %P"},
+    {0x0FB0FFF0, 0x0120F000, "msr%c %P_%F, %m"},
+    {0x0FB0F000, 0x0320F000, "msr%c %P_%F, %o"},
+    {0x0DE00000, 0x00000000, "and%c%s %d, %n, %o"},
+    {0x0DE00000, 0x00200000, "eor%c%s %d, %n, %o"},
+    {0x0DE00000, 0x00400000, "sub%c%s %d, %n, %o"},
+    {0x0DE00000, 0x00600000, "rsb%c%s %d, %n, %o"},
+    {0x0DE00000, 0x00800000, "add%c%s %d, %n, %o"},
+    {0x0DE00000, 0x00A00000, "adc%c%s %d, %n, %o"},
+    {0x0DE00000, 0x00C00000, "sbc%c%s %d, %n, %o"},
+    {0x0DE00000, 0x00E00000, "rsc%c%s %d, %n, %o"},
+    {0x0DF00000, 0x01100000, "tst%c %n, %o"},
+    {0x0DF00000, 0x01300000, "teq%c %n, %o"},
+    {0x0DF00000, 0x01500000, "cmp%c %n, %o"},
+    {0x0DF00000, 0x01700000, "cmn%c %n, %o"},
+    {0x0DE00000, 0x01800000, "orr%c%s %d, %n, %o"},
+    {0x0DE00000, 0x01A00000, "mov%c%s %d, %o"},
+    {0x0DE00000, 0x01C00000, "bic%c%s %d, %n, %o"},
+    {0x0DE00000, 0x01E00000, "mvn%c%s %d, %o"},
+    {0x0E000010, 0x06000010, "undefined"},
+    {0x0C100000, 0x04100000, "ldr%c%B%T %d, %a"},
+    {0x0C100000, 0x04000000, "str%c%B%T %d, %a"},
+    {0x0E100000, 0x08100000, "ldm%c%D %n%w, %l%^"},
+    {0x0E100000, 0x08000000, "stm%c%D %n%w, %l%^"},
+    {0x0F000000, 0x0A000000, "b%c %b"},
+    {0x0F000000, 0x0B000000, "bl%c %b"},
+    {0x0E100000, 0x0C100000, "ldc%c%L p%C, c%Z, %E"},
+    {0x0E100000, 0x0C000000, "stc%c%L p%C, c%Z, %E"},
+    {0x0F100010, 0x0E100010, "mrc%c p%C, %1, %d, c%R, c%M, %2"},
+    {0x0F100010, 0x0E000010, "mcr%c p%C, %1, %d, c%R, c%M, %2"},
+    {0x0F000010, 0x0E000000, "cdp%c p%C, %4, c%Z, c%R, c%M, %2"},
+    {0x00000000, 0x00000000, "undefined"},
+};
+
+/**
+ * @brief The Thumb decode table, for single halfwords. The two halves of a
+ * long branch are joined before this table is consulted.
+ */
+constexpr Decoding THUMB_TABLE[] = {
+    {0xF800, 0x0000, "lsl %0, %3, #%i"},
+    {0xF800, 0x0800, "lsr %0, %3, #%I"},
+    {0xF800, 0x1000, "asr %0, %3, #%I"},
+    {0xFE00, 0x1800, "add %0, %3, %6"},
+    {0xFE00, 0x1A00, "sub %0, %3, %6"},
+    {0xFE00, 0x1C00, "add %0, %3, #%j"},
+    {0xFE00, 0x1E00, "sub %0, %3, #%j"},
+    {0xF800, 0x2000, "mov %8, #%k"},
+    {0xF800, 0x2800, "cmp %8, #%k"},
+    {0xF800, 0x3000, "add %8, #%k"},
+    {0xF800, 0x3800, "sub %8, #%k"},
+    {0xFFC0, 0x4000, "and %0, %3"},
+    {0xFFC0, 0x4040, "eor %0, %3"},
+    {0xFFC0, 0x4080, "lsl %0, %3"},
+    {0xFFC0, 0x40C0, "lsr %0, %3"},
+    {0xFFC0, 0x4100, "asr %0, %3"},
+    {0xFFC0, 0x4140, "adc %0, %3"},
+    {0xFFC0, 0x4180, "sbc %0, %3"},
+    {0xFFC0, 0x41C0, "ror %0, %3"},
+    {0xFFC0, 0x4200, "tst %0, %3"},
+    {0xFFC0, 0x4240, "neg %0, %3"},
+    {0xFFC0, 0x4280, "cmp %0, %3"},
+    {0xFFC0, 0x42C0, "cmn %0, %3"},
+    {0xFFC0, 0x4300, "orr %0, %3"},
+    {0xFFC0, 0x4340, "mul %0, %3"},
+    {0xFFC0, 0x4380, "bic %0, %3"},
+    {0xFFC0, 0x43C0, "mvn %0, %3"},
+    {0xFF00, 0x4400, "add %D, %M"},
+    {0xFF00, 0x4500, "cmp %D, %M"},
+    {0xFF00, 0x4600, "mov %D, %M"},
+    {0xFF80, 0x4700, "bx %M"},
+    {0xFF80, 0x4780, "blx %M"},
+    {0xF800, 0x4800, "ldr %8, [pc, #%K]"},
+    {0xFE00, 0x5000, "str %0, [%3, %6]"},
+    {0xFE00, 0x5200, "strh %0, [%3, %6]"},
+    {0xFE00, 0x5400, "strb %0, [%3, %6]"},
+    {0xFE00, 0x5600, "ldrsb %0, [%3, %6]"},
+    {0xFE00, 0x5800, "ldr %0, [%3, %6]"},
+    {0xFE00, 0x5A00, "ldrh %0, [%3, %6]"},
+    {0xFE00, 0x5C00, "ldrb %0, [%3, %6]"},
+    {0xFE00, 0x5E00, "ldrsh %0, [%3, %6]"},
+    {0xF800, 0x6000, "str %0, [%3, #%w]"},
+    {0xF800, 0x6800, "ldr %0, [%3, #%w]"},
+    {0xF800, 0x7000, "strb %0, [%3, #%i]"},
+    {0xF800, 0x7800, "ldrb %0, [%3, #%i]"},
+    {0xF800, 0x8000, "strh %0, [%3, #%h]"},
+    {0xF800, 0x8800, "ldrh %0, [%3, #%h]"},
+    {0xF800, 0x9000, "str %8, [sp, #%K]"},
+    {0xF800, 0x9800, "ldr %8, [sp, #%K]"},
+    {0xF800, 0xA000, "add %8, pc, #%K"},
+    {0xF800, 0xA800, "add %8, sp, #%K"},
+    {0xFF80, 0xB000, "add sp, #%q"},
+    {0xFF80, 0xB080, "sub sp, #%q"},
+    {0xFE00, 0xB400, "push %L"},
+    {0xFE00, 0xBC00, "pop %P"},
+    {0xFF00, 0xBE00, "bkpt #%k"},
+    {0xF800, 0xC000, "stmia %8!, %l"},
+    {0xF800, 0xC800, "ldmia %8!, %l"},
+    {0xFF00, 0xDE00, "undefined"},
+    {0xFF00, 0xDF00, "swi %k"},
+    {0xF000, 0xD000, "b%c %b"},
+    {0xF800, 0xE000, "b %B"},
+    {0xF800, 0xE800, "blx (second half)"},
+    {0xF800, 0xF000, "bl (first half)"},
+    {0xF800, 0xF800, "bl (second half)"},
+    {0x0000, 0x0000, "undefined"},
+};
+
+/**
+ * @brief Condition code suffixes, indexed by condition field. "al" is left
+ * unwritten.
+ */
+constexpr const char* CONDITIONS[16] = {"eq", "ne", "cs", "cc", "mi", "pl",
+                                        "vs", "vc", "hi", "ls", "ge", "lt",
+                                        "gt", "le", "",   "nv"};
+
+/**
+ * @brief Register names, indexed by register number.
+ */
+constexpr const char* REGISTERS[16] = {"r0", "r1", "r2",  "r3", "r4", "r5",
+                                       "r6", "r7", "r8",  "r9", "r10", "r11",
+                                       "r12", "sp", "lr", "pc"};
+
+/**
+ * @brief Shift names, indexed by shift type.
+ */
+constexpr const char* SHIFTS[4] = {"lsl", "lsr", "asr", "ror"};
+
+/**
+ * @brief Load/store multiple addressing modes, indexed by the P and U bits.
+ */
+constexpr const char* BLOCK_MODES[4] = {"da", "ia", "db", "ib"};
+
+/**
+ * @brief A remembered disassembly of one word.
+ */
+class CacheEntry {
+ public:
+  /**
+   * @brief The address the word was at - branch targets depend on it.
+   */
+  uint32_t address = 0;
+
+  /**
+   * @brief The word that was disassembled.
+   */
+  uint32_t word = 0;
+
+  /**
+   * @brief The instruction set it was disassembled as.
+   */
+  Disassembler::InstructionSet set = Disassembler::InstructionSet::ARM;
+
+  /**
+   * @brief Whether this entry holds anything yet.
+   */
+  bool valid = false;
+
+  /**
+   * @brief The length of the text.
+   */
+  unsigned char length = 0;
+
+  /**
+   * @brief The disassembled text, null terminated.
+   */
+  char text[TEXT_LENGTH];
+};
+
+/**
+ * @brief Disassembled words, indexed by a hash of their address and value.
+ */
+std::array<CacheEntry, CACHE_SIZE> cache;
+
+/**
+ * @brief Writes text into a cache entry, silently stopping when it is full.
+ */
+class TextWriter {
+ public:
+  /**
+   * @brief Constructs a writer over an empty buffer.
+   * @param text The buffer, of `TEXT_LENGTH` characters.
+   */
+  TextWriter(char* const text) : text(text) { text[0] = '\0'; }
+
+  /**
+   * @brief Appends a character.
+   * @param c The character.
+   */
+  void put(const char c) {
+    if (length < TEXT_LENGTH - 1) {
+      text[length++] = c;
+      text[length] = '\0';
+    }
+  }
+
+  /**
+   * @brief Appends a string.
+   * @param s The null terminated string.
+   */
+  void put(const char* s) {
+    while (*s != '\0') {
+      put(*s++);
+    }
+  }
+
+  /**
+   * @brief Appends a number in decimal.
+   * @param n The number.
+   */
+  void number(const int64_t n) {
+    char digits[24];
+    snprintf(digits, sizeof(digits), "%lld", static_cast<long long>(n));
+    put(digits);
+  }
+
+  /**
+   * @brief Appends an address, in the same form as the address column.
+   * @param a The address.
+   */
+  void address(const uint32_t a) {
+    char digits[12];
+    snprintf(digits, sizeof(digits), "0x%08X", a);
+    put(digits);
+  }
+
+  /**
+   * @brief Appends the name of a register.
+   * @param r The register number.
+   */
+  void reg(const uint32_t r) { put(REGISTERS[r & 0xF]); }
+
+  /**
+   * @brief Appends a register list, joining runs of three or more registers
+   * into a range.
+   * @param list A bit per register.
+   */
+  void registerList(const uint32_t list) {
+    bool first = true;
+
+    put('{');
+    for (int r = 0; r < 16; r++) {
+      if (((list >> r) & 1) == 0) {
+        continue;
+      }
+
+      int last = r;
+      while (last < 15 && ((list >> (last + 1)) & 1) != 0) {
+        last++;
+      }
+
+      if (not first) {
+        put(", ");
+      }
+      first = false;
+
+      reg(r);
+      if (last - r >= 2) {
+        put('-');
+        reg(last);
+        r = last;
+      }
+    }
+    put('}');
+  }
+
+  /**
+   * @brief The buffer being written.
+   */
+  char* const text;
+
+  /**
+   * @brief How many characters have been written.
+   */
+  int length = 0;
+};
+
+/**
+ * @brief Sign extends the bottom `bits` bits of a value.
+ * @param value The value.
+ * @param bits How many bits the value is.
+ * @return int32_t The sign extended value.
+ */
+constexpr int32_t signExtend(const uint32_t value, const int bits) {
+  const uint32_t sign = 1u << (bits - 1);
+  return static_cast<int32_t>(((value & ((sign << 1) - 1)) ^ sign) - sign);
+}
+
+/**
+ * @brief Rotates a word right.
+ * @param value The word.
+ * @param amount How far to rotate it, from 0 to 31.
+ * @return uint32_t The rotated word.
+ */
+constexpr uint32_t rotateRight(const uint32_t value, const int amount) {
+  return amount == 0 ? value : (value >> amount) | (value << (32 - amount));
+}
+
+/**
+ * @brief Finds the first row of a decode table an instruction matches. The
+ * last row of every table matches anything.
+ * @param table The decode table.
+ * @param instruction The instruction.
+ * @return const Decoding& The matching row.
+ */
+template <size_t N>
+const Decoding& decode(const Decoding (&table)[N], const uint32_t instruction) {
+  for (const auto& row : table) {
+    if ((instruction & row.mask) == row.value) {
+      return row;
+    }
+  }
+  return table[N - 1];
+}
+
+/**
+ * @brief Writes an ARM register operand, with its shift if it has one.
+ * @param out Where to write it.
+ * @param w The instruction.
+ */
+void armShiftedRegister(TextWriter& out, const uint32_t w) {
+  const uint32_t type = (w >> 5) & 3, amount = (w >> 7) & 0x1F;
+
+  out.reg(w);
+  if ((w & 0x10) != 0) {  // Shift by register
+    out.put(", ");
+    out.put(SHIFTS[type]);
+    out.put(' ');
+    out.reg(w >> 8);
+  } else if (amount != 0) {
+    out.put(", ");
+    out.put(SHIFTS[type]);
+    out.put(" #");
+    out.number(amount);
+  } else if (type == 3) {
+    out.put(", rrx");
+  } else if (type != 0) {
+    out.put(", ");
+    out.put(SHIFTS[type]);
+    out.put(" #32");
+  }
+}
+
+/**
+ * @brief Writes an ARM load/store address - `[Rn, offset]`, `[Rn, offset]!` or
+ * `[Rn], offset` - where the offset has already been decoded.
+ * @param out Where to write it.
+ * @param w The instruction.
+ * @param offset Writes the offset, after ", ".
+ * @param omitOffset Whether a pre-indexed offset may be left out (it is zero).
+ */
+template <typename WriteOffset>
+void armAddress(TextWriter& out,
+                const uint32_t w,
+                WriteOffset offset,
+                const bool omitOffset) {
+  const bool preIndexed = ((w >> 24) & 1) != 0, writeBack = ((w >> 21) & 1);
+
+  out.put('[');
+  out.reg(w >> 16);
+  if (preIndexed) {
+    if (not omitOffset) {
+      out.put(", ");
+      offset();
+    }
+    out.put(']');
+    if (writeBack) {
+      out.put('!');
+    }
+  } else {
+    out.put("], ");
+    offset();
+  }
+}
+
+/**
+ * @brief Writes an ARM instruction, following its format.
+ * @param out Where to write it.
+ * @param format The format from the instruction's decode table row.
+ * @param address The address of the instruction.
+ * @param w The instruction.
+ */
+void formatArm(TextWriter& out,
+               const char* format,
+               const uint32_t address,
+               const uint32_t w) {
+  const bool up = ((w >> 23) & 1) != 0;
+
+  for (; *format != '\0'; format++) {
+    if (*format != '%') {
+      out.put(*format);
+      continue;
+    }
+
+    switch (*++format) {
+      case 'c':
+        out.put(CONDITIONS[w >> 28]);
+        break;
+      case 's':
+        if ((w >> 20) & 1) {
+          out.put('s');
+        }
+        break;
+      case 'd':
+        out.reg(w >> 12);
+        break;
+      case 'n':
+        out.reg(w >> 16);
+        break;
+      case 'm':
+        out.reg(w);
+        break;
+      case 'S':
+        out.reg(w >> 8);
+        break;
+      case 'o':  // Data processing operand
+        if ((w >> 25) & 1) {
+          out.put('#');
+          out.number(rotateRight(w & 0xFF, ((w >> 8) & 0xF) * 2));
+        } else {
+          armShiftedRegister(out, w);
+        }
+        break;
+      case 'a': {  // Word and unsigned byte address
+        const bool registerOffset = ((w >> 25) & 1) != 0;
+        armAddress(
+            out, w,
+            [&]() {
+              if (registerOffset) {
+                out.put(up ? "" : "-");
+                armShiftedRegister(out, w);
+              } else {
+                out.put(up ? "#" : "#-");
+                out.number(w & 0xFFF);
+              }
+            },
+            not registerOffset && up && (w & 0xFFF) == 0);
+      } break;
+      case 'A': {  // Halfword and signed byte address
+        const bool immediateOffset = ((w >> 22) & 1) != 0;
+        const uint32_t immediate = ((w >> 4) & 0xF0) | (w & 0xF);
+        armAddress(
+            out, w,
+            [&]() {
+              if (immediateOffset) {
+                out.put(up ? "#" : "#-");
+                out.number(immediate);
+              } else {
+                out.put(up ? "" : "-");
+                out.reg(w);
+              }
+            },
+            immediateOffset && up && immediate == 0);
+      } break;
+      case 'E': {  // Coprocessor address
+        const bool unindexed = ((w >> 24) & 1) == 0 && ((w >> 21) & 1) == 0;
+        if (unindexed) {
+          out.put('[');
+          out.reg(w >> 16);
+          out.put("], {");
+          out.number(w & 0xFF);
+          out.put('}');
+        } else {
+          armAddress(
+              out, w,
+              [&]() {
+                out.put(up ? "#" : "#-");
+                out.number((w & 0xFF) * 4);
+              },
+              up && (w & 0xFF) == 0);
+        }
+      } break;
+      case 'b':
+        out.address(address + 8 + (signExtend(w, 24) << 2));
+        break;
+      case 'Y':
+        out.address(address + 8 + (signExtend(w, 24) << 2) +
+                    (((w >> 24) & 1) << 1));
+        break;
+      case 'x':
+        out.number(w & 0xFFFFFF);
+        break;
+      case 'l':
+        out.registerList(w & 0xFFFF);
+        break;
+      case 'D':
+        out.put(BLOCK_MODES[(w >> 23) & 3]);
+        break;
+      case 'w':
+        if ((w >> 21) & 1) {
+          out.put('!');
+        }
+        break;
+      case '^':
+        if ((w >> 22) & 1) {
+          out.put('^');
+        }
+        break;
+      case 'B':
+        if ((w >> 22) & 1) {
+          out.put('b');
+        }
+        break;
+      case 'T':  // Post-indexed with write back is the user mode transfer
+        if (((w >> 24) & 1) == 0 && ((w >> 21) & 1) != 0) {
+          out.put('t');
+        }
+        break;
+      case 'L':
+        if ((w >> 22) & 1) {
+          out.put('l');
+        }
+        break;
+      case 'P':
+        out.put(((w >> 22) & 1) ? "spsr" : "cpsr");
+        break;
+      case 'F':
+        for (int bit = 19; bit >= 16; bit--) {
+          if ((w >> bit) & 1) {
+            out.put("cxsf"[bit - 16]);
+          }
+        }
+        break;
+      case 'C':
+        out.number((w >> 8) & 0xF);
+        break;
+      case '1':
+        out.number((w >> 21) & 0x7);
+        break;
+      case '4':
+        out.number((w >> 20) & 0xF);
+        break;
+      case '2':
+        out.number((w >> 5) & 0x7);
+        break;
+      case 'R':
+        out.number((w >> 16) & 0xF);
+        break;
+      case 'M':
+        out.number(w & 0xF);
+        break;
+      case 'Z':
+        out.number((w >> 12) & 0xF);
+        break;
+      default:
+        out.put(*format);
+        break;
+    }
+  }
+}
+
+/**
+ * @brief Writes a Thumb instruction, following its format.
+ * @param out Where to write it.
+ * @param format The format from the instruction's decode table row.
+ * @param address The address of the instruction.
+ * @param h The instruction.
+ */
+void formatThumb(TextWriter& out,
+                 const char* format,
+                 const uint32_t address,
+                 const uint32_t h) {
+  for (; *format != '\0'; format++) {
+    if (*format != '%') {
+      out.put(*format);
+      continue;
+    }
+
+    switch (*++format) {
+      case '0':
+        out.reg(h & 7);
+        break;
+      case '3':
+        out.reg((h >> 3) & 7);
+        break;
+      case '6':
+        out.reg((h >> 6) & 7);
+        break;
+      case '8':
+        out.reg((h >> 8) & 7);
+        break;
+      case 'D':
+        out.reg(((h >> 4) & 8) | (h & 7));
+        break;
+      case 'M':
+        out.reg((h >> 3) & 0xF);
+        break;
+      case 'i':
+        out.number((h >> 6) & 0x1F);
+        break;
+      case 'I':  // A shift by 0 encodes a shift by 32
+        out.number(((h >> 6) & 0x1F) == 0 ? 32 : (h >> 6) & 0x1F);
+        break;
+      case 'h':
+        out.number(((h >> 6) & 0x1F) * 2);
+        break;
+      case 'w':
+        out.number(((h >> 6) & 0x1F) * 4);
+        break;
+      case 'j':
+        out.number((h >> 6) & 7);
+        break;
+      case 'k':
+        out.number(h & 0xFF);
+        break;
+      case 'K':
+        out.number((h & 0xFF) * 4);
+        break;
+      case 'q':
+        out.number((h & 0x7F) * 4);
+        break;
+      case 'c':
+        out.put(CONDITIONS[(h >> 8) & 0xF]);
+        break;
+      case 'b':
+        out.address(address + 4 + (signExtend(h, 8) << 1));
+        break;
+      case 'B':
+        out.address(address + 4 + (signExtend(h, 11) << 1));
+        break;
+      case 'l':
+        out.registerList(h & 0xFF);
+        break;
+      case 'L':
+        out.registerList((h & 0xFF) | (((h >> 8) & 1) << 14));
+        break;
+      case 'P':
+        out.registerList((h & 0xFF) | (((h >> 8) & 1) << 15));
+        break;
+      default:
+        out.put(*format);
+        break;
+    }
+  }
+}
+
+/**
+ * @brief Writes the two Thumb instructions in a word, or the long branch the
+ * pair of them make up.
+ * @param out Where to write them.
+ * @param address The address of the word.
+ * @param w The word; the instruction at `address` is the low halfword.
+ */
+void disassembleThumb(TextWriter& out, const uint32_t address, uint32_t w) {
+  const uint32_t first = w & 0xFFFF, second = w >> 16;
+
+  // BL and BLX are a pair of halfwords carrying half of the offset each
+  if ((first & 0xF800) == 0xF000 && (second & 0xE800) == 0xE800) {
+    const bool exchange = (second & 0xF800) == 0xE800;
+    uint32_t target = address + 4 + (signExtend(first, 11) << 12) +
+                      ((second & 0x7FF) << 1);
+
+    out.put(exchange ? "blx " : "bl ");
+    out.address(exchange ? target & ~3u : target);
+    return;
+  }
+
+  formatThumb(out, decode(THUMB_TABLE, first).format, address, first);
+  out.put(" ; ");
+  formatThumb(out, decode(THUMB_TABLE, second).format, address + 2, second);
+}
+}  // namespace
+
+/**
+ * @brief Disassembles a word of memory. Results are cached by address and
+ * word, so the same word at the same address is only decoded once while it
+ * stays in the cache.
+ * @param address The address the word is at.
+ * @param word The word, as read from memory.
+ * @param set Whether to decode the word as one ARM instruction or two Thumb
+ * instructions.
+ * @return const std::string_view The disassembly. It remains valid until the
+ * next call to this function that lands in the same cache entry, so copy it
+ * if it is to be kept.
+ */
+const std::string_view Disassembler::disassemble(const uint32_t address,
+                                                 const uint32_t word,
+                                                 const InstructionSet set) {
+  const uint32_t index =
+      ((address >> 2) ^ ((word * 0x9E3779B1u) >> 22)) & (CACHE_SIZE - 1);
+  auto& entry = cache[index];
+
+  if (not entry.valid || entry.address != address || entry.word != word ||
+      entry.set != set) {
+    TextWriter out(entry.text);
+
+    if (set == InstructionSet::ARM) {
+      formatArm(out, decode(ARM_TABLE, word).format, address, word);
+    } else {
+      disassembleThumb(out, address, word);
+    }
+
+    entry.address = address;
+    entry.word = word;
+    entry.set = set;
+    entry.valid = true;
+    entry.length = out.length;
+  }
+
+  return std::string_view(entry.text, entry.length);
+}
@@ -0,0 +1,26 @@
+/**
+ * @file disassembler.h
+ * @author Lawrence Warren (lawrencewarren2@gmail.com)
+ * @brief The header file associated with the `disassembler.cpp` file - a
+ * table-driven ARM and Thumb disassembler, used to show instructions at
+ * addresses that have no source line.
+ * @version 1.0.0
+ * @date 18-10-2026
+ */
+
+#include <stdint.h>
+#include <string_view>
+
+namespace Disassembler {
+/**
+ * @brief The instruction set a word of memory is decoded as.
+ */
+enum class InstructionSet : unsigned char {
+  ARM = 0,
+  THUMB = 1,
+};
+
+const std::string_view disassemble(const uint32_t address,
+                                   const uint32_t word,
+                                   const InstructionSet set);
+}  // namespace Disassembler
@@ -37,6 +37,37 @@ inline unsigned char operator|(ClientState l, unsigned char r) {
   return static_cast<unsigned char>(l) | r;
 }
 
+/**
+ * @brief What became of asking a resident assembler (`aasm --serve`) to
+ * compile and load a file.
+ */
+enum class ResidentCompile : unsigned char {
+  UNAVAILABLE = 0,  // There is none to ask; run aasm instead
+  FAILED = 1,       // It did not assemble, or did not load
+  LOADED = 2,
+};
+
+/**
+ * @brief The types of unsolicited event frame Jimulator sends when something
+ * happens, rather than waiting to be asked. Each is a single bit, so that
+ * several can be combined into a mask.
+ */
+enum class JimulatorEvent : unsigned char {
+  STATUS = 0x01,
+  CONSOLE = 0x02,
+};
+
+/**
+ * @brief Performing an and between a mask of JimulatorEvents and a
+ * JimulatorEvent.
+ * @param l The left hand mask.
+ * @param r The right hand JimulatorEvent value.
+ * @return bool Whether the event is in the mask.
+ */
+inline bool operator&(int l, JimulatorEvent r) {
+  return (l & static_cast<unsigned char>(r)) != 0;
+}
+
 /**
  * @brief Stores the file descriptor used for writing to Jimulator.
  */
@@ -45,6 +76,11 @@ extern int writeToJimulator;
  * @brief Stores the file descriptor used for reading from Jimulator.
  */
 extern int readFromJimulator;
+/**
+ * @brief Stores the file descriptor event frames are read from, or -1 if
+ * Jimulator is not sending any.
+ */
+extern int jimulatorEvents;
 /**
  * @brief The pipe which will be used by KoMo2 to read from Jimulator (i.e.
  * Jimulator will write to it, KoMo2 will read)
@@ -55,11 +91,6 @@ extern int communicationFromJimulator[2];
  * Jimulator will read from it, KoMo2 will write)
  */
 extern int communicationToJimulator[2];
-/**
- * @brief The pipe that handles communication between the compiler process and
- * KoMo2.
- */
-extern int compilerCommunication[2];
 
 /**
  * @brief Groups together functions that make up the Jimulator API layer - these
@@ -101,9 +132,10 @@ const std::string getJimulatorTerminalMessages();
 
 // ! Loading data
 
-void compileJimulator(const char* const pathToBin,
-                      const char* const pathToS,
-                      const char* const pathToKMD);
+const bool assembleJimulator(const char* const pathToS, std::string& messages);
+const ResidentCompile compileResidentJimulator(const char* const pathToS,
+                                               std::string& messages);
+const bool isElfFile(const char* const path);
 const bool loadJimulator(const char* const pathToKMD);
 
 // ! Sending commands
@@ -113,5 +145,13 @@ void continueJimulator();
 void pauseJimulator();
 void resetJimulator();
 const bool sendTerminalInputToJimulator(const unsigned int val);
+const bool sendTerminalTextToJimulator(const std::string& text);
+const bool flushTerminalInput();
+const bool isTerminalInputWaiting();
 const bool setBreakpoint(const uint32_t address);
+
+// ! Events
+
+const bool subscribeToJimulatorEvents(const int fd);
+const int readJimulatorEvents();
 }  // namespace Jimulator
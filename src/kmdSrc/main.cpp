@@ -22,8 +22,14 @@
 #include <glib.h>
 #include <glibmm/optioncontext.h>
 #include <gtkmm/application.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
 #include <libgen.h>
+#include <netinet/in.h>
+#include <string.h>
 #include <sys/signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <array>
 #include <fstream>
@@ -37,12 +43,14 @@
 
 // ! Forward function declarations
 void initJimulator(const std::string argv0);
-void initCompilerPipes(KoMo2Model* const mainModel);
+const bool connectJimulator(const char* const address);
+const int openJimulatorSocket(const char* const address);
+void initJimulatorEvents(KoMo2Model* const mainModel);
 const std::string getAbsolutePathToRootDirectory(const char* const arg);
 const int initialiseCommandLine(
     const Glib::RefPtr<Gio::ApplicationCommandLine>&,
     const Glib::RefPtr<Gtk::Application>& app);
-const bool receivedCompilerOutput(GIOChannel* source,
+const bool receivedJimulatorEvent(GIOChannel* source,
                                   GIOCondition condition,
                                   gpointer data);
 void readProgramVariables(const std::string argv0);
@@ -55,10 +63,10 @@ int emulator_PID = -1;
 // Communication pipes
 int communicationFromJimulator[2];
 int communicationToJimulator[2];
-int compilerCommunication[2];
 // Defined as extern in jimulatorInterface.h
 int writeToJimulator;
 int readFromJimulator;
+int jimulatorEvents = -1;
 
 /**
  * @brief Version information read from variables.json is stored here.
@@ -80,6 +88,11 @@ std::string help = "Please view the user manual (" + manual + ") for help.";
  */
 int refresh = 200;
 
+/**
+ * @brief The number of lines the terminal keeps, read from variables.json.
+ */
+int scrollback = 5000;
+
 /**
  * @brief Used as a reference to the master KoMo2Model.
  */
@@ -98,8 +111,11 @@ int main(int argc, char* argv[]) {
 
   readProgramVariables(argv0);
 
-  // Setup communication to Jimulator child process
-  initJimulator(argv0);
+  // Attach to an already running Jimulator if asked to, else fork our own
+  auto address = getenv("JIMULATOR_SOCKET");
+  if (address == NULL || not connectJimulator(address)) {
+    initJimulator(argv0);
+  }
 
   // Setup command line argument recognition
   app->signal_command_line().connect(
@@ -107,37 +123,37 @@ int main(int argc, char* argv[]) {
 
   // Setup model & view
   MainWindowView koMo2Window(400, 400);
-  KoMo2Model mainModel(&koMo2Window, argv0, manual, refresh);
+  KoMo2Model mainModel(&koMo2Window, argv0, manual, refresh, scrollback);
 
   model = &mainModel;
 
-  // Setup communication methods to compile child process
-  initCompilerPipes(&mainModel);
+  // Watch for events from Jimulator
+  initJimulatorEvents(&mainModel);
 
   // Run
   auto exit = app->run(koMo2Window);
-  kill(emulator_PID, SIGKILL);  // Kill Jimulator if main window is killed
+  // Kill Jimulator if main window is killed - unless it is a shared one
+  if (emulator_PID > 0) {
+    kill(emulator_PID, SIGKILL);
+  }
   return exit;
 }
 
 /**
- * @brief Initialises the communication pipes between the compiler process & the
- * main KoMo2 GUI.
+ * @brief Watches the stream of event frames from Jimulator, if there is one,
+ * so that the views are refreshed as soon as something happens rather than at
+ * the next timer tick.
  * @param mainModel A pointer to the main KoMo2 model.
  */
-void initCompilerPipes(KoMo2Model* mainModel) {
-  // Allows for printing compile output in the KoMo2 terminal
-  if (pipe(compilerCommunication)) {
-    std::cout << "A pipe error ocurred." << std::endl;
-    exit(1);
+void initJimulatorEvents(KoMo2Model* mainModel) {
+  if (jimulatorEvents < 0) {
+    return;
   }
 
-  // Sets up the function `receivedCompilerOutput` to fire whenever a change to
-  // the `compilerCommunication` pipe occurs. This in turn calls a function
-  // in the mainModel object.
-  auto fd = g_io_channel_unix_new(compilerCommunication[0]);
-  auto f = (GIOFunc)receivedCompilerOutput;
-  g_io_add_watch(fd, G_IO_IN, f, mainModel);
+  auto fd = g_io_channel_unix_new(jimulatorEvents);
+  auto f = (GIOFunc)receivedJimulatorEvent;
+  g_io_add_watch(fd, (GIOCondition)(G_IO_IN | G_IO_HUP | G_IO_ERR), f,
+                 mainModel);
 }
 
 /**
@@ -160,6 +176,12 @@ void initJimulator(std::string argv0) {
   readFromJimulator = communicationFromJimulator[0];
   writeToJimulator = communicationToJimulator[1];
 
+  // A third pipe carries event frames; without it, stops show at the next tick
+  int events[2];
+  if (pipe(events)) {
+    events[0] = events[1] = -1;
+  }
+
   // Stores the emulator_PID for later.
   emulator_PID = fork();
 
@@ -174,10 +196,87 @@ void initJimulator(std::string argv0) {
     dup2(communicationToJimulator[0], 0);
 
     auto jimulatorPath = argv0.append("/bin/jimulator").c_str();
-    execlp(jimulatorPath, "", (char*)0);
+    if (events[1] >= 0) {
+      dup2(events[1], 3);
+      execlp(jimulatorPath, "", "--events", "3", (char*)0);
+    } else {
+      execlp(jimulatorPath, "", (char*)0);
+    }
     // should never get here
     _exit(1);
   }
+
+  if (events[1] >= 0) {
+    close(events[1]);
+    jimulatorEvents = events[0];
+    fcntl(events[0], F_SETFL, fcntl(events[0], F_GETFL) | O_NONBLOCK);
+  }
+}
+
+/**
+ * @brief Attaches to a Jimulator already running in socket mode, rather than
+ * forking a private one. The single socket is used in both directions; a
+ * second one is subscribed to event frames.
+ * @param address Either a loopback TCP port number, or the path of a
+ * Unix-domain socket.
+ * @return bool true if the connection was made.
+ */
+const bool connectJimulator(const char* const address) {
+  int fd = openJimulatorSocket(address);
+
+  if (fd < 0) {
+    std::cout << "Can't attach to Jimulator at " << address
+              << ", starting a new one." << std::endl;
+    return false;
+  }
+
+  readFromJimulator = fd;
+  writeToJimulator = fd;
+
+  // Without events, stops show at the next tick
+  int events = openJimulatorSocket(address);
+  if (events >= 0 && Jimulator::subscribeToJimulatorEvents(events)) {
+    jimulatorEvents = events;
+  } else if (events >= 0) {
+    close(events);
+  }
+
+  return true;
+}
+
+/**
+ * @brief Opens a connection to a Jimulator running in socket mode.
+ * @param address Either a loopback TCP port number, or the path of a
+ * Unix-domain socket.
+ * @return const int The connected socket, or -1 if the connection failed.
+ */
+const int openJimulatorSocket(const char* const address) {
+  int fd;
+
+  if (strspn(address, "0123456789") == strlen(address)) {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(atoi(address));
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+      close(fd);
+      fd = -1;
+    }
+  } else {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, address, sizeof(addr.sun_path) - 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  return fd;
 }
 
 /**
@@ -244,6 +343,10 @@ void readProgramVariables(const std::string argv0) {
   if (d.HasMember("refresh")) {
     refresh = d["refresh"].GetInt();
   }
+
+  if (d.HasMember("scrollback")) {
+    scrollback = d["scrollback"].GetInt();
+  }
 }
 
 /**
@@ -331,42 +434,27 @@ const int initialiseCommandLine(
 }
 
 /**
- * @brief This callback function is called when the compiler communication pipe
- * receives a change in state (meaning the compiler process has sent some data).
- * This function will then send that data to the integrated terminal within
- * KoMo2.
- * @param source A pointer to the file descriptor which had a change of state
- * and caused this callback function to fire.
- * @param condition The type of state that changed to cause this callback to
- * fire - for example, new data is to be read from the file descriptor, or data
- * can be written to the file descriptor.
- * @param data Any additional data - in this case, a pointer to the KoMo2 model
- * is sent.
- * @return true There is more to be handled - this function can be called again
- * to handle a related state change.
- * @return false The function is done handling the state change.
+ * @brief Fires whenever Jimulator sends event frames, passing them on to the
+ * main model.
+ * @param source The source of the event.
+ * @param condition The condition of the IO channel.
+ * @param data A pointer to the main KoMo2Model.
+ * @return const bool false if the event stream has closed and should no
+ * longer be watched.
  */
-const bool receivedCompilerOutput(GIOChannel* source,
+const bool receivedJimulatorEvent(GIOChannel* source,
                                   GIOCondition condition,
                                   gpointer data) {
   // data is always a pointer to the main window
   auto p = static_cast<KoMo2Model*>(data);
-  char buff[128];  // An arbitrary size
+  const int events = Jimulator::readJimulatorEvents();
 
-  // The amount of bytes that were read
-  int x = read(compilerCommunication[0], buff, 128);
-
-  // There was a pipe reading failure.
-  if (x < 0) {
-    std::cout << "Error reading from compiler communcation pipe." << std::endl;
-    return false;
-  }
-  // There is no more data to be read.
-  else if (x == 0) {
-    return false;
+  // The stream has closed - only the timer is left
+  if (events < 0) {
+    close(jimulatorEvents);
+    jimulatorEvents = -1;
   }
 
-  buff[x] = '\0';
-  p->getTerminalModel()->appendTextToTextView(buff);
-  return true;
+  p->handleJimulatorEvents(events);
+  return events >= 0;
 }
@@ -8,8 +8,6 @@
  */
 
 #include <gtkmm/filechooserdialog.h>
-#include <sys/wait.h>
-#include <unistd.h>
 #include <iostream>
 #include <regex>
 #include <string>
@@ -38,9 +36,10 @@ CompileLoadModel::CompileLoadModel(CompileLoadView* const view,
 }
 
 /**
- * @brief Compiles a `.s` file into a `.kmd` file:
- * Forks a child process, executes aasm on the child, and then load it into
- * Jimulator, if a valid file path is given.
+ * @brief Assembles a `.s` file within this process, with aasm linked in, and
+ * then loads it into Jimulator, if a valid file path is given. An ELF
+ * executable is loaded as it is, without being compiled, and a resident
+ * assembler named by `AASM_SOCKET` is asked before assembling here.
  */
 void CompileLoadModel::onCompileLoadClick() const {
   // If the length is zero, invalid path
@@ -49,38 +48,47 @@ void CompileLoadModel::onCompileLoadClick() const {
     return;
   }
 
-  // The code within this if block is executed by the child process.
-  if (not fork()) {
-    // Compile the .s program to .kmd
-    Jimulator::compileJimulator(
-        (getParent()->getAbsolutePathToProjectRoot() + "/bin/aasm").c_str(),
-        getAbsolutePathToSelectedFile().c_str(),
-        makeKmdPath(getAbsolutePathToSelectedFile()).c_str());
-    _exit(0);
-  }
-
-  // parent process
-  else {
-    int status = 0;
-    wait(&status);  // Wait for the child to return
+  // An ELF executable needs no compiling - load it directly
+  if (Jimulator::isElfFile(getAbsolutePathToSelectedFile().c_str())) {
+    Jimulator::resetJimulator();
 
-    // If child process failed
-    if (status) {
+    if (not Jimulator::loadJimulator(getAbsolutePathToSelectedFile().c_str())) {
+      std::cout << "Error loading file into KoMo2." << std::endl;
       return;
     }
 
-    // Perform the load
-    Jimulator::resetJimulator();
+    getParent()->changeJimulatorState(JimulatorState::LOADED);
+    return;
+  }
 
-    // If load function failed
-    if (not Jimulator::loadJimulator(
-            makeKmdPath(getAbsolutePathToSelectedFile()).c_str())) {
+  // A resident assembler, if one is running, has likely done it already
+  std::string messages;
+  switch (Jimulator::compileResidentJimulator(
+      getAbsolutePathToSelectedFile().c_str(), messages)) {
+    case ResidentCompile::LOADED:
+      getParent()->getTerminalModel()->appendTextToTextView(messages);
+      getParent()->changeJimulatorState(JimulatorState::LOADED);
+      return;
+    case ResidentCompile::FAILED:
+      getParent()->getTerminalModel()->appendTextToTextView(messages);
       std::cout << "Error loading file into KoMo2." << std::endl;
       return;
-    }
+    case ResidentCompile::UNAVAILABLE:
+      break;
+  }
 
-    getParent()->changeJimulatorState(JimulatorState::LOADED);
+  // Otherwise assemble it here, with aasm linked in
+  const bool loaded = Jimulator::assembleJimulator(
+      getAbsolutePathToSelectedFile().c_str(), messages);
+  getParent()->getTerminalModel()->appendTextToTextView(messages);
+
+  // If it failed to assemble, or to load
+  if (not loaded) {
+    std::cout << "Error loading file into KoMo2." << std::endl;
+    return;
   }
+
+  getParent()->changeJimulatorState(JimulatorState::LOADED);
 }
 
 /**
@@ -104,6 +112,12 @@ void CompileLoadModel::onBrowseClick() {
   assemblyFilter->add_pattern("*.s");
   dialog.add_filter(assemblyFilter);
 
+  auto executableFilter = Gtk::FileFilter::create();
+  executableFilter->set_name("ARM ELF executables");
+  executableFilter->add_pattern("*.elf");
+  executableFilter->add_pattern("*.axf");
+  dialog.add_filter(executableFilter);
+
   // Show the dialog and wait for a user response, then handle the result
   handleResultFromFileBrowser(dialog.run(), &dialog);
 }
@@ -142,18 +156,6 @@ void CompileLoadModel::handleResultFromFileBrowser(
   }
 }
 
-/**
- * @brief Takes an ARM assembly file, removes it's current `s` extension, and
- * appends `kmd`. For example, `/home/user/demo.s` will return
- * `home/user/demo.kmd`.
- * @param absolutePath The absolute path to the `.s` program.
- * @return std::string The absolute path with just the file name.
- */
-const std::string CompileLoadModel::makeKmdPath(
-    const std::string absolutePath) const {
-  return absolutePath.substr(0, absolutePath.size() - 1).append("kmd");
-}
-
 /**
  * @brief Handles a change in JimulatorState for this model.
  * @param newState The state that has been changed into.
@@ -64,7 +64,6 @@ class CompileLoadModel : private Model {
   // ! General functions
   void onBrowseClick();
   void onCompileLoadClick() const;
-  const std::string makeKmdPath(const std::string absolutePath) const;
   void handleResultFromFileBrowser(const int result,
                                    const Gtk::FileChooserDialog* const dialog);
 
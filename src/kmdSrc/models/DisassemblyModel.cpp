@@ -8,9 +8,10 @@
  */
 
 #include <ctype.h>
+#include <stdlib.h>
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
-#include <regex>
 #include <sstream>
 #include "../views/MainWindowView.h"
 #include "KoMo2Model.h"
@@ -18,6 +19,13 @@
 // Initialise static list pointers
 uint32_t DisassemblyModel::memoryIndex = 0;
 
+/**
+ * @brief How many English translations are remembered before the memo is
+ * emptied - arbitrary memory is disassembled too, so it is not bounded by the
+ * length of the source file.
+ */
+constexpr long unsigned int ENGLISH_MNEMONIC_LIMIT = 4096;
+
 /**
  * @brief Construct a new DisassemblyModel::DisassemblyModel object.
  * @param view A pointer to the view object, set at initialisation.
@@ -39,13 +47,18 @@ DisassemblyModel::DisassemblyModel(DisassemblyView* const view,
  * breakpoint should be set at.
  */
 void DisassemblyModel::onBreakpointToggle(DisassemblyRows* const row) {
-  row->setBreakpoint(Jimulator::setBreakpoint(row->getAddressVal()));
-  const auto s = buildDisassemblyRowAccessibilityString(*row);
-  row->get_accessible()->set_description(s);
+  const bool state = Jimulator::setBreakpoint(row->getAddressVal());
+  const long unsigned int index = row - getView()->getRows()->data();
+  row->setBreakpoint(state);
+  renderedValues[index].breakpoint = state;
+
+  describeRow(index);
 }
 
 /**
- * @brief Adds button handlers to every breakpoint button.
+ * @brief Adds button handlers to every breakpoint button, and a focus handler
+ * to every row so that its screenreader string can be brought up to date
+ * before it is read.
  */
 void DisassemblyModel::setupButtonHandlers() {
   auto* const rows = getView()->getRows();
@@ -54,9 +67,26 @@ void DisassemblyModel::setupButtonHandlers() {
     (*rows)[i].getButton()->signal_clicked().connect(
         sigc::bind(sigc::mem_fun(*this, &DisassemblyModel::onBreakpointToggle),
                    &(*rows)[i]));
+    (*rows)[i].signal_focus_in_event().connect(
+        sigc::bind(sigc::mem_fun(*this, &DisassemblyModel::onRowFocus), i));
   }
 }
 
+/**
+ * @brief Handles a row gaining focus, rebuilding its screenreader string if a
+ * refresh has left it out of date.
+ * @param index The index of the row which gained focus.
+ * @return const bool false, so that the focus event continues to propagate.
+ */
+const bool DisassemblyModel::onRowFocus(GdkEventFocus* const,
+                                        const long unsigned int index) {
+  if (staleDescriptions[index]) {
+    describeRow(index);
+  }
+
+  return false;
+}
+
 /**
  * @brief Adds scroll recognition to the container object, which causes scroll
  * events to be sent to the member function `handleScroll.`
@@ -112,29 +142,94 @@ const std::string DisassemblyModel::intToFormattedHexString(
 
 /**
  * @brief Refreshes the values in the views to display the new values fetched
- * from Jimulator.
+ * from Jimulator. Each row is compared with what it was last drawn with, and
+ * only the widgets whose values differ are touched. A value that changed
+ * without the row moving to a new address is highlighted until the next
+ * refresh.
  */
 void DisassemblyModel::refreshViews() {
   const auto vals = getMemoryValues();
   auto* const rows = getView()->getRows();
+  const bool redescribeAll =
+      not rendered || renderedEnglishMnemonic != englishMnemonic;
 
   // Loop through each of the fetched rows
   for (long unsigned int i = 0; i < vals.size(); i++) {
     auto& row = (*rows)[i];
-    auto flag = row.get_state_flags();
+    auto& old = renderedValues[i];
+    bool redescribe = redescribeAll;
+
+    updateCSSFlags(row.get_state_flags(), row, vals[i].address);
+
+    if (not rendered || old.address != vals[i].address) {
+      row.setAddressVal(vals[i].address);
+      row.setAddress(intToFormattedHexString(vals[i].address));
+      redescribe = true;
+    }
+
+    if (not rendered || old.hex != vals[i].hex) {
+      row.setHex(vals[i].hex);
+    }
+
+    const bool changed =
+        rendered && old.address == vals[i].address && old.hex != vals[i].hex;
+    if (changed != renderedChanges[i]) {
+      row.setChanged(changed);
+      renderedChanges[i] = changed;
+    }
+
+    if (not rendered || old.disassembly != vals[i].disassembly) {
+      row.setDisassembly(vals[i].disassembly);
+      redescribe = true;
+    }
+
+    if (not rendered || old.breakpoint != vals[i].breakpoint) {
+      row.setBreakpoint(vals[i].breakpoint);
+      redescribe = true;
+    }
 
-    updateCSSFlags(flag, row, vals[i].address);
-    row.setAddressVal(vals[i].address);
-    row.setAddress(intToFormattedHexString(vals[i].address));
-    row.setHex(vals[i].hex);
-    row.setDisassembly(vals[i].disassembly);
-    row.setBreakpoint(vals[i].breakpoint);
+    // Only the focused row is read out straight away; the rest wait until
+    // they are focused
+    staleDescriptions[i] = staleDescriptions[i] || redescribe;
+    if (staleDescriptions[i] && row.has_focus()) {
+      describeRow(i);
+    }
+
+    old = vals[i];
+  }
+
+  rendered = true;
+  renderedEnglishMnemonic = englishMnemonic;
+}
+
+/**
+ * @brief Removes the highlight from every row that changed on the last
+ * refresh - for example, once a new program has been loaded, when every value
+ * is new rather than changed.
+ */
+void DisassemblyModel::clearChanges() {
+  auto* const rows = getView()->getRows();
 
-    const auto s = buildDisassemblyRowAccessibilityString(row);
-    row.get_accessible()->set_description(s);
+  for (long unsigned int i = 0; i < renderedChanges.size(); i++) {
+    if (renderedChanges[i]) {
+      (*rows)[i].setChanged(false);
+      renderedChanges[i] = false;
+    }
   }
 }
 
+/**
+ * @brief Rebuilds the screenreader string of a single row.
+ * @param index The index of the row to describe.
+ */
+void DisassemblyModel::describeRow(const long unsigned int index) {
+  auto& row = (*getView()->getRows())[index];
+
+  const auto s = buildDisassemblyRowAccessibilityString(row);
+  row.get_accessible()->set_description(s);
+  staleDescriptions[index] = false;
+}
+
 /**
  * @brief Generates the string to set for the accessibility model.
  * @param row The row to build to accessibility string from.
@@ -146,14 +241,14 @@ const std::string DisassemblyModel::buildDisassemblyRowAccessibilityString(
   // Used for the accessibility object
   std::string bp = row.getBreakpoint() ? "breakpoint set" : "no breakpoint";
 
-  // Removes leading 0's from addresses
-  std::stringstream gHex;
-  gHex << std::hex << row.getAddress();
-  const auto addr = std::regex_replace(gHex.str(), std::regex("^0x0{0,7}"), "");
+  // Removes the "0x" and up to 7 leading 0's from addresses
+  const auto hex = row.getAddress();
+  const auto digits = std::min(hex.find_first_not_of('0', 2), hex.size() - 1);
+  const auto addr = hex.substr(std::min(digits, static_cast<size_t>(9)));
 
   // Gets the mnemonic OR an English "translation"
   const std::string disassemblyInfo =
-      englishMnemonic ? convertMnemonicToEnglish(row.getDisassembly())
+      englishMnemonic ? getEnglishMnemonic(row.getDisassembly())
                       : row.getDisassembly();
 
   std::stringstream ss;
@@ -162,6 +257,69 @@ const std::string DisassemblyModel::buildDisassemblyRowAccessibilityString(
   return ss.str();
 }
 
+/**
+ * @brief Gets the English translation of a mnemonic, translating it only if it
+ * has not been translated before.
+ * @param mnemonic An ARM instruction mnemonic.
+ * @return const std::string& The mnemonic, translated into English.
+ */
+const std::string& DisassemblyModel::getEnglishMnemonic(
+    const std::string& mnemonic) {
+  const auto iter = englishMnemonics.find(mnemonic);
+
+  if (iter != englishMnemonics.end()) {
+    return iter->second;
+  }
+
+  if (englishMnemonics.size() >= ENGLISH_MNEMONIC_LIMIT) {
+    englishMnemonics.clear();
+  }
+
+  return englishMnemonics.emplace(mnemonic, convertMnemonicToEnglish(mnemonic))
+      .first->second;
+}
+
+/**
+ * @brief Compiles each translation string of a map into a template - see the
+ * comment for `mnemonicsMap` for details on the paramter notation.
+ * @param map A map of ARM mnemonics to translation strings.
+ * @return const std::unordered_map<std::string, MnemonicTemplate> The same map,
+ * with each translation string compiled.
+ */
+const std::unordered_map<std::string, MnemonicTemplate>
+DisassemblyModel::compileMnemonicTemplates(
+    const std::unordered_map<std::string, std::string>& map) {
+  std::unordered_map<std::string, MnemonicTemplate> ret;
+
+  for (const auto& [key, value] : map) {
+    MnemonicTemplate t;
+    std::string literal;
+
+    for (long unsigned int i = 0; i < value.size(); i++) {
+      // Looks for a "?n?" slot starting at this character
+      long unsigned int end = i + 1;
+      while (end < value.size() && isdigit(value[end])) {
+        end++;
+      }
+
+      if (value[i] == '?' && end > i + 1 && end < value.size() &&
+          value[end] == '?') {
+        t.literals.push_back(literal);
+        t.slots.push_back(std::stoul(value.substr(i + 1, end - i - 1)));
+        literal.clear();
+        i = end;
+      } else {
+        literal += value[i];
+      }
+    }
+
+    t.literals.push_back(literal);
+    ret.emplace(key, t);
+  }
+
+  return ret;
+}
+
 /**
  * @brief Converts a mnemonic into plain English.
  * @param mnemonic An ARM instruction mnemonic.
@@ -189,12 +347,14 @@ const std::string DisassemblyModel::convertMnemonicToEnglish(
   std::string outputText = "";
   tie(m, outputText) = parseLabel(m);
 
-  try {
-    return buildMnemonicString(outputText + mnemonicsMap.at(m[0]), m);
-  } catch (std::out_of_range const&) {
-    // ! Only happens in mnemonic is unrecognised - consider adding to the map
+  const auto t = mnemonicTemplates.find(m[0]);
+
+  // ! Only happens in mnemonic is unrecognised - consider adding to the map
+  if (t == mnemonicTemplates.end()) {
     return mnemonic;
   }
+
+  return buildMnemonicString(t->second, outputText, m);
 }
 
 /**
@@ -215,8 +375,8 @@ const std::vector<std::string> DisassemblyModel::parseDEFB(
       s += m[i] + " ";
     }
 
-    // replace anything past the final comma
-    m[1] = std::regex_replace(s, std::regex(",[^,]*$"), "");
+    // remove anything from the final comma onwards
+    m[1] = s.substr(0, s.rfind(','));
   }
 
   return m;
@@ -255,9 +415,7 @@ const std::pair<std::vector<std::string>, std::string>
 DisassemblyModel::parseLabel(std::vector<std::string> m) const {
   std::string out = "";
 
-  try {
-    auto t = mnemonicsMap.at(m[0]);  // If not present in the map, throws
-  } catch (std::out_of_range const&) {
+  if (mnemonicTemplates.count(m[0]) == 0) {
     out += "At label \"" + m[0] + "\", ";
 
     // Remove label from vector - m[1] becomes m[0]
@@ -274,20 +432,24 @@ DisassemblyModel::parseLabel(std::vector<std::string> m) const {
 
 /**
  * @brief Builds the output mnemonics string from the vector making up the
- * current ARM command and the value read from the map. See the comment for
- * mnemonicMap for details on the syntax of the value read from the map.
- * @param s The value read from the map.
+ * current ARM command and the compiled template for its keyword. Slots for
+ * paramters the command does not have are left as they were written.
+ * @param t The template compiled from the value read from the map.
+ * @param prefix Any text to place before the translation.
  * @param m The vector making up the current ARM command.
  * @return const std::string The mnemonic, translated into English.
  */
 const std::string DisassemblyModel::buildMnemonicString(
-    std::string s,
+    const MnemonicTemplate& t,
+    const std::string& prefix,
     std::vector<std::string> m) const {
-  for (long unsigned int i = 1; i < m.size(); i++) {
-    // Builds the regex match string
-    std::string reg = "\\?" + std::to_string(i) + "\\?";
-    // Replaces the regex match string with the parameter
-    s = std::regex_replace(s, std::regex(reg), m[i]);
+  std::string s = prefix + t.literals[0];
+
+  for (long unsigned int i = 0; i < t.slots.size(); i++) {
+    const auto slot = t.slots[i];
+    s += slot >= 1 && slot < m.size() ? m[slot]
+                                      : "?" + std::to_string(slot) + "?";
+    s += t.literals[i + 1];
   }
 
   return s + ", ";
@@ -332,7 +494,7 @@ void DisassemblyModel::updateCSSFlags(const Gtk::StateFlags flag,
                                       DisassemblyRows& row,
                                       const uint32_t address) {
   // If this is the address in program counter:
-  if (intToFormattedHexString(address) == PCValue) {
+  if (address == PCValue) {
     // Make it highlighted if it is not focused
     if (flag == NORMAL) {
       row.set_state_flags(PC_ADDRESS);
@@ -371,7 +533,12 @@ void DisassemblyModel::incrementMemoryIndex(const uint32_t val) {
  * @brief Handles changes of Jimulator state.
  * @param newState The state Jimulator has changed into.
  */
-void DisassemblyModel::changeJimulatorState(const JimulatorState newState) {}
+void DisassemblyModel::changeJimulatorState(const JimulatorState newState) {
+  if (newState == JimulatorState::LOADED) {
+    clearChanges();
+    englishMnemonics.clear();
+  }
+}
 
 /**
  * @brief Handles any key press events.
@@ -476,10 +643,10 @@ DisassemblyModel::getMemoryValues() const {
 }
 /**
  * @brief Updates the value of PCValue.
- * @param val The value to set PCValue to.
+ * @param val The value to set PCValue to, as a hexadecimal string.
  */
 void DisassemblyModel::setPCValue(const std::string val) {
-  PCValue = val;
+  PCValue = std::strtoul(val.c_str(), NULL, 16);
 }
 /**
  * @brief Set the value of the englishMnemonic member variable.
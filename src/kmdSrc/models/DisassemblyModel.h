@@ -17,6 +17,24 @@
 class DisassemblyView;
 class DisassemblyRows;
 
+/**
+ * @brief An English translation string from `mnemonicsMap`, compiled into the
+ * literal text between its paramters and the paramter number of each slot, so
+ * that translating a mnemonic is a concatenation rather than a search.
+ */
+class MnemonicTemplate {
+ public:
+  /**
+   * @brief The text before each slot, and after the final slot - there is
+   * always one more literal than there are slots.
+   */
+  std::vector<std::string> literals;
+  /**
+   * @brief The paramter number of each slot, in the order they appear.
+   */
+  std::vector<unsigned int> slots;
+};
+
 /**
  * @brief The declaration of the DisassemblyModel class.
  */
@@ -47,7 +65,35 @@ class DisassemblyModel : private Model {
   /**
    * @brief Stores the value currently in the program counter.
    */
-  std::string PCValue = "0x00000000";
+  uint32_t PCValue = 0;
+
+  /**
+   * @brief The values each row was last drawn with, so that a refresh only
+   * touches the widgets whose values have changed.
+   */
+  std::array<Jimulator::MemoryValues, 13> renderedValues;
+
+  /**
+   * @brief Whether each row is currently highlighted as having changed.
+   */
+  std::array<bool, 13> renderedChanges = {};
+
+  /**
+   * @brief Whether the rows have been drawn at all yet.
+   */
+  bool rendered = false;
+
+  /**
+   * @brief The value of `englishMnemonic` the screenreader strings were last
+   * built with.
+   */
+  bool renderedEnglishMnemonic = false;
+
+  /**
+   * @brief Whether each row's screenreader string is out of date. Strings are
+   * only rebuilt for rows that are focused, as that is when they are read.
+   */
+  std::array<bool, 13> staleDescriptions = {};
 
   /**
    * @brief The CSS state flags for an un-highlighted memory row.
@@ -79,7 +125,7 @@ class DisassemblyModel : private Model {
    * @brief A map pairing ARM mnemonic commands with the English translation
    * string associated with them for the screenreader.
    * For ARM commands that take paramters, the English equivalent string has a
-   * paramter notation that is regexed away. This notation is:
+   * paramter notation that is substituted away. This notation is:
    * ?'paramter_number'?.
    *
    * For example, in the command "ADD R1, R2, R3", R1 is paramter 1, R2 is
@@ -120,6 +166,18 @@ class DisassemblyModel : private Model {
       {"mla", "Multiply ?2? with ?3? , add ?4? and store in ?1?"},
       {"mls", "Multiply ?2? with ?3? , subtract ?4? and store in ?1?"}};
 
+  /**
+   * @brief Every value of `mnemonicsMap`, compiled once into a template.
+   */
+  const std::unordered_map<std::string, MnemonicTemplate> mnemonicTemplates =
+      compileMnemonicTemplates(mnemonicsMap);
+
+  /**
+   * @brief English translations already built, keyed by the mnemonic they
+   * were built from - source lines rarely change, so most are re-read.
+   */
+  std::unordered_map<std::string, std::string> englishMnemonics;
+
   /**
    * @brief Whether or not ARM mnemonics should be read in English when being
    * read by a screenreader, or if they should be left as ARM mnemonics.
@@ -136,8 +194,15 @@ class DisassemblyModel : private Model {
   void updateCSSFlags(const Gtk::StateFlags state,
                       DisassemblyRows& row,
                       const uint32_t address);
+  void clearChanges();
   const std::string buildDisassemblyRowAccessibilityString(
       DisassemblyRows& val);
+  void describeRow(const long unsigned int index);
+  const bool onRowFocus(GdkEventFocus* const e, const long unsigned int index);
+  const std::string& getEnglishMnemonic(const std::string& mnemonic);
+  static const std::unordered_map<std::string, MnemonicTemplate>
+  compileMnemonicTemplates(
+      const std::unordered_map<std::string, std::string>& map);
   const std::string convertMnemonicToEnglish(const std::string mnemonic) const;
   const std::string sanitizeParamters(std::string param) const;
   const std::string toLowerCase(std::string s) const;
@@ -145,7 +210,8 @@ class DisassemblyModel : private Model {
   const std::vector<std::string> parseSWI(std::vector<std::string> m) const;
   const std::pair<std::vector<std::string>, std::string> parseLabel(
       std::vector<std::string> m) const;
-  const std::string buildMnemonicString(std::string s,
+  const std::string buildMnemonicString(const MnemonicTemplate& t,
+                                        const std::string& prefix,
                                         std::vector<std::string> m) const;
 
   // ! Deleted special member functions
@@ -24,18 +24,20 @@
  * @param manual A URI that describes where the user manual can be found.
  * @param refreshRate An integer that describes how many milliseconds should be
  * taken between refreshes when KoMo2 is in the `JimulatorState::RUNNING` state.
+ * @param scrollback The number of lines of output the terminal keeps.
  */
 KoMo2Model::KoMo2Model(MainWindowView* const mainWindow,
                        const std::string argv0,
                        const std::string manual,
-                       const int refreshRate)
+                       const int refreshRate,
+                       const int scrollback)
     : Model(this),
       mainWindow(mainWindow),
       absolutePathToProjectRoot(argv0),
       compileLoadModel(mainWindow->getCompileLoadView(), this),
       controlsModel(mainWindow->getControlsView(), manual, this),
       registersModel(mainWindow->getRegistersView(), this),
-      terminalModel(mainWindow->getTerminalView(), this),
+      terminalModel(mainWindow->getTerminalView(), scrollback, this),
       disassemblyModel(mainWindow->getDisassemblyView(), this),
       refreshRate(refreshRate) {
   // Updates the main window to have a pointer to its model, sets its CSS.
@@ -75,6 +77,25 @@ const bool KoMo2Model::refreshViews() {
   return getJimulatorState() == JimulatorState::RUNNING;
 }
 
+/**
+ * @brief Handles event frames sent by Jimulator, so that a stop or console
+ * output shows straight away rather than at the next refresh. A status change
+ * refreshes every view, which also catches any console output; console output
+ * on its own only needs the terminal updating. The views are still refreshed
+ * on a timer while running, so that they follow the program as it goes.
+ * @param events A mask of the JimulatorEvent types received, or -1 if
+ * Jimulator has stopped sending them.
+ */
+void KoMo2Model::handleJimulatorEvents(const int events) {
+  if (events < 0) {
+    return;  // The timer carries on without them
+  } else if (events & JimulatorEvent::STATUS) {
+    refreshViews();
+  } else if (events & JimulatorEvent::CONSOLE) {
+    terminalModel.appendTextToTextView(terminalModel.readJimulator());
+  }
+}
+
 /**
  * @brief Passes the key press event off to other child models.
  * @param e The key press event.
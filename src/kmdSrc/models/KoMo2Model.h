@@ -36,9 +36,11 @@ class KoMo2Model : public Model {
   KoMo2Model(MainWindowView* const mainWindow,
              const std::string argv0,
              const std::string manual,
-             const int refreshRate);
+             const int refreshRate,
+             const int scrollback);
   virtual void changeJimulatorState(const JimulatorState newState) override;
   const bool refreshViews();
+  void handleJimulatorEvents(const int events);
 
   // Getters
   const std::string getAbsolutePathToProjectRoot() const;
@@ -10,7 +10,7 @@
  */
 
 #include <gdkmm/event.h>
-#include <regex>
+#include <algorithm>
 #include "../views/MainWindowView.h"
 #include "KoMo2Model.h"
 #include "iostream"
@@ -30,7 +30,14 @@ RegistersModel::RegistersModel(RegistersView* const view,
  * @brief Handles changes in the Jimulator state.
  * @param newState The state being changed into.
  */
-void RegistersModel::changeJimulatorState(const JimulatorState newState) {}
+void RegistersModel::changeJimulatorState(const JimulatorState newState) {
+  // Every value is new after a load, rather than changed
+  if (newState == JimulatorState::LOADED) {
+    for (long unsigned int i = 0; i < renderedChanges.size(); i++) {
+      setChanged(i, false);
+    }
+  }
+}
 
 /**
  * @brief Handles any key press events.
@@ -136,31 +143,66 @@ const bool RegistersModel::handleKeyPress(const GdkEventKey* const e) {
 
 /**
  * @brief Handles updating this particular view.
- * Reads register values from Jimulator, sets the label values of this view
- * to reflect those values.
+ * Reads register values from Jimulator, and sets the labels of only those
+ * registers whose values have changed since the last refresh, highlighting
+ * them until the next refresh.
  */
 void RegistersModel::refreshViews() {
   const auto newValues = getRegisterValueFromJimulator();
   auto* const labelArray = getView()->getLabels();
 
   for (long unsigned int i = 0; i < 16; i++) {
+    const bool changed = newValues[i] != renderedValues[i];
+    setChanged(i, rendered && changed);
+
+    if (rendered && not changed) {
+      continue;
+    }
+
     (*labelArray)[1][i].set_text(newValues[i]);
 
     // A string describing the register
-
     std::string reg = i != 15 ? std::string("Register ")
                                     .append(std::to_string(i))
                                     .append(" stores ")
                               : "Program Counter stores ";
 
-    // Set the accessibility object to describe
+    // Set the accessibility object to describe, without the "0x" and leading
+    // zeroes
+    const auto digits = std::min(newValues[i].find_first_not_of('0', 2),
+                                 newValues[i].size() - 1);
     (*labelArray)[1][i].get_accessible()->set_name(
-        reg + std::regex_replace(newValues[i], std::regex("^0x0{0,7}"), ""));
+        reg + newValues[i].substr(digits));
   }
 
   // Send the new program counter value to disassembly model
-  getParent()->getDisassemblyModel()->setPCValue(
-      newValues[newValues.size() - 1]);
+  if (not rendered || newValues[15] != renderedValues[15]) {
+    getParent()->getDisassemblyModel()->setPCValue(
+        newValues[newValues.size() - 1]);
+  }
+
+  renderedValues = newValues;
+  rendered = true;
+}
+
+/**
+ * @brief Highlights a register's value, or removes its highlight, to show
+ * whether it changed on the last refresh.
+ * @param index The register number.
+ * @param changed Whether the value changed.
+ */
+void RegistersModel::setChanged(const int index, const bool changed) {
+  if (changed == renderedChanges[index]) {
+    return;
+  }
+
+  auto context = (*getView()->getLabels())[1][index].get_style_context();
+  if (changed) {
+    context->add_class("changedValue");
+  } else {
+    context->remove_class("changedValue");
+  }
+  renderedChanges[index] = changed;
 }
 
 // ! Getters and setters
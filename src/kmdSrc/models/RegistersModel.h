@@ -31,7 +31,24 @@ class RegistersModel : private Model {
    */
   RegistersView* const view;
 
+  /**
+   * @brief The values the labels were last drawn with, so that a refresh only
+   * touches the labels whose values have changed.
+   */
+  std::array<std::string, 16> renderedValues;
+
+  /**
+   * @brief Whether each label is currently highlighted as having changed.
+   */
+  std::array<bool, 16> renderedChanges = {};
+
+  /**
+   * @brief Whether the labels have been drawn at all yet.
+   */
+  bool rendered = false;
+
   const std::array<std::string, 16> getRegisterValueFromJimulator() const;
+  void setChanged(const int index, const bool changed);
 
   // ! Deleted special member functions
   // stops these functions from being misused, creates a sensible error
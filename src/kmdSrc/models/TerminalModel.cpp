@@ -9,19 +9,49 @@
  */
 
 #include <atkmm/relationset.h>
+#include <glibmm/main.h>
+#include <gtkmm/clipboard.h>
+#include <algorithm>
 #include <iostream>
 #include "../views/TerminalView.h"
 #include "KoMo2Model.h"
 
+/**
+ * @brief The smallest size, in bytes, that pending output is allowed to grow to
+ * before it is trimmed.
+ */
+constexpr long unsigned int PENDING_LIMIT = 64 * 1024;
+
+/**
+ * @brief The most output, in bytes, the terminal keeps however few lines it
+ * makes - older output is trimmed.
+ */
+constexpr long unsigned int TEXT_LIMIT = 1024 * 1024;
+
+/**
+ * @brief How many milliseconds to wait before offering Jimulator input it had
+ * no room for again.
+ */
+constexpr unsigned int INPUT_RETRY_INTERVAL = 20;
+
 /**
  * @brief Construct a new TerminalModel::TerminalModel object.
  * @param view A constant pointer to the related view.
+ * @param scrollback The number of lines of output to keep.
  * @param parent A constant pointer to the parent model.
  */
-TerminalModel::TerminalModel(TerminalView* const view, KoMo2Model* const parent)
-    : Model(parent), view(view) {
+TerminalModel::TerminalModel(TerminalView* const view,
+                             const int scrollback,
+                             KoMo2Model* const parent)
+    : Model(parent),
+      view(view),
+      scrollback(std::max(scrollback, 1)),
+      pendingLimit(PENDING_LIMIT) {
   view->setModel(this);
   setButtonListener(view->getClearButton(), this, &TerminalModel::onClearClick);
+
+  auto buff = view->getTextView()->get_buffer();
+  endMark = buff->create_mark(buff->end(), false);
 }
 
 /**
@@ -40,6 +70,7 @@ void TerminalModel::changeJimulatorState(const JimulatorState newState) {
  */
 void TerminalModel::onClearClick() {
   getView()->getTextView()->get_buffer()->set_text("");
+  pending.clear();
 }
 
 /**
@@ -64,15 +95,28 @@ const bool TerminalModel::handleKeyPress(const GdkEventKey* const e) {
   // Else send key press to Jimulator if running or paused
   else if (Model::getJimulatorState() == JimulatorState::PAUSED ||
            Model::getJimulatorState() == JimulatorState::RUNNING) {
-    return Jimulator::sendTerminalInputToJimulator(e->keyval);
+    const auto mods = e->state & (GDK_SHIFT_MASK | GDK_CONTROL_MASK);
+
+    // Pasted text is sent in as few frames as possible
+    if ((mods == GDK_CONTROL_MASK && e->keyval == GDK_KEY_v) ||
+        (mods == GDK_SHIFT_MASK && e->keyval == GDK_KEY_Insert)) {
+      Jimulator::sendTerminalTextToJimulator(
+          Gtk::Clipboard::get()->wait_for_text());
+    } else if (not Jimulator::sendTerminalInputToJimulator(e->keyval)) {
+      return false;
+    }
+
+    scheduleInputRetry();
   }
   
   return true;
 }
 
 /**
- * @brief Appends a string to the current text view of the terminal, and scroll
- * to the bottom of the terminal.
+ * @brief Appends a string to the terminal. The text view itself is written to
+ * once the main loop is idle, so that everything appended in the meantime is
+ * inserted at once. Only the last `scrollback` lines, and at most
+ * `TEXT_LIMIT` bytes, are ever kept.
  * @param text The text to append to the text view.
  */
 void TerminalModel::appendTextToTextView(std::string text) {
@@ -80,16 +124,108 @@ void TerminalModel::appendTextToTextView(std::string text) {
     return;
   }
 
-  auto* const view = getView()->getTextView();
+  pending += text;
 
-  // Append text to the buffer, reset the buffer
+  // Output that would be trimmed as soon as it was inserted is dropped now, so
+  // that a program printing without end cannot use up memory
+  if (pending.size() > pendingLimit) {
+    trimToLastLines(pending);
+    pendingLimit = std::max(PENDING_LIMIT, pending.size() * 2);
+  }
+
+  if (not flushScheduled) {
+    Glib::signal_idle().connect(sigc::mem_fun(*this, &TerminalModel::flush));
+    flushScheduled = true;
+  }
+}
+
+/**
+ * @brief Writes any pending output to the text view in a single insert, trims
+ * the oldest output beyond `scrollback` lines or `TEXT_LIMIT` characters in a
+ * single erase, and scrolls to the bottom of the terminal.
+ * @return const bool false, so that this is not called again until more output
+ * is appended.
+ */
+const bool TerminalModel::flush() {
+  flushScheduled = false;
+
+  if (pending.empty()) {
+    return false;
+  }
+
+  auto* const view = getView()->getTextView();
   auto buff = view->get_buffer();
-  buff->insert(buff->end(), text);
-  view->set_buffer(buff);
+
+  buff->insert(buff->end(), pending);
+  pending.clear();
+  pendingLimit = PENDING_LIMIT;
+
+  // Erasing is only worth doing in bulk, so a little over the limit is allowed
+  const int excess = buff->get_line_count() - scrollback;
+  const int excessText = buff->get_char_count() - (int)TEXT_LIMIT;
+  if (excessText > (int)TEXT_LIMIT / 8) {
+    buff->erase(buff->begin(), buff->get_iter_at_offset(excessText));
+  } else if (excess > scrollback / 8) {
+    buff->erase(buff->begin(), buff->get_iter_at_line(excess));
+  }
 
   // Scroll to the bottom of the scroll bar
-  buff = view->get_buffer();
-  view->scroll_to(buff->create_mark(buff->end(), false));
+  buff->move_mark(endMark, buff->end());
+  view->scroll_to(endMark);
+  return false;
+}
+
+/**
+ * @brief Removes all but the last `scrollback` lines from a string, and then
+ * all but its last `TEXT_LIMIT` bytes - output without newlines has to be cut
+ * somewhere.
+ * @param s The string to trim.
+ */
+void TerminalModel::trimToLastLines(std::string& s) const {
+  auto pos = s.size();
+
+  for (int lines = 0; lines < scrollback && pos != std::string::npos; lines++) {
+    pos = pos == 0 ? std::string::npos : s.rfind('\n', pos - 1);
+  }
+
+  if (pos != std::string::npos) {
+    s.erase(0, pos + 1);
+  }
+
+  if (s.size() > TEXT_LIMIT) {
+    pos = s.size() - TEXT_LIMIT;
+
+    // Don't start part way through a UTF-8 character
+    while (pos < s.size() && (s[pos] & 0xC0) == 0x80) {
+      pos++;
+    }
+    s.erase(0, pos);
+  }
+}
+
+/**
+ * @brief If Jimulator had no room for some of the input sent to it, arranges
+ * for it to be sent again shortly - by which time the program may have read
+ * some.
+ */
+void TerminalModel::scheduleInputRetry() {
+  if (inputRetryScheduled || not Jimulator::isTerminalInputWaiting()) {
+    return;
+  }
+
+  Glib::signal_timeout().connect(
+      sigc::mem_fun(*this, &TerminalModel::retryInput), INPUT_RETRY_INTERVAL);
+  inputRetryScheduled = true;
+}
+
+/**
+ * @brief Sends input Jimulator previously had no room for.
+ * @return const bool true if some is still waiting, so that this is called
+ * again.
+ */
+const bool TerminalModel::retryInput() {
+  inputRetryScheduled = Jimulator::flushTerminalInput();
+  return inputRetryScheduled;
 }
 
 /**
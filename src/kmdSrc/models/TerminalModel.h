@@ -8,6 +8,8 @@
  * @date 10-04-2021
  */
 
+#include <gtkmm/textmark.h>
+#include <string>
 #include "RegistersModel.h"
 
 class TerminalView;
@@ -18,7 +20,9 @@ class TerminalView;
  */
 class TerminalModel : private Model {
  public:
-  TerminalModel(TerminalView* const view, KoMo2Model* const parent);
+  TerminalModel(TerminalView* const view,
+                const int scrollback,
+                KoMo2Model* const parent);
   void appendTextToTextView(std::string text);
   const std::string readJimulator() const;
 
@@ -37,8 +41,44 @@ class TerminalModel : private Model {
    */
   TerminalView* const view;
 
+  /**
+   * @brief The number of lines the terminal keeps - older lines are trimmed.
+   */
+  const int scrollback;
+
+  /**
+   * @brief Output that has arrived since the text view was last written to,
+   * so that all of it can be inserted at once.
+   */
+  std::string pending;
+
+  /**
+   * @brief The size `pending` may reach before its oldest lines are trimmed.
+   */
+  long unsigned int pendingLimit;
+
+  /**
+   * @brief Whether writing `pending` to the text view has been scheduled.
+   */
+  bool flushScheduled = false;
+
+  /**
+   * @brief A mark that stays at the end of the text view, scrolled to after
+   * every write.
+   */
+  Glib::RefPtr<Gtk::TextMark> endMark;
+
+  /**
+   * @brief Whether sending input Jimulator had no room for has been scheduled.
+   */
+  bool inputRetryScheduled = false;
+
   const bool isFocused();
   void onClearClick();
+  const bool flush();
+  void trimToLastLines(std::string& s) const;
+  void scheduleInputRetry();
+  const bool retryInput();
 
   // ! Deleted special member functions
   // stops these functions from being misused, creates a sensible error
@@ -176,6 +176,18 @@ void DisassemblyRows::setHex(const std::string text) {
 void DisassemblyRows::setDisassembly(const std::string text) {
   disassembly.set_text(text);
 }
+/**
+ * @brief Highlights the hex label, or removes its highlight, to show whether
+ * the value at this address changed on the last refresh.
+ * @param changed Whether the value changed.
+ */
+void DisassemblyRows::setChanged(const bool changed) {
+  if (changed) {
+    hex.get_style_context()->add_class("changedValue");
+  } else {
+    hex.get_style_context()->remove_class("changedValue");
+  }
+}
 /**
  * @brief Gets a constant pointer to the breakpoint button member.
  * @return Gtk::ToggleButton* const A constant pointer to the breakpoint button
@@ -34,6 +34,7 @@ class DisassemblyRows : public Gtk::Box {
   void setAddress(const std::string text);
   void setHex(const std::string text);
   void setDisassembly(const std::string text);
+  void setChanged(const bool changed);
   void setAddressVal(const uint32_t val);
   void setModel(DisassemblyModel* const val);
 